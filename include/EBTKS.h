@@ -525,6 +525,11 @@
 #define WAIT_WHILE_PHI_2_HIGH        while(IS_PHI_2_HIGH) {}
 #define WAIT_WHILE_PHI_2_LOW         while(IS_PHI_2_LOW) {}
 #define IS_IPRIH_IN_LO               ((GPIO_PAD_STATUS_REG_IPRIH_IN & BIT_MASK_IPRIH_IN) == 0)
+#if IFETCH_ACTIVE_HIGH
+#define IS_IFETCH_ACTIVE             ((GPIO_PAD_STATUS_REG_IFETCH & BIT_MASK_IFETCH) != 0)
+#else
+#define IS_IFETCH_ACTIVE             ((GPIO_PAD_STATUS_REG_IFETCH & BIT_MASK_IFETCH) == 0)
+#endif
 
 #define PHI_1_and_2_IMR              (GPIO6_IMR)
 #define PHI_1_and_2_ISR              (GPIO6_ISR)
@@ -628,6 +633,139 @@
 #define ASSERT_WR                          (GPIO_DR_CLEAR_WR = BIT_MASK_WR)
 #define RELEASE_WR                         (GPIO_DR_SET_WR   = BIT_MASK_WR)
 
+//
+//  PSRAM. The linker places EXTMEM variables from the start of the PSRAM address space whether or not a chip is
+//  fitted, so each EXTMEM buffer must be checked to end within the PSRAM that startup.c found before it is used.
+//  external_psram_size (MB) is declared extern "C" by the files that use these
+//
+
+#ifndef PSRAM_START_ADDRESS
+#define PSRAM_START_ADDRESS                (0x70000000U)
+#endif
+#define PSRAM_END_ADDRESS                  (PSRAM_START_ADDRESS + ((uintptr_t)external_psram_size << 20))
+#define PSRAM_HOLDS(end)                   ((uintptr_t)(end) <= PSRAM_END_ADDRESS)      //  end is one past the last byte
+
+
+//
+//  ISR cycle budget profiler. See EBTKS_ISR_Profiler.cpp
+//  Each profiled piece of code in pinChange_isr() has a slot. The I/O handlers get one slot per I/O address
+//
+
+#define ISR_PROFILE_SLOT_IO_READ          (0)       //  256 slots, indexed by I/O address & 0xFF
+#define ISR_PROFILE_SLOT_IO_WRITE         (256)     //  256 slots, indexed by I/O address & 0xFF
+#define ISR_PROFILE_SLOT_MEMORY_READ      (512)     //  ROM, AUXROM RAM window, and 16K RAM reads
+#define ISR_PROFILE_SLOT_MEMORY_WRITE     (513)     //  AUXROM RAM window, and 16K RAM writes
+#define ISR_PROFILE_SLOT_LOGIC_ANALYZER   (514)
+#define ISR_PROFILE_SLOT_PHI_1_RISE       (515)     //  All of onPhi_1_Rise(), which must fit in the Phi 1 window
+#define ISR_PROFILE_SLOT_PHI_2_RISE       (516)     //  All of onPhi_2_Rise()
+#define ISR_PROFILE_SLOT_PHI_1_BY_TYPE    (517)     //  8 slots, onPhi_1_Rise() by bus cycle type, indexed like BUS_STATS_INT_ACK etc.
+#define ISR_PROFILE_SLOT_PHI_2_BY_TYPE    (525)     //  8 slots, onPhi_2_Rise() by bus cycle type
+#define ISR_PROFILE_SLOT_DMA_LA_SAMPLE    (533)     //  Logic Analyzer / flight recorder sample taken by the DMA engine, per DMA bus cycle
+#define ISR_PROFILE_NUM_SLOTS             (534)
+
+//
+//  The bus cycle type (/WR /RD /LMA in bits 2..0) from the most recent Phi 2. At Phi 1 this is the type of the current cycle
+//
+#define ISR_PROFILE_CYCLE_TYPE            ((Logic_Analyzer_current_bus_cycle_state_LA >> BIT_POSITION_LMA) & 0x07U)
+
+#if ENABLE_ISR_PROFILER
+#define ISR_PROFILE_START(stamp)          uint32_t stamp = ARM_DWT_CYCCNT
+#define ISR_PROFILE_END(stamp, slot)      ISR_Profiler_Record((slot), ARM_DWT_CYCCNT - (stamp))
+#define ISR_PROFILE_END_BY_TYPE(stamp, slot, type_slot)   \
+                                          do { uint32_t cycles = ARM_DWT_CYCCNT - (stamp);                          \
+                                               ISR_Profiler_Record((slot), cycles);                                 \
+                                               ISR_Profiler_Record((type_slot) + ISR_PROFILE_CYCLE_TYPE, cycles); } while(0)
+#else
+#define ISR_PROFILE_START(stamp)          do {} while(0)
+#define ISR_PROFILE_END(stamp, slot)      do {} while(0)
+#define ISR_PROFILE_END_BY_TYPE(stamp, slot, type_slot)   do {} while(0)
+#endif
+
+//
+//  Bus utilization counters. See EBTKS_Bus_Stats.cpp
+//  The first 8 are indexed by the control lines sampled at Phi 2, /WR /RD /LMA in bits 2..0 (active low),
+//  which is the same order as bits 26..24 of Logic_Analyzer_main_sample
+//
+
+#define BUS_STATS_INT_ACK                 (0)       //  /WR /RD /LMA all low. Interrupt acknowledge
+#define BUS_STATS_DMA_ACK                 (1)       //  /WR /RD low. DMA acknowledge
+#define BUS_STATS_LMA_WR                  (2)       //  Not used by Capricorn
+#define BUS_STATS_WRITE                   (3)
+#define BUS_STATS_LMA_RD                  (4)       //  Not used by Capricorn
+#define BUS_STATS_READ                    (5)
+#define BUS_STATS_LMA                     (6)       //  Address byte. Two per address load
+#define BUS_STATS_IDLE                    (7)
+#define BUS_STATS_READ_US                 (8)       //  Reads that EBTKS supplied the data for (HP85_Read_Us)
+#define BUS_STATS_IO_READ                 (9)       //  Reads of the I/O page 0177400..0177777
+#define BUS_STATS_IO_WRITE                (10)      //  Writes to the I/O page
+#define BUS_STATS_DMA_GRANT               (11)      //  DMA grants to EBTKS
+#define BUS_STATS_NUM                     (12)
+
+#if ENABLE_BUS_STATS
+#define BUS_STATS_COUNT(index)            (Bus_Stats_Counts[(index)]++)
+#else
+#define BUS_STATS_COUNT(index)            do {} while(0)
+#endif
+
+//
+//  Firmware event trace points, see EBTKS_Event_Trace.cpp. Only for background code, not within an ISR.
+//  Each TRACE_BEGIN() must be followed by a TRACE_END() with the same id on every path
+//
+
+#define TRACE_TAPE_READ                   (0)       //  arg = tape block number
+#define TRACE_TAPE_WRITE                  (1)       //  arg = tape block number
+#define TRACE_DISK_READ                   (2)       //  arg = LBA (low 16 bits)
+#define TRACE_DISK_WRITE                  (3)       //  arg = LBA (low 16 bits)
+#define TRACE_AUXROM                      (4)       //  arg = AUXROM usage code
+#define TRACE_TRANSLATOR                  (5)       //  arg = 1MB5 OB value. Only when loopTranslator() has an OB to process
+#define TRACE_LOG_FLUSH                   (6)
+#define TRACE_DMA                         (7)       //  arg = bytes transferred. From DMA grant to the end of release_DMA_request()
+#define TRACE_NUM_IDS                     (8)
+
+#define TRACE_PHASE_BEGIN                 (0)
+#define TRACE_PHASE_END                   (1)
+
+#if ENABLE_EVENT_TRACE
+#define TRACE_BEGIN(id, arg)              do { if (Event_Trace_Active) Event_Trace_Record((id), TRACE_PHASE_BEGIN, (arg), ARM_DWT_CYCCNT); } while(0)
+#define TRACE_END(id, arg)                do { if (Event_Trace_Active) Event_Trace_Record((id), TRACE_PHASE_END, (arg), ARM_DWT_CYCCNT); } while(0)
+#else
+#define TRACE_BEGIN(id, arg)              do {} while(0)
+#define TRACE_END(id, arg)                do {} while(0)
+#endif
+
+//
+//  DMA timing points, see EBTKS_DMA_Timing.cpp. The numbers in [] are the points on the "DMA Preamble" timing
+//  diagram, as marked in DMA_Preamble(). The Phi edges are stamped just after the wait for them ends
+//
+
+#define DMA_TP_LMA1_PHI1_RISE             (0)       //  Phi 1 rises, first address cycle
+#define DMA_TP_LMA1_ASSERT                (1)       //  [01]  /LMA low, address low byte
+#define DMA_TP_LMA1_PHI2_FALL             (2)
+#define DMA_TP_ADDR_LOW_ON                (3)       //  [06]  Address low byte driven on the bus
+#define DMA_TP_LMA1_RELEASE               (4)       //  [08]
+#define DMA_TP_LMA2_PHI1_RISE             (5)       //  Phi 1 rises, second address cycle
+#define DMA_TP_LMA2_ASSERT                (6)       //  [09]  /LMA low, address high byte
+#define DMA_TP_LMA2_PHI1_FALL             (7)
+#define DMA_TP_ADDR_LOW_OFF               (8)       //  [10]  End of the address low byte
+#define DMA_TP_LMA2_PHI2_FALL             (9)
+#define DMA_TP_ADDR_HIGH_ON               (10)      //  [14]  Address high byte driven on the bus
+#define DMA_TP_LMA2_RELEASE               (11)      //  [15]
+#define DMA_TP_RDWR_PHI1_RISE             (12)      //  Phi 1 rises, first data cycle
+#define DMA_TP_RDWR_ASSERT                (13)      //  /RD or /WR low
+#define DMA_TP_RDWR_PHI1_FALL             (14)
+#define DMA_TP_ADDR_HIGH_OFF              (15)      //  End of the address high byte
+#define DMA_TP_DATA_PHI2_FALL             (16)      //  From here on, the last byte of the burst
+#define DMA_TP_DATA_ON                    (17)      //  Write data driven on the bus
+#define DMA_TP_RDWR_RELEASE               (18)
+#define DMA_TP_DATA_PHI1_FALL             (19)
+#define DMA_TP_DATA_OFF                   (20)      //  End of the write data, or read data sampled
+#define DMA_TP_NUM                        (21)
+
+#if ENABLE_DMA_TIMING_CHECK
+#define DMA_TIMING_POINT(point)           (DMA_Timing_Stamps[(point)] = ARM_DWT_CYCCNT)
+#else
+#define DMA_TIMING_POINT(point)           do {} while(0)
+#endif
 
 //    Simple Logic Analyzer
 //
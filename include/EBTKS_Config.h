@@ -39,6 +39,81 @@
 
 #define DEVELOPMENT_MODE            (1)
 
+//
+//      Enable the ISR cycle budget profiler. Stamps ARM_DWT_CYCCNT around each I/O handler, the memory
+//      reads/writes, and the Logic Analyzer in pinChange_isr(). See EBTKS_ISR_Profiler.cpp and "isr prof"
+//      on the diagnostic menu. This adds overhead to every bus cycle, so leave it off for normal use
+#define ENABLE_ISR_PROFILER         (0)
+
+//
+//      Enable the bus utilization counters. One counter increment per bus cycle, plus one for each I/O access
+//      and DMA grant. See EBTKS_Bus_Stats.cpp and "bus stats" on the diagnostic menu
+#define ENABLE_BUS_STATS            (1)
+
+//
+//      Enable the IFETCH based PC profiler. When enabled but not running ("pc prof on"), the cost is one test per
+//      read cycle, and the histogram takes 64 KB of DMAMEM. Leave it off for normal use. See EBTKS_PC_Profiler.cpp.
+//      PC_PROFILE_DECIMATION should be prime, to avoid locking onto loops. IFETCH_ACTIVE_HIGH is the level of the
+//      IFETCH pin during an opcode fetch
+#ifndef ENABLE_PC_PROFILER
+#define ENABLE_PC_PROFILER          (0)
+#endif
+#define PC_PROFILE_DECIMATION       (61)
+#define IFETCH_ACTIVE_HIGH          (1)
+
+//
+//      Enable address watchpoints ("wp set"). When enabled and no watchpoint covers the current page, the cost
+//      is one table lookup per bus cycle. Leave it off for normal use. See EBTKS_Watchpoints.cpp. WATCH_MAX_PAGES
+//      limits how many 256 byte pages all the watchpoints together can cover, at 256 bytes of RAM each
+#ifndef ENABLE_WATCHPOINTS
+#define ENABLE_WATCHPOINTS          (0)
+#endif
+#define MAX_WATCHPOINTS             (8)
+#define WATCH_MAX_PAGES             (64)
+
+//
+//      Enable the bus flight recorder ("fr start"), which streams every bus cycle to the SD Card.
+//      The ring is in PSRAM, 4 bytes per entry, and FLIGHT_RECORDER_RING_WORDS must be a power of two.
+//      FLIGHT_RECORDER_FILE_MB is the default file size. When enabled, the cost is one test per bus cycle while
+//      it is not running. Leave it off for normal use. See EBTKS_Flight_Recorder.cpp
+//      [env:native] in platformio.ini sets it, so test/test_psram can check its ring against the PSRAM budget
+#ifndef ENABLE_FLIGHT_RECORDER
+#define ENABLE_FLIGHT_RECORDER      (0)
+#endif
+#define FLIGHT_RECORDER_RING_WORDS  (524288)
+#define FLIGHT_RECORDER_FILE_MB     (1024)
+
+//
+//      Enable the ROM bank and page read heatmap ("heat on"). When enabled, every read that EBTKS supplies costs
+//      one counter increment through the page descriptor, whether or not the heatmap is running, and the counters
+//      take 32 KB of DMAMEM. Leave it off for normal use. See EBTKS_Heatmap.cpp
+#ifndef ENABLE_HEATMAP
+#define ENABLE_HEATMAP              (0)
+#endif
+
+//
+//      Enable interrupt latency tracing for the emulated devices ("int lat"). Only costs time when the interrupt
+//      state changes. See EBTKS_Interrupt_Latency.cpp
+#define ENABLE_INTERRUPT_LATENCY    (1)
+
+//
+//      Enable firmware event tracing ("trace on"), begin/end points around the slow background operations,
+//      saved as Chrome trace JSON. The ring is in PSRAM, 12 bytes per entry (see the PSRAM budget below),
+//      and EVENT_TRACE_ENTRIES must be a power of two. When disabled, the trace points compile to nothing and
+//      there is no ring. See EBTKS_Event_Trace.cpp
+#define ENABLE_EVENT_TRACE          (1)
+#define EVENT_TRACE_ENTRIES         (65536)
+
+//
+//      Enable the DMA timing check ("dma timing"). The DMA code stamps ARM_DWT_CYCCNT at each control and data bus
+//      step of a transfer, and the check compares the times from the Phi 1 / Phi 2 edges against setup, hold and
+//      pulse width rules. Each stamp is a store of a few ns, which shifts the hand tuned edges a little, so leave this
+//      off in normal use. When disabled, the stamps compile to nothing. See EBTKS_DMA_Timing.cpp
+//      [env:native] in platformio.ini sets it, so test/test_dma_timing can run the check on the bus clock model
+#ifndef ENABLE_DMA_TIMING_CHECK
+#define ENABLE_DMA_TIMING_CHECK     (0)
+#endif
+
 
 //
 //  Logging control is one of 3 levels:     LOG_NONE      for no logging
@@ -86,6 +161,13 @@
 #define IO_ADDR                           (0177400)       //  Top 256 bytes of the address space
 #define EXP_RAM_SIZE                      (16384 - 256)   //  16128 bytes of RAM
 
+//
+//    Shadow copy of the HP85 built-in DRAM, see EBTKS_DRAM_Shadow.cpp
+//
+
+#define DRAM_SHADOW_BASE_ADDR             (0100000)
+#define DRAM_SHADOW_SIZE                  (32768)         //  Up to 0177777, though the I/O page is never shadowed
+
 //
 //    Tracking the CRT activity. Can be used to dump to a remote file or printer, and
 //    also needed if we want to scribble on the screen
@@ -105,10 +187,35 @@
 //    The effective transfer rate approaches (burst_length)/(burst_length + break_cycles)
 //    times 1/1.6 us . i.e. 15/(15+3) gives 520 K Bytes per second, approximately
 //
+//    11/22/2020  The burst and break lengths are no longer fixed. The refresh scheduler in EBTKS_DMA_Scheduler.cpp
+//    keeps a running refresh debt from the bus cycles we have used, and sizes each burst and break from it.
+//    These are the defaults, and each machine model can override them in CONFIG.TXT ("dmaRefresh").
+//    With the defaults, sustained DMA approaches 8/9 of the bus, about 555 K Bytes per second. A block still starts
+//    with no more than the 17 busy cycles (2 LMA and 15 data) of the fixed bursts.
+//    "dma sched check" runs a model of the 1MA2 against every setting in the legal ranges
+//
 
 #define MAX_DMA_TRANSFER_LENGTH           (256)
-#define MAX_DMA_BURST_LENGTH              (15)
-#define DMA_BURST_BREAK_CYCLES            (3)
+#define DMA_REFRESH_INTERVAL              (9)       //  Bus cycles between 1MA2 refresh requests
+#define DMA_REFRESH_POSTPONED             (2)       //  Refresh requests the 1MA2 can postpone
+#define DMA_REFRESH_GRANT_DEBT            (0)       //  Refreshes assumed postponed when we get the bus after the CPU has had it for a while
+#define DMA_REFRESH_INTERVAL_MIN          (4)       //  Legal ranges, checked by "dma sched check"
+#define DMA_REFRESH_INTERVAL_MAX          (32)
+#define DMA_REFRESH_POSTPONED_MIN         (1)
+#define DMA_REFRESH_POSTPONED_MAX         (4)
+
+//
+//    11/23/2020  Background DMA jobs (EBTKS_DMA_Queue.cpp) run in slices, each with its own bus grant, so that
+//    interrupts (USB Serial, SysTick) are serviced between them. A slice is limited to DMA_QUEUE_SLICE_BYTES
+//    data cycles and DMA_QUEUE_SLICE_OPS operations, and a poll to DMA_QUEUE_POLL_READS reads per slice.
+//    DMA_Engine_Poll() runs slices for up to DMA_QUEUE_POLL_US each time loop() calls it
+//
+
+#define DMA_QUEUE_LENGTH                  (16)
+#define DMA_QUEUE_SLICE_BYTES             (64)
+#define DMA_QUEUE_SLICE_OPS               (16)
+#define DMA_QUEUE_POLL_READS              (16)
+#define DMA_QUEUE_POLL_US                 (200)
 
 #define SERIAL_STRING_MAX_LENGTH          (81)
 #define SERIAL_COMMAND_MAX_LENGTH         (81)
@@ -125,6 +232,42 @@
 // #define LOGIC_ANALYZER_BUFFER_SIZE        (8192)
 // #define LOGIC_ANALYZER_INDEX_MASK         (0x00001FFFU)
 
+//
+//  Buffer lengths above LOGIC_ANALYZER_BUFFER_SIZE use buffers in PSRAM (EXTMEM), up to
+//  LOGIC_ANALYZER_PSRAM_SAMPLES, which must also be a power of two. 8 bytes per sample, so 4 MB
+//  for 512K samples (about 0.8 seconds of bus cycles). See EBTKS_Logic_Analyzer.cpp
+//
+
+#define ENABLE_LA_PSRAM                   (1)
+#define LOGIC_ANALYZER_PSRAM_SAMPLES      (524288)
+
+//
+//  PSRAM budget. With every EXTMEM user enabled, everything in EXTMEM must fit in one 8 MB PSRAM chip, the usual EBTKS
+//  build. The linker places EXTMEM for up to 16 MB whatever is fitted, so the sum is checked here, and each
+//  large buffer is also checked at run time against the PSRAM that startup.c found (PSRAM_HOLDS() in EBTKS.h)
+//
+//    AUXROM SD services  Directory listing buffers, copy buffer, paths       about 165 KB
+//    Logic Analyzer      2 buffers of LOGIC_ANALYZER_PSRAM_SAMPLES x 4 bytes  4096 KB
+//    Flight recorder     FLIGHT_RECORDER_RING_WORDS x 4 bytes                 2048 KB
+//    Event trace         EVENT_TRACE_ENTRIES x 12 bytes                        768 KB
+//
+
+#define PSRAM_BUDGET_KB                   (8192)
+#define PSRAM_SD_SERVICES_KB              (176)           //  Rounded up, for alignment
+#define PSRAM_LA_KB                       (ENABLE_LA_PSRAM ? (2 * 4 * LOGIC_ANALYZER_PSRAM_SAMPLES / 1024) : 0)
+#define PSRAM_FLIGHT_RECORDER_KB          (ENABLE_FLIGHT_RECORDER ? (4 * FLIGHT_RECORDER_RING_WORDS / 1024) : 0)
+#define PSRAM_EVENT_TRACE_KB              (ENABLE_EVENT_TRACE ? (12 * EVENT_TRACE_ENTRIES / 1024) : 0)
+
+#if (PSRAM_SD_SERVICES_KB + PSRAM_LA_KB + PSRAM_FLIGHT_RECORDER_KB + PSRAM_EVENT_TRACE_KB) > PSRAM_BUDGET_KB
+#error "The EXTMEM buffers don't fit in PSRAM_BUDGET_KB, see the PSRAM budget in EBTKS_Config.h"
+#endif
+
+//
+//  Maximum number of sequential trigger stages, see EBTKS_LA_Trigger.cpp
+//
+
+#define LA_TRIGGER_MAX_STAGES             (4)
+
 
 
 #define DIRECTORY_LISTING_BUFFER_SIZE    (65536)
@@ -38,6 +38,40 @@ uint16_t DMA_Peek16(uint32_t address);
 void    DMA_Poke8 (uint32_t address, uint8_t  val);
 void    DMA_Poke16(uint32_t address, uint16_t val);
 
+int32_t DMA_Session(struct S_DMA_Op ops[], uint32_t op_count);
+void    DMA_Session_Bench(void);
+void    DMA_LA_Sample_Reset(void);
+void    DMA_LA_Sample_Report(void);
+
+void    EBTKS_delay_34_ns(void);
+void    EBTKS_delay_for_LMA_start(void);
+
+//
+//  DMA refresh scheduler
+//
+bool     DMA_Sched_Configure(struct S_DMA_Sched *sched, uint32_t interval, uint32_t postponed, uint32_t grant_debt);
+void     DMA_Sched_Grant(struct S_DMA_Sched *sched, uint32_t gap_bus_cycles);
+uint32_t DMA_Sched_Block_Start(struct S_DMA_Sched *sched);
+uint32_t DMA_Sched_Burst(struct S_DMA_Sched *sched, uint32_t remaining);
+uint32_t DMA_Sched_Break(struct S_DMA_Sched *sched);
+void     DMA_Sched_Release(void);
+uint32_t DMA_Sched_Idles_Before_Block(void);
+void     DMA_Sched_Report(void);
+void     DMA_Sched_Set_Command(void);
+uint32_t DMA_Sched_Check_Setting(uint32_t interval, uint32_t postponed, uint32_t grant_debt, uint32_t model_postponed, uint32_t *runs);
+void     DMA_Sched_Check_Command(void);
+
+//
+//  Background DMA jobs
+//
+bool    DMA_Queue_Submit(struct S_DMA_Job *job);
+bool    DMA_Queue_Wait(struct S_DMA_Job *job);
+bool    DMA_Queue_Run(struct S_DMA_Job *job);
+void    DMA_Engine_Poll(void);
+void    DMA_Queue_Report(void);
+uint32_t DMA_Timing_Check(void);
+void    DMA_Timing_Check_Command(void);
+
 
 //
 //  CRT Functions
@@ -52,11 +86,14 @@ void writePixel(int x, int y, int color);
 void writeLine(int x0, int y0, int x1, int y1, int color);
 void CRT_capture_screen(void);
 void CRT_restore_screen(void);
+bool CRT_restore_screen_start(void (*callback)(struct S_DMA_Job *job));
+void CRT_Mirror_Poll(void);
+void CRT_Mirror_Resync(uint16_t bad, uint16_t sad, uint8_t ctrl);
 
 //
 //  Bank Switched ROM support
 //
-bool      readBankRom(uint16_t addr);
+void      buildRomPageTable(void);
 uint8_t * getROMEntry(uint8_t romId);
 
 //
@@ -74,12 +111,116 @@ FASTRUN void pinChange_isr(void) __attribute__ ((interrupt ("IRQ")));     //  Th
 void setupPinChange(void);
 void mySystick_isr(void);
 void initIOfuncTable(void);
+void initBusCycleDecodeTable(void);
+void buildPageTable(void);
 void setIOReadFunc(uint8_t addr,ioReadFuncPtr_t readFuncP);
-void setIOWriteFunc(uint8_t addr,ioWriteFuncPtr_t writeFuncP);
+void setIOWriteFunc(uint8_t addr,ioWriteFuncPtr_t writeFuncP, bool deferred = false);
 void removeIOReadFunc(uint8_t addr);
 void removeIOWriteFunc(uint8_t addr);
 
+//
+//  ISR cycle budget profiler
+//
+void ISR_Profiler_Record(uint32_t slot, uint32_t cycles);
+void ISR_Profiler_Clear(void);
+void ISR_Profiler_Get(uint32_t slot, struct S_ISR_Profile *prof);
+void ISR_Profiler_Clear_Command(void);
+void ISR_Profiler_Report(void);
 
+//
+//  ISR to background event ring
+//
+bool ISR_Event_Push(uint8_t type, uint8_t data, uint8_t aux, uint32_t value);
+void Deferred_IO_Write_Push(uint8_t addr, uint8_t data);
+uint32_t Deferred_IO_Writes_Lost(void);
+void ISR_Event_Poll(void);
+void ISR_Event_Report(void);
+bool AUXROM_Alert_Event(uint8_t mailbox);
+bool tape_block_request_event(uint32_t block_num);
+bool translator_OB_event(uint8_t ob_val, uint8_t ccr_val);
+
+
+//
+//  Bus utilization counters
+//
+void Bus_Stats_Poll(void);
+void Bus_Stats_Report(void);
+int  Bus_Stats_Format(char *dest, int max_len);
+
+//
+//  IFETCH PC profiler
+//
+void PC_Profile_Sample(uint16_t address);
+void PC_Profiler_Poll(void);
+void PC_Profiler_On_Command(void);
+void PC_Profiler_Off_Command(void);
+void PC_Profiler_Report(void);
+void PC_Profiler_Save_Command(void);
+
+//
+//  Address watchpoints
+//
+void Watchpoint_Check(uint16_t addr, uint8_t data, uint32_t slot);
+void Watchpoint_Poll(void);
+void Watchpoint_Report(void);
+void Watchpoint_Set_Command(void);
+void Watchpoint_Clear_Command(void);
+
+//
+//  Bus flight recorder
+//
+void Flight_Recorder_Sample(void);
+bool Flight_Recorder_Store_Is_Cached(void);
+void Flight_Recorder_Drop(void);
+void Flight_Recorder_Prefetch(void);
+void Flight_Recorder_Poll(void);
+void Flight_Recorder_Start_Command(void);
+void Flight_Recorder_Stop_Command(void);
+void Flight_Recorder_Report(void);
+
+//
+//  ROM bank and page read heatmap
+//
+uint32_t * Heatmap_ROM_Counters(uint8_t bank);
+void Heatmap_Bind_Pages(void);
+void Heatmap_On_Command(void);
+void Heatmap_Off_Command(void);
+void Heatmap_Report(void);
+void Heatmap_Save_Command(void);
+
+//
+//  Interrupt latency tracing
+//
+void Interrupt_Latency_Request(void);
+void Interrupt_Latency_IRL(void);
+void Interrupt_Latency_Lost(void);
+void Interrupt_Latency_Handoff(void);
+void Interrupt_Latency_Vector_Read(void);
+void Interrupt_Latency_Report(void);
+void Interrupt_Latency_Get_Counts(uint8_t vector, uint32_t *requests, uint32_t *irls, uint32_t *handoffs);
+void Interrupt_Latency_Clear_Command(void);
+
+//
+//  Firmware event tracing
+//
+void Event_Trace_Record(uint8_t id, uint8_t phase, uint16_t arg, uint32_t cycles);
+void Event_Trace_On_Command(void);
+void Event_Trace_Off_Command(void);
+void Event_Trace_Report(void);
+void Event_Trace_Save_Command(void);
+
+//
+//  HP85 DRAM shadow
+//
+uint8_t * getDRAMShadowPage(uint32_t page);
+void DRAM_Shadow_Enable(bool en);
+bool DRAM_Shadow_Read(uint32_t addr, uint8_t *buffer, uint32_t count);
+void DRAM_Shadow_Update(uint32_t addr, uint8_t *buffer, uint32_t count);
+void DRAM_Shadow_Status(void);
+void DRAM_Shadow_On_Command(void);
+void DRAM_Shadow_Off_Command(void);
+void DRAM_Shadow_Verify_Command(void);
+void DRAM_Shadow_Check_Command(void);
 
 //
 //  SD Card support
@@ -160,6 +301,7 @@ void AUXROM_WROM(void);
           void AUXROM_MEMCPY(void);
           void AUXROM_SETLED(void);
           void AUXROM_SDCOPY(void);
+void AUXROM_BUSSTAT(void);
 
 //
 //  Utility Functions
@@ -185,6 +327,30 @@ void show_file(void);
 void Setup_Logic_Analyzer(void);
 void Logic_analyzer_go(void);
 void Logic_Analyzer_Poll(void);
+uint32_t Logic_Analyzer_Max_Buffer_Length(void);
+void Logic_Analyzer_Select_Buffer(void);
+void Logic_Analyzer_Prefetch(void);
+bool Logic_Analyzer_Store_Is_Cached(void);
+void Logic_Analyzer_Bench(void);
+uint32_t Logic_Analyzer_Post_Trigger_Blocks(void);
+void Logic_Analyzer_Compress_Sample(void);
+bool Logic_Analyzer_Decode_First(void);
+bool Logic_Analyzer_Decode_Next(uint32_t *main, uint32_t *aux, int32_t *sample_number);
+uint32_t Logic_Analyzer_Compressed_Bytes(void);
+void Logic_Analyzer_Trigger_Compile(void);
+bool Logic_Analyzer_Trigger_Check(void);
+uint32_t Logic_Analyzer_Trigger_Stage(void);
+void Logic_Analyzer_Stages_Command(void);
+bool Logic_Analyzer_Export_Busy(void);
+void Logic_Analyzer_VCD_Command(void);
+void Logic_Analyzer_Dump_Command(void);
+void Logic_Analyzer_Decode_Command(void);
+void Logic_Analyzer_Export_Poll(void);
+void Logic_Analyzer_Text_Printf(const char *format, ...);
+void Capricorn_Trace_Begin(void);
+void Capricorn_Trace_Sample(uint32_t main, uint32_t aux, int32_t relative);
+void Capricorn_Trace_Finish(void);
+void Capricorn_Trace_Summary(void);
 
 void Simple_Graphics_Test(void);
 
@@ -125,7 +125,8 @@ union PARAMETER_BLOCK_OVERLAY
 
 EXTERN  union PARAMETER_BLOCK_OVERLAY Parameter_blocks;
 
-EXTERN  bool      new_AUXROM_Alert;
+EXTERN  bool      new_AUXROM_Alert;               //  Only written by the background loop, see AUXROM_Alert_Event()
+EXTERN  bool      AUXROM_Mailbox_Deferred;        //  Set by an AUXROM function that releases the mailbox itself, from a DMA job callback
 EXTERN  uint8_t   Mailbox_to_be_processed;
 
 EXTERN  uint8_t HP85A_16K_RAM_module[EXP_RAM_SIZE]; //map this into the HP85 address space @ 0xc000..0xfeff
@@ -133,6 +134,78 @@ EXTERN  uint8_t HP85A_16K_RAM_module[EXP_RAM_SIZE]; //map this into the HP85 add
 EXTERN  uint8_t Shared_DMA_Buffer_1[MAX_DMA_TRANSFER_LENGTH + 8];    // + 8 for a tiny bit of off by error safety
 EXTERN  uint8_t Shared_DMA_Buffer_2[MAX_DMA_TRANSFER_LENGTH + 8];    // + 8 for a tiny bit of off by error safety
 
+//
+//  DMA session operations, run back to back with one bus grant by DMA_Session(). See EBTKS_DMA.cpp
+//
+
+#define DMA_OP_READ                     (0)       //  Read count bytes from address into buffer
+#define DMA_OP_WRITE                    (1)       //  Write count bytes from buffer to address
+#define DMA_OP_READ_MODIFY_WRITE        (2)       //  One byte, new = (old & mask) | value. If buffer is not NULL, the new value is saved there
+#define DMA_OP_POLL                     (3)       //  Read one byte until (data & mask) == value. If buffer is not NULL, the last read is saved there.
+                                                  //  limit is the most reads to do, 0 for no limit
+#define DMA_OP_WRITE_PACED              (4)       //  Write count bytes from buffer to address, one at a time, each after polling status until
+                                                  //  (data & mask) == value, such as CRTDAT with CRTSTS. limit applies to each poll
+
+struct S_DMA_Op
+{
+  uint8_t     op;
+  uint8_t     mask;
+  uint8_t     value;
+  uint16_t    address;
+  uint16_t    count;
+  uint8_t     *buffer;
+  uint32_t    limit;
+  uint16_t    status;                             //  Only for DMA_OP_WRITE_PACED
+};
+
+//
+//  Background DMA jobs, a list of DMA session operations run in slices by DMA_Engine_Poll(). See EBTKS_DMA_Queue.cpp
+//
+
+#define DMA_JOB_IDLE                    (0)       //  Not submitted yet, or picked up after it was done
+#define DMA_JOB_QUEUED                  (1)
+#define DMA_JOB_DONE                    (2)
+#define DMA_JOB_FAILED                  (3)       //  A poll ran out of reads. ops_done is the operation that failed
+
+#define DMA_CLIENT_AUXROM               (0)       //  Jobs from the same client run in order, and clients take turns by slice
+#define DMA_CLIENT_CRT                  (1)
+#define DMA_CLIENT_TERM85               (2)
+#define DMA_CLIENT_OTHER                (3)
+#define DMA_NUM_CLIENTS                 (4)
+
+struct S_DMA_Job
+{
+  struct S_DMA_Op   *ops;                         //  The job and its operations must stay put until it is done
+  uint32_t          op_count;
+  uint8_t           client;
+  bool              unsliced;                     //  Run as one slice, with one bus grant, whatever its size
+  void              (*callback)(struct S_DMA_Job *job);   //  Called from loop() when the job is done or failed, can be NULL
+  void              *context;                     //  For the callback
+  volatile uint8_t  state;
+  uint32_t          ops_done;                     //  Progress, only written by the engine
+  uint32_t          offset;                       //  Bytes done within ops[ops_done]
+  uint32_t          poll_reads;                   //  Reads done by the poll in progress
+};
+
+//
+//  DMA refresh scheduler settings and state. See EBTKS_DMA_Scheduler.cpp
+//
+
+struct S_DMA_Sched
+{
+  uint32_t    interval;                           //  Bus cycles between 1MA2 refresh requests
+  uint32_t    postponed;                          //  Refresh requests the 1MA2 can postpone
+  uint32_t    grant_debt;                         //  Refreshes assumed postponed after the CPU has had the bus for a while
+  uint32_t    debt;                               //  Refresh debt, in bus cycles
+  uint32_t    bursts;                             //  Statistics, not used by the model
+  uint32_t    breaks;
+  uint32_t    idle_cycles;
+  uint32_t    busy_cycles;
+  uint32_t    max_debt;
+};
+
+EXTERN  struct S_DMA_Sched  DMA_Sched;
+
 
 EXTERN  bool haltReq; //set true to request the HP85 to halt/DMA request
 
@@ -181,6 +254,95 @@ EXTERN  volatile bool globalIntEn;           // global interrupt enable
 typedef void (*ioWriteFuncPtr_t)(uint8_t);
 typedef bool (*ioReadFuncPtr_t)(void);
 
+//
+//  Page descriptor table. One entry for each 256 byte page of the HP85 64K address space.
+//  onReadData() and onWriteData() decode the bus address with a single indexed load into
+//  this table, rather than walking a chain of range tests. See EBTKS_Bus_Interface_ISR.cpp
+//
+//  read_ptr and write_ptr point to the EBTKS memory that backs offset 0 of the page, or NULL
+//  if EBTKS does not respond to that type of access. The I/O page has both NULL and is
+//  marked with PAGE_FLAG_IO, which dispatches through ioReadFuncs[] and ioWriteFuncs[]
+//
+
+#define PAGE_FLAG_IO              (0x01)      //  Page is the I/O page 0177400..0177777
+#define PAGE_FLAG_ROM             (0x02)      //  Page is part of the bank switched ROM area 060000..077777
+#define PAGE_FLAG_AUXROM_WINDOW   (0x04)      //  Page is currently mapped to the AUXROM shared RAM window
+#define PAGE_FLAG_RAM16K          (0x08)      //  Page is part of the HP85A 16K RAM module
+#define PAGE_FLAG_DRAM_SHADOW     (0x10)      //  Page is built-in DRAM, writes are copied into the DRAM shadow
+
+struct S_Page_Descriptor
+{
+  uint8_t       *read_ptr;
+  uint8_t       *write_ptr;
+  uint32_t      flags;
+#if ENABLE_HEATMAP
+  uint32_t      *heat_ptr;          //  Read counter for this page, never NULL. See EBTKS_Heatmap.cpp
+#endif
+};
+
+EXTERN  struct S_Page_Descriptor Page_Table[256];
+EXTERN  volatile bool Rom_Page_Table_Stale;     //  Set by a write to RSELEC, the ROM pages are rebuilt on the next Phi 2
+
+EXTERN  volatile uint32_t Bus_Stats_Counts[BUS_STATS_NUM];    //  Free running, only written by the ISR. See EBTKS_Bus_Stats.cpp
+
+EXTERN  volatile bool     PC_Profile_Active;                  //  See EBTKS_PC_Profiler.cpp
+EXTERN  uint32_t          PC_Profile_Countdown;               //  Only used by the ISR while PC_Profile_Active
+
+//
+//  Address watchpoints. See EBTKS_Watchpoints.cpp
+//
+
+#define WATCH_READ                      (0x01)
+#define WATCH_WRITE                     (0x02)
+#define WATCH_FETCH                     (0x04)    //  Opcode fetch (IFETCH asserted). A fetch also matches WATCH_READ
+
+EXTERN  volatile uint8_t  Watch_Page_Slot[256];               //  0 if no watchpoint touches the page, else 1 + index into Watch_Pages[]
+EXTERN  bool              Watch_Fetch_Cycle;                  //  IFETCH at Phi 2, only sampled for watched pages
+
+EXTERN  volatile bool     Flight_Recorder_Active;             //  See EBTKS_Flight_Recorder.cpp
+EXTERN  uint32_t          DMA_LA_Samples;                     //  DMA cycles recorded, or skipped, by DMA_LA_Sample() in EBTKS_DMA.cpp
+EXTERN  uint32_t          DMA_LA_Skipped;                     //  Not given to the Logic Analyzer, the store was not in the data cache
+EXTERN  uint32_t          DMA_LA_Max_Cycles;                  //  Longest DMA_LA_Sample()
+EXTERN  uint32_t          DMA_LA_Overruns;                    //  DMA_LA_Sample() calls longer than DMA_LA_SAMPLE_WINDOW_NS
+
+EXTERN  volatile bool     Event_Trace_Active;                 //  See EBTKS_Event_Trace.cpp
+EXTERN  uint32_t          DMA_Grant_Cycles;                   //  ARM_DWT_CYCCNT when the ISR took the bus for DMA, for TRACE_DMA
+#if ENABLE_DMA_TIMING_CHECK
+EXTERN  uint32_t          DMA_Timing_Stamps[DMA_TP_NUM];      //  ARM_DWT_CYCCNT at each DMA_TIMING_POINT() , see EBTKS_DMA_Timing.cpp
+#endif
+
+//
+//  Events from the I/O handlers in pinChange_isr() to the background loop. See EBTKS_ISR_Events.cpp
+//
+
+#define ISR_EVENT_AUXROM_ALERT          (1)       //  data = Mailbox number written to HEYEBTKS
+#define ISR_EVENT_TAPE_BLOCK_REQUEST    (2)       //  value = tape block number
+#define ISR_EVENT_1MB5_OB               (3)       //  data = OB value, aux = CCR at the time of the OB write
+
+struct S_ISR_Event
+{
+  uint8_t       type;
+  uint8_t       data;
+  uint8_t       aux;
+  uint32_t      value;
+};
+
+//
+//  ISR cycle budget profiler statistics for one slot, see EBTKS_ISR_Profiler.cpp
+//
+
+#define ISR_PROFILE_NUM_BUCKETS         (8)
+#define ISR_PROFILE_BUCKET_CYCLES       (F_CPU / 20000000)      //  50 ns buckets. 30 cycles at 600 MHz
+
+struct S_ISR_Profile
+{
+  uint32_t      count;
+  uint32_t      min;
+  uint32_t      max;
+  uint64_t      total;
+  uint32_t      histogram[ISR_PROFILE_NUM_BUCKETS];   //  The last bucket also counts everything longer
+};
+
 
 
 
@@ -198,8 +360,8 @@ EXTERN  char logfile_temp_text[200];    //  That should be enough, bad news as n
 
 EXTERN  enum analyzer_state Logic_Analyzer_State;
 
-EXTERN  uint32_t  Logic_Analyzer_Data_1[LOGIC_ANALYZER_BUFFER_SIZE];      //  See EBTKS_Bus_Interface_ISR.cpp for bit field layout
-EXTERN  uint32_t  Logic_Analyzer_Data_2[LOGIC_ANALYZER_BUFFER_SIZE];      //  See EBTKS_Bus_Interface_ISR.cpp for bit field layout
+EXTERN  uint32_t  *Logic_Analyzer_Data_1;          //  See EBTKS_Bus_Interface_ISR.cpp for bit field layout, and
+EXTERN  uint32_t  *Logic_Analyzer_Data_2;          //  Logic_Analyzer_Select_Buffer() for where they point
 EXTERN  uint32_t  Logic_Analyzer_Data_index;
 EXTERN  uint32_t  Logic_Analyzer_Trigger_Mask_1;
 EXTERN  uint32_t  Logic_Analyzer_Trigger_Mask_2;
@@ -210,7 +372,8 @@ EXTERN  uint32_t  Logic_Analyzer_Pre_Trigger_Samples;
 EXTERN  int32_t   Logic_Analyzer_Event_Count_Init;
 EXTERN  int32_t   Logic_Analyzer_Event_Count;
 EXTERN  uint32_t  Logic_Analyzer_Samples_Till_Done;
-EXTERN  int16_t   Logic_Analyzer_Index_of_Trigger;
+EXTERN  int32_t   Logic_Analyzer_Index_of_Trigger;        //  For compressed capture, this is a sample number
+EXTERN  bool      Logic_Analyzer_Compressed;              //  See EBTKS_Logic_Analyzer.cpp
 EXTERN  uint32_t  Logic_Analyzer_current_bus_cycle_state_LA;
 EXTERN  uint32_t  Logic_Analyzer_Valid_Samples;
 EXTERN  uint32_t  Logic_Analyzer_Current_Buffer_Length;
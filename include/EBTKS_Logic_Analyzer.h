@@ -0,0 +1,62 @@
+//
+//      11/16/2020      Logic_Analyzer_Capture(), the sample store shared by onPhi_1_Rise() and the DMA engine
+//
+//  Both build Logic_Analyzer_main_sample and Logic_Analyzer_aux_sample (layout is in EBTKS_Bus_Interface_ISR.cpp),
+//  and then call this while Logic_Analyzer_State is ANALYZER_ACQUIRING. It checks the trigger (until triggered),
+//  stores the sample (raw, or compressed, see EBTKS_Logic_Analyzer.cpp), and counts down the post-trigger samples.
+//
+//  Samples from the DMA engine have bit 27 set, the source tag. With it, the control bits are the ones EBTKS drove:
+//
+
+#define LA_SAMPLE_DMA_LMA             (0x0E000000U)       //  One of the 2 address bytes. Data is the address byte
+#define LA_SAMPLE_DMA_READ            (0x0D000000U)
+#define LA_SAMPLE_DMA_WRITE           (0x0B000000U)
+#define LA_SAMPLE_DMA_IDLE            (0x0F000000U)       //  Break between bursts, for DRAM refresh. Data is junk
+
+//
+//  Samples from onPhi_1_Rise() have IFETCH in bit 28, set if the cycle was an opcode fetch
+//
+
+#define LA_SAMPLE_IFETCH              (0x10000000U)
+
+inline void Logic_Analyzer_Capture(void) __attribute__((always_inline, unused));
+inline void Logic_Analyzer_Capture(void)
+{
+  //
+  //  Check for trigger pattern
+  //      Don't look for trigger if the pre-trigger number of samples has not yet occured
+  //      Don't look for trigger if we have already triggered
+  //  Once triggered, count down till we have collected al post-trigger samples
+  //
+
+  if (!Logic_Analyzer_Triggered)
+  {
+    if (Logic_Analyzer_Valid_Samples >= Logic_Analyzer_Pre_Trigger_Samples)
+    { //  Triggering is allowed
+      if (Logic_Analyzer_Trigger_Check())                                     //  Last trigger stage has completed. Fixed cost per cycle
+      {
+        Logic_Analyzer_Triggered = true;
+        Logic_Analyzer_Index_of_Trigger = Logic_Analyzer_Data_index;         //  Record the buffer index at time of trigger
+      }
+    }
+  }
+  Logic_Analyzer_Valid_Samples++;                                             //  This could theoretically over flow if we didn't see a trigger in 7000 seconds (1.9 hours). Saturating is not worth the overhead
+  if (Logic_Analyzer_Compressed)
+  {
+    Logic_Analyzer_Compress_Sample();                                         //  Also counts down the post trigger blocks. See EBTKS_Logic_Analyzer.cpp
+  }
+  else
+  {
+    Logic_Analyzer_Data_1[Logic_Analyzer_Data_index  ] = Logic_Analyzer_main_sample;
+    Logic_Analyzer_Data_2[Logic_Analyzer_Data_index++] = Logic_Analyzer_aux_sample;
+
+    Logic_Analyzer_Data_index &= Logic_Analyzer_Current_Index_Mask;           //  Modulo addressing of sample buffer. Requires buffer length to be a power of two
+    if (Logic_Analyzer_Triggered)
+    {
+      if (--Logic_Analyzer_Samples_Till_Done == 0)
+      {
+        Logic_Analyzer_State = ANALYZER_ACQUISITION_DONE;
+      }
+    }
+  }
+}
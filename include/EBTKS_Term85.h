@@ -1,20 +1,9 @@
 #include <Arduino.h>
 
+#include "Inc_Common_Headers.h"
+
 #define HP85_WIDTH (32U)
 #define HP85_LINES (16U)
-extern void DMA_Poke8(uint32_t addr, uint8_t);
-extern void DMA_Poke16(uint32_t addr, uint16_t);
-extern uint8_t DMA_Peek8(uint32_t addr);
-extern volatile bool DMA_Active;
-extern volatile bool DMA_Request;
-extern int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t bytecount);
-extern int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t bytecount);
-extern void release_DMA_request(void);
-
-#define CRTSAD (0177404) //  CRT START ADDRESS
-#define CRTBAD (0177405) //  CRT BYTE ADDRESS
-#define CRTSTS (0177406) //  CRT STATUS
-#define CRTDAT (0177407) //  CRT DATA
 
 enum
 {
@@ -76,7 +65,7 @@ public:
             putCh(_currCh, _currLine, c);
             incCursor();
         }
-        return 1;
+        return 1;
     }
     //
     //  return character if character was not consumed
@@ -314,6 +303,12 @@ public:
         _startLine = 0;
         _enabled = false;
         _tick = millis();
+        _zero = 0;
+        _ops[0] = {DMA_OP_POLL, 0x80, 0x00, CRTSTS};                            //wait until video controller is ready
+        _ops[1] = {DMA_OP_WRITE, 0, 0, CRTBAD, 2, (uint8_t *)&_zero};            //set the crt address to the beginning of the screen
+        _ops[2] = {DMA_OP_WRITE, 0, 0, CRTSAD, 2, (uint8_t *)&_zero};            //set the crt start address to the beginning of the screen
+        _ops[3] = {DMA_OP_WRITE_PACED, 0x80, 0x00, CRTDAT, sizeof(_screen), _screen, 0, CRTSTS};
+        _job = {_ops, 4, DMA_CLIENT_TERM85, true};        //one slice, so the HP85 can't move CRTBAD in the middle
     }
 
     // updates the HP85 display. call at a regular interval
@@ -334,48 +329,30 @@ public:
         _enabled = en;
     }
 
+    //
+    //  copy the visible part of the virtual screen, with the cursor, and send it to the hp85's video controller
+    //  as a background DMA job, so interrupts are serviced while it goes. If the last update is still going, skip this one
+    //
     void update()
     {
-        uint8_t data;
-
-        //copy a line at a time and dma into the hp85's video controller
-        while (DMA_Peek8(CRTSTS) & 0x80)
-        {
-        };                     //wait until video controller is ready
-        DMA_Poke16(CRTBAD, 0); //set the crt address to the beginning of the screen
-        DMA_Poke16(CRTSAD, 0); //set the crt start address to the beginning of the screen
-
-        //start dma
-        DMA_Request = true;
-        while (!DMA_Active)
+        if (_job.state == DMA_JOB_QUEUED)
         {
-        }; // Wait for acknowledgement, and Bus ownership
-
+            return;
+        }
         for (uint32_t line = 0; line < HP85_LINES; line++)
         {
             for (uint32_t ch = 0; ch < HP85_WIDTH; ch++)
             {
-                data = 0x80;
-                while (data & 0x80)
-                {
-                    DMA_Read_Block(CRTSTS, (uint8_t *)&data, 1);
-                }; //wait until video controller is ready
-
                 uint8_t c = _term->getCh(ch + _startCh, line + _startLine);
                 //uint8_t c = 'A' + line;
                 if ((line == ((uint32_t)_term->getCursorLine() - _startLine)) && (ch == ((uint32_t)_term->getCursorCh() - _startCh)))
                 {
                     c |= 0x80; //add cursor
                 }
-                DMA_Write_Block(CRTDAT, &c, 1);
-                //DMA_Poke8(CRTDAT,c);
+                _screen[(line * HP85_WIDTH) + ch] = c;
             }
         }
-        release_DMA_request();
-        while (DMA_Active)
-        {
-        }; // Wait for release
-        //stop dma
+        DMA_Queue_Submit(&_job);
     }
     void updateLoop(void)
     {
@@ -461,4 +438,8 @@ private:
     uint32_t _updateState;
     bool _enabled;
     uint32_t _tick;
+    uint16_t _zero;
+    uint8_t _screen[HP85_LINES * HP85_WIDTH];
+    struct S_DMA_Op _ops[4];
+    struct S_DMA_Job _job;
 };
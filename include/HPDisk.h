@@ -155,6 +155,7 @@ class HPDisk
             {
             bool err = false; //default to fail
 
+            TRACE_BEGIN(TRACE_DISK_READ, _lba);
             if (!_diskFile.seek(_lba * SECTOR_SIZE))
                 {
                 LOGPRINTF_1MB5("Disk seek error %d\n", _lba);
@@ -170,6 +171,7 @@ class HPDisk
                     err = true;
                     }
                 }
+            TRACE_END(TRACE_DISK_READ, _lba);
 
             LOGPRINTF_1MB5("Read Block %06d\n", _lba);
             if (err == false)
@@ -197,7 +199,9 @@ class HPDisk
                     }
                 else
                     {
+                    TRACE_BEGIN(TRACE_DISK_WRITE, _lba);
                     _diskFile.write(buff, SECTOR_SIZE);
+                    TRACE_END(TRACE_DISK_WRITE, _lba);
 
                     LOGPRINTF_1MB5("Write Block %06d\n", _lba);
                     incSector();
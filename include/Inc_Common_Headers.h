@@ -10,5 +10,6 @@
 #include "SdFat.h"
 #include "sdios.h"
 #include "EBTKS_Function_Declarations.h"
+#include "EBTKS_Logic_Analyzer.h"
 #include "EBTKS_Led.h"
 
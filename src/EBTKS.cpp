@@ -564,6 +564,8 @@ void setup()
 
   pinMode(CORE_PIN_PWO_L, INPUT);      //PWO from HP85
 
+  pinMode(CORE_PIN_IFETCH, INPUT);     //  Capricorn IFETCH, used by the PC profiler
+
   // data bus pins to input
 
   pinMode(CORE_PIN_DB0, INPUT);   //  DB0
@@ -579,6 +581,9 @@ void setup()
   initIOfuncTable();
   initRoms();
   initCrtEmu();
+  ISR_Profiler_Clear();
+  DMA_Sched_Configure(&DMA_Sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED,     //  Until loadConfiguration() sets it for this machine model
+                      DMA_REFRESH_GRANT_DEBT);
 
   leds.begin();
 
@@ -724,6 +729,9 @@ void setup()
   Serial.printf("Config Success is %s\n"   , config_success  ? "true":"false");
 
   Logic_Analyzer_Event_Count_Init = -1000;      // Use this to indicate the Logic analyzer has no default values.
+  Logic_Analyzer_Current_Buffer_Length = LOGIC_ANALYZER_BUFFER_SIZE;
+  Logic_Analyzer_Current_Index_Mask    = LOGIC_ANALYZER_INDEX_MASK;
+  Logic_Analyzer_Select_Buffer();               //  Logic_Analyzer_Data_1/2 must never be NULL
 
   Serial.flush();
   delay(1000);
@@ -806,10 +814,18 @@ void loop()
 
 
 	Serial_Command_Poll();
+  ISR_Event_Poll();     //  Hand the events queued by the ISR to tape, AUXROM, 1MB5, and CRT
+  CRT_Mirror_Poll();    //  Resync the CRT mirror if deferred CRT writes were lost
   tape.poll();
   AUXROM_Poll();
+  DMA_Engine_Poll();     //  Background DMA jobs, a slice at a time (CRT restore, AUXROM block moves, Term85)
   Logic_Analyzer_Poll();
+  Logic_Analyzer_Export_Poll();   //  Background VCD / binary export of a capture, a chunk at a time
   loopTranslator();     //  1MB5 / HPIB / DISK poll
+  Bus_Stats_Poll();     //  Once per second, turn the bus cycle counters into rates
+  PC_Profiler_Poll();   //  Move PC samples from the ISR into the histogram
+  Watchpoint_Poll();    //  Count and report watchpoint hits
+  Flight_Recorder_Poll(); //  Drain the flight recorder ring to the SD Card
   //myusb.Task();
 
 
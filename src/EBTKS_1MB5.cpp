@@ -6,6 +6,15 @@
 // cp/m interface and others
 // Russell Bull July 2020
 //
+// 11/05/2020  OB writes now reach the background through the ISR event ring (EBTKS_ISR_Events.cpp),
+//             with the CCR captured at the time of the write. No more __disable_irq() in the mainline functions
+// 11/19/2020  Interrupt requests and the vector read are stamped for "int lat" (EBTKS_Interrupt_Latency.cpp)
+// 11/20/2020  Each OB processed is a trace point for "trace on" (EBTKS_Event_Trace.cpp)
+// 11/26/2020  writeIb() and loadReadBuff() disable interrupts again, as onReadInterrupt() writes the same
+//             variables. The last byte of a burst write is left in the OB for processOB(), as it always was
+// 11/26/2020  Interrupt requests are stamped for "int lat" before interruptReq is set, not after. The IOP reset
+//             request in loopTranslator() is made with interrupts disabled, as the isr can request one too
+//
 //
 //
 #include <Arduino.h>
@@ -177,19 +186,19 @@ void onWriteOb(uint8_t val)
     ob = val;
     obf = true;
 
-    if (writeBurst == true)
+    if ((writeBurst == true) && writeCount)
     {
+        writeBuff[writeIndex++] = val; //burst data goes straight to writeBuff
+        writeCount--;
         if (writeCount)
         {
-            writeBuff[writeIndex++] = val;
-            writeCount--;
-            if (writeCount == 0)
-            {
-                requestInterrupt(1);
-                writeBurst = false;
-            }
+            return;
         }
+        requestInterrupt(1);
+        writeBurst = false;
+        //the last byte stays in the OB, and processOB() reads it as the end of the burst
     }
+    ISR_Event_Push(ISR_EVENT_1MB5_OB, val, ccr, 0); //the CCR is captured with the OB, so they always match
 }
 
 //
@@ -200,6 +209,9 @@ bool onReadInterrupt(void)
 
     if (globalIntAck == true)
     {
+#if ENABLE_INTERRUPT_LATENCY
+        Interrupt_Latency_Vector_Read();
+#endif
         intCount++;
         readData = selectCode;
 
@@ -215,32 +227,56 @@ bool onReadInterrupt(void)
     return false;
 }
 // these are the mainline functions for register access
+//
+// OB values delivered by ISR_Event_Poll(). Only the mainline touches these
+//
+static bool obLatched = false;
+static uint8_t obLatch;
+static uint8_t obLatchCcr;
 
-bool readOb(uint8_t *val)
+bool translator_OB_event(uint8_t ob_val, uint8_t ccr_val)
 {
-    bool full;
-    uint8_t obval;
-
-    //ensure atomic access
-    __disable_irq();
-    full = obf;
-    obval = ob;
-    obf = false;
-    __enable_irq();
+    if (obLatched == true)
+    {
+        return false; //still haven't used the last one, leave this one in the event ring
+    }
+    obLatch = ob_val;
+    obLatchCcr = ccr_val;
+    obLatched = true;
+    return true;
+}
 
-    if (full == true)
+bool readOb(uint8_t *val, uint8_t *ccr_val = NULL)
+{
+    if (obLatched == false)
     {
-        *val = obval;
+        ISR_Event_Poll(); //we are often called in a busy wait, so go and look for it
     }
-    return full;
+    if (obLatched == false)
+    {
+        return false;
+    }
+    *val = obLatch;
+    if (ccr_val)
+    {
+        *ccr_val = obLatchCcr;
+    }
+    obLatched = false;
+    obf = false; //the isr only sets obf, we only clear it
+    return true;
 }
 
+//
+// onReadInterrupt() writes readBuff[0..1], readIndex, readCount, statusReg and ibf from the isr at any time,
+// so these two must not be interrupted part way through
+//
 bool writeIb(uint8_t *val)
 {
     bool full;
+
     __disable_irq();
     full = ibf;
-    if (ibf == false)
+    if (full == false)
     {
         ib = *val;
         ibf = true;
@@ -252,22 +288,17 @@ bool writeIb(uint8_t *val)
 //assumes data to send in in the readBuff array
 void loadReadBuff(int count, bool pack = false)
 {
-    __disable_irq();
-    readIndex = 0;
-    readCount = count;
-    if (count == 1)
-    {
-        statusReg = PSR_PED;
-    }
-    else
-    {
-        statusReg = 0;
-    }
+    uint8_t status;
 
+    status = (count == 1) ? PSR_PED : 0;
     if (pack)
     {
-        statusReg |= PSR_PACK;
+        status |= PSR_PACK;
     }
+    __disable_irq();
+    readIndex = 0;
+    statusReg = status;
+    readCount = count;
     ibf = true;
     __enable_irq();
 }
@@ -290,6 +321,9 @@ void requestInterrupt(uint8_t reason)
 {
     intReason = reason;
     interruptVector = 0x10; //  Interrupt vector for the 1MB5
+#if ENABLE_INTERRUPT_LATENCY
+    Interrupt_Latency_Request(); //  Stamped before the bus ISR can see the request
+#endif
     interruptReq = true;
 }
 
@@ -384,9 +418,14 @@ void loopTranslator(void)
         {
             LOGPRINTF_1MB5("IOP RESET GIE:%d\n", globalIntEn);
 
+            __disable_irq();        //  onWriteOb() can call requestInterrupt() from the isr, and it sets the same variables
             intReason = 3;
             interruptVector = 0x10; //int vector for the 1MB5
+#if ENABLE_INTERRUPT_LATENCY
+            Interrupt_Latency_Request();
+#endif
             interruptReq = true;
+            __enable_irq();
             prevReset = false;
         }
     }
@@ -412,9 +451,9 @@ void processOB(void)
     uint32_t reads;
     uint8_t poll = 0;
 
-    ourCCR = readCcr(); //might be a race condition with reading OB and CCR
-    if (readOb(&ourOB))
+    if (readOb(&ourOB, &ourCCR)) //the CCR as it was when the OB was written
     {
+        TRACE_BEGIN(TRACE_TRANSLATOR, ourOB);
         if (ourCCR & CCR_COM)
         {
             //LOGPRINTF_1MB5("Count: %04d INT: %d PSR: %02X CCR: %02X CMD: %02X ", readIBCount, intCount, statusReg, ourCCR, ourOB);
@@ -660,6 +699,7 @@ void processOB(void)
             } //end switch
         }
         LOGPRINTF_1MB5("\n");
+        TRACE_END(TRACE_TRANSLATOR, ourOB);
     }
 }
 
@@ -5,6 +5,20 @@
 //
 //  10/17/2020        Fix pervasive errors in how I was handling buffers
 //
+//  11/05/2020        HEYEBTKS writes are queued on the ISR event ring, see AUXROM_Alert_Event()
+//
+//  11/06/2020        AUXROM_Fetch_Memory() reads from the DRAM shadow when it can
+//
+//  11/20/2020        Each AUXROM function call is a trace point for "trace on", tagged with the usage code
+//
+//  11/21/2020        AUXROM_Fetch_Memory() and AUXROM_Store_Memory() split the transfer into runs by page owner,
+//                    memcpy() for EBTKS memory and block DMA for the rest, instead of DMA_Peek8()/DMA_Poke8() per byte
+//
+//  11/23/2020        The block DMA for AUXROM_Fetch_Memory() and AUXROM_Store_Memory() is done as background DMA jobs.
+//                    HELP restores the screen with a background job, and releases the mailbox when it is done
+//
+//  11/26/2020        The block DMA jobs use DMA_Queue_Run() , which runs the job at once if it can't be queued and waited for
+//
 
 #include <Arduino.h>
 #include <string.h>
@@ -42,6 +56,7 @@
 #define  AUX_USAGE_MEMCPY        ( 22)      //  MEMCPY
 #define  AUX_USAGE_SETLED        ( 23)      //  SETLED
 #define  AUX_USAGE_SDCOPY        ( 24)      //  SDCOPY                                            
+#define  AUX_USAGE_BUSSTAT       ( 25)      //  BUSSTAT$                                          Return the bus utilization rates (cycles per second)
 
 
 
@@ -92,8 +107,23 @@
 
 void ioWriteAuxROM_Alert(uint8_t val)                 //  This function is running within an ISR, keep it short and fast.
 {
-  new_AUXROM_Alert        = true;                     //  Let the background Polling loop know we have a function to be processed
-  Mailbox_to_be_processed = val;
+  ISR_Event_Push(ISR_EVENT_AUXROM_ALERT, val, 0, 0);  //  Let the background Polling loop know we have a function to be processed
+}
+
+//
+//  Called by ISR_Event_Poll() in the background. Returns false if we are still working on the previous
+//  alert, in which case the event stays in the ring until AUXROM_Poll() has finished with it.
+//
+
+bool AUXROM_Alert_Event(uint8_t mailbox)
+{
+  if (new_AUXROM_Alert)
+  {
+    return false;
+  }
+  Mailbox_to_be_processed = mailbox;
+  new_AUXROM_Alert        = true;
+  return true;
 }
 
 //
@@ -124,6 +154,7 @@ void AUXROM_Poll(void)
   //int         string_len;
   //uint32_t    string_addr;
   //uint32_t    my_R12;
+  uint16_t      usage;
 
   if (!new_AUXROM_Alert)
   {
@@ -137,6 +168,8 @@ void AUXROM_Poll(void)
 
   LOGPRINTF_AUX("AUXROM Function called. Got Mailbox # %d  and Usage %d\n", Mailbox_to_be_processed , *p_usage);
 
+  usage = *p_usage;                                                                         //  The functions overwrite it with their status
+  TRACE_BEGIN(TRACE_AUXROM, usage);
   switch (*p_usage)
   {
     case AUX_USAGE_CLOCK:
@@ -213,103 +246,138 @@ void AUXROM_Poll(void)
     case AUX_USAGE_SDCOPY                                            :
       AUXROM_SDCOPY();
       break;
+    case AUX_USAGE_BUSSTAT:
+      AUXROM_BUSSTAT();
+      break;
     default:
       *p_usage = 1;               //  Failure, unrecognized Usage code
   }
+  TRACE_END(TRACE_AUXROM, usage);
 
   new_AUXROM_Alert = false;
   //show_mailboxes_and_usage();
+  if (AUXROM_Mailbox_Deferred)
+  {                               //  The function relinquishes the mailbox when its background DMA job is done
+    AUXROM_Mailbox_Deferred = false;
+    return;
+  }
   *p_mailbox = 0;                 //  Relinquish control of the mailbox
 
 }
 
 //
-//  Fetch num_bytes for HP-85 memory. Made difficult because they might be in
-//  the built-in DRAM (access via DMA) or they might be in RAM that EBTKS
-//  supplies (but only for HP85A)
+//  Move a run of HP-85 memory that EBTKS doesn't own (built-in DRAM, system ROMs, I/O) with block DMA,
+//  as a background DMA job per MAX_DMA_TRANSFER_LENGTH bytes, so interrupts are serviced between the slices.
+//  Reads come from the DRAM shadow when it covers the chunk
 //
-//  The efficient solution would be identify the three scenarios:
-//    all in built-in DRAM
-//    all in EBTKS memory
-//    mixed
-//  and then write block transfer for each.
+
+static void AUXROM_DMA_Run(uint8_t *buffer, uint32_t addr, uint32_t count, bool write)
+{
+  uint32_t          chunk;
+  struct S_DMA_Op   op = {write ? (uint8_t)DMA_OP_WRITE : (uint8_t)DMA_OP_READ};
+  struct S_DMA_Job  job = {&op, 1, DMA_CLIENT_AUXROM};
+
+  while (count)
+  {
+    chunk = (count > MAX_DMA_TRANSFER_LENGTH) ? MAX_DMA_TRANSFER_LENGTH : count;
+    if (write || !DRAM_Shadow_Read(addr, buffer, chunk))
+    {
+      op.address = addr;
+      op.count   = chunk;
+      op.buffer  = buffer;
+      DMA_Queue_Run(&job);                            //  At once if the queue is full. No polls, so it can't fail
+    }
+    addr   += chunk;
+    buffer += chunk;
+    count  -= chunk;
+  }
+}
+
 //
-//  The expediant (and slower and less bug prone) is just transfer 1 byte at
-//  a time and do a test for each. Doing this for now.
-//  Actually, probably not that slow, since the overhead here is totally masked by the slow HP85 bus data rate
+//  Fetch num_bytes for HP-85 memory. They might be in the built-in DRAM (access via DMA) or they might
+//  be in memory that EBTKS supplies: the 16K RAM module (HP85A only), the AUXROM RAM window, or a ROM
 //
-//  #################  does not handle ROMs that EBTKS provides
-//  #################  does not handle RAM window in EBTKS ROMs
+//  The request is split into runs by page owner, using Page_Table[] , which already knows what EBTKS
+//  supplies for each 256 byte page. Pages with a read_ptr are copied with memcpy(), and consecutive pages
+//  without one are read with block DMA. Our own ROMs can't be read with DMA, as the ISR is off while we
+//  own the bus, and nobody would answer.
 //
 
 void AUXROM_Fetch_Memory(uint8_t *dest, uint32_t src_addr, uint16_t num_bytes)
 {
-  while (num_bytes--)
+  uint32_t    segment, run_addr = 0, run_length = 0;
+  struct S_Page_Descriptor  *page;
+
+  src_addr &= 0x0000FFFFU;
+  while (num_bytes)
   {
-    if (getHP85RamExp())
+    segment = 256 - (src_addr & 0xFFU);               //  To the end of this page
+    if (segment > num_bytes)
     {
-      //
-      //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-      //
-      if ((src_addr >= HP85A_16K_RAM_module_base_addr) && (src_addr < IO_ADDR))
+      segment = num_bytes;
+    }
+    page = &Page_Table[src_addr >> 8];
+    if (page->read_ptr)
+    {
+      AUXROM_DMA_Run(dest - run_length, run_addr, run_length, false);
+      run_length = 0;
+      memcpy(dest, &page->read_ptr[src_addr & 0xFFU], segment);
+    }
+    else
+    {
+      if (run_length == 0)
       {
-        *dest++ = HP85A_16K_RAM_module[src_addr++ & 0x3FFFU]; //  Got 85A EBTKS RAM, and address match
-        continue;
+        run_addr = src_addr;
       }
-      //  If we get here, got 85A EBTKS RAM, and address does not match, so must be built-in DRAM,
-      //  so just fall into that code
+      run_length += segment;
     }
-    //
-    //  built-in DRAM
-    //
-    *dest++ = DMA_Peek8(src_addr++);
+    dest      += segment;
+    src_addr   = (src_addr + segment) & 0x0000FFFFU;
+    num_bytes -= segment;
   }
+  AUXROM_DMA_Run(dest - run_length, run_addr, run_length, false);
 }
 
 //
-//  Store num_bytes into HP-85 memory. Made difficult because they might be in
-//  the built-in DRAM (access via DMA) or they might be in RAM that EBTKS
-//  supplies (but only for HP85A)
-//
-//  The efficient solution would be identify the three scenarios:
-//    all in built-in DRAM
-//    all in EBTKS memory
-//    mixed
-//  and then write block transfer for each
-//
-//  The expediant (and slower and less bug prone) is just transfer 1 byte at
-//  a time and do a test for each. Doing this for now.
-//  Actually, probably not that slow, since the overhead here is totally masked by the slow HP85 bus data rate
-//
-//  #################  does not handle ROMs that EBTKS provides
-//  #################  does not handle RAM window in EBTKS ROMs
+//  Store num_bytes into HP-85 memory. Split into runs like AUXROM_Fetch_Memory() . Only the 16K RAM module
+//  and the AUXROM RAM window are EBTKS memory that the HP85 can write, these get memcpy(). Everything else,
+//  including pages we only shadow, is written with block DMA, which also keeps the DRAM shadow up to date.
 //
 //  dest_addr is an HP85 memory address. source is a pointer into EBTKS memory
 //
 
 void AUXROM_Store_Memory(uint16_t dest_addr, char *source, uint16_t num_bytes)
 {
-  while (num_bytes--)
+  uint32_t    segment, run_addr = 0, run_length = 0;
+  struct S_Page_Descriptor  *page;
+
+  while (num_bytes)
   {
-    if (getHP85RamExp())
+    segment = 256 - (dest_addr & 0xFFU);
+    if (segment > num_bytes)
     {
-      //
-      //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-      //
-      if ((dest_addr >= HP85A_16K_RAM_module_base_addr) && (dest_addr < IO_ADDR))
+      segment = num_bytes;
+    }
+    page = &Page_Table[dest_addr >> 8];
+    if (page->flags & (PAGE_FLAG_RAM16K | PAGE_FLAG_AUXROM_WINDOW))
+    {
+      AUXROM_DMA_Run((uint8_t *)source - run_length, run_addr, run_length, true);
+      run_length = 0;
+      memcpy(&page->write_ptr[dest_addr & 0xFFU], source, segment);
+    }
+    else
+    {
+      if (run_length == 0)
       {
-        HP85A_16K_RAM_module[dest_addr++ - HP85A_16K_RAM_module_base_addr] = *source++; //  Got 85A EBTKS RAM, and address match
-        continue;
+        run_addr = dest_addr;
       }
-      //  If we get here, got 85A EBTKS RAM, and address does not match, so must be built-in DRAM,
-      //  so just fall into that code
+      run_length += segment;
     }
-    //
-    //  built-in DRAM
-    //
-    //Serial.printf("DestAddr %08X  SrcAddr %08X  byte %02X\n", dest_addr, source, *source);
-    DMA_Poke8((dest_addr++) & 0x0000FFFF, *source++);
+    source    += segment;
+    dest_addr += segment;                             //  uint16_t, so it wraps like the HP85 address
+    num_bytes -= segment;
   }
+  AUXROM_DMA_Run((uint8_t *)source - run_length, run_addr, run_length, true);
 }
 
 //
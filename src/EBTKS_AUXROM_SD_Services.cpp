@@ -24,6 +24,8 @@
 //  10/23/2020        SDMOUNT total re-write to support Tape and Disk
 //  10/24/2020        Update SDREAD and SDWRITE to match AUXROM Release 11
 //                    UNMOUNT
+//  11/07/2020        BUSSTAT$
+//  11/23/2020        HELP restores the screen with a background DMA job
 //
 
 /////////////////////On error message / error codes.  Go see email log for this text in context
@@ -49,6 +51,7 @@
 //                                          310       Can't open /AUXROM_FLAGS.TXT
 //                                          311       Can't write /AUXROM_FLAGS.TXT
 //        320..329      AUXROM_HELP
+//                                          320       Screen restore already running
 //        330..339      AUXROM_SDCAT
 //                                          330       Can't resolve path                  Used by multiple functions when Resolve_Path() fails
 //                                          331       Can't list directory
@@ -250,6 +253,19 @@ char HelpScreen[]="\
 //              1 = Save screen state
 //
 
+//  The restore is a background DMA job, so the HP85 is kept waiting on the mailbox until AUXROM_HELP_Restored()
+//
+
+static uint8_t    *HELP_Mailbox;
+static uint16_t   *HELP_Usage;
+
+static void AUXROM_HELP_Restored(struct S_DMA_Job *job)
+{
+  Serial.printf("HELP 0 done.\n");
+  *HELP_Usage = (job->state == DMA_JOB_DONE) ? 0 : 1;
+  *HELP_Mailbox = 0;      //  Indicate we are done
+}
+
 void AUXROM_HELP(void)
 {
   if(AUXROM_RAM_Window.as_struct.AR_Opts[0])
@@ -259,7 +275,16 @@ void AUXROM_HELP(void)
   }
   else
   {
-    CRT_restore_screen();
+    HELP_Mailbox = p_mailbox;
+    HELP_Usage   = p_usage;
+    if (CRT_restore_screen_start(AUXROM_HELP_Restored))
+    {
+      AUXROM_Mailbox_Deferred = true;
+      return;
+    }
+    post_custom_error_message("Screen restore already running", 320);
+    *p_mailbox = 0;
+    return;
   }
   Serial.printf("HELP %d done.\n", AUXROM_RAM_Window.as_struct.AR_Opts[0]);
   *p_usage = 0;           //  Success
@@ -1804,6 +1829,18 @@ void AUXROM_SDCOPY(void)
   
 }
 
+//
+//  BUSSTAT$  returns the bus utilization rates from the last second, as a comma separated list
+//  See Bus_Stats_Format() in EBTKS_Bus_Stats.cpp for the order
+//
+
+void AUXROM_BUSSTAT(void)
+{
+  *p_len = Bus_Stats_Format(p_buffer, 256);
+  *p_usage = 0;                        //  Indicate Success
+  *p_mailbox = 0;                      //  Release mailbox.    Must always be the last thing we do
+}
+
 
 
 
@@ -1,6 +1,8 @@
 //
 //	    06/27/2020	These Function were moved from EBTKS.cpp to here.
 //      07/29/2020  Add support for the special RAM window in the AUXROM(s)
+//      11/02/2020  Replace readBankRom() with the ROM pages of the page descriptor table
+//      11/17/2020  Point the ROM pages at the heatmap counters for the selected bank
 //
 
 #include <Arduino.h>
@@ -15,10 +17,17 @@ DMAMEM uint8_t roms[MAX_ROMS][ROM_PAGE_SIZE];    //  Array to store the rom imag
 uint8_t *romMap[256];                  //  Hold the pointers to the rom data based on ID as the index
 
 
+//
+//  Rebuilding the 32 ROM pages of Page_Table[] takes too long for the Phi 1 write path, so just
+//  flag it here. onPhi_2_Rise() rebuilds them before the next read, and no write to the ROM
+//  area (the AUXROM RAM window) can happen before then either.
+//
+
 void ioWriteRSELEC(uint8_t val)                  //  This function is running within an ISR, keep it short and fast.
 {
   rselec = val;
   currRom = romMap[val];
+  Rom_Page_Table_Stale = true;
 }
 
 void initRoms(void)
@@ -36,6 +45,8 @@ uint8_t getRselec(void)
 void setRomMap(uint8_t romId,uint8_t slotNum)
 {
   romMap[romId] = &roms[slotNum][0];
+  currRom = romMap[rselec];                       //  In case we just loaded the currently selected ROM
+  Rom_Page_Table_Stale = true;
 }
 
 uint8_t * getROMEntry(uint8_t romId)
@@ -49,31 +60,46 @@ uint8_t *getRomSlotPtr(int slotNum)
 }
 
 
-bool readBankRom(uint16_t addr)                   //  This function is running within an ISR, keep it short and fast.
-{                                                 //  addr is in the range 000000 .. 017777
-  //
-  //  Check for the special RAM window in the AUXROMs
-  //
+//
+//  Fill in the Page_Table[] entries for the bank switched ROM area 060000..077777 based on the
+//  currently selected ROM. Called from onPhi_2_Rise() after RSELEC has been written, and from
+//  buildPageTable(). This function may be running within an ISR, keep it short and fast.
+//
+//  If one of the AUXROMs is selected, the pages of the shared RAM window at 070000..075777
+//  (AUXROM_RAM_WINDOW_START relative to ROM_PAGE) are both read and written by the HP85.
+//  Everything else in the ROM area is read only, and only if we have the selected ROM.
+//
 
-  if ((rselec >= AUXROM_PRIMARY_ID) && (rselec <= AUXROM_SECONDARY_ID_END))      //  Testing for Primary AUXROM and all secondaries
+void buildRomPageTable(void)
+{
+  bool      auxrom_selected;
+  uint32_t  offset;
+  struct S_Page_Descriptor *page;
+#if ENABLE_HEATMAP
+  uint32_t  *heat = Heatmap_ROM_Counters(rselec);                 //  32 counters, one per page
+#endif
+
+  Rom_Page_Table_Stale = false;
+  auxrom_selected = (rselec >= AUXROM_PRIMARY_ID) && (rselec <= AUXROM_SECONDARY_ID_END);      //  Testing for Primary AUXROM and all secondaries
+
+  page = &Page_Table[ROM_PAGE >> 8];
+  for (offset = 0 ; offset < ROM_PAGE_SIZE ; offset += 256 , page++)
   {
-    if ((addr >= AUXROM_RAM_WINDOW_START) && (addr <= AUXROM_RAM_WINDOW_LAST))   //  Read AUXROM shared RAM window
+    if (auxrom_selected && (offset >= AUXROM_RAM_WINDOW_START) && (offset <= AUXROM_RAM_WINDOW_LAST))
     {
-      readData = AUXROM_RAM_Window.as_bytes[addr - AUXROM_RAM_WINDOW_START];
-      return true;
+      page->read_ptr  = &AUXROM_RAM_Window.as_bytes[offset - AUXROM_RAM_WINDOW_START];
+      page->write_ptr = page->read_ptr;
+      page->flags     = PAGE_FLAG_ROM | PAGE_FLAG_AUXROM_WINDOW;
     }
+    else
+    {
+      page->read_ptr  = currRom ? &currRom[offset] : NULL;       //  Normal ROM read for all normal ROMs, and the remainder of the AUXROM(s)
+      page->write_ptr = NULL;
+      page->flags     = PAGE_FLAG_ROM;
+    }
+#if ENABLE_HEATMAP
+    page->heat_ptr = &heat[offset >> 8];
+#endif
   }
-
-  //
-  //  Normal ROM read for all normal ROMs, and the remainder of the AUXROM(s)
-  //
-
-  if (currRom)
-  {
-    readData = currRom[addr];
-    return true;
-  }
-  return false;
 }
 
-
@@ -19,6 +19,27 @@
 //
 //      10/05/2020      First attempt ot trace DMA with the logic analyzer
 //
+//      11/02/2020      Replace the if-chain address decode in onReadData() and onWriteData() with
+//                      the page descriptor table Page_Table[]
+//      11/03/2020      Bus cycle decode in onPhi_2_Rise() is now a table lookup, see Bus_Cycle_Decode_Table[]
+//      11/04/2020      Optional ISR_PROFILE_START/END stamps for the ISR cycle budget profiler
+//      11/05/2020      I/O write handlers can be registered as deferred, see setIOWriteFunc()
+//      11/06/2020      Optional DRAM shadow pages in buildPageTable()
+//      11/07/2020      Bus utilization counters, see BUS_STATS_COUNT()
+//      11/08/2020      Decimated IFETCH sampling for the PC profiler
+//      11/09/2020      Address watchpoints, see Watch_Page_Slot[]
+//      11/10/2020      ISR profile of onPhi_1_Rise() and onPhi_2_Rise() by bus cycle type
+//      11/12/2020      Optional delta compressed Logic Analyzer capture
+//      11/13/2020      Multi-stage Logic Analyzer trigger, see EBTKS_LA_Trigger.cpp
+//      11/15/2020      Bus flight recorder, see EBTKS_Flight_Recorder.cpp
+//      11/16/2020      Logic Analyzer sample store moved to Logic_Analyzer_Capture(), so DMA can use it too
+//      11/17/2020      Per page read counters for the ROM bank and page heatmap, see EBTKS_Heatmap.cpp
+//      11/18/2020      IFETCH is recorded in Logic_Analyzer_main_sample, for the trace decoder in EBTKS_LA_Decode.cpp
+//      11/19/2020      Interrupt latency stamps, see EBTKS_Interrupt_Latency.cpp
+//      11/20/2020      DMA grant time stamp for the event trace, see EBTKS_Event_Trace.cpp
+//      11/26/2020      buildPageTable() builds into a scratch table and copies it over an entry at a time, with
+//                      interrupts off for each entry, so the ISR never sees a page cleared that is being rebuilt
+//
 
 //
 //  HP85 bus emulation
@@ -51,10 +72,38 @@
 
 ioReadFuncPtr_t ioReadFuncs[256];      //ensure the setup() code initialises this!
 ioWriteFuncPtr_t ioWriteFuncs[256];
+bool ioWriteDeferred[256];              //  If true, onWriteData() queues the write and the handler runs in the background
 
 volatile bool intEn_1MB5 = false;
 int intrState = 0;
 
+//
+//  Bus cycle decode table for onPhi_2_Rise(). The index is the 3 control bits /WR /RD /LMA exactly as
+//  they are in the GPIO register (shifted down to bits 2..0), plus the decode state carried over from
+//  the prior cycle: schedule_address_load in bit 3 and delayed_lma in bit 4. Each entry supplies
+//  every schedule flag for this cycle and the decode state for the next cycle, so the decode has
+//  no branches.
+//
+
+#define BUS_DECODE_SAL                (0x08)      //  Index bit for schedule_address_load from the prior cycle
+#define BUS_DECODE_DLMA               (0x10)      //  Index bit for delayed_lma from the prior cycle
+#define BUS_DECODE_TABLE_SIZE         (32)
+
+struct S_Bus_Cycle_Decode
+{
+  uint8_t   next_state;                           //  BUS_DECODE_SAL and BUS_DECODE_DLMA for the next cycle
+  bool      schedule_read;
+  bool      schedule_write;
+  bool      increment_allowed;                    //  schedule_address_increment, except for the I/O space test which needs addReg
+  bool      schedule_address_load;
+  bool      delayed_lma;
+  bool      DMA_Acknowledge;
+  bool      Interrupt_Acknowledge;
+};
+
+static struct S_Bus_Cycle_Decode Bus_Cycle_Decode_Table[BUS_DECODE_TABLE_SIZE];
+static uint8_t bus_decode_state = 0;              //  Matches schedule_address_load and delayed_lma both false at power up
+
 bool ioReadNullFunc(void) //  This function is running within an ISR, keep it short and fast.
 {
   return false;
@@ -89,10 +138,50 @@ for (int a = 0; a < 256; a++)
   {
     ioReadFuncs[a] = &ioReadNullFunc; //default all
     ioWriteFuncs[a] = &ioWriteNullFunc;
+    ioWriteDeferred[a] = false;
   }
 
 setIOWriteFunc(0x40,&onWriteInterrupt); //177500 1MB5 INTEN
 setIOWriteFunc(0, &onWriteGIE);         //global interrupt enable
+
+buildPageTable();
+initBusCycleDecodeTable();
+}
+
+//
+//  Fill in Bus_Cycle_Decode_Table[] by evaluating Russell's boolean equations (the ones that used
+//  to be in onPhi_2_Rise()) for all 32 combinations of control bits and prior decode state. Since
+//  the table is generated from the original logic, it is equivalent to it by construction.
+//
+
+void initBusCycleDecodeTable(void)
+{
+  uint32_t    index;
+  bool        lma, rd, wr;
+  bool        prior_schedule_address_load, prior_delayed_lma;
+  struct S_Bus_Cycle_Decode *entry;
+
+  for (index = 0 ; index < BUS_DECODE_TABLE_SIZE ; index++)
+  {
+    entry = &Bus_Cycle_Decode_Table[index];
+
+    lma = !(index & (BIT_MASK_LMA >> BIT_POSITION_LMA));              //  Invert the bits so they are active high
+    rd  = !(index & (BIT_MASK_RD  >> BIT_POSITION_LMA));
+    wr  = !(index & (BIT_MASK_WR  >> BIT_POSITION_LMA));
+    prior_schedule_address_load = index & BUS_DECODE_SAL;
+    prior_delayed_lma           = index & BUS_DECODE_DLMA;
+
+    entry->schedule_read          = rd && !wr;
+    entry->schedule_write         = wr && !rd;
+    entry->increment_allowed      = !(!prior_schedule_address_load & prior_delayed_lma) &&
+                                    (entry->schedule_read | entry->schedule_write);
+    entry->schedule_address_load  = !prior_schedule_address_load && prior_delayed_lma;
+    entry->delayed_lma            = lma;
+    entry->DMA_Acknowledge        = wr && rd && !lma;
+    entry->Interrupt_Acknowledge  = wr && rd && lma;
+    entry->next_state             = (entry->schedule_address_load ? BUS_DECODE_SAL  : 0) |
+                                    (entry->delayed_lma           ? BUS_DECODE_DLMA : 0);
+  }
 }
 
 void removeIOReadFunc(uint8_t addr)
@@ -103,6 +192,7 @@ void removeIOReadFunc(uint8_t addr)
 void removeIOWriteFunc(uint8_t addr)
 {
   ioWriteFuncs[addr] = &ioWriteNullFunc;
+  ioWriteDeferred[addr] = false;
 }
 
 void setIOReadFunc(uint8_t addr,ioReadFuncPtr_t readFuncP)
@@ -110,9 +200,18 @@ void setIOReadFunc(uint8_t addr,ioReadFuncPtr_t readFuncP)
   ioReadFuncs[addr] = readFuncP;
 }
 
-void setIOWriteFunc(uint8_t addr,ioWriteFuncPtr_t writeFuncP)
+//
+//  If deferred is true, the ISR only captures the address and data (see Deferred_IO_Write_Push() ) and the
+//  handler is called later from the background by ISR_Event_Poll(). Only use this for registers where
+//  nothing the HP85 does on the next bus cycle depends on the handler having run, such as the CRT mirror
+//  registers that we only snoop. Deferred handlers are not running within an ISR.
+//
+
+void setIOWriteFunc(uint8_t addr,ioWriteFuncPtr_t writeFuncP, bool deferred)
 {
+  ioWriteDeferred[addr] = false;                  //  Don't let the ISR see a new handler with the old deferred setting
   ioWriteFuncs[addr] = writeFuncP;
+  ioWriteDeferred[addr] = deferred;
 }
 
 bool enRam16k = false;
@@ -120,12 +219,87 @@ bool enRam16k = false;
 void enHP85RamExp(bool en)
 {
   enRam16k = en;
+  buildPageTable();
 }
 
 bool getHP85RamExp(void)      //  Report true if HP85A RAM expansion is enabled
 {
   return enRam16k;
 }
+
+//
+//  Rebuild the whole page descriptor table from the current configuration:
+//    Bank switched ROM pages 060000..077777 (including the AUXROM RAM window), see buildRomPageTable()
+//    HP85A 16K RAM module pages 0140000..0177377 if enabled
+//    Built-in DRAM pages, write only, if the DRAM shadow is enabled (see EBTKS_DRAM_Shadow.cpp)
+//    I/O page 0177400..0177777, dispatched through ioReadFuncs[] and ioWriteFuncs[]
+//  All other pages belong to the HP85, and EBTKS ignores them.
+//
+//  Called when the 16K RAM enable changes, with the ISR running. RSELEC and ROM map changes only rebuild the ROM
+//  pages, and the DRAM shadow switches its own pages in place (see DRAM_Shadow_Enable() ).
+//
+//  The new table is built in Page_Table_Scratch[], then each entry is copied with interrupts off, so every page
+//  goes straight from its old setting to its new one. The ROM pages are built in place by buildRomPageTable() ,
+//  also with interrupts off, so it can't race the ISR's own call when Rom_Page_Table_Stale is set. heat_ptr is
+//  never cleared, and Heatmap_Bind_Pages() rebinds it afterwards.
+//
+
+static struct S_Page_Descriptor Page_Table_Scratch[256];
+
+void buildPageTable(void)
+{
+  uint32_t    page;
+  struct S_Page_Descriptor  *scratch;
+
+  for (page = 0 ; page < 256 ; page++)
+  {
+    Page_Table_Scratch[page].read_ptr  = NULL;
+    Page_Table_Scratch[page].write_ptr = NULL;
+    Page_Table_Scratch[page].flags     = 0;
+  }
+
+  if (enRam16k)
+  {
+    for (page = (HP85A_16K_RAM_module_base_addr >> 8) ; page < (IO_ADDR >> 8) ; page++)
+    {
+      Page_Table_Scratch[page].read_ptr  = &HP85A_16K_RAM_module[(page << 8) & 0x3FFFU];
+      Page_Table_Scratch[page].write_ptr = Page_Table_Scratch[page].read_ptr;
+      Page_Table_Scratch[page].flags     = PAGE_FLAG_RAM16K;
+    }
+  }
+
+  for (page = (DRAM_SHADOW_BASE_ADDR >> 8) ; page < (IO_ADDR >> 8) ; page++)
+  {
+    if (!Page_Table_Scratch[page].write_ptr && (Page_Table_Scratch[page].write_ptr = getDRAMShadowPage(page)))
+    {
+      Page_Table_Scratch[page].flags     = PAGE_FLAG_DRAM_SHADOW;     //  read_ptr stays NULL, we only listen
+    }
+  }
+
+  Page_Table_Scratch[IO_ADDR >> 8].flags = PAGE_FLAG_IO;
+
+  for (page = 0 ; page < 256 ; page++)
+  {
+    if ((page >= (ROM_PAGE >> 8)) && (page < ((ROM_PAGE + ROM_PAGE_SIZE) >> 8)))
+    {
+      continue;                                                   //  Left to buildRomPageTable()
+    }
+    scratch = &Page_Table_Scratch[page];
+    __disable_irq();
+    Page_Table[page].read_ptr  = scratch->read_ptr;
+    Page_Table[page].write_ptr = scratch->write_ptr;
+    Page_Table[page].flags     = scratch->flags;
+    __enable_irq();
+  }
+
+#if ENABLE_HEATMAP
+  Heatmap_Bind_Pages();
+#endif
+
+  __disable_irq();
+  buildRomPageTable();
+  __enable_irq();
+}
 //
 //  EBTKS has only 2 interrupts, one for Phi 1 rising edge, and one for Phi 2 rising edge
 //  Both interupts come here to be serviced. They are mutually exclusive.
@@ -145,7 +319,9 @@ FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short
 
   if (interrupts & BIT_MASK_PHASE1)     //  Phi 1
   {
+    ISR_PROFILE_START(phi_1_stamp);
     onPhi_1_Rise();               //                                                                                           Need to document Max Duration
+    ISR_PROFILE_END_BY_TYPE(phi_1_stamp, ISR_PROFILE_SLOT_PHI_1_RISE, ISR_PROFILE_SLOT_PHI_1_BY_TYPE);    //  Use "isr prof" to see it
     WAIT_WHILE_PHI_1_HIGH;        //  While Phi_1 is high, just hang around, not worth doing a return from interrupt
                                   //  and then having an interrupt on the falling edge.
                                   //
@@ -157,7 +333,9 @@ FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short
   }
   else                            //  Sneaky because we only have two possible interrupts, so must be Phi 2 Rising
   {
+    ISR_PROFILE_START(phi_2_stamp);
     onPhi_2_Rise();
+    ISR_PROFILE_END_BY_TYPE(phi_2_stamp, ISR_PROFILE_SLOT_PHI_2_RISE, ISR_PROFILE_SLOT_PHI_2_BY_TYPE);
   }
   TOGGLE_RXD;                     //  Mark the end of all ISR
 }
@@ -202,7 +380,8 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
 //
 //  Logic_Analyzer_main_sample layout is:
 //  Bits          Content
-//  31 .. 28      Currently always 0000
+//  31 .. 29      Currently always 000
+//  28            IFETCH  recorded at the prior Phi 2, set for an opcode fetch (LA_SAMPLE_IFETCH)
 //  27            Set if this was a DMA cycle
 //  26            /WRX    recorded at the prior Phi 2
 //  25            /RDX    recorded at the prior Phi 2
@@ -226,43 +405,27 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
                                                                               //  uses the falling edge.
   Logic_Analyzer_aux_sample  =  getRselec() & 0x000000FF;                     //  Get the Bank switched ROM select code
 
+  ISR_PROFILE_START(la_stamp);
   if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
   {
-    //
-    //  Check for trigger pattern
-    //      Don't look for trigger if the pre-trigger number of samples has not yet occured
-    //      Don't look for trigger if we have already triggered
-    //  Once triggered, count down till we have collected al post-trigger samples
-    //
+    Logic_Analyzer_Capture();                                                 //  Trigger check and sample store, see EBTKS_Logic_Analyzer.h
+  }
+  ISR_PROFILE_END(la_stamp, ISR_PROFILE_SLOT_LOGIC_ANALYZER);
 
-    if (!Logic_Analyzer_Triggered)
-    {
-      if (Logic_Analyzer_Valid_Samples >= Logic_Analyzer_Pre_Trigger_Samples)
-      { //  Triggering is allowed
-        if (   ((Logic_Analyzer_main_sample & Logic_Analyzer_Trigger_Mask_1) == Logic_Analyzer_Trigger_Value_1) &&
-              ((Logic_Analyzer_aux_sample  & Logic_Analyzer_Trigger_Mask_2) == Logic_Analyzer_Trigger_Value_2)    )
-        {   //  Trigger pattern has been matched
-          if (--Logic_Analyzer_Event_Count <= 0)                             //  Event Count is how many match events needed to trigger
-          {
-            Logic_Analyzer_Triggered = true;
-            Logic_Analyzer_Index_of_Trigger = Logic_Analyzer_Data_index;   //  Record the buffer index at time of trigger
-          }
-        }
-      }
-    }
-    Logic_Analyzer_Data_1[Logic_Analyzer_Data_index  ] = Logic_Analyzer_main_sample;
-    Logic_Analyzer_Data_2[Logic_Analyzer_Data_index++] = Logic_Analyzer_aux_sample;
+#if ENABLE_WATCHPOINTS
+  uint32_t watch_slot = Watch_Page_Slot[addReg >> 8];
+  if (watch_slot)
+  {                                     //  Some watchpoint covers this page, see if it covers this address and access type
+    Watchpoint_Check(addReg, data_from_IO_bus, watch_slot);
+  }
+#endif
 
-    Logic_Analyzer_Data_index &= Logic_Analyzer_Current_Index_Mask;           //  Modulo addressing of sample buffer. Requires buffer length to be a power of two
-    Logic_Analyzer_Valid_Samples++;                                           //  This could theoretically over flow if we didn't see a trigger in 7000 seconds (1.9 hours). Saturating is not worth the overhead
-    if (Logic_Analyzer_Triggered)
-    {
-      if (--Logic_Analyzer_Samples_Till_Done == 0)
-      {
-        Logic_Analyzer_State = ANALYZER_ACQUISITION_DONE;
-      }
-    }
+#if ENABLE_FLIGHT_RECORDER
+  if (Flight_Recorder_Active)
+  {
+    Flight_Recorder_Sample();
   }
+#endif
 
 //
 //  If this is a Write cycle to EBTKS, this is where it is handled
@@ -297,72 +460,59 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
 
 inline void onPhi_2_Rise(void)                             //  This function is running within an ISR, keep it short and fast.
 {
-  bool       lma;
-  bool       rd;
-  bool       wr;
   uint32_t   dataBus;
   uint32_t   bus_cycle_info;                              //  Bits 26 down to 24 will be /WR , /RD , /24 in that order
+  const struct S_Bus_Cycle_Decode *decode;
 
 //
-//  This is Russell's code with some minor edits.
+//  This was Russell's code, and is now a lookup in Bus_Cycle_Decode_Table[] which is generated
+//  from his equations by initBusCycleDecodeTable(). It replaces Philip's enum version which
+//  didn't work on rare occasions.
 //
 
   bus_cycle_info = GPIO_PAD_STATUS_REG_LMA;               //  All 3 control bits are in the same GPIO register
-  lma = !(bus_cycle_info & BIT_MASK_LMA);                 //  Invert the bits so they are active high
-  rd  = !(bus_cycle_info & BIT_MASK_RD );
-  wr  = !(bus_cycle_info & BIT_MASK_WR );
+  decode = &Bus_Cycle_Decode_Table[bus_decode_state | ((bus_cycle_info >> BIT_POSITION_LMA) & 0x07)];
+  BUS_STATS_COUNT((bus_cycle_info >> BIT_POSITION_LMA) & 0x07);   //  One counter per control line state, see BUS_STATS_INT_ACK etc.
 
   //  Resolve control logic states
 
-  schedule_read  = rd && !wr;
-  schedule_write = wr && !rd;
-  schedule_address_increment = ((addReg >> 8) != 0xff) &&
-                                !(!schedule_address_load & delayed_lma) &&
-                                (schedule_read | schedule_write);         //  Only increment addr on a non i/o address
-  schedule_address_load = !schedule_address_load && delayed_lma;          //  Load address reg flag
-  delayed_lma = lma;                                                      //  Delayed lma
-  DMA_Acknowledge = wr && rd && !lma;                                     //  Decode DMA acknowlege state
-  Interrupt_Acknowledge = wr && rd && lma;                                //  Decode interrupt acknowlege state
-
-  Logic_Analyzer_current_bus_cycle_state_LA = bus_cycle_info  &           //  Yes, this is supposed to be a single &
-                                              (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA);      //  Require bus cycle state to be in bits 24, 25, and 26 of GPIO register
-
-//
-//  This is Philip's much nicer version of above that uses enums, and doesn't work on rare occasions.
-//
-//////enum bus_cycle_type{
-//////        BUS_INTACK    = 0,
-//////        BUS_DMA_GRANT = 1,
-//////        BUS_ADDR_WR   = 2,    //  Should never happen
-//////        BUS_WR        = 3,
-//////        BUS_ADDR_RD   = 4,    //  While reading from somewhere, also load value into address register
-//////        BUS_RD        = 5,
-//////        BUS_ADDR      = 6,
-//////        BUS_NOP       = 7
-//////      };
-//////
-//////
-//////  previous_bus_cycle_state   = current_bus_cycle_state;         //  Save what the prior bus cycle was. Used in handling high byte/low byte  of dual /LMA address transfers
-//////
-//////  Logic_Analyzer_current_bus_cycle_state_LA = GPIO_PAD_STATUS_REG_LMA &         //  Yes, this is supposed to be a single &
-//////                               (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA);      //  Require bus cycle state to be in bits 24, 25, and 26 of GPIO register
-//////
-//////  current_bus_cycle_state    = (enum bus_cycle_type)(Logic_Analyzer_current_bus_cycle_state_LA >> 24);            //  Make it ready to be used in enum comaprisons
-//////
-//////  schedule_read              = ((current_bus_cycle_state == BUS_RD) || (current_bus_cycle_state == BUS_ADDR_RD));
-//////  schedule_write             = (current_bus_cycle_state == BUS_WR);
-//////  schedule_address_increment = ((addReg >> 8) != 0x00FFU) &&                    //  If not I/O space
-//////                               !(!schedule_address_load & delayed_lma) &&       //    and
-//////                               (schedule_read ||  schedule_write);              //  Any bus read or write
-//////  schedule_address_load      = !schedule_address_load && delayed_lma;
-//////  delayed_lma                = (current_bus_cycle_state == BUS_ADDR) || (current_bus_cycle_state == BUS_ADDR_RD) || (current_bus_cycle_state == BUS_INTACK);
-//////  DMA_Acknowledge            = (current_bus_cycle_state == BUS_DMA_GRANT);
-//////  Interrupt_Acknowledge      = (current_bus_cycle_state == BUS_INTACK);
-//////
+  bus_decode_state           = decode->next_state;
+  schedule_read              = decode->schedule_read;
+  schedule_write             = decode->schedule_write;
+  schedule_address_increment = decode->increment_allowed & ((addReg >> 8) != 0xff);     //  Only increment addr on a non i/o address
+  schedule_address_load      = decode->schedule_address_load;                             //  Load address reg flag
+  delayed_lma                = decode->delayed_lma;                                       //  Delayed lma
+  DMA_Acknowledge            = decode->DMA_Acknowledge;                                   //  Decode DMA acknowlege state
+  Interrupt_Acknowledge      = decode->Interrupt_Acknowledge;                             //  Decode interrupt acknowlege state
+
+  Logic_Analyzer_current_bus_cycle_state_LA = (bus_cycle_info  &         //  Yes, this is supposed to be a single &
+                                              (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA)) |    //  Require bus cycle state to be in bits 24, 25, and 26 of GPIO register
+                                              (IS_IFETCH_ACTIVE ? LA_SAMPLE_IFETCH : 0);       //  Opcode fetch, for "la decode"
+
+  if (Rom_Page_Table_Stale)
+  {           //  RSELEC has been written since the last Phi 2 (or the ROM map changed). Must be done before any read or write of the ROM area
+    buildRomPageTable();
+  }
 
   if (schedule_read)
   {           //  Test if address is in our range and if it is , return true and set readData to the data to be sent to the bus
     HP85_Read_Us = onReadData(addReg);
+#if ENABLE_PC_PROFILER
+    if (PC_Profile_Active && IS_IFETCH_ACTIVE)
+    {         //  Opcode fetch, so addReg is the PC. Only every PC_PROFILE_DECIMATION th one is recorded
+      if (--PC_Profile_Countdown == 0)
+      {
+        PC_Profile_Countdown = PC_PROFILE_DECIMATION;
+        PC_Profile_Sample(addReg);
+      }
+    }
+#endif
+#if ENABLE_WATCHPOINTS
+    if (Watch_Page_Slot[addReg >> 8])
+    {         //  The data isn't on the bus till Phi 1, where the watchpoint check is, but IFETCH is sampled now
+      Watch_Fetch_Cycle = IS_IFETCH_ACTIVE;
+    }
+#endif
   }
 
 //  if (HP85_Read_Us && just_once)
@@ -387,6 +537,9 @@ inline void onPhi_2_Rise(void)                             //  This function is
       {
         intrState = 1; //interrupt was requested
         ASSERT_INT; //IRL low synchronous to phi2 rise - max 500ns to fall
+#if ENABLE_INTERRUPT_LATENCY
+        Interrupt_Latency_IRL();
+#endif
       }  
       break;
 
@@ -400,12 +553,18 @@ inline void onPhi_2_Rise(void)                             //  This function is
           HP85_Read_Us = true; 
           interruptReq = false; //clear request
           intrState = 0;
+#if ENABLE_INTERRUPT_LATENCY
+          Interrupt_Latency_Handoff();
+#endif
         }
       if ((Interrupt_Acknowledge) && (IS_IPRIH_IN_LO)) //higher priority request beat us
         {
           RELEASE_INT;  //let go of /IRL as we lost
           RELEASE_INTPRI;
           intrState = 0; //try for another request
+#if ENABLE_INTERRUPT_LATENCY
+          Interrupt_Latency_Lost();
+#endif
         }
       break;
   }
@@ -419,6 +578,7 @@ inline void onPhi_2_Rise(void)                             //  This function is
 
   if (HP85_Read_Us)
   {
+    BUS_STATS_COUNT(BUS_STATS_READ_US);
 
     //
     //  This is diagnostic code to see if 1MA8 has let go of bus by the time we get here.
@@ -474,6 +634,7 @@ inline void onPhi_2_Rise(void)                             //  This function is
   if (DMA_Acknowledge && DMA_has_been_Requested)
   {
     DMA_has_been_Requested = false;       //  Bus DMA request is no longer pending
+    BUS_STATS_COUNT(BUS_STATS_DMA_GRANT);
     //
     //  Although we are in an interrupt handler, we are about to turn interrupts off
     //  (for the Phi 1 and 2 pin interrupts), so we can spend extra time here to get
@@ -543,6 +704,9 @@ inline void onPhi_2_Rise(void)                             //  This function is
 
     DMA_Acknowledge = false;
     DMA_Active = true;
+#if ENABLE_EVENT_TRACE
+    DMA_Grant_Cycles = ARM_DWT_CYCCNT;
+#endif
 
   //
   //  We now own the bus, the 3 control lines are high, HALT is still asserted, and interrupts are off, we are driving
@@ -573,6 +737,9 @@ inline void onPhi_2_Rise(void)                             //  This function is
 //    Any SpecialRAM that we are implementing within the AUXROMs
 //    Any I/O registers that we are implementing
 //
+//  All of the above are described by Page_Table[], so this is one indexed load, and then
+//  either a memory read or a call to an I/O read handler
+//
 //  While this is an interrupt routine that is providing data back to the HP-85
 //  processor, we entered this routine from the rising edge interrupt for Phi 2
 //  The data we are going to put on the bus won't be looked at till Phi 1, which
@@ -583,41 +750,42 @@ inline void onPhi_2_Rise(void)                             //  This function is
 inline bool onReadData(uint16_t Current_Read_Address)                  //  This function is running within an ISR, keep it short and fast.
 {
   //
-  //  If any of these tests indicate that we need to supply data
+  //  If the page descriptor indicates that we need to supply data
   //    Put the data in readData
   //    return true
   //  else
   //    return false
   //
+  const struct S_Page_Descriptor *page = &Page_Table[Current_Read_Address >> 8];
+  ISR_PROFILE_START(read_stamp);
 
-  if ((Current_Read_Address & 0xE000) == ROM_PAGE) // ROM page 0x6000..0x7FFF   (8 KB)
+  if (page->read_ptr)
   {
-    return readBankRom(Current_Read_Address & (ROM_PAGE_SIZE - 1));     //  Knock off some MSBs so we address the ROM from Current_Read_Address 0
-                                                        //  This function knows about the AUXROM RAM Window, and handles these reads as well
-  }
-
-  if (enRam16k)
-  {
-    //
-    //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-    //
-    if ((Current_Read_Address >= HP85A_16K_RAM_module_base_addr) && (Current_Read_Address < IO_ADDR))
-    {
-      readData = HP85A_16K_RAM_module[Current_Read_Address & 0x3FFF];
-      return true;
-    }
+    readData = page->read_ptr[Current_Read_Address & 0x00FFU];      //  ROM, AUXROM RAM window, or 16K RAM
+#if ENABLE_HEATMAP
+    (*page->heat_ptr)++;                                            //  Points at a discard counter if the heatmap is off
+#endif
+    ISR_PROFILE_END(read_stamp, ISR_PROFILE_SLOT_MEMORY_READ);
+    return true;
   }
 
   //
   //  Process I/O reads (data from I/O bus to the CPU)
   //
-  if ((Current_Read_Address & 0xFF00U) == 0xFF00U)
+  if (page->flags & PAGE_FLAG_IO)
   {
+    BUS_STATS_COUNT(BUS_STATS_IO_READ);
+#if ENABLE_ISR_PROFILER
+    bool io_read_result = (ioReadFuncs[Current_Read_Address & 0x00FFU])();
+    ISR_PROFILE_END(read_stamp, ISR_PROFILE_SLOT_IO_READ + (Current_Read_Address & 0x00FFU));
+    return io_read_result;
+#else
     return (ioReadFuncs[Current_Read_Address & 0x00FFU])();  // Call I/O read handler
+#endif
   }
 
   //
-  //  If we get here, none of the checked address ranges matche the current Read Address
+  //  If we get here, the current Read Address is not one of ours
   //
 
   return false;
@@ -628,52 +796,44 @@ inline bool onReadData(uint16_t Current_Read_Address)                  //  This
 //
 //    Note: By the time we get to this routine, the bus has already been captured.
 //
-//    Any ROM that we are emulating
 //    Any RAM that we are emulating
 //    Any SpecialRAM that we are implementing within the AUXROMs
 //    Any I/O registers that we are implementing
 //    Any I/O registers that we are tracking
 //
 //    Unlike the onReadData() function that is associated with Phi 2, and has rather relaxed timing,
-//    onWriteData() is associated with Phi 1, and the timing is quite tight
+//    onWriteData() is associated with Phi 1, and the timing is quite tight. Like onReadData()
+//    the decode is a single indexed load into Page_Table[]
 //
 
 
 inline void onWriteData(uint16_t addr, uint8_t data)
-{                                                                    
-  //
-  //  Process I/O writes
-  //
-  if ((addr & 0xFF00U) == 0xFF00U)
-  {
-    (ioWriteFuncs[addr & 0xFFU])(data);  //  Call an I/O write handler
-    return;
-  }
+{
+  const struct S_Page_Descriptor *page = &Page_Table[addr >> 8];
+  ISR_PROFILE_START(write_stamp);
 
-  if (enRam16k)
+  if (page->write_ptr)
   {
-    //
-    //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-    //
-
-    if ((addr >= HP85A_16K_RAM_module_base_addr) && (addr < IO_ADDR))
-    {
-      HP85A_16K_RAM_module[addr & 0x3FFFU] = data;
-      return;
-    }
+    page->write_ptr[addr & 0xFFU] = data;   //  16K RAM, or AUXROM RAM window
+    ISR_PROFILE_END(write_stamp, ISR_PROFILE_SLOT_MEMORY_WRITE);
+    return;
   }
 
   //
-  //  Handle special RAM window in the AUXROM(s)
+  //  Process I/O writes
   //
-
-  if ((getRselec() >= AUXROM_PRIMARY_ID) && (getRselec() <= AUXROM_SECONDARY_ID_END))      //  Testing for Primary AUXROM and all secondaries
+  if (page->flags & PAGE_FLAG_IO)
   {
-    if ((addr >= (AUXROM_RAM_WINDOW_START + 060000)) && (addr <= (AUXROM_RAM_WINDOW_LAST + 060000)))     //  Write AUXROM shared RAM window
+    BUS_STATS_COUNT(BUS_STATS_IO_WRITE);
+    if (ioWriteDeferred[addr & 0xFFU])
+    {
+      Deferred_IO_Write_Push(addr & 0xFFU, data);   //  Handler runs later in the background
+    }
+    else
     {
-      AUXROM_RAM_Window.as_bytes[addr - AUXROM_RAM_WINDOW_START - 060000] = data;
-      return;
+      (ioWriteFuncs[addr & 0xFFU])(data);     //  Call an I/O write handler
     }
+    ISR_PROFILE_END(write_stamp, ISR_PROFILE_SLOT_IO_WRITE + (addr & 0xFFU));
   }
 }
 
@@ -727,6 +887,23 @@ inline void onPhi_1_Fall(void)
   //  CLEAR_TXD;
 }
 
+#ifdef EBTKS_NATIVE
+//
+//  For the host tests in test/ , which check and time the address decode on its own. onReadData() and onWriteData()
+//  are inline, so there is nothing to call from another file
+//
+
+bool Native_onReadData(uint16_t addr)
+{
+  return onReadData(addr);
+}
+
+void Native_onWriteData(uint16_t addr, uint8_t data)
+{
+  onWriteData(addr, data);
+}
+#endif
+
 void setupPinChange(void)
 {
   __disable_irq();    //  This code is a critical region.
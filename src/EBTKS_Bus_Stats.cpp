@@ -0,0 +1,89 @@
+//
+//      11/07/2020      Bus utilization counters
+//
+//  onPhi_2_Rise() increments one of 8 counters for every bus cycle, selected by the /WR /RD /LMA
+//  control lines (the same 3 bits that are in Logic_Analyzer_main_sample), so the total of the 8 is the
+//  number of bus cycles. There are also counters for reads that EBTKS answered (HP85_Read_Us), I/O page
+//  reads and writes, and DMA grants. See BUS_STATS_INT_ACK etc. in EBTKS.h
+//
+//  The counters are free running and only written by the ISR. Bus_Stats_Poll() is called from loop()
+//  and once per second turns the differences into per second rates.
+//
+//  Serial command:   bus stats
+//  AUXROM:           Usage AUX_USAGE_BUSSTAT returns the rates as a string, see AUXROM_BUSSTAT()
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define BUS_STATS_INTERVAL_MS       (1000)
+
+static const char * Bus_Stats_Names[BUS_STATS_NUM] =
+{
+  "Interrupt Ack", "DMA Ack", "LMA + WR", "Write", "LMA + RD", "Read", "LMA", "Idle",
+  "Read by EBTKS", "I/O Read", "I/O Write", "DMA Grant"
+};
+
+static uint32_t   Bus_Stats_Previous[BUS_STATS_NUM];
+static uint32_t   Bus_Stats_Rates[BUS_STATS_NUM];           //  Per second, from the last complete interval
+static uint32_t   Bus_Stats_Cycle_Rate;                     //  Total bus cycles per second
+static uint32_t   Bus_Stats_Last_Poll_ms;
+
+void Bus_Stats_Poll(void)
+{
+  uint32_t    now, elapsed, index, current, total;
+
+  now = millis();
+  elapsed = now - Bus_Stats_Last_Poll_ms;
+  if (elapsed < BUS_STATS_INTERVAL_MS)
+  {
+    return;
+  }
+  Bus_Stats_Last_Poll_ms = now;
+
+  total = 0;
+  for (index = 0 ; index < BUS_STATS_NUM ; index++)
+  {
+    current = Bus_Stats_Counts[index];                      //  Each counter is read once, so a count during this loop is not lost
+    Bus_Stats_Rates[index] = (uint32_t)(((uint64_t)(current - Bus_Stats_Previous[index]) * 1000U) / elapsed);
+    Bus_Stats_Previous[index] = current;
+    if (index <= BUS_STATS_IDLE)
+    {
+      total += Bus_Stats_Rates[index];
+    }
+  }
+  Bus_Stats_Cycle_Rate = total;
+}
+
+void Bus_Stats_Report(void)
+{
+#if ENABLE_BUS_STATS
+  uint32_t    index;
+
+  Serial.printf("\nBus cycles per second: %lu  (nominal is 625000 at 1.6 us per cycle)\n", Bus_Stats_Cycle_Rate);
+  Serial.printf("Type               Per second   %% of cycles      Total\n");
+  for (index = 0 ; index < BUS_STATS_NUM ; index++)
+  {
+    Serial.printf("%-16s %12lu   %9lu%%  %10lu\n", Bus_Stats_Names[index], Bus_Stats_Rates[index],
+                  Bus_Stats_Cycle_Rate ? (Bus_Stats_Rates[index] * 100U) / Bus_Stats_Cycle_Rate : 0, Bus_Stats_Counts[index]);
+  }
+  Serial.printf("Address loads (LMA pairs) per second: %lu.  Busy (not Idle): %lu%%\n\n", Bus_Stats_Rates[BUS_STATS_LMA] / 2,
+                Bus_Stats_Cycle_Rate ? ((Bus_Stats_Cycle_Rate - Bus_Stats_Rates[BUS_STATS_IDLE]) * 100U) / Bus_Stats_Cycle_Rate : 0);
+#else
+  Serial.printf("Bus stats are not enabled. Set ENABLE_BUS_STATS in EBTKS_Config.h and rebuild\n");
+#endif
+}
+
+//
+//  Format the per second rates for the AUXROM. Comma separated so the HP85 can parse them with VAL()
+//  Order is: total cycles, idle, LMA, read, write, read by EBTKS, I/O read, I/O write, DMA grant, interrupt ack
+//
+
+int Bus_Stats_Format(char *dest, int max_len)
+{
+  return snprintf(dest, max_len, "%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu", Bus_Stats_Cycle_Rate,
+                  Bus_Stats_Rates[BUS_STATS_IDLE], Bus_Stats_Rates[BUS_STATS_LMA], Bus_Stats_Rates[BUS_STATS_READ],
+                  Bus_Stats_Rates[BUS_STATS_WRITE], Bus_Stats_Rates[BUS_STATS_READ_US], Bus_Stats_Rates[BUS_STATS_IO_READ],
+                  Bus_Stats_Rates[BUS_STATS_IO_WRITE], Bus_Stats_Rates[BUS_STATS_DMA_GRANT], Bus_Stats_Rates[BUS_STATS_INT_ACK]);
+}
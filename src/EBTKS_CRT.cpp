@@ -4,6 +4,20 @@
 //  07/17/2020  Re-write some functions, and start adding support
 //              for safely writing text to the CRT for status messages
 //              and menu support
+//
+//  11/05/2020  The CRT mirror write handlers are now deferred, they run in the background
+//              from ISR_Event_Poll() rather than within the ISR
+//
+//  11/21/2020  writePixel() and the register setup in CRT_restore_screen() use one DMA_Session()
+//              each, rather than a bus grant for every DMA_Peek8() and DMA_Poke()
+//
+//  11/23/2020  CRT_restore_screen() is a background DMA job, with interrupts on between slices.
+//              CRT_restore_screen_start() submits it and returns
+//
+//  11/26/2020  CRT_Mirror_Poll() resyncs the mirror's addresses and mode if deferred CRT writes were lost
+//
+//  11/26/2020  The restore job is unsliced, one bus grant for all of it, so the HP85 can't write CRTBAD part way
+//              through. CRT_restore_screen() uses DMA_Queue_Run() , so it also works from a DMA job callback
 
 #include <Arduino.h>
 
@@ -42,12 +56,15 @@ video_capt_t captured_screen;         // the current screen is copied into here
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////     CRT Mirror Support
 
+//
+//  All four of these CRT mirror handlers are registered as deferred (see initCrtEmu() ) as we only snoop
+//  these registers, the real CRT controller responds to the HP85. They run in the background.
 //
 //  Write only 0xFF04/0177404. CRT Start Address . Tells the CRT controller where to start
 //  fetching characters to put on the screen. Supports fast vertical scrolling
 //
 
-void ioWriteCrtSad(uint8_t val)                 //  This function is running within an ISR, keep it short and fast.
+void ioWriteCrtSad(uint8_t val)                 //  Deferred, runs in the background
 {
   if (sadFlag)
   {                                             //  If true, we are doing the high byte
@@ -66,7 +83,7 @@ void ioWriteCrtSad(uint8_t val)                 //  This function is running wit
 //  write only 0xFF05/0177405. Byte address (cursor pos)
 //
 
-void ioWriteCrtBad(uint8_t val)                 //  This function is running within an ISR, keep it short and fast.
+void ioWriteCrtBad(uint8_t val)                 //  Deferred, runs in the background
 {
   if (badFlag)
   {
@@ -93,7 +110,7 @@ void ioWriteCrtBad(uint8_t val)                 //  This function is running wit
 //  write only 0xFF06/0177406
 //
 
-void ioWriteCrtCtrl(uint8_t val)                //  This function is running within an ISR, keep it short and fast.
+void ioWriteCrtCtrl(uint8_t val)                //  Deferred, runs in the background
 {
   crtControl = val;
   current_screen.ctrl = val;
@@ -104,7 +121,7 @@ void ioWriteCrtCtrl(uint8_t val)                //  This function is running wit
 //  write only 0xFF07/0177407
 //
 
-void ioWriteCrtDat(uint8_t val)                             //  This function is running within an ISR, keep it short and fast.
+void ioWriteCrtDat(uint8_t val)                             //  Deferred, runs in the background
 {
   if (badAddr & 1)                                          //  If addr is ODD - we split nibbles. Does this ever happen in real life?
   {                                                         //  00085-90444 85 Assembler ROM, page 7-110 says top nibble goes to lower nibble address
@@ -134,12 +151,52 @@ void ioWriteCrtDat(uint8_t val)                             //  This function is
 }
 
 
+//
+//  A lost CRTSAD or CRTBAD byte leaves sadFlag or badFlag out of step with the HP85 for good, and every address after
+//  it is wrong. So if the deferred I/O ring lost any writes, take the addresses and mode from the copies the system ROM
+//  keeps in RAM, and restart both flags on a low byte. Lost CRTDAT bytes stay stale in current_screen.vram until the
+//  HP85 writes them again. Called from loop()
+//
+
+void CRT_Mirror_Poll(void)
+{
+  uint16_t        bad, sad;
+  uint8_t         ctrl;
+  struct S_DMA_Op ops[] =
+  {
+    {DMA_OP_READ, 0, 0, CRTBYT, 2, (uint8_t *)&bad},
+    {DMA_OP_READ, 0, 0, CRTRAM, 2, (uint8_t *)&sad},
+    {DMA_OP_READ, 0, 0, CRTWRS, 1, &ctrl}
+  };
+
+  if (Deferred_IO_Writes_Lost() == 0)
+  {
+    return;
+  }
+  ISR_Event_Poll();                             //  What is still in the ring is older than the copies we are about to read
+  DMA_Session(ops, sizeof(ops) / sizeof(ops[0]));
+  CRT_Mirror_Resync(bad, sad, ctrl);
+}
+
+void CRT_Mirror_Resync(uint16_t bad, uint16_t sad, uint8_t ctrl)
+{
+  crtControl = ctrl;
+  current_screen.ctrl = ctrl;
+  sadAddr = sad;
+  current_screen.sadAddr = sad;
+  badAddr = bad & ((ctrl & 0x80) ? 0x3FFFU : 0x0FFFU);
+  current_screen.badAddr = badAddr;
+  sadFlag = false;
+  badFlag = false;
+  writeCRTflag = true;
+}
+
 void initCrtEmu(void)
 {
-  setIOWriteFunc(4,&ioWriteCrtSad); // Address 0xFF04   CRT controller
-  setIOWriteFunc(5,&ioWriteCrtBad);
-  setIOWriteFunc(6,&ioWriteCrtCtrl);
-  setIOWriteFunc(7,&ioWriteCrtDat);
+  setIOWriteFunc(4,&ioWriteCrtSad, true); // Address 0xFF04   CRT controller. All deferred
+  setIOWriteFunc(5,&ioWriteCrtBad, true);
+  setIOWriteFunc(6,&ioWriteCrtCtrl, true);
+  setIOWriteFunc(7,&ioWriteCrtDat, true);
 }
 
 //
@@ -161,6 +218,7 @@ void Write_on_CRT_Alpha(uint16_t row, uint16_t column, const char *  text)
     return;                     //  CRT is in Graphics mode, so just ignore for now. Maybe later we will allow writing text to the Graphics screen (Implies a Character ROM) 
   }  
 
+  ISR_Event_Poll();             //  Bring badAddr and sadAddr up to date with any deferred CRT writes
   badAddr_restore = badAddr;
   //Serial.printf("WoCA: R=%2d  C=%2d  badAddr = %04x  timeout %6d\n", row, column, badAddr, timeout);
 
@@ -496,10 +554,7 @@ void writePixel(int x, int y, int color)
 
   // calculate write address
   int offs = (x >> 3) + (y * 32);
-  while (DMA_Peek8(CRTSTS) & 0x80)
-  {
-  }; //wait until video controller is ready
-  DMA_Poke16(CRTBAD, 0x1000U + (offs * 2));
+  uint16_t bad = 0x1000U + (offs * 2);
 
   uint8_t val = vram[offs];
 
@@ -514,10 +569,15 @@ void writePixel(int x, int y, int color)
   }
   
   vram[offs] = val;
-  while (DMA_Peek8(CRTSTS) & 0x80)
+
+  struct S_DMA_Op ops[] =
   {
-  }; //wait until video controller is ready
-  DMA_Poke8(CRTDAT, val);
+    {DMA_OP_POLL,  0x80, 0x00, CRTSTS},                   //  wait until video controller is ready
+    {DMA_OP_WRITE, 0,    0,    CRTBAD, 2, (uint8_t *)&bad},
+    {DMA_OP_POLL,  0x80, 0x00, CRTSTS},
+    {DMA_OP_WRITE, 0,    0,    CRTDAT, 1, &val}
+  };
+  DMA_Session(ops, sizeof(ops) / sizeof(ops[0]));
 }
 
 void writeLine(int x0, int y0, int x1, int y1, int color)
@@ -684,11 +744,12 @@ void dumpCrtAlphaAsJSON(void)
 //
 //  Copy the current video state into captured_screen
 //  no synchronisation is done - not sure if it is needed.
-//  Time will tell!
+//  Time will tell!  Any deferred CRT writes are processed first
 //
 
 void CRT_capture_screen(void)
 {
+  ISR_Event_Poll();
   memcpy(&captured_screen, &current_screen, sizeof(video_capt_t));
 }
 
@@ -696,61 +757,56 @@ void CRT_capture_screen(void)
 //  restore the HP85 video state from one previously captured
 //  currently we only restore the alpha pages
 //
+//  This is one background DMA job (see EBTKS_DMA_Queue.cpp), unsliced, so interrupts are off while it runs.
+//  Returns false if a restore is already running. callback (can be NULL) is called from loop() when it is done
+//
 
-void CRT_restore_screen(void)
-{
-  //copy 2k of alpha data back to the HP85 video controller
-  while (DMA_Peek8(CRTSTS) & 0x80)              //  I thought this wait might not be necessary, but the code in the system ROMs checks the busy bit
-  {                                             //  before writing to CRTBAD. It also does it before writing to CRTSAD, but only if a CRTBAD write is adjacent.
-  }   //wait until video controller is ready       Best guess is it is only needed for CRTBAD.  Also seems that if it knows retrace is happening, then a write is ok.
-  DMA_Poke16(CRTBAD, 0);
-  DMA_Poke16(CRTSAD, 0);
-
-  // Serial.printf("CRTBAD and CRTBAD set to 0\n");
-  // delay(1000);
-  // Serial.printf("Start block DMA\n");         //  no reporting until DMA end, as interrupts are off
-
-  //  Start DMA mode
-  DMA_Request = true;
-  while (!DMA_Active)
-  {
-  } // Wait for acknowledgement, and Bus ownership
-
-  //  Bus is now ours, All interrupts are disabled on Teensy
-
-  for (int ch = 0; ch < 2048; ch++)
-    {
-    uint8_t data = 0x80;
-    while (data & 0x80)
-    {
-      DMA_Read_Block(CRTSTS,&data, 1);
-    }  // Wait until video controller is ready
-
-    DMA_Write_Block(CRTDAT, &captured_screen.vram[ch], 1);              
-    }
-        
-  release_DMA_request();
-        
-  while (DMA_Active)
-  {
-  } //  Wait for release
-    //  DMA mode is ended
-
-  // Serial.printf("Block DMA has ended\n");         //  no reporting until DMA end, as interrupts are off
-  // delay(1000);
-  // Serial.printf("Restoring CRTBAD, CRTSAD, and CRTSTS\n");         //  no reporting until DMA end, as interrupts are off
+static uint16_t           CRT_Restore_Zero = 0;
 
-  while (DMA_Peek8(CRTSTS) & 0x80)
+//copy 2k of alpha data back to the HP85 video controller
+//  I thought the first wait might not be necessary, but the code in the system ROMs checks the busy bit
+//  before writing to CRTBAD. It also does it before writing to CRTSAD, but only if a CRTBAD write is adjacent.
+//  Best guess is it is only needed for CRTBAD.  Also seems that if it knows retrace is happening, then a write is ok.
+static struct S_DMA_Op    CRT_Restore_Ops[] =
+{
+  {DMA_OP_POLL,        0x80, 0x00, CRTSTS},                 //  wait until video controller is ready
+  {DMA_OP_WRITE,       0,    0,    CRTBAD, 2, (uint8_t *)&CRT_Restore_Zero},
+  {DMA_OP_WRITE,       0,    0,    CRTSAD, 2, (uint8_t *)&CRT_Restore_Zero},
+  {DMA_OP_WRITE_PACED, 0x80, 0x00, CRTDAT, 2048, captured_screen.vram, 0, CRTSTS},    //  Each byte when the video controller is ready
+  {DMA_OP_POLL,        0x80, 0x00, CRTSTS},
+  {DMA_OP_WRITE,       0,    0,    CRTBAD, 2, (uint8_t *)&captured_screen.badAddr},
+  {DMA_OP_WRITE,       0,    0,    CRTSAD, 2, (uint8_t *)&captured_screen.sadAddr},
+  {DMA_OP_WRITE,       0,    0,    CRTSTS, 1, &captured_screen.ctrl}
+};
+
+static struct S_DMA_Job   CRT_Restore_Job = {CRT_Restore_Ops, sizeof(CRT_Restore_Ops) / sizeof(CRT_Restore_Ops[0]), DMA_CLIENT_CRT, true};
+
+bool CRT_restore_screen_start(void (*callback)(struct S_DMA_Job *job))
+{
+  if (CRT_Restore_Job.state == DMA_JOB_QUEUED)
   {
-  } ;   //wait until video controller is ready
-  DMA_Poke16(CRTBAD, captured_screen.badAddr); 
-  DMA_Poke16(CRTSAD, captured_screen.sadAddr);
-  DMA_Poke8(CRTSTS,captured_screen.ctrl);
+    return false;
+  }
+  CRT_Restore_Job.callback = callback;
   //
   //  Update what BASIC thinks these variables are
   //
   // DMA_Poke16(CRTBYT, captured_screen.badAddr); 
   // DMA_Poke16(CRTRAM, captured_screen.sadAddr);
   // DMA_Poke8(CRTWRS,captured_screen.ctrl);
+  return DMA_Queue_Submit(&CRT_Restore_Job);
+}
+
+//
+//  The same, but returns when it is done. If a restore is already queued, that one is waited for
+//
+
+void CRT_restore_screen(void)
+{
+  if (CRT_Restore_Job.state != DMA_JOB_QUEUED)
+  {
+    CRT_Restore_Job.callback = NULL;
+  }
+  DMA_Queue_Run(&CRT_Restore_Job);
 }
 
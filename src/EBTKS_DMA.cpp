@@ -53,6 +53,42 @@
 //                      BUT, DMA is initialized by 1MB5 chips in various modules to implement FHS (Fast HandShake transfer mode). Standard ROMs only support
 //                      one 1MB5 at a time using this capability, but that means we need to not interfere
 //
+//      11/06/2020      DMA_Peek8() and DMA_Peek16() are served from the DRAM shadow when it is enabled,
+//                      and DMA_Write_Block() keeps the shadow up to date, since the ISR can't see our writes
+//
+//      11/16/2020      DMA cycles are captured inline by DMA_LA_Sample(), as each one completes, rather than
+//                      reconstructed after each burst by DMA_Logic_Analyzer_Support() (removed). This now includes
+//                      the 2 LMA cycles and the refresh break cycles, and is done before the trigger as well as
+//                      after. Samples go through Logic_Analyzer_Capture(), the same code onPhi_1_Rise() uses,
+//                      tagged with bit 27 (see EBTKS_Logic_Analyzer.h), and to the flight recorder. DMA samples can
+//                      now also cause the trigger. Each is taken just after Phi 1 falls, where the code is only waiting
+//                      for Phi 2, so the tuned edge timing is not affected. The cost per DMA cycle is in "isr prof",
+//                      slot DMA LA Sample
+//
+//      11/20/2020      Each DMA session, from the grant to the end of release_DMA_request(), is recorded in the
+//                      event trace ("trace on") with the number of bytes moved. See EBTKS_Event_Trace.cpp
+//
+//      11/21/2020      DMA_Session() runs a list of reads, writes, read-modify-writes and polls with a single bus grant,
+//                      with refresh breaks counted across the operations. "dma bench" compares the HP85 bus stall time
+//                      against a grant per operation
+//
+//      11/22/2020      Burst lengths and refresh breaks come from the refresh scheduler (EBTKS_DMA_Scheduler.cpp), which
+//                      tracks the 1MA2 refresh debt across blocks and grants, rather than MAX_DMA_BURST_LENGTH and
+//                      DMA_BURST_BREAK_CYCLES. DMA_Session() no longer does its own refresh breaks
+//
+//      11/23/2020      DMA_OP_WRITE_PACED, for the CRT data register. Background DMA jobs are run by DMA_Session() a slice
+//                      at a time, see EBTKS_DMA_Queue.cpp
+//
+//      11/24/2020      DMA_TIMING_POINT() stamps at each step of the preamble and the bursts, for the timing check
+//                      ("dma timing", ENABLE_DMA_TIMING_CHECK). They compile to nothing when it is disabled
+//
+//      11/26/2020      DMA_LA_Sample() runs between Phi 1 falling and Phi 2 falling, and loop() can't prefetch the PSRAM
+//                      capture buffers while interrupts are off for DMA, so a store that missed the data cache (about 1 us)
+//                      would push the next edge late. DMA_Session() now prefetches before it asks for the bus, and a
+//                      sample whose store is not in the cache is skipped (LA) or counted as dropped (flight recorder).
+//                      Every DMA_LA_Sample() is timed, and the worst case is shown against DMA_LA_SAMPLE_WINDOW_NS
+//                      with the LA results and in "fr"
+//
 
 
 #include <Arduino.h>
@@ -63,7 +99,9 @@ static void DMA_Preamble(uint16_t DMA_Target_Address);
 static int32_t DMA_Read_Burst(uint8_t buffer[], uint32_t bytecount);           //  This function is only called by DMA_Read_Block()
 static int32_t DMA_Write_Burst(uint8_t buffer[], uint32_t bytecount);          //  This function is only called by DMA_Write_Block()
 
-static void DMA_Logic_Analyzer_Support(uint8_t buffer[], uint32_t bytecount, int mode);
+#if ENABLE_EVENT_TRACE
+static uint32_t DMA_Session_Bytes = 0;                                          //  Bytes moved since the DMA grant, for TRACE_DMA
+#endif
 
 static uint32_t   DMA_Addr_for_Logic_Analyzer;
 
@@ -77,6 +115,91 @@ static uint32_t   DMA_Addr_for_Logic_Analyzer;
 #define CTRL_END_RD_TWEAK                    EBTKS_delay_ns(140)               //  Adjusts the end time of /RDX  after Phi 1 Rising edge. Goal is 130 ns after Phi 1 Rising
 #define CTRL_END_WR_TWEAK                    EBTKS_delay_ns(145)               //  Adjusts the end time of /WRX  after Phi 1 Rising edge. Goal is 130 ns after Phi 1 Rising
 
+//
+//  DMA_LA_Sample() is called at most about 100 ns (OUTPUT_DATA_HOLD_TWEAK) after Phi 1 falls, and the code after it
+//  waits for Phi 2 to rise, then fall. Phi 2 falls 816 ns after Phi 1 falls, so this leaves margin for the call
+//  and the wait loop
+//
+
+#define DMA_LA_SAMPLE_WINDOW_NS       (600)
+#define DMA_LA_SAMPLE_WINDOW_CYCLES   ((F_CPU_ACTUAL / 1000000U) * DMA_LA_SAMPLE_WINDOW_NS / 1000U)
+
+//
+//  Record one DMA bus cycle for the Logic Analyzer and the flight recorder. Only call this just after Phi 1 falling
+//
+
+static inline void DMA_LA_Sample(uint32_t cycle, uint32_t address, uint32_t data) __attribute__((always_inline, unused));
+static inline void DMA_LA_Sample(uint32_t cycle, uint32_t address, uint32_t data)
+{
+  uint32_t    start, cycles;
+
+  if ((Logic_Analyzer_State == ANALYZER_ACQUIRING) || Flight_Recorder_Active)
+  {
+    ISR_PROFILE_START(dma_la_stamp);
+    start = ARM_DWT_CYCCNT;
+    DMA_LA_Samples++;
+    Logic_Analyzer_main_sample = cycle | ((address & 0x0000FFFFU) << 8) | (data & 0x000000FFU);
+    Logic_Analyzer_aux_sample  = getRselec() & 0x000000FF;
+    if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
+    {
+      if (Logic_Analyzer_Store_Is_Cached())
+      {
+        Logic_Analyzer_Capture();
+      }
+      else
+      {
+        DMA_LA_Skipped++;                               //  Nor can it trigger
+      }
+    }
+#if ENABLE_FLIGHT_RECORDER
+    if (Flight_Recorder_Active)
+    {
+      if (Flight_Recorder_Store_Is_Cached())
+      {
+        Flight_Recorder_Sample();
+      }
+      else
+      {
+        Flight_Recorder_Drop();                         //  Leaves a drop marker in the recording
+      }
+    }
+#endif
+    cycles = ARM_DWT_CYCCNT - start;
+    if (cycles > DMA_LA_Max_Cycles)
+    {
+      DMA_LA_Max_Cycles = cycles;
+    }
+    if (cycles > DMA_LA_SAMPLE_WINDOW_CYCLES)
+    {
+      DMA_LA_Overruns++;
+    }
+    ISR_PROFILE_END(dma_la_stamp, ISR_PROFILE_SLOT_DMA_LA_SAMPLE);
+  }
+}
+
+//
+//  Called when a Logic Analyzer capture or a flight recording is started
+//
+
+void DMA_LA_Sample_Reset(void)
+{
+  DMA_LA_Samples    = 0;
+  DMA_LA_Skipped    = 0;
+  DMA_LA_Max_Cycles = 0;
+  DMA_LA_Overruns   = 0;
+}
+
+void DMA_LA_Sample_Report(void)
+{
+  if (DMA_LA_Samples == 0)
+  {
+    return;
+  }
+  Serial.printf("DMA cycles %lu, %lu not captured (PSRAM not prefetched). Worst sample %lu ns of the %d ns window, %lu over\n",
+                DMA_LA_Samples, DMA_LA_Skipped, (uint32_t)(((uint64_t)DMA_LA_Max_Cycles * 1000U) / (F_CPU_ACTUAL / 1000000U)),
+                DMA_LA_SAMPLE_WINDOW_NS, DMA_LA_Overruns);
+}
+
 
 //
 //  The following delays include the time to make the call and return
@@ -87,6 +210,8 @@ static uint32_t   DMA_Addr_for_Logic_Analyzer;
 //  asm volatile("mov r0, r0\n\t");
 //}
 
+#ifndef EBTKS_NATIVE                  //  The host build for the tests in test/ has its own, timed by the bus model in test/native/EBTKS_Native/Native_Bus.h
+
 void EBTKS_delay_34_ns(void)
 {
   asm volatile("mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" );
@@ -97,6 +222,22 @@ void EBTKS_delay_for_LMA_start(void)
   asm volatile("mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" "mov r0, r0\n\t" );
 }
 
+#endif
+
+//
+//  Idle bus cycles for the 1MA2 to refresh. On entry and exit, we are just after Phi 1 falling, with no transaction in progress
+//
+
+static void DMA_Idle_Cycles(uint32_t cycles)
+{
+  while (cycles--)
+  {
+    WAIT_WHILE_PHI_1_LOW;
+    WAIT_WHILE_PHI_1_HIGH;
+    DMA_LA_Sample(LA_SAMPLE_DMA_IDLE, DMA_Addr_for_Logic_Analyzer, 0);
+  }
+}
+
 
 
 //
@@ -175,12 +316,15 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
 {
 
   uint32_t               buffer_index;
-  uint8_t                refresh_count;
+  uint32_t               burst;
 
   if ((bytecount == 0) || (buffer == NULL) || (!DMA_Active))
   {
     return 0;   //  Pointless or dangerous call
   }
+#if ENABLE_EVENT_TRACE
+  DMA_Session_Bytes += bytecount;
+#endif
                      //                                                                                This has been reviewed, and __disable_irq() has already been done "DMA_Acknowledge" part of the
                      //                                                                                EBTKS_Bus_Interface_ISR.cpp  .  So this should be removed, and tested
   __disable_irq();   //  Disable all interrupts while DMA is happening. In particular the Systick stuff.
@@ -188,6 +332,8 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
                      //  All interrupts are re-enabled at the end of release_DMA_request()
 
   DMA_Addr_for_Logic_Analyzer = DMA_Target_Address;
+  DMA_Idle_Cycles(DMA_Sched_Idles_Before_Block());      //  Room for the refresh the 1MA2 may still owe, see EBTKS_DMA_Scheduler.cpp
+  burst = DMA_Sched_Burst(&DMA_Sched, bytecount);
   DMA_Preamble(DMA_Target_Address);
   //  /LMAX has just been deasserted, and time is about mid to late Phi 21
   //  /RC is still asserted, and the High byte of the address is on the bus
@@ -195,6 +341,7 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
   //  Start the first read by asserting /RD. Use same timing as /LMAX
   //
   WAIT_WHILE_PHI_1_LOW;
+  DMA_TIMING_POINT(DMA_TP_RDWR_PHI1_RISE);
   //
   //  Phi 1 has just gone high
   //  Allowing for assorted overhead, try and place the falling edge of /RD 130 ns after
@@ -204,12 +351,16 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
   CTRL_START_RD_TWEAK;                //  Extremely finely tuned so that the falling edge of /RD will arrive at pin 17 of 1MB1 130 ns after rising edge of Phi 1
                                       //  Tuned 2020_07_14                                                                  DMA_Tweak_5_for_RD_Falling_edge_2020_07_14_132_ns.png
   ASSERT_RD;                          //  /RDX goes low During Phi 1 High
+  DMA_TIMING_POINT(DMA_TP_RDWR_ASSERT);
   //SET_T33;                            //  Trigger for timing /RD   matching CLEAR_T33 is in DMA_Read_Burst()
   WAIT_WHILE_PHI_1_HIGH;              
+  DMA_TIMING_POINT(DMA_TP_RDWR_PHI1_FALL);
   OUTPUT_DATA_HOLD_TWEAK;             //  Hold time of High address byte after falling edge of Phi 1. The 1MB5 spec indicates a hold time of
                                       //  40 to 150 ns. We are going to target 100 ns, which will be tweaked here and similar code sequences                                 <<<<<<<<<<<<<<<<<<<<<<
   BUS_DIR_FROM_HP;                    //  DIR Low, this also de-asserts /RC . This ends the data phase of Address High byte
+  DMA_TIMING_POINT(DMA_TP_ADDR_HIGH_OFF);
   SET_T4_BUS_TO_INPUT;                //  Prep for Read
+  DMA_LA_Sample(LA_SAMPLE_DMA_LMA, DMA_Target_Address, DMA_Target_Address >> 8);     //  Address High byte LMA cycle
   //
   //  At this point, we have sent both bytes of the address, and we have initiated a read cycle.
   //  The Teensy data bus is set to input and the data bus buffer/translator (U2) is disabled
@@ -220,17 +371,15 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
   //
   buffer_index = 0;                  //  Index into the DMA buffer, and also indicates how many bytes we have transfered so far
   //
-  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh
+  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh.
+  //  The scheduler sizes each burst, and the break after it, from the refresh debt
   //
-  while((bytecount - buffer_index) > MAX_DMA_BURST_LENGTH)
-  {                                  //  We have more than the max burst length still to be completed
-    DMA_Read_Burst(&buffer[buffer_index], MAX_DMA_BURST_LENGTH);
-    buffer_index += MAX_DMA_BURST_LENGTH;
-    for (refresh_count = 0 ; refresh_count < (DMA_BURST_BREAK_CYCLES - 1); refresh_count++)
-    {
-      WAIT_WHILE_PHI_1_LOW;
-      WAIT_WHILE_PHI_1_HIGH;
-    }
+  while((bytecount - buffer_index) > burst)
+  {                                  //  We have more than this burst still to be completed
+    DMA_Read_Burst(&buffer[buffer_index], burst);
+    buffer_index += burst;
+    DMA_Idle_Cycles(DMA_Sched_Break(&DMA_Sched));
+    burst = DMA_Sched_Burst(&DMA_Sched, bytecount - buffer_index);
     WAIT_WHILE_PHI_1_LOW;
     //
     //  Phi 1 has just gone high
@@ -244,7 +393,7 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
     WAIT_WHILE_PHI_1_HIGH;
   }
   //
-  //  When we get here, there is at most MAX_DMA_BURST_LENGTH transfers pending
+  //  When we get here, the last burst covers the rest
   //
   DMA_Read_Burst(&buffer[buffer_index], bytecount - buffer_index);
 
@@ -319,6 +468,7 @@ static void DMA_Preamble(uint16_t DMA_Target_Address)
               //  Phi 1 is now low (or worst case has just gone high)
               WAIT_WHILE_PHI_1_LOW;
               //SET_T33;                             //  TIME_MARKER_1    From here to exit from this function, it takes 2.808            DMA_preamble_after_sync_Duration_2020_07_14_2808_ns.png
+              DMA_TIMING_POINT(DMA_TP_LMA1_PHI1_RISE);
               //
               //  Phi 1 has just gone high
               //  Allowing for assorted overhead, try and place the falling
@@ -329,9 +479,11 @@ static void DMA_Preamble(uint16_t DMA_Target_Address)
               CTRL_START_LMA_1_TWEAK;               //  Extremely finely tuned so that the falling edge of /LMA will arrive at pin 16 of 1MB1 130 ns after rising edge of Phi 1
                                                     //  Tuned 2020_07_14                                                                  DMA_Tweak_1_for_LMA_Falling_edge_2020_07_14_127_ns.png
 /* [01] */    ASSERT_LMA;                           //  /LMAX goes low During Phi 1 High
+              DMA_TIMING_POINT(DMA_TP_LMA1_ASSERT);
               WAIT_WHILE_PHI_2_LOW;
               //SET_T33;                              //  Trigger for timing the previous ASSERT_LMA and the next. A twofer
               WAIT_WHILE_PHI_2_HIGH;                //  After this we are just after Phi 2 falling.
+              DMA_TIMING_POINT(DMA_TP_LMA1_PHI2_FALL);
                                                     //  Put the low byte of the address on the local bus,
                                                     //  change the direction of the bus buffer (which also assert /RC)
                                                     //  and enable the bus buffer
@@ -346,6 +498,7 @@ static void DMA_Preamble(uint16_t DMA_Target_Address)
 /* [05] */    BUS_DIR_TO_HP;                        //  DIR high, this also asserts /RC
                                                     //  may need to delay for 1MA8 to let go of driving bus   Need to investigate
 /* [06] */    ENABLE_BUS_BUFFER_U2;                 //  !OE low
+              DMA_TIMING_POINT(DMA_TP_ADDR_LOW_ON);
 
 /* [07] */    //  After transit time, Low address will be on the I/O bus, and then the main board
 
@@ -356,22 +509,29 @@ static void DMA_Preamble(uint16_t DMA_Target_Address)
                                                     //  this generates a 1.160 ns /LMA on the processor bus, measured at the 1MB1, pin 16
                                                     //  Tuned 2020_07_14                                                                  DMA_Tweak_3_for_LMA_Duration_1_2020_07_14_1160_ns.png
 /* [08] */    RELEASE_LMA;
+              DMA_TIMING_POINT(DMA_TP_LMA1_RELEASE);
               //CLEAR_T33;                            //  Clear the trigger for timing LMA
               //
               //  Do the second LMA pulse, note the first byte of the address is still driven onto the bus, and /RC is still asserted
               //
               WAIT_WHILE_PHI_1_LOW;
+              DMA_TIMING_POINT(DMA_TP_LMA2_PHI1_RISE);
 /* ADDR High Byte sequence starts here */
               CTRL_START_LMA_2_TWEAK;               //  Extremely finely tuned so that the falling edge of /LMA will arrive at pin 16 of 1MB1 130 ns after rising edge of Phi 1
                                                     //  Tuned 2020_07_14                                                                  DMA_Tweak_2_for_LMA_Falling_edge_2020_07_14_127_ns.png
 /* [09] */    ASSERT_LMA;                           //  LMA goes low During Phi 1 High
+              DMA_TIMING_POINT(DMA_TP_LMA2_ASSERT);
               WAIT_WHILE_PHI_1_HIGH;
+              DMA_TIMING_POINT(DMA_TP_LMA2_PHI1_FALL);
               OUTPUT_DATA_HOLD_TWEAK;               //  Hold time of Low address byte after falling edge of Phi 1
                                                     //  See similar code in DMA_Read_Block() for a description
 /* [10] */    BUS_DIR_FROM_HP;                      //  DIR low, this also de-asserts /RC . This ends the data phase of Address Low byte
+              DMA_TIMING_POINT(DMA_TP_ADDR_LOW_OFF);
 /* [11] */    DISABLE_BUS_BUFFER_U2;                //  Floats the data bus. This is to avoid contention
+              DMA_LA_Sample(LA_SAMPLE_DMA_LMA, DMA_Target_Address, DMA_Target_Address);   //  Address Low byte LMA cycle
               WAIT_WHILE_PHI_2_LOW;
               WAIT_WHILE_PHI_2_HIGH;                //  After this we are just after Phi 2 falling.
+              DMA_TIMING_POINT(DMA_TP_LMA2_PHI2_FALL);
                                                     //  Put the high byte of the address on the local bus,      #####
                                                     //  change the direction of the bus buffer (which also assert /RC)
                                                     //  and enable the bus buffer
@@ -381,12 +541,14 @@ static void DMA_Preamble(uint16_t DMA_Target_Address)
 /* [13] */    BUS_DIR_TO_HP;                        //  DIR high, this also asserts /RC
                                                     //  may need to delay for 1MA8 to let go of driving bus   Need to investigate                              <<<<<<<<<<<<<<<<<<<<<<
 /* [14] */    ENABLE_BUS_BUFFER_U2;                 //  !OE low
+              DMA_TIMING_POINT(DMA_TP_ADDR_HIGH_ON);
               //
               //  The address byte remains driven on the I/O bus till the falling edge of Phi 1
               //
               CTRL_END_LMA_TWEAK_4;                 //  After going through the I/O bus cable and 1MA8, plus the delay of the above code,
                                                     //  Tuned 2020_07_14                                                                   DMA_Tweak_4_for_LMA_Duration_2_2020_07_14_1161_ns.png
 /* [15] */    RELEASE_LMA;
+              DMA_TIMING_POINT(DMA_TP_LMA2_RELEASE);
               //CLEAR_T33;                          //  TIME_MARKER_2
 
 //
@@ -431,10 +593,12 @@ static int32_t DMA_Read_Burst(uint8_t buffer[], uint32_t bytecount)
     WAIT_WHILE_PHI_2_LOW;
     //CLEAR_T33;                        //  Clear Trigger for timing
     WAIT_WHILE_PHI_2_HIGH;              //  After this we are just after Phi 2 falling.
+    DMA_TIMING_POINT(DMA_TP_DATA_PHI2_FALL);
     CTRL_END_RD_TWEAK;                  //  After going through the I/O bus cable and 1MA8, plus the delay of the above code,
                                         //  this generates a nominal 1.160 ns /RD on the processor bus, sensed on 1MB1 pin 17
                                         //  Tuned 2020_07_14                                                DMA_Tweak_6_for_RD_Duration_2020_07_14_1154_ns.png
     RELEASE_RD;
+    DMA_TIMING_POINT(DMA_TP_RDWR_RELEASE);
     //
     //  Due to the pipelined nature of bus transactions, if we need to do more transfers after the current read,
     //  we need to assert /RD for the next transaction, even though we haven't received the data for the current cycle
@@ -451,13 +615,11 @@ static int32_t DMA_Read_Burst(uint8_t buffer[], uint32_t bytecount)
       WAIT_WHILE_PHI_1_LOW;             // this is in both branches of the if () so that the other one is not separated from the CTRL_START_TWEAK and ASSERT
     }
     WAIT_WHILE_PHI_1_HIGH;
+    DMA_TIMING_POINT(DMA_TP_DATA_PHI1_FALL);
     data_from_IO_bus = (GPIO_PAD_STATUS_REG_DB0 >> BIT_POSITION_DB0) & 0x000000FFU;     //  Requires that data bits are contiguous and in the right order
+    DMA_TIMING_POINT(DMA_TP_DATA_OFF);
     buffer[buffer_index++] = data_from_IO_bus;     //  Save the data that has just been read
-  }
-
-  if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
-  {
-    DMA_Logic_Analyzer_Support(buffer, bytecount, 0);
+    DMA_LA_Sample(LA_SAMPLE_DMA_READ, DMA_Addr_for_Logic_Analyzer++, data_from_IO_bus);
   }
 
   return buffer_index;
@@ -471,12 +633,15 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
 {
 
   uint32_t               buffer_index;
-  uint8_t                refresh_count;
+  uint32_t               burst;
 
   if ((bytecount == 0) || (buffer == NULL) || (!DMA_Active))
   {
     return 0;        //  Pointless or dangerous call
   }
+#if ENABLE_EVENT_TRACE
+  DMA_Session_Bytes += bytecount;
+#endif
 
                      //                                                                                This has been reviewed, and __disable_irq() has already been done "DMA_Acknowledge" part of the
                      //                                                                                EBTKS_Bus_Interface_ISR.cpp  .  So this should be removed, and tested
@@ -485,6 +650,8 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
                      //  All interrupts are re-enabled at the end of release_DMA_request()
 
   DMA_Addr_for_Logic_Analyzer = DMA_Target_Address;
+  DMA_Idle_Cycles(DMA_Sched_Idles_Before_Block());      //  Room for the refresh the 1MA2 may still owe, see EBTKS_DMA_Scheduler.cpp
+  burst = DMA_Sched_Burst(&DMA_Sched, bytecount);
   DMA_Preamble(DMA_Target_Address);
   //  /LMAX has just been deasserted, and time is about mid to late Phi 21
   //  /RC is still asserted, and the High byte of the address is on the bus
@@ -492,6 +659,7 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
   //  Start the first write by asserting /WR. Use same timing as /LMAX
   //
   WAIT_WHILE_PHI_1_LOW;
+  DMA_TIMING_POINT(DMA_TP_RDWR_PHI1_RISE);
   //
   //  Phi 1 has just gone high
   //  Allowing for assorted overhead, try and place the falling edge of /WR 130 ns after
@@ -501,12 +669,16 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
   CTRL_START_WR_TWEAK;           //  Extremely finely tuned so that the falling edge of /WR will arrive at pin 15 of 1MB1 130 ns after rising edge of Phi 1
                                  //  Tuned 2020_07_14                                                                  DMA_Tweak_7_for_WR_Falling_edge_2020_07_14_132_ns.png
   ASSERT_WR;                     //  /WRX goes low During Phi 1 High
+  DMA_TIMING_POINT(DMA_TP_RDWR_ASSERT);
   //SET_T33;                       //  Trigger for timing /WR   matching CLEAR_T33 is in DMA_Write_Burst()
   WAIT_WHILE_PHI_1_HIGH;
+  DMA_TIMING_POINT(DMA_TP_RDWR_PHI1_FALL);
   OUTPUT_DATA_HOLD_TWEAK;        //  Hold time of High address byte after falling edge of Phi 1. The 1MB5 spec indicates a hold time of
                                  //  40 to 150 ns. We are going to target 100 ns, which will be tweaked here and similar code sequences                                 <<<<<<<<<<<<<<<<<<<<<<
   BUS_DIR_FROM_HP;               //  DIR Low, this also de-asserts /RC . This ends the data phase of Address High byte
+  DMA_TIMING_POINT(DMA_TP_ADDR_HIGH_OFF);
   DISABLE_BUS_BUFFER_U2;         //  Floats the data bus. This is to avoid contention, as we are leaving T4 as a driver of the local bus
+  DMA_LA_Sample(LA_SAMPLE_DMA_LMA, DMA_Target_Address, DMA_Target_Address >> 8);     //  Address High byte LMA cycle
   //
   //  At this point, we have sent both bytes of the address, and we have initiated a write cycle.
   //  The Teensy data bus is still set to output and the data bus buffer/translator (U2) is disabled, direction is input to T4
@@ -517,18 +689,16 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
   //
   buffer_index = 0;              //  Index into the DMA buffer, and also indicates how many bytes we have transfered so far
   //
-  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh
+  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh.
+  //  The scheduler sizes each burst, and the break after it, from the refresh debt
   //
-  while((bytecount - buffer_index) > MAX_DMA_BURST_LENGTH)
-  {  //  We have more than the max burst length still to be completed
-    DMA_Write_Burst(&buffer[buffer_index], MAX_DMA_BURST_LENGTH);     //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
+  while((bytecount - buffer_index) > burst)
+  {  //  We have more than this burst still to be completed
+    DMA_Write_Burst(&buffer[buffer_index], burst);                    //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
                                                                       //  /RC not asserted, U2 disabled, T4 bus is output, I/O bus direction is from HP
-    buffer_index += MAX_DMA_BURST_LENGTH;
-    for (refresh_count = 0 ; refresh_count < (DMA_BURST_BREAK_CYCLES - 1); refresh_count++)
-    {
-      WAIT_WHILE_PHI_1_LOW;
-      WAIT_WHILE_PHI_1_HIGH;
-    }
+    buffer_index += burst;
+    DMA_Idle_Cycles(DMA_Sched_Break(&DMA_Sched));
+    burst = DMA_Sched_Burst(&DMA_Sched, bytecount - buffer_index);
     WAIT_WHILE_PHI_1_LOW;
     //
     //  Phi 1 has just gone high
@@ -542,7 +712,7 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
     WAIT_WHILE_PHI_1_HIGH;
   }
   //
-  //  When we get here, there is at most MAX_DMA_BURST_LENGTH transfers pending
+  //  When we get here, the last burst covers the rest
   //
   DMA_Write_Burst(&buffer[buffer_index], bytecount - buffer_index);     //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
                                                                         //  /RC not asserted, U2 disabled, T4 bus is output, I/O bus direction is from HP
@@ -553,6 +723,8 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
   SET_T4_BUS_TO_INPUT;
   ENABLE_BUS_BUFFER_U2;
 
+  DRAM_Shadow_Update(DMA_Target_Address, buffer, bytecount);     //  The ISR doesn't see our DMA writes
+
   return bytecount;
 }
 
@@ -599,7 +771,9 @@ static int32_t DMA_Write_Burst(uint8_t buffer[], uint32_t bytecount)
     BUS_DIR_TO_HP;                               //  DIR high, this also asserts /RC
 
     WAIT_WHILE_PHI_2_HIGH;                       //  After this we are just after Phi 2 falling.
+    DMA_TIMING_POINT(DMA_TP_DATA_PHI2_FALL);
     ENABLE_BUS_BUFFER_U2;                        //  !OE low
+    DMA_TIMING_POINT(DMA_TP_DATA_ON);
     //
     //  The data byte remains driven on the I/O bus until 100 ns after the falling edge of Phi 1
     //
@@ -608,6 +782,7 @@ static int32_t DMA_Write_Burst(uint8_t buffer[], uint32_t bytecount)
                                                  //  Tuned 2020_07_14                                                DMA_Tweak_8_for_WR_Duration_2020_07_14_1157_ns.png
 
     RELEASE_WR;
+    DMA_TIMING_POINT(DMA_TP_RDWR_RELEASE);
     //
     //  Due to the pipelined nature of bus transactions, if we need to do more transfers after the current write,
     //  we need to assert /WR for the next transaction, even though we haven't written the data for the current cycle
@@ -623,24 +798,22 @@ static int32_t DMA_Write_Burst(uint8_t buffer[], uint32_t bytecount)
       WAIT_WHILE_PHI_1_LOW;             // this is in both branches of the if () so that the other one is not separated from the CTRL_START_TWEAK and ASSERT
     }
     WAIT_WHILE_PHI_1_HIGH;
+    DMA_TIMING_POINT(DMA_TP_DATA_PHI1_FALL);
     //
     //  Phi 1 falling edge just occured, so our outbound data is sent
     //
     OUTPUT_DATA_HOLD_TWEAK;               //  Hold time of data byte after falling edge of Phi 1
                                           //  See similar code in DMA_Read_Block() for a description
     BUS_DIR_FROM_HP;                      //  DIR low, this also de-asserts /RC . This ends the data phase of the DMA Write Byte
+    DMA_TIMING_POINT(DMA_TP_DATA_OFF);
     DISABLE_BUS_BUFFER_U2;                //  Floats the data bus. This is to avoid contention
+    DMA_LA_Sample(LA_SAMPLE_DMA_WRITE, DMA_Addr_for_Logic_Analyzer++, buffer[buffer_index - 1]);
   }
   //
   //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
   //  /RC is asserted and the last data byte to be written is on the data bus
   //
 
-  if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
-  {
-    DMA_Logic_Analyzer_Support(buffer, bytecount, 1);
-  }
-
   return buffer_index;
 }
 
@@ -650,6 +823,10 @@ uint8_t DMA_Peek8(uint32_t address)
 {
   uint8_t data;
 
+  if (DRAM_Shadow_Read(address, &data, 1))
+  {
+    return data;            //  No DMA needed
+  }
   DMA_Request = true;
   while(!DMA_Active){}      // Wait for acknowledgement, and Bus ownership
 
@@ -665,6 +842,10 @@ uint16_t DMA_Peek16(uint32_t address)
 {
   uint16_t data;
 
+  if (DRAM_Shadow_Read(address, (uint8_t *)&data, 2))
+  {
+    return data;            //  No DMA needed
+  }
   DMA_Request = true;
   while(!DMA_Active){};     // Wait for acknowledgement, and Bus ownership
   DMA_Read_Block(address , (uint8_t *)&data , 2);
@@ -695,6 +876,186 @@ void DMA_Poke16(uint32_t address, uint16_t val)
   while(DMA_Active){};      // Wait for release
 }
 
+////////////////////////////////////////////////////////////////////////////////  DMA Sessions  ////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+//
+//  Each DMA_Peek/DMA_Poke pays for a DMA request, the grant, and release_DMA_request() , and the HP85 is halted
+//  for all of it. DMA_Session() requests the bus once, runs a list of operations (see DMA_OP_READ etc. in
+//  EBTKS_Global_Data.h) over any addresses, and then releases it. Each operation still needs its own 2 LMA
+//  cycles, as the addresses are not contiguous.
+//
+//  The 1MA2 refresh is taken care of by DMA_Read_Block() and DMA_Write_Block() , as the refresh scheduler
+//  (EBTKS_DMA_Scheduler.cpp) carries the refresh debt from one block to the next within a grant.
+//
+//  Returns the number of operations completed, which is less than op_count if a poll ran out of reads.
+//  The DRAM shadow is not used for reads, so DMA_OP_READ_MODIFY_WRITE is atomic with respect to the HP85.
+//
+
+int32_t DMA_Session(struct S_DMA_Op ops[], uint32_t op_count)
+{
+  uint32_t          index, reads, offset;
+  uint8_t           data;
+  struct S_DMA_Op   *op;
+
+  Logic_Analyzer_Prefetch();  //  DMA_LA_Sample() only records cycles whose PSRAM store is in the cache,
+  Flight_Recorder_Prefetch(); //  and loop() can't prefetch during the session
+  DMA_Request = true;
+  while(!DMA_Active){};     // Wait for acknowledgement, and Bus ownership
+
+  for (index = 0 ; index < op_count ; index++)
+  {
+    op = &ops[index];
+    switch (op->op)
+    {
+      case DMA_OP_READ:
+        DMA_Read_Block(op->address, op->buffer, op->count);
+        break;
+      case DMA_OP_WRITE:
+        DMA_Write_Block(op->address, op->buffer, op->count);
+        break;
+      case DMA_OP_READ_MODIFY_WRITE:
+        DMA_Read_Block(op->address, &data, 1);
+        data = (data & op->mask) | op->value;
+        DMA_Write_Block(op->address, &data, 1);
+        if (op->buffer)
+        {
+          *op->buffer = data;
+        }
+        break;
+      case DMA_OP_POLL:
+        reads = 0;
+        do
+        {
+          if (op->limit && (reads++ == op->limit))
+          {
+            goto session_end;               //  Ran out of reads
+          }
+          DMA_Read_Block(op->address, &data, 1);
+        } while ((data & op->mask) != op->value);
+        if (op->buffer)
+        {
+          *op->buffer = data;
+        }
+        break;
+      case DMA_OP_WRITE_PACED:
+        for (offset = 0 ; offset < op->count ; offset++)
+        {
+          reads = 0;
+          do
+          {
+            if (op->limit && (reads++ == op->limit))
+            {
+              goto session_end;             //  Ran out of reads, before this byte
+            }
+            DMA_Read_Block(op->status, &data, 1);
+          } while ((data & op->mask) != op->value);
+          DMA_Write_Block(op->address, &op->buffer[offset], 1);
+        }
+        break;
+    }
+  }
+
+session_end:
+  release_DMA_request();
+  while(DMA_Active){};      // Wait for release
+  return index;
+}
+
+//
+//  Compare the HP85 bus stall time of a mixed workload, done as one DMA session, and with a bus grant for each
+//  operation as DMA_Peek/DMA_Poke do (a read-modify-write keeps its read and write in one grant, for safety).
+//  The stall is timed from the DMA request to the end of the release, with interrupts off, so ARM_DWT_CYCCNT
+//  is good. The workload only reads, and rewrites one DRAM byte with its own value, so the HP85 is not disturbed.
+//
+
+#define DMA_BENCH_ROUNDS          (100)
+#define DMA_BENCH_RAM_ADDR        (DRAM_SHADOW_BASE_ADDR)
+
+static uint32_t DMA_Bench_Per_Grant(struct S_DMA_Op ops[], uint32_t op_count, uint32_t *grants)
+{
+  uint32_t          index, start, cycles, reads;
+  uint8_t           data = 0;
+  struct S_DMA_Op   *op;
+
+  cycles = 0;
+  for (index = 0 ; index < op_count ; index++)
+  {
+    op = &ops[index];
+    reads = 0;
+    do
+    {
+      start = ARM_DWT_CYCCNT;
+      DMA_Request = true;
+      while(!DMA_Active){};
+      switch (op->op)
+      {
+        case DMA_OP_READ:
+          DMA_Read_Block(op->address, op->buffer, op->count);
+          break;
+        case DMA_OP_WRITE:
+          DMA_Write_Block(op->address, op->buffer, op->count);
+          break;
+        case DMA_OP_READ_MODIFY_WRITE:
+          DMA_Read_Block(op->address, &data, 1);
+          data = (data & op->mask) | op->value;
+          DMA_Write_Block(op->address, &data, 1);
+          break;
+        case DMA_OP_POLL:
+          DMA_Read_Block(op->address, &data, 1);
+          break;
+      }
+      release_DMA_request();
+      while(DMA_Active){};
+      cycles += ARM_DWT_CYCCNT - start;
+      (*grants)++;
+    } while ((op->op == DMA_OP_POLL) && ((data & op->mask) != op->value) && (++reads != op->limit));
+  }
+  return cycles;
+}
+
+void DMA_Session_Bench(void)
+{
+  uint32_t          round, start, session_cycles, grant_cycles, grants, completed;
+  uint8_t           status, word[2], block[32];
+  struct S_DMA_Op   ops[] =
+  {
+    {DMA_OP_POLL,               0x80, 0x00, CRTSTS,                 0, &status, 1000},    //  CRT not busy, as writePixel() does
+    {DMA_OP_READ,               0,    0,    DMA_BENCH_RAM_ADDR,     2, word},
+    {DMA_OP_READ,               0,    0,    DMA_BENCH_RAM_ADDR + 2, 32, block},
+    {DMA_OP_READ_MODIFY_WRITE,  0xFF, 0x00, DMA_BENCH_RAM_ADDR + 1, 0, NULL},             //  Writes back what it read
+    {DMA_OP_POLL,               0x80, 0x00, CRTSTS,                 0, &status, 1000},
+    {DMA_OP_READ,               0,    0,    CRTSTS,                 1, &status}
+  };
+  const uint32_t    op_count = sizeof(ops) / sizeof(ops[0]);
+
+  session_cycles = 0;
+  grant_cycles   = 0;
+  grants         = 0;
+  completed      = 0;
+  for (round = 0 ; round < DMA_BENCH_ROUNDS ; round++)
+  {
+    start = ARM_DWT_CYCCNT;
+    completed += DMA_Session(ops, op_count);
+    session_cycles += ARM_DWT_CYCCNT - start;
+    grant_cycles += DMA_Bench_Per_Grant(ops, op_count, &grants);
+  }
+
+  Serial.printf("\nDMA bench, %d rounds of %lu operations (poll, read 2, read 32, read-modify-write, poll, read 1)\n",
+                DMA_BENCH_ROUNDS, op_count);
+  if (completed != DMA_BENCH_ROUNDS * op_count)
+  {
+    Serial.printf("Only %lu operations completed, the CRT stayed busy\n", completed);
+  }
+  Serial.printf("                   Grants   Stall us   us/round  Bus cycles/round\n");
+  Serial.printf("One session     %9d  %9lu  %9lu  %9lu\n", DMA_BENCH_ROUNDS, session_cycles / (F_CPU_ACTUAL / 1000000),
+                session_cycles / (F_CPU_ACTUAL / 1000000) / DMA_BENCH_ROUNDS,
+                session_cycles / (F_CPU_ACTUAL / 1000000) * 10 / 16 / DMA_BENCH_ROUNDS);
+  Serial.printf("Grant per op    %9lu  %9lu  %9lu  %9lu\n", grants, grant_cycles / (F_CPU_ACTUAL / 1000000),
+                grant_cycles / (F_CPU_ACTUAL / 1000000) / DMA_BENCH_ROUNDS,
+                grant_cycles / (F_CPU_ACTUAL / 1000000) * 10 / 16 / DMA_BENCH_ROUNDS);
+  Serial.printf("\n");
+}
+
 //
 //  Since we are doing DMA (otherwise why call this routine), Pin change interrupts for Phi 1 and Phi 2 are disabled.
 //  DMA is released 200 ns after the falling edge of Phi 2
@@ -749,52 +1110,20 @@ void release_DMA_request(void)
   NVIC_CLEAR_PENDING(IRQ_GPIO6789);         //  Do it again, just to be sure
   NVIC_ENABLE_IRQ(IRQ_GPIO6789);            //  and re-enable the interrupt controller for these Pin interrupts
   PHI_1_and_2_IMR = (BIT_MASK_PHASE1 | BIT_MASK_PHASE2);   //  Enable Phi 1 and Phi 2 interrupts
+  DMA_Sched_Release();                      //  The CPU has the bus from here, and the refresh scheduler times the gap to the next grant
   __enable_irq();                           //  Enable all interrupts, now that DMA is complete. Allows USB activity, Serial via USB, SysTick
-}
 
-
-//
-//  While DMA is running, all interrupts are disabled, so the normal Logic Analyzer updates that happen during onPhi_1_Rise()
-//  are not going to happen. The timing is pretty scary around DMA, so the strategy is that after the DMA is complete, but before
-//  DMA is released, the DMA transfers are repeated, but into the logic analyzer.
-//
-//  Mode is 0 for read, 1 for write
-//
-//  WE DO NOT TRACE THE DMA LMA Cycles, or the Refresh Cycles. We do not support triggering on DMA
-//
-static void DMA_Logic_Analyzer_Support(uint8_t buffer[], uint32_t bytecount, int mode)
-{
-  uint32_t    index;
-
-  index = 0;
-
-  if (Logic_Analyzer_Triggered && (Logic_Analyzer_State == ANALYZER_ACQUIRING))
+#if ENABLE_EVENT_TRACE
+  //
+  //  Nothing else is traced while we own the bus, so both ends of the session can be recorded here, in order.
+  //  The trace only has 16 bits for the byte count
+  //
+  if (Event_Trace_Active)
   {
-    while(index < bytecount)
-    {
-      Logic_Analyzer_main_sample = (DMA_Addr_for_Logic_Analyzer++ << 8) | buffer[index++];
-      if (mode == 0)
-      {   //    Read
-        Logic_Analyzer_main_sample |= 0x0D000000;
-      }
-      else
-      {   //    Write
-        Logic_Analyzer_main_sample |= 0x0B000000;
-      }
-      Logic_Analyzer_aux_sample  =  getRselec() & 0x000000FF;
-
-      Logic_Analyzer_Data_1[Logic_Analyzer_Data_index  ] = Logic_Analyzer_main_sample;
-      Logic_Analyzer_Data_2[Logic_Analyzer_Data_index++] = Logic_Analyzer_aux_sample;
-
-      Logic_Analyzer_Data_index &= Logic_Analyzer_Current_Index_Mask;          //  Modulo addressing of sample buffer. Requires buffer length to be a power of two
-      Logic_Analyzer_Valid_Samples++;   //  This could theoretically over flow if we didn't see a trigger in 7000 seconds (1.9 hours). Saturating is not worth the overhead
-      if (Logic_Analyzer_Triggered)
-      {
-        if (--Logic_Analyzer_Samples_Till_Done == 0)
-        {
-          Logic_Analyzer_State = ANALYZER_ACQUISITION_DONE;
-        }
-      }
-    }
+    Event_Trace_Record(TRACE_DMA, TRACE_PHASE_BEGIN, 0, DMA_Grant_Cycles);
+    Event_Trace_Record(TRACE_DMA, TRACE_PHASE_END, (DMA_Session_Bytes > 0xFFFF) ? 0xFFFF : DMA_Session_Bytes, ARM_DWT_CYCCNT);
   }
+  DMA_Session_Bytes = 0;
+#endif
 }
+
@@ -0,0 +1,424 @@
+//
+//      11/23/2020      Background DMA jobs
+//      11/26/2020      Unsliced jobs for the screen writes, and DMA_Queue_Run() , which runs a job at once when the
+//                      engine can't be run (from a job callback) or the queue is full
+//
+//  DMA_Session() and the DMA_Peek/DMA_Poke functions keep the bus, and interrupts off, until they are done. That is
+//  fine for a few bytes, but restoring the CRT, or moving a few KB for the AUXROM, stops USB Serial and SysTick for
+//  milliseconds. Instead, a caller can describe the work as a list of DMA session operations (S_DMA_Job in
+//  EBTKS_Global_Data.h), hand it to DMA_Queue_Submit() , and carry on. DMA_Engine_Poll() , called from loop() , runs
+//  the queued jobs a slice at a time, each slice with its own bus grant, so interrupts are serviced in between.
+//  When a job is done, or a poll runs out of reads, its callback is called from DMA_Engine_Poll() .
+//
+//  A slice is at most DMA_QUEUE_SLICE_OPS operations and DMA_QUEUE_SLICE_BYTES data cycles. Reads and writes are
+//  split across slices, a DMA_OP_WRITE_PACED becomes a poll and a write per byte, and a poll gets at most
+//  DMA_QUEUE_POLL_READS reads per slice, carrying on in the next slice if the condition is not met yet.
+//  The 1MA2 refresh is looked after by the refresh scheduler within each slice, as for any other DMA.
+//
+//  A job marked unsliced is run as one slice, with one bus grant, whatever its size. The CRT restore and the
+//  Term85 screen update are: they set CRTBAD and then stream CRTDAT, and if the HP85 got the bus in between,
+//  its own screen writes would move the CRT address out from under them.
+//
+//  Ordering and fairness:
+//      Jobs from one client (DMA_CLIENT_AUXROM etc.) run one at a time, in the order they were submitted
+//      Clients with work queued take turns, a slice each, so a long CRT restore doesn't hold up the AUXROM
+//
+//  A caller that needs the result before it can continue, such as AUXROM_Fetch_Memory() , uses DMA_Queue_Run() ,
+//  which submits the job and runs the engine until it is done, with interrupts serviced between slices. If that
+//  can't be done, because it was called from a job callback (the engine is already running) or the queue is full,
+//  it runs the whole job right away in one DMA_Session() , as the callers did before the queue.
+//  DMA_Queue_Wait() , on a job that was submitted earlier, returns false from a job callback.
+//
+//  Serial commands:
+//      dma queue       Show the queue and the job and slice counts by client
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+struct S_DMA_Queue_Stats
+{
+  uint32_t    submitted;
+  uint32_t    done;
+  uint32_t    failed;
+  uint32_t    slices;
+  uint32_t    bytes;
+  uint32_t    at_once;                                        //  Run by DMA_Queue_Run() without the queue
+};
+
+static struct S_DMA_Job   *DMA_Queue[DMA_QUEUE_LENGTH];           //  In the order they were submitted
+static uint32_t     DMA_Queue_Count = 0;
+static uint32_t     DMA_Queue_Max_Count = 0;
+static uint32_t     DMA_Queue_Rejected = 0;
+static uint8_t      DMA_Queue_Last_Client = DMA_NUM_CLIENTS - 1;  //  So DMA_CLIENT_AUXROM goes first
+static bool         DMA_Engine_Running = false;
+
+static struct S_DMA_Queue_Stats   DMA_Queue_Stats[DMA_NUM_CLIENTS];
+
+static const char * const DMA_Client_Names[DMA_NUM_CLIENTS] =
+{
+  "AUXROM", "CRT", "Term85", "Other"
+};
+
+//
+//  Returns false if the queue is full, or the job is already queued. Not within an ISR
+//
+
+bool DMA_Queue_Submit(struct S_DMA_Job *job)
+{
+  if ((DMA_Queue_Count == DMA_QUEUE_LENGTH) || (job->state == DMA_JOB_QUEUED) || (job->client >= DMA_NUM_CLIENTS))
+  {
+    DMA_Queue_Rejected++;
+    return false;
+  }
+  job->ops_done   = 0;
+  job->offset     = 0;
+  job->poll_reads = 0;
+  job->state      = DMA_JOB_QUEUED;
+  DMA_Queue[DMA_Queue_Count++] = job;
+  if (DMA_Queue_Count > DMA_Queue_Max_Count)
+  {
+    DMA_Queue_Max_Count = DMA_Queue_Count;
+  }
+  DMA_Queue_Stats[job->client].submitted++;
+  return true;
+}
+
+//
+//  The queue index of the next job to get a slice: the oldest job of the first client after the last one served
+//
+
+static int32_t DMA_Queue_Next(void)
+{
+  uint32_t    turn, client, index;
+
+  for (turn = 1 ; turn <= DMA_NUM_CLIENTS ; turn++)
+  {
+    client = (DMA_Queue_Last_Client + turn) % DMA_NUM_CLIENTS;
+    for (index = 0 ; index < DMA_Queue_Count ; index++)
+    {
+      if (DMA_Queue[index]->client == client)
+      {
+        return index;
+      }
+    }
+  }
+  return -1;
+}
+
+static void DMA_Queue_Finish(uint32_t index, uint8_t state)
+{
+  struct S_DMA_Job  *job = DMA_Queue[index];
+
+  memmove(&DMA_Queue[index], &DMA_Queue[index + 1], (DMA_Queue_Count - index - 1) * sizeof(DMA_Queue[0]));
+  DMA_Queue_Count--;
+  if (state == DMA_JOB_DONE)
+  {
+    DMA_Queue_Stats[job->client].done++;
+  }
+  else
+  {
+    DMA_Queue_Stats[job->client].failed++;
+  }
+  job->state = state;
+  if (job->callback)
+  {
+    job->callback(job);
+  }
+}
+
+//
+//  Reads for a poll in this slice. The first poll of a slice may be carrying on from the last slice
+//
+
+static uint32_t DMA_Job_Poll_Reads(struct S_DMA_Job *job, struct S_DMA_Op *op, bool first)
+{
+  uint32_t    left;
+
+  if (op->limit == 0)
+  {
+    return DMA_QUEUE_POLL_READS;
+  }
+  left = op->limit - (first ? job->poll_reads : 0);
+  return (left < DMA_QUEUE_POLL_READS) ? left : DMA_QUEUE_POLL_READS;
+}
+
+//
+//  Build the next slice of a job. For each slice operation, advance[] is the bytes of the job operation it
+//  completes, and ends[] is whether it completes the job operation. Returns the number of slice operations
+//
+
+static uint32_t DMA_Job_Slice(struct S_DMA_Job *job, struct S_DMA_Op slice[], uint16_t advance[], bool ends[], uint32_t *bytes)
+{
+  uint32_t          count = 0, budget = DMA_QUEUE_SLICE_BYTES, index, offset, take;
+  struct S_DMA_Op   *op;
+
+  index  = job->ops_done;
+  offset = job->offset;
+  while ((index < job->op_count) && (count < DMA_QUEUE_SLICE_OPS) && budget)
+  {
+    op = &job->ops[index];
+    switch (op->op)
+    {
+      case DMA_OP_READ:
+      case DMA_OP_WRITE:
+        take = op->count - offset;
+        take = (take > budget) ? budget : take;
+        slice[count]         = *op;
+        slice[count].address = op->address + offset;
+        slice[count].buffer  = op->buffer + offset;
+        slice[count].count   = take;
+        advance[count]       = take;
+        ends[count]          = (offset + take) == op->count;
+        count++;
+        budget -= take;
+        offset += take;
+        break;
+      case DMA_OP_READ_MODIFY_WRITE:
+        slice[count]   = *op;
+        advance[count] = 0;
+        ends[count]    = true;
+        count++;
+        budget = (budget > 2) ? budget - 2 : 0;
+        offset = op->count;
+        break;
+      case DMA_OP_POLL:
+        slice[count]       = *op;
+        slice[count].limit = DMA_Job_Poll_Reads(job, op, count == 0);
+        advance[count]     = 0;
+        ends[count]        = true;
+        count++;
+        budget--;                                             //  The usual case is a read or two
+        offset = op->count;
+        break;
+      case DMA_OP_WRITE_PACED:
+        if (op->count == 0)
+        {
+          slice[count]   = {DMA_OP_WRITE, 0, 0, op->address, 0, op->buffer};     //  Does nothing, but completes the operation
+          advance[count] = 0;
+          ends[count]    = true;
+          count++;
+          break;
+        }
+        while ((offset < op->count) && ((count + 2) <= DMA_QUEUE_SLICE_OPS) && (budget >= 2))
+        {
+          slice[count]   = {DMA_OP_POLL, op->mask, op->value, op->status, 0, NULL, DMA_Job_Poll_Reads(job, op, count == 0)};
+          advance[count] = 0;
+          ends[count]    = false;
+          count++;
+          slice[count]   = {DMA_OP_WRITE, 0, 0, op->address, 1, &op->buffer[offset]};
+          advance[count] = 1;
+          ends[count]    = (offset + 1) == op->count;
+          count++;
+          budget -= 2;
+          offset++;
+        }
+        break;
+      default:                                                //  Nothing to do, but it still has to be passed
+        slice[count]   = *op;
+        advance[count] = 0;
+        ends[count]    = true;
+        count++;
+        offset = op->count;
+        break;
+    }
+    if (offset < op->count)
+    {
+      break;                                                  //  Out of room in this slice
+    }
+    index++;
+    offset = 0;
+  }
+  *bytes = DMA_QUEUE_SLICE_BYTES - budget;
+  return count;
+}
+
+//
+//  Data cycles for a job's operations, as DMA_Job_Slice() counts them
+//
+
+static uint32_t DMA_Job_Bytes(struct S_DMA_Op ops[], uint32_t op_count)
+{
+  uint32_t    index, bytes = 0;
+
+  for (index = 0 ; index < op_count ; index++)
+  {
+    switch (ops[index].op)
+    {
+      case DMA_OP_READ:
+      case DMA_OP_WRITE:
+        bytes += ops[index].count;
+        break;
+      case DMA_OP_READ_MODIFY_WRITE:
+        bytes += 2;
+        break;
+      case DMA_OP_POLL:
+        bytes++;
+        break;
+      case DMA_OP_WRITE_PACED:
+        bytes += 2 * ops[index].count;
+        break;
+    }
+  }
+  return bytes;
+}
+
+//
+//  Run one slice of the queue index job with its own bus grant. Returns false if the job is finished
+//
+
+static bool DMA_Job_Run_Slice(uint32_t index)
+{
+  struct S_DMA_Job  *job = DMA_Queue[index];
+  struct S_DMA_Op   slice[DMA_QUEUE_SLICE_OPS];
+  uint16_t          advance[DMA_QUEUE_SLICE_OPS];
+  bool              ends[DMA_QUEUE_SLICE_OPS];
+  uint32_t          count, completed, i, bytes;
+  struct S_DMA_Op   *op;
+
+  if (job->unsliced && (job->ops_done < job->op_count))
+  {                                                           //  All of it, and polls have their own limits
+    count     = job->op_count - job->ops_done;
+    completed = DMA_Session(&job->ops[job->ops_done], count);
+    DMA_Queue_Stats[job->client].slices++;
+    DMA_Queue_Stats[job->client].bytes += DMA_Job_Bytes(&job->ops[job->ops_done], count);
+    job->ops_done += completed;
+    if (completed < count)
+    {
+      DMA_Queue_Finish(index, DMA_JOB_FAILED);
+      return false;
+    }
+  }
+  else if (job->ops_done < job->op_count)
+  {
+    count = DMA_Job_Slice(job, slice, advance, ends, &bytes);
+    completed = DMA_Session(slice, count);
+    DMA_Queue_Stats[job->client].slices++;
+    DMA_Queue_Stats[job->client].bytes += bytes;
+    for (i = 0 ; i < completed ; i++)
+    {
+      job->offset += advance[i];
+      if (advance[i] || ends[i])
+      {
+        job->poll_reads = 0;
+      }
+      if (ends[i])
+      {
+        job->ops_done++;
+        job->offset = 0;
+      }
+    }
+    if (completed < count)
+    {                                                         //  A poll ran out of its reads for this slice
+      op = &job->ops[job->ops_done];
+      job->poll_reads += slice[completed].limit;
+      if (op->limit && (job->poll_reads >= op->limit))
+      {
+        DMA_Queue_Finish(index, DMA_JOB_FAILED);
+        return false;
+      }
+    }
+  }
+  if (job->ops_done >= job->op_count)
+  {
+    DMA_Queue_Finish(index, DMA_JOB_DONE);
+    return false;
+  }
+  return true;
+}
+
+//
+//  Called from loop() . Runs slices, taking turns by client, until the queue is empty or DMA_QUEUE_POLL_US is up
+//
+
+void DMA_Engine_Poll(void)
+{
+  int32_t     index;
+  uint32_t    start = micros();
+
+  if (DMA_Engine_Running)
+  {
+    return;                                                   //  Called from a callback
+  }
+  DMA_Engine_Running = true;
+  while ((index = DMA_Queue_Next()) >= 0)
+  {
+    DMA_Queue_Last_Client = DMA_Queue[index]->client;
+    DMA_Job_Run_Slice(index);
+    if ((micros() - start) >= DMA_QUEUE_POLL_US)
+    {
+      break;
+    }
+  }
+  DMA_Engine_Running = false;
+}
+
+//
+//  Run the engine until the job is done. Returns true if it completed, false if a poll ran out of reads,
+//  or if called from a job callback, where the engine can't be run
+//
+
+bool DMA_Queue_Wait(struct S_DMA_Job *job)
+{
+  if (DMA_Engine_Running)
+  {
+    return false;
+  }
+  while (job->state == DMA_JOB_QUEUED)
+  {
+    DMA_Engine_Poll();
+  }
+  return job->state == DMA_JOB_DONE;
+}
+
+//
+//  Run a job and return when it is done. Returns true if it completed, false if a poll ran out of reads.
+//  From a job callback, or with the queue full, the whole job is run at once, in one DMA_Session() . A job
+//  that is already queued can only be waited for, so that returns false from a callback
+//
+
+bool DMA_Queue_Run(struct S_DMA_Job *job)
+{
+  if (job->state == DMA_JOB_QUEUED)
+  {
+    return DMA_Queue_Wait(job);
+  }
+  if (!DMA_Engine_Running && DMA_Queue_Submit(job))
+  {
+    return DMA_Queue_Wait(job);
+  }
+  if (job->client >= DMA_NUM_CLIENTS)
+  {
+    return false;
+  }
+  job->offset     = 0;
+  job->poll_reads = 0;
+  job->ops_done   = DMA_Session(job->ops, job->op_count);
+  job->state      = (job->ops_done == job->op_count) ? DMA_JOB_DONE : DMA_JOB_FAILED;
+  DMA_Queue_Stats[job->client].at_once++;
+  DMA_Queue_Stats[job->client].bytes += DMA_Job_Bytes(job->ops, job->op_count);
+  if (job->callback)
+  {
+    job->callback(job);
+  }
+  return job->state == DMA_JOB_DONE;
+}
+
+void DMA_Queue_Report(void)
+{
+  uint32_t    client;
+
+  Serial.printf("\nDMA queue: %lu jobs queued, most %lu of %d, %lu rejected\n", DMA_Queue_Count, DMA_Queue_Max_Count,
+                DMA_QUEUE_LENGTH, DMA_Queue_Rejected);
+  Serial.printf("Slices of up to %d bytes and %d operations, up to %d us per loop()\n", DMA_QUEUE_SLICE_BYTES,
+                DMA_QUEUE_SLICE_OPS, DMA_QUEUE_POLL_US);
+  Serial.printf("Client     Submitted       Done     Failed     Slices    At once      Bytes\n");
+  for (client = 0 ; client < DMA_NUM_CLIENTS ; client++)
+  {
+    Serial.printf("%-8s  %10lu %10lu %10lu %10lu %10lu %10lu\n", DMA_Client_Names[client], DMA_Queue_Stats[client].submitted,
+                  DMA_Queue_Stats[client].done, DMA_Queue_Stats[client].failed, DMA_Queue_Stats[client].slices,
+                  DMA_Queue_Stats[client].at_once, DMA_Queue_Stats[client].bytes);
+  }
+  Serial.printf("\n");
+}
@@ -0,0 +1,403 @@
+//
+//      11/22/2020      Refresh aware DMA burst scheduler
+//      11/26/2020      The 2 LMA cycles of each block are always counted, there is no "lmaBusy" any more. The longest run of
+//                      busy cycles is one short of interval * postponed, so the default is the 17 of the old fixed bursts.
+//                      "dma sched check" runs a 1MA2 model that only sees the bus cycles, see below
+//
+//  The 1MA2 DRAM controller asks for a refresh every interval bus cycles (9 on the HP85). The refresh is done
+//  in a cycle without a DRAM access, and up to postponed (2) requests can wait for one. DMA_Read_Block() and
+//  DMA_Write_Block() used to give it DMA_BURST_BREAK_CYCLES after every MAX_DMA_BURST_LENGTH bytes, whatever
+//  had happened before. Now they ask this scheduler, which keeps a running refresh debt in bus cycles:
+//
+//      Each busy cycle (our LMA and data cycles) adds 1, as 1/interval of a refresh request comes due
+//      Each idle cycle subtracts interval - 1, as it pays one refresh, less the 1/interval that comes due
+//
+//  The debt is never allowed past interval * postponed - 1. A run of that many busy cycles sees at most postponed
+//  requests come due, even if one came due on the CPU's last cycle before the grant and is still waiting. A burst
+//  is as long as the remaining room allows, and a break is as many idle cycles as the debt can use, at least one.
+//  Sustained DMA then approaches (interval - 1) / interval of the bus. Before each block, enough idle cycles are
+//  inserted for the 2 LMA cycles and one data cycle to fit, so DMA_Session() needs no refresh logic of its own.
+//
+//  Between grants the CPU has the bus. If it has had it for at least interval * (postponed + 1) bus cycles,
+//  we assume no more than grant_debt refreshes are waiting, as HP's own timing depends on that. Otherwise the
+//  debt from our last grant is kept, and the gap is counted as busy cycles.
+//
+//  "dma sched check" tests these decisions against a model of the 1MA2 that knows nothing of the debt. It is fed
+//  the bus cycles one at a time, DRAM access or not, and counts a request every interval cycles from a starting
+//  phase, doing one in each cycle without a DRAM access. Any cycle of ours with more than postponed requests
+//  waiting is a violation. Between grants, the CPU's cycles go through the model too: all DRAM accesses for a
+//  short gap, and for a long one, DRAM accesses except where the CPU must leave the 1MA2 a cycle to keep no more
+//  than grant_debt requests waiting. The CPU's last cycle before the grant is always a DRAM access. Every legal
+//  setting is run at every phase with a set of mixed workloads. test/test_dma_sched runs the same check, and the
+//  cycles that DMA_Read_Block() actually puts on the bus, on the PC.
+//
+//  The settings for each machine model are read from CONFIG.TXT , such as
+//      "dmaRefresh": { "HP85A": { "interval": 9, "postponed": 2, "grantDebt": 0 } }
+//  and can be changed with "dma sched set"
+//
+//  Serial commands:
+//      dma sched         Show the settings and burst statistics
+//      dma sched set     Change the settings until the next restart
+//      dma sched check   Check every legal setting against the 1MA2 model
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define DMA_SCHED_LMA_CYCLES          (2)
+#define DMA_SCHED_CPU_PER_BUS_CYCLE   ((F_CPU_ACTUAL / 1000000U) * 1600U / 1000U)     //  1.6 us bus cycle
+#define DMA_SCHED_MODEL_WORKLOADS     (6)
+#define DMA_SCHED_MODEL_SESSIONS      (3)
+#define DMA_SCHED_MODEL_BLOCKS        (4)
+
+static bool       DMA_Sched_In_Grant = false;
+static bool       DMA_Sched_Released = false;               //  Not until the first release
+static uint32_t   DMA_Sched_Release_Cycles;
+static uint32_t   DMA_Sched_Release_Millis;
+
+static uint32_t DMA_Sched_Limit(struct S_DMA_Sched *sched)
+{
+  return sched->interval * sched->postponed - 1;
+}
+
+static void DMA_Sched_Busy(struct S_DMA_Sched *sched, uint32_t cycles)
+{
+  sched->debt += cycles;
+  sched->busy_cycles += cycles;
+  if (sched->debt > sched->max_debt)
+  {
+    sched->max_debt = sched->debt;
+  }
+}
+
+static void DMA_Sched_Idle(struct S_DMA_Sched *sched, uint32_t cycles)
+{
+  uint32_t    paid = cycles * (sched->interval - 1);
+
+  sched->debt = (sched->debt > paid) ? sched->debt - paid : 0;
+  sched->idle_cycles += cycles;
+}
+
+//
+//  Returns false, and leaves the settings alone, if any are out of the legal range
+//
+
+bool DMA_Sched_Configure(struct S_DMA_Sched *sched, uint32_t interval, uint32_t postponed, uint32_t grant_debt)
+{
+  if ((interval < DMA_REFRESH_INTERVAL_MIN) || (interval > DMA_REFRESH_INTERVAL_MAX) ||
+      (postponed < DMA_REFRESH_POSTPONED_MIN) || (postponed > DMA_REFRESH_POSTPONED_MAX) || (grant_debt >= postponed))
+  {
+    return false;
+  }
+  memset(sched, 0, sizeof(struct S_DMA_Sched));
+  sched->interval   = interval;
+  sched->postponed  = postponed;
+  sched->grant_debt = grant_debt;
+  sched->debt       = grant_debt * interval;
+  return true;
+}
+
+//
+//  A new bus grant, gap_bus_cycles after the last release
+//
+
+void DMA_Sched_Grant(struct S_DMA_Sched *sched, uint32_t gap_bus_cycles)
+{
+  if (gap_bus_cycles >= sched->interval * (sched->postponed + 1))
+  {
+    sched->debt = sched->grant_debt * sched->interval;
+  }
+  else
+  {
+    sched->debt += gap_bus_cycles;                          //  The CPU might have used every one of them
+  }
+}
+
+//
+//  Before a block. Returns the idle cycles to insert before the LMA cycles, and counts both
+//
+
+uint32_t DMA_Sched_Block_Start(struct S_DMA_Sched *sched)
+{
+  uint32_t    need, idle = 0;
+
+  need = sched->debt + DMA_SCHED_LMA_CYCLES + 1;
+  if (need > DMA_Sched_Limit(sched))
+  {
+    idle = (need - DMA_Sched_Limit(sched) + sched->interval - 2) / (sched->interval - 1);
+    DMA_Sched_Idle(sched, idle);
+  }
+  DMA_Sched_Busy(sched, DMA_SCHED_LMA_CYCLES);
+  return idle;
+}
+
+//
+//  Length of the next burst, at least 1. DMA_Sched_Block_Start() or DMA_Sched_Break() always leave room for one
+//
+
+uint32_t DMA_Sched_Burst(struct S_DMA_Sched *sched, uint32_t remaining)
+{
+  uint32_t    room = DMA_Sched_Limit(sched) - sched->debt;
+  uint32_t    burst = (remaining < room) ? remaining : room;
+
+  DMA_Sched_Busy(sched, burst);
+  sched->bursts++;
+  return burst;
+}
+
+//
+//  Idle cycles between two bursts of the same block
+//
+
+uint32_t DMA_Sched_Break(struct S_DMA_Sched *sched)
+{
+  uint32_t    idle = sched->debt / (sched->interval - 1);
+
+  if (idle == 0)
+  {
+    idle = 1;
+  }
+  DMA_Sched_Idle(sched, idle);
+  sched->breaks++;
+  return idle;
+}
+
+//
+//  The live scheduler. DMA_Sched_Release() is called at the end of release_DMA_request() , and
+//  DMA_Sched_Idles_Before_Block() by DMA_Read_Block() and DMA_Write_Block() . Interrupts are off for both
+//
+
+void DMA_Sched_Release(void)
+{
+  DMA_Sched_In_Grant = false;
+  DMA_Sched_Released = true;
+  DMA_Sched_Release_Cycles = ARM_DWT_CYCCNT;
+  DMA_Sched_Release_Millis = millis();
+}
+
+uint32_t DMA_Sched_Idles_Before_Block(void)
+{
+  uint32_t    gap;
+
+  if (!DMA_Sched_In_Grant)
+  {
+    if (!DMA_Sched_Released || ((millis() - DMA_Sched_Release_Millis) > 1000))    //  ARM_DWT_CYCCNT wraps after about 7 seconds
+    {
+      gap = UINT32_MAX;
+    }
+    else
+    {
+      gap = (ARM_DWT_CYCCNT - DMA_Sched_Release_Cycles) / DMA_SCHED_CPU_PER_BUS_CYCLE;
+    }
+    DMA_Sched_Grant(&DMA_Sched, gap);
+    DMA_Sched_In_Grant = true;
+  }
+  return DMA_Sched_Block_Start(&DMA_Sched);
+}
+
+void DMA_Sched_Report(void)
+{
+  uint32_t    total = DMA_Sched.busy_cycles + DMA_Sched.idle_cycles;
+
+  Serial.printf("\nDMA refresh scheduler: interval %lu, postponed %lu, grant debt %lu\n", DMA_Sched.interval,
+                DMA_Sched.postponed, DMA_Sched.grant_debt);
+  Serial.printf("Longest burst %lu bus cycles, debt now %lu, max %lu\n", DMA_Sched_Limit(&DMA_Sched), DMA_Sched.debt,
+                DMA_Sched.max_debt);
+  Serial.printf("Bursts %lu, breaks %lu, busy cycles %lu, idle cycles %lu", DMA_Sched.bursts, DMA_Sched.breaks,
+                DMA_Sched.busy_cycles, DMA_Sched.idle_cycles);
+  if (total)
+  {
+    Serial.printf(", %lu%% busy", (uint32_t)((DMA_Sched.busy_cycles * 100ULL) / total));
+  }
+  Serial.printf("\n\n");
+}
+
+void DMA_Sched_Set_Command(void)
+{
+  unsigned int    interval, postponed, grant_debt;
+
+  Serial.printf("interval(%d..%d) postponed(%d..%d) grant_debt(less than postponed), such as 9 2 0\n:",
+                DMA_REFRESH_INTERVAL_MIN, DMA_REFRESH_INTERVAL_MAX, DMA_REFRESH_POSTPONED_MIN, DMA_REFRESH_POSTPONED_MAX);
+  if (!wait_for_serial_string())
+  {
+    return;                                                     //  Got a Ctrl-C , so abort command
+  }
+  if (sscanf(serial_string, "%u %u %u", &interval, &postponed, &grant_debt) != 3)
+  {
+    serial_string_used();
+    Serial.printf("Need all 3 values\n");
+    return;
+  }
+  serial_string_used();
+  __disable_irq();                                              //  DMA_Sched is used with interrupts off
+  if (!DMA_Sched_Configure(&DMA_Sched, interval, postponed, grant_debt))
+  {
+    __enable_irq();
+    Serial.printf("Out of range, not changed\n");
+    return;
+  }
+  __enable_irq();
+  DMA_Sched_Report();
+}
+
+//
+//  The model of the 1MA2. It only sees the bus cycles, see the notes at the top of the file
+//
+
+struct S_Refresh_Model
+{
+  uint32_t    interval;
+  uint32_t    postponed;
+  uint32_t    counter;
+  uint32_t    pending;
+  uint32_t    worst;                                        //  Most requests waiting in any cycle of ours
+};
+
+static void Refresh_Model_Cycles(struct S_Refresh_Model *model, uint32_t cycles, bool dram, bool ours)
+{
+  while (cycles--)
+  {
+    if (++model->counter == model->interval)
+    {
+      model->counter = 0;
+      model->pending++;
+    }
+    if (!dram && model->pending)
+    {
+      model->pending--;
+    }
+    if (ours && (model->pending > model->worst))
+    {
+      model->worst = model->pending;
+    }
+  }
+}
+
+//
+//  The CPU has the bus for gap cycles. It makes a DRAM access in every cycle it can, without leaving more than
+//  limit requests waiting, and in its last cycle
+//
+
+static void Refresh_Model_CPU(struct S_Refresh_Model *model, uint32_t gap, uint32_t limit)
+{
+  uint32_t    due;
+
+  while (gap--)
+  {
+    due = (model->counter + 1 == model->interval) ? 1 : 0;
+    Refresh_Model_Cycles(model, 1, (gap == 0) || (model->pending + due <= limit), false);
+  }
+}
+
+//
+//  One block, as DMA_Read_Block() and DMA_Write_Block() run it
+//
+
+static void Refresh_Model_Block(struct S_Refresh_Model *model, struct S_DMA_Sched *sched, uint32_t bytecount)
+{
+  uint32_t    burst;
+
+  Refresh_Model_Cycles(model, DMA_Sched_Block_Start(sched), false, true);
+  Refresh_Model_Cycles(model, DMA_SCHED_LMA_CYCLES, true, true);
+  while (1)
+  {
+    burst = DMA_Sched_Burst(sched, bytecount);
+    Refresh_Model_Cycles(model, burst, true, true);
+    if ((bytecount -= burst) == 0)
+    {
+      break;
+    }
+    Refresh_Model_Cycles(model, DMA_Sched_Break(sched), false, true);
+  }
+}
+
+//
+//  Run one setting of the scheduler against a 1MA2 that can postpone model_postponed requests, at every phase
+//  of its counter and with the CPU leaving from 0 to grant_debt requests waiting. Returns the number of runs
+//  with too many waiting. Normally model_postponed is postponed. Less is a 1MA2 that the setting doesn't suit,
+//  which the tests use to see that the check can fail
+//
+
+uint32_t DMA_Sched_Check_Setting(uint32_t interval, uint32_t postponed, uint32_t grant_debt, uint32_t model_postponed, uint32_t *runs)
+{
+  static const uint16_t   block_sizes[] = {1, 1, 2, 3, 15, 16, 17, 18, 19, 40, 256};
+  uint32_t    phase, cpu_pending, workload, session, block, gap, seed, violations = 0;
+  uint32_t    long_gap = interval * (postponed + 1);
+  struct S_DMA_Sched      sched;
+  struct S_Refresh_Model  model;
+
+  for (phase = 0 ; phase < interval ; phase++)
+  {
+    for (cpu_pending = 0 ; cpu_pending <= grant_debt ; cpu_pending++)
+    {
+      seed = 1;                                             //  The same workloads for every setting
+      for (workload = 0 ; workload < DMA_SCHED_MODEL_WORKLOADS ; workload++)
+      {
+        if (!DMA_Sched_Configure(&sched, interval, postponed, grant_debt))
+        {
+          return 0;
+        }
+        model.interval  = interval;
+        model.postponed = model_postponed;
+        model.counter   = phase;
+        model.pending   = 0;
+        model.worst     = 0;
+        Refresh_Model_CPU(&model, long_gap, cpu_pending);                       //  The CPU has had the bus since power on
+        for (session = 0 ; session < DMA_SCHED_MODEL_SESSIONS ; session++)
+        {
+          for (block = 0 ; block <= (seed >> 16) % DMA_SCHED_MODEL_BLOCKS ; block++)
+          {
+            seed = seed * 1103515245 + 12345;
+            Refresh_Model_Block(&model, &sched, block_sizes[(seed >> 16) % (sizeof(block_sizes) / sizeof(block_sizes[0]))]);
+          }
+          seed = seed * 1103515245 + 12345;
+          switch ((seed >> 16) % 5)                         //  The gap to the next grant
+          {
+            case 0:  gap = 0;                                   break;
+            case 1:  gap = 3;                                   break;
+            case 2:  gap = long_gap - 1;                        break;    //  Longest that still counts as short
+            case 3:  gap = long_gap;                            break;
+            default: gap = long_gap + (seed >> 8) % 1000;       break;
+          }
+          Refresh_Model_CPU(&model, gap, (gap >= long_gap) ? cpu_pending : postponed);
+          DMA_Sched_Grant(&sched, gap);
+        }
+        (*runs)++;
+        if (model.worst > model.postponed)
+        {
+          violations++;
+        }
+      }
+    }
+  }
+  return violations;
+}
+
+void DMA_Sched_Check_Command(void)
+{
+  uint32_t    interval, postponed, grant_debt, found;
+  uint32_t    settings = 0, runs = 0, violations = 0, start = millis();
+
+  Serial.printf("\nChecking the DMA refresh scheduler against the 1MA2 model, for every legal setting\n");
+  for (interval = DMA_REFRESH_INTERVAL_MIN ; interval <= DMA_REFRESH_INTERVAL_MAX ; interval++)
+  {
+    for (postponed = DMA_REFRESH_POSTPONED_MIN ; postponed <= DMA_REFRESH_POSTPONED_MAX ; postponed++)
+    {
+      for (grant_debt = 0 ; grant_debt < postponed ; grant_debt++)
+      {
+        settings++;
+        if ((found = DMA_Sched_Check_Setting(interval, postponed, grant_debt, postponed, &runs)) != 0)
+        {
+          if (violations < 10)
+          {
+            Serial.printf("  Interval %lu, postponed %lu, grant debt %lu: %lu runs with too many refreshes waiting\n",
+                          interval, postponed, grant_debt, found);
+          }
+          violations += found;
+        }
+      }
+    }
+  }
+  Serial.printf("%lu settings, %lu runs, %lu violations, %lu ms\n\n", settings, runs, violations, millis() - start);
+}
@@ -0,0 +1,207 @@
+//
+//      11/24/2020      DMA timing check
+//      11/26/2020      DMA_Timing_Check() returns the number of rules failed, for test/test_dma_timing. Without
+//                      ENABLE_DMA_TIMING_CHECK only the command is built, to say so
+//
+//  The DMA code depends on hand tuned busy waits (EBTKS_delay_ns(), the NOP sled in EBTKS_delay_for_LMA_start(),
+//  the CTRL_*_TWEAK macros) and on where it is in the Phi 1 / Phi 2 cycle when each one starts. A change that
+//  upsets this used to be visible only on a scope. With ENABLE_DMA_TIMING_CHECK set, DMA_TIMING_POINT() stamps
+//  ARM_DWT_CYCCNT at each step of a transfer (DMA_TP_LMA1_PHI1_RISE etc. in EBTKS.h), and "dma timing" runs
+//  DMA_TIMING_ROUNDS one byte reads and writes of a DRAM byte (written back with its own value), and checks
+//  each interval against the rules below. The result is the waveform of /LMA, /RD, /WR and the data bus as
+//  driven by the Teensy, in ns from the Phi edges, with the worst case of each rule over all the rounds.
+//
+//  On the Teensy this is the real clock and the real pins. test/test_dma_timing runs the same check in the
+//  [env:native] build, where the Phi edges come from the bus clock model and the busy waits take their Teensy
+//  times (test/native/EBTKS_Native), so a change that breaks a rule is caught before it gets to the scope.
+//  Neither can see the delay through U2/U3, the I/O bus cable and the 1MA8, which the tuning notes allow for.
+//  So the rules are on the Teensy side:
+//      Address and data hold after Phi 1 falls, 40 to 150 ns, from the 1MB5 spec in DMA_Read_Block()
+//      /LMA, /RD and /WR low for about 1160 ns, as tuned at the 1MB1. Both edges see the same path delay
+//      /LMA, /RD and /WR fall after Phi 1 rises, and early enough to arrive at the 1MB1 near 130 ns
+//      Each address byte is on the bus before its /LMA ends, and /LMA falls with at least 50 ns of Phi 1 high left
+//  A Phi edge is stamped when the wait for it ends, which is late by up to one read of the pin, about 10 ns.
+//  The stamps themselves add a few ns to each step, so retune with ENABLE_DMA_TIMING_CHECK off.
+//
+//  To tighten the delays for throughput: change a tweak, rebuild with the check enabled, and run "dma timing".
+//
+//  Serial commands:
+//      dma timing      Run the check and show the waveform and the rules
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_DMA_TIMING_CHECK
+
+#define DMA_TIMING_ROUNDS             (100)
+#define DMA_TIMING_RAM_ADDR           (DRAM_SHADOW_BASE_ADDR)
+#define DMA_TIMING_NS(cycles)         ((uint32_t)(((uint64_t)(cycles) * 1000U) / (F_CPU_ACTUAL / 1000000U)))
+
+#define DMA_TIMING_READ               (0x01)          //  Which transfers a rule applies to
+#define DMA_TIMING_WRITE              (0x02)
+#define DMA_TIMING_BOTH               (0x03)
+
+struct S_DMA_Timing_Rule
+{
+  const char  *name;
+  uint8_t     from;                                   //  DMA_TP_*
+  uint8_t     to;
+  uint8_t     applies;
+  uint32_t    min_ns;
+  uint32_t    max_ns;
+};
+
+static const struct S_DMA_Timing_Rule DMA_Timing_Rules[] =
+{
+  {"/LMA 1 fall after Phi 1 rise",      DMA_TP_LMA1_PHI1_RISE,  DMA_TP_LMA1_ASSERT,     DMA_TIMING_BOTH,    20,  200},
+  {"Addr low on before /LMA 1 ends",    DMA_TP_ADDR_LOW_ON,     DMA_TP_LMA1_RELEASE,    DMA_TIMING_BOTH,   100, 1600},
+  {"/LMA 1 low",                        DMA_TP_LMA1_ASSERT,     DMA_TP_LMA1_RELEASE,    DMA_TIMING_BOTH,  1100, 1220},
+  {"/LMA 2 fall after Phi 1 rise",      DMA_TP_LMA2_PHI1_RISE,  DMA_TP_LMA2_ASSERT,     DMA_TIMING_BOTH,    20,  200},
+  {"/LMA 2 fall before Phi 1 fall",     DMA_TP_LMA2_ASSERT,     DMA_TP_LMA2_PHI1_FALL,  DMA_TIMING_BOTH,    50, 1600},
+  {"Addr low hold after Phi 1 fall",    DMA_TP_LMA2_PHI1_FALL,  DMA_TP_ADDR_LOW_OFF,    DMA_TIMING_BOTH,    40,  150},
+  {"Addr high on before /LMA 2 ends",   DMA_TP_ADDR_HIGH_ON,    DMA_TP_LMA2_RELEASE,    DMA_TIMING_BOTH,   100, 1600},
+  {"/LMA 2 low",                        DMA_TP_LMA2_ASSERT,     DMA_TP_LMA2_RELEASE,    DMA_TIMING_BOTH,  1100, 1220},
+  {"/RD /WR fall after Phi 1 rise",     DMA_TP_RDWR_PHI1_RISE,  DMA_TP_RDWR_ASSERT,     DMA_TIMING_BOTH,    20,  200},
+  {"Addr high hold after Phi 1 fall",   DMA_TP_RDWR_PHI1_FALL,  DMA_TP_ADDR_HIGH_OFF,   DMA_TIMING_BOTH,    40,  150},
+  {"/RD /WR low",                       DMA_TP_RDWR_ASSERT,     DMA_TP_RDWR_RELEASE,    DMA_TIMING_BOTH,  1100, 1220},
+  {"Data on before /WR ends",           DMA_TP_DATA_ON,         DMA_TP_RDWR_RELEASE,    DMA_TIMING_WRITE,  100, 1600},
+  {"Data hold after Phi 1 fall",        DMA_TP_DATA_PHI1_FALL,  DMA_TP_DATA_OFF,        DMA_TIMING_WRITE,   40,  150},
+  {"Read data sample after Phi 1 fall", DMA_TP_DATA_PHI1_FALL,  DMA_TP_DATA_OFF,        DMA_TIMING_READ,     0,   40}
+};
+
+#define DMA_TIMING_NUM_RULES          (sizeof(DMA_Timing_Rules) / sizeof(DMA_Timing_Rules[0]))
+
+static const char * const DMA_Timing_Point_Names[DMA_TP_NUM] =
+{
+  "Phi 1 rise", "/LMA low, addr low", "Phi 2 fall", "Addr low on bus", "/LMA high",
+  "Phi 1 rise", "/LMA low, addr high", "Phi 1 fall", "Addr low off bus", "Phi 2 fall", "Addr high on bus", "/LMA high",
+  "Phi 1 rise", "/RD or /WR low", "Phi 1 fall", "Addr high off bus",
+  "Phi 2 fall", "Write data on bus", "/RD or /WR high", "Phi 1 fall", "Data off bus / sampled"
+};
+
+struct S_DMA_Timing_Result
+{
+  uint32_t    min;                                    //  In CPU cycles
+  uint32_t    max;
+};
+
+//
+//  One byte, read then written back in the same grant, and the stamps kept for each. Interrupts are off from
+//  the grant to the end of release_DMA_request() , and millis() doesn't run, so ARM_DWT_CYCCNT is the only clock
+//
+
+static void DMA_Timing_Run(uint32_t read_stamps[], uint32_t write_stamps[])
+{
+  uint8_t     data;
+
+  DMA_Request = true;
+  while(!DMA_Active){};     // Wait for acknowledgement, and Bus ownership
+  memset(DMA_Timing_Stamps, 0, sizeof(DMA_Timing_Stamps));
+  DMA_Read_Block(DMA_TIMING_RAM_ADDR, &data, 1);
+  memcpy(read_stamps, DMA_Timing_Stamps, sizeof(DMA_Timing_Stamps));
+  memset(DMA_Timing_Stamps, 0, sizeof(DMA_Timing_Stamps));
+  DMA_Write_Block(DMA_TIMING_RAM_ADDR, &data, 1);
+  memcpy(write_stamps, DMA_Timing_Stamps, sizeof(DMA_Timing_Stamps));
+  release_DMA_request();
+  while(DMA_Active){};      // Wait for release
+}
+
+static void DMA_Timing_Waveform(const char *title, uint32_t stamps[])
+{
+  uint32_t    point;
+
+  Serial.printf("\n%s, ns from the first Phi 1 rise\n", title);
+  for (point = 0 ; point < DMA_TP_NUM ; point++)
+  {
+    if (stamps[point] == 0)
+    {
+      continue;                                       //  Not a step of this transfer
+    }
+    Serial.printf("  %6lu  %s\n", DMA_TIMING_NS(stamps[point] - stamps[DMA_TP_LMA1_PHI1_RISE]), DMA_Timing_Point_Names[point]);
+  }
+}
+
+//
+//  Run the check and show the results. Returns the number of rules failed
+//
+
+uint32_t DMA_Timing_Check(void)
+{
+  uint32_t    round, rule, failures = 0, interval;
+  uint32_t    read_stamps[DMA_TP_NUM], write_stamps[DMA_TP_NUM];
+  uint32_t    *stamps;
+  uint8_t     direction;
+  struct S_DMA_Timing_Result  results[DMA_TIMING_NUM_RULES][2];
+  const struct S_DMA_Timing_Rule  *r;
+
+  for (rule = 0 ; rule < DMA_TIMING_NUM_RULES ; rule++)
+  {
+    results[rule][0].min = results[rule][1].min = UINT32_MAX;
+    results[rule][0].max = results[rule][1].max = 0;
+  }
+  for (round = 0 ; round < DMA_TIMING_ROUNDS ; round++)
+  {
+    DMA_Timing_Run(read_stamps, write_stamps);
+    for (rule = 0 ; rule < DMA_TIMING_NUM_RULES ; rule++)
+    {
+      r = &DMA_Timing_Rules[rule];
+      for (direction = 0 ; direction < 2 ; direction++)
+      {
+        if (!(r->applies & (direction ? DMA_TIMING_WRITE : DMA_TIMING_READ)))
+        {
+          continue;
+        }
+        stamps = direction ? write_stamps : read_stamps;
+        interval = stamps[r->to] - stamps[r->from];
+        if (interval < results[rule][direction].min)
+        {
+          results[rule][direction].min = interval;
+        }
+        if (interval > results[rule][direction].max)
+        {
+          results[rule][direction].max = interval;
+        }
+      }
+    }
+  }
+
+  DMA_Timing_Waveform("DMA read, last round", read_stamps);
+  DMA_Timing_Waveform("DMA write, last round", write_stamps);
+  Serial.printf("\n%d rounds. Times in ns at the Teensy pins\n", DMA_TIMING_ROUNDS);
+  Serial.printf("Rule                                  Dir      Min      Max      Window\n");
+  for (rule = 0 ; rule < DMA_TIMING_NUM_RULES ; rule++)
+  {
+    r = &DMA_Timing_Rules[rule];
+    for (direction = 0 ; direction < 2 ; direction++)
+    {
+      if (!(r->applies & (direction ? DMA_TIMING_WRITE : DMA_TIMING_READ)))
+      {
+        continue;
+      }
+      bool  pass = (DMA_TIMING_NS(results[rule][direction].min) >= r->min_ns) &&
+                   (DMA_TIMING_NS(results[rule][direction].max) <= r->max_ns);
+      failures += pass ? 0 : 1;
+      Serial.printf("%-36s  %-5s %8lu %8lu  %5lu..%-5lu %s\n", r->name, direction ? "Write" : "Read",
+                    DMA_TIMING_NS(results[rule][direction].min), DMA_TIMING_NS(results[rule][direction].max),
+                    r->min_ns, r->max_ns, pass ? "" : "FAIL");
+    }
+  }
+  Serial.printf("\n%lu rules failed\n\n", failures);
+  return failures;
+}
+
+void DMA_Timing_Check_Command(void)
+{
+  DMA_Timing_Check();
+}
+
+#else
+
+void DMA_Timing_Check_Command(void)
+{
+  Serial.printf("The DMA timing check is not enabled. Set ENABLE_DMA_TIMING_CHECK in EBTKS_Config.h and rebuild\n");
+}
+
+#endif
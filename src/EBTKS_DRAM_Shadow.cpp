@@ -0,0 +1,311 @@
+//
+//      11/06/2020      Shadow copy of the HP85 built-in DRAM
+//      11/26/2020      DRAM_Shadow_Enable() switches the shadow pages in place, rather than rebuilding the page table
+//                      under the running ISR
+//
+//  Every bus write cycle already reaches onWriteData(), whatever the address. With the shadow enabled,
+//  DRAM_Shadow_Enable() (and buildPageTable() , if it runs later) points the write_ptr of every built-in DRAM page at DRAM_Shadow[], so the existing
+//  page table write path keeps a copy of everything the CPU writes, at no extra cost in the ISR.
+//  read_ptr is left NULL, so EBTKS never drives the bus for these pages.
+//
+//  Reads of HP85 memory (DMA_Peek8(), DMA_Peek16(), AUXROM_Fetch_Memory(), and so HexDump_HP85_mem() )
+//  are then served from the shadow, with no DMA.
+//
+//  What the ISR does not see:
+//    Memory contents from before the shadow was enabled. The first read after enabling does a one time
+//      DMA read of the whole range to prime the shadow (DRAM_Shadow_Prime() )
+//    Our own DMA writes, as interrupts are off during DMA. DMA_Write_Block() calls DRAM_Shadow_Update()
+//
+//  Range is 0100000..0137777 for an HP85A, and 0100000..0177377 for an HP85B. Pages that EBTKS itself
+//  provides (the HP85A 16K RAM module) are never shadowed. Not supported for HP86/87, which bank switch memory.
+//
+//  Opt-in with "dramShadow": true in CONFIG.TXT, or the "shadow on" command. "shadow check" compares
+//  the whole shadow against DMA reads, and "shadow verify" does that comparison for every shadow read.
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+static DMAMEM uint8_t   DRAM_Shadow[DRAM_SHADOW_SIZE];            //  DMAMEM is not cleared, but we always prime before use
+
+static bool       DRAM_Shadow_Snooping = false;                   //  Page_Table[] points writes at DRAM_Shadow[]
+static bool       DRAM_Shadow_Primed   = false;                   //  DRAM_Shadow[] has been filled by DMA since snooping started
+static bool       DRAM_Shadow_Verify   = false;                   //  Check every shadow read against a DMA read
+static uint32_t   DRAM_Shadow_End      = DRAM_SHADOW_BASE_ADDR;   //  One past the last shadowed address, depends on machine type
+
+static uint32_t   DRAM_Shadow_Reads;
+static uint32_t   DRAM_Shadow_Bytes;
+static uint32_t   DRAM_Shadow_Divergences;
+
+static uint8_t    DRAM_Shadow_Check_Buffer[MAX_DMA_TRANSFER_LENGTH];
+
+//
+//  Called by buildPageTable() and DRAM_Shadow_Set_Pages() for each page without a write_ptr. Returns NULL if the page is not shadowed
+//
+
+uint8_t * getDRAMShadowPage(uint32_t page)
+{
+  if (!DRAM_Shadow_Snooping || ((page << 8) < DRAM_SHADOW_BASE_ADDR) || ((page << 8) >= DRAM_Shadow_End))
+  {
+    return NULL;
+  }
+  return &DRAM_Shadow[(page << 8) - DRAM_SHADOW_BASE_ADDR];
+}
+
+//
+//  Switch the shadow on or off, with the ISR running. Only the built-in DRAM pages are touched, each with single
+//  stores that take it from one valid setting to the next: off is the flag cleared, so no reads are served from
+//  the shadow, then write_ptr. On is write_ptr, then the flag. Pages that EBTKS owns (the 16K RAM) are left alone
+//
+
+static void DRAM_Shadow_Set_Pages(bool on)
+{
+  uint32_t    page;
+
+  for (page = (DRAM_SHADOW_BASE_ADDR >> 8) ; page < (IO_ADDR >> 8) ; page++)
+  {
+    if (on)
+    {
+      if ((Page_Table[page].write_ptr == NULL) && (Page_Table[page].flags == 0) &&
+          (Page_Table[page].write_ptr = getDRAMShadowPage(page)))
+      {
+        Page_Table[page].flags = PAGE_FLAG_DRAM_SHADOW;
+      }
+    }
+    else if (Page_Table[page].flags == PAGE_FLAG_DRAM_SHADOW)
+    {
+      Page_Table[page].flags     = 0;
+      Page_Table[page].write_ptr = NULL;
+    }
+  }
+}
+
+void DRAM_Shadow_Enable(bool en)
+{
+  DRAM_Shadow_Snooping = false;                 //  Before the pointers are cleared, so nothing trusts the shadow
+  DRAM_Shadow_Primed   = false;
+  DRAM_Shadow_Set_Pages(false);
+
+  if (!en)
+  {
+    return;
+  }
+  switch (getMachineNum())
+  {
+    case MACH_HP85A:
+      DRAM_Shadow_End = HP85A_16K_RAM_module_base_addr;
+      break;
+    case MACH_HP85B:
+      DRAM_Shadow_End = IO_ADDR;
+      break;
+    default:
+      LOGPRINTF("DRAM shadow is only supported on HP85A and HP85B\n");
+      return;
+  }
+  DRAM_Shadow_Snooping = true;
+  DRAM_Shadow_Set_Pages(true);                  //  Must be before priming, so no write can be missed
+}
+
+//
+//  DMA read that takes care of acquiring and releasing the bus, in chunks of MAX_DMA_TRANSFER_LENGTH
+//
+
+static void DRAM_Shadow_DMA_Read(uint32_t addr, uint8_t *buffer, uint32_t count)
+{
+  uint32_t    chunk;
+
+  while (count)
+  {
+    chunk = (count > MAX_DMA_TRANSFER_LENGTH) ? MAX_DMA_TRANSFER_LENGTH : count;
+    DMA_Request = true;
+    while(!DMA_Active){};     // Wait for acknowledgement, and Bus ownership
+    DMA_Read_Block(addr, buffer, chunk);
+    release_DMA_request();
+    while(DMA_Active){};      // Wait for release
+    addr   += chunk;
+    buffer += chunk;
+    count  -= chunk;
+  }
+}
+
+//
+//  Fill the shadow from the real DRAM. Snooping is already on, so any CPU write between our DMA
+//  chunks lands in the shadow, and a later chunk reads the same value back from the DRAM.
+//
+
+static bool DRAM_Shadow_Prime(void)
+{
+  if (!DRAM_Shadow_Snooping)
+  {
+    return false;
+  }
+  DRAM_Shadow_DMA_Read(DRAM_SHADOW_BASE_ADDR, DRAM_Shadow, DRAM_Shadow_End - DRAM_SHADOW_BASE_ADDR);
+  DRAM_Shadow_Primed = true;
+  return true;
+}
+
+//
+//  Is every byte of addr..addr+count-1 currently shadowed?
+//
+
+static bool DRAM_Shadow_Covers(uint32_t addr, uint32_t count)
+{
+  uint32_t    page;
+
+  if (!DRAM_Shadow_Snooping || (count == 0) || (addr < DRAM_SHADOW_BASE_ADDR) || ((addr + count) > DRAM_Shadow_End))
+  {
+    return false;
+  }
+  for (page = addr >> 8 ; page <= ((addr + count - 1) >> 8) ; page++)
+  {
+    if (!(Page_Table[page].flags & PAGE_FLAG_DRAM_SHADOW))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+//  Compare the shadow against DMA reads. On a mismatch, read that byte again to rule out the CPU having
+//  written it between our DMA read and the compare. Returns the number of divergent bytes.
+//
+
+static uint32_t DRAM_Shadow_Compare(uint32_t addr, uint32_t count, bool report)
+{
+  uint32_t    chunk, index, divergent = 0;
+  uint8_t     recheck;
+
+  while (count)
+  {
+    chunk = (count > MAX_DMA_TRANSFER_LENGTH) ? MAX_DMA_TRANSFER_LENGTH : count;
+    DRAM_Shadow_DMA_Read(addr, DRAM_Shadow_Check_Buffer, chunk);
+    for (index = 0 ; index < chunk ; index++)
+    {
+      if (DRAM_Shadow_Check_Buffer[index] != DRAM_Shadow[addr + index - DRAM_SHADOW_BASE_ADDR])
+      {
+        DRAM_Shadow_DMA_Read(addr + index, &recheck, 1);
+        if (recheck != DRAM_Shadow[addr + index - DRAM_SHADOW_BASE_ADDR])
+        {
+          if (report && (divergent < 16))
+          {
+            Serial.printf("Divergence at %06o  DRAM %03o  Shadow %03o\n", (unsigned int)(addr + index),
+                          recheck, DRAM_Shadow[addr + index - DRAM_SHADOW_BASE_ADDR]);
+          }
+          divergent++;
+        }
+      }
+    }
+    addr  += chunk;
+    count -= chunk;
+  }
+  return divergent;
+}
+
+//
+//  Returns true if the whole range was served from the shadow, else the caller must use DMA
+//
+
+bool DRAM_Shadow_Read(uint32_t addr, uint8_t *buffer, uint32_t count)
+{
+  uint32_t    divergent;
+
+  if (!DRAM_Shadow_Covers(addr, count))
+  {
+    return false;
+  }
+  if (!DRAM_Shadow_Primed && !DRAM_Shadow_Prime())
+  {
+    return false;
+  }
+  memcpy(buffer, &DRAM_Shadow[addr - DRAM_SHADOW_BASE_ADDR], count);
+  DRAM_Shadow_Reads++;
+  DRAM_Shadow_Bytes += count;
+
+  if (DRAM_Shadow_Verify)
+  {
+    divergent = DRAM_Shadow_Compare(addr, count, false);
+    if (divergent)
+    {
+      DRAM_Shadow_Divergences += divergent;
+      LOGPRINTF("DRAM shadow divergence: %lu bytes in %06o..%06o\n", divergent, (unsigned int)addr, (unsigned int)(addr + count - 1));
+    }
+  }
+  return true;
+}
+
+//
+//  Called by DMA_Write_Block(), with interrupts off. Do exactly what onWriteData() would have done
+//
+
+void DRAM_Shadow_Update(uint32_t addr, uint8_t *buffer, uint32_t count)
+{
+  const struct S_Page_Descriptor *page;
+
+  if (!DRAM_Shadow_Snooping)
+  {
+    return;
+  }
+  while (count--)
+  {
+    page = &Page_Table[(addr >> 8) & 0xFFU];
+    if (page->flags & PAGE_FLAG_DRAM_SHADOW)
+    {
+      page->write_ptr[addr & 0xFFU] = *buffer;
+    }
+    addr++;
+    buffer++;
+  }
+}
+
+//
+//  Serial commands
+//
+
+void DRAM_Shadow_Status(void)
+{
+  Serial.printf("\nDRAM shadow is %s", DRAM_Shadow_Snooping ? "on" : "off");
+  if (DRAM_Shadow_Snooping)
+  {
+    Serial.printf(", %06o..%06o, %s, verify is %s", DRAM_SHADOW_BASE_ADDR, (unsigned int)(DRAM_Shadow_End - 1),
+                  DRAM_Shadow_Primed ? "primed" : "not yet primed", DRAM_Shadow_Verify ? "on" : "off");
+  }
+  Serial.printf("\nReads served from shadow: %lu (%lu bytes).  Divergences found by verify: %lu\n\n",
+                DRAM_Shadow_Reads, DRAM_Shadow_Bytes, DRAM_Shadow_Divergences);
+}
+
+void DRAM_Shadow_On_Command(void)
+{
+  DRAM_Shadow_Enable(true);
+  DRAM_Shadow_Status();
+}
+
+void DRAM_Shadow_Off_Command(void)
+{
+  DRAM_Shadow_Enable(false);
+  DRAM_Shadow_Status();
+}
+
+void DRAM_Shadow_Verify_Command(void)
+{
+  DRAM_Shadow_Verify = !DRAM_Shadow_Verify;
+  Serial.printf("DRAM shadow verify is %s\n", DRAM_Shadow_Verify ? "on" : "off");
+}
+
+void DRAM_Shadow_Check_Command(void)
+{
+  uint32_t    divergent;
+
+  if (!DRAM_Shadow_Snooping)
+  {
+    Serial.printf("DRAM shadow is off\n");
+    return;
+  }
+  if (!DRAM_Shadow_Primed)
+  {
+    DRAM_Shadow_Prime();
+  }
+  divergent = DRAM_Shadow_Compare(DRAM_SHADOW_BASE_ADDR, DRAM_Shadow_End - DRAM_SHADOW_BASE_ADDR, true);
+  Serial.printf("DRAM shadow check: %lu divergent bytes in %lu\n\n", divergent, DRAM_Shadow_End - DRAM_SHADOW_BASE_ADDR);
+}
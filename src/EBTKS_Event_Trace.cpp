@@ -0,0 +1,297 @@
+//
+//      11/20/2020      Firmware event tracing, saved as Chrome trace JSON
+//      11/26/2020      The ring is in the PSRAM budget (EBTKS_Config.h), and only built with ENABLE_EVENT_TRACE.
+//                      "trace on" checks it with PSRAM_HOLDS()
+//
+//  TRACE_BEGIN() and TRACE_END() (EBTKS.h) mark the slow background operations:
+//      tape read, tape write     Tape::blockRead() and Tape::blockWrite(), arg is the block number
+//      disk read, disk write     HPDisk::readSector() and HPDisk::writeSector(), arg is the LBA
+//      AUXROM                    Each AUXROM_Poll() function call, arg is the usage code
+//      1MB5                      processOB() when there is an OB to process, arg is the OB value
+//      log flush                 flush_logfile()
+//      DMA                       From the DMA grant to the end of release_DMA_request(), arg is the byte count
+//
+//  Each point stores ARM_DWT_CYCCNT and millis() in a ring in PSRAM, and once the ring is full the oldest
+//  entries are overwritten. When ENABLE_EVENT_TRACE is 0 the trace points compile to nothing, and when it
+//  is 1 but tracing is off, they cost one test of Event_Trace_Active.
+//
+//  ARM_DWT_CYCCNT wraps after about 7 seconds, so on save each entry's time is rebuilt from millis(), and
+//  then corrected to the cycle with ARM_DWT_CYCCNT. This works as long as the two were read within a couple
+//  of seconds of each other, which is always the case. (The DMA begin entry uses the cycle count from the
+//  grant, but millis() doesn't move while interrupts are off during DMA)
+//
+//  The saved file is in the Chrome trace event format, with times in microseconds. Open it with
+//  chrome://tracing or https://ui.perfetto.dev . There is no need for a host side converter.
+//
+//  Serial commands:
+//      trace on      Clear the ring and start tracing
+//      trace off     Stop tracing
+//      trace         Show status, and the count and total time for each trace point
+//      trace save    Write the ring to /TRACE.JSON on the SD Card
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define TRACE_FILE_NAME               "/TRACE.JSON"
+#define TRACE_CYCLES_PER_MS           (F_CPU_ACTUAL / 1000U)
+#define TRACE_WRITE_BUFFER_SIZE       (4096)
+
+extern "C" uint8_t external_psram_size;                   //  In MB, set by startup.c. 0 if no PSRAM is fitted
+
+#if ENABLE_EVENT_TRACE
+
+struct S_Trace_Event
+{
+  uint32_t    cycles;                                     //  ARM_DWT_CYCCNT
+  uint32_t    ms;                                         //  millis()
+  uint8_t     id;                                         //  TRACE_TAPE_READ etc.
+  uint8_t     phase;                                      //  TRACE_PHASE_BEGIN or TRACE_PHASE_END
+  uint16_t    arg;
+};
+
+static const char * const Trace_Names[TRACE_NUM_IDS] =
+{
+  "tape read", "tape write", "disk read", "disk write", "AUXROM", "1MB5", "log flush", "DMA"
+};
+
+static const char * const Trace_Arg_Names[TRACE_NUM_IDS] =
+{
+  "block", "block", "lba", "lba", "usage", "ob", NULL, "bytes"
+};
+
+EXTMEM static struct S_Trace_Event  Event_Trace_Ring[EVENT_TRACE_ENTRIES];
+static uint32_t     Event_Trace_Count = 0;                //  Entries recorded since trace on. The ring holds the last EVENT_TRACE_ENTRIES
+static uint32_t     Event_Trace_Start_Time;
+
+//
+//  Only called through TRACE_BEGIN() and TRACE_END() , and by release_DMA_request() . Not within an ISR
+//
+
+void Event_Trace_Record(uint8_t id, uint8_t phase, uint16_t arg, uint32_t cycles)
+{
+  struct S_Trace_Event  *event = &Event_Trace_Ring[Event_Trace_Count & (EVENT_TRACE_ENTRIES - 1)];
+
+  event->cycles = cycles;
+  event->ms     = millis();
+  event->id     = id;
+  event->phase  = phase;
+  event->arg    = arg;
+  Event_Trace_Count++;
+}
+
+//
+//  Cycles from the base entry to this entry, see the notes at the top of the file
+//
+
+static uint64_t Event_Trace_Cycles_Since(struct S_Trace_Event *base, struct S_Trace_Event *event)
+{
+  int64_t     approx;
+
+  approx = (int64_t)(int32_t)(event->ms - base->ms) * TRACE_CYCLES_PER_MS;
+  return (uint64_t)(approx + (int32_t)((event->cycles - base->cycles) - (uint32_t)approx));
+}
+
+static uint32_t Event_Trace_Entries(void)
+{
+  return (Event_Trace_Count < EVENT_TRACE_ENTRIES) ? Event_Trace_Count : EVENT_TRACE_ENTRIES;
+}
+
+static struct S_Trace_Event * Event_Trace_Entry(uint32_t index)           //  0 is the oldest entry in the ring
+{
+  return &Event_Trace_Ring[(Event_Trace_Count - Event_Trace_Entries() + index) & (EVENT_TRACE_ENTRIES - 1)];
+}
+
+void Event_Trace_On_Command(void)
+{
+  if (!PSRAM_HOLDS(&Event_Trace_Ring[EVENT_TRACE_ENTRIES]))
+  {
+    Serial.printf("Not enough PSRAM for the event trace (%d MB fitted)\n", external_psram_size);
+    return;
+  }
+  Event_Trace_Active = false;
+  Event_Trace_Count = 0;
+  Event_Trace_Start_Time = millis();
+  Event_Trace_Active = true;
+  Serial.printf("Event trace started\n");
+}
+
+void Event_Trace_Off_Command(void)
+{
+  Event_Trace_Active = false;
+  Serial.printf("Event trace stopped after %lu ms, %lu events\n", millis() - Event_Trace_Start_Time, Event_Trace_Count);
+}
+
+//
+//  Count and total time for each trace point, matching each end with the latest open begin of the same id
+//
+
+void Event_Trace_Report(void)
+{
+  uint32_t    i, entries, id;
+  uint32_t    count[TRACE_NUM_IDS];
+  uint64_t    total[TRACE_NUM_IDS], max[TRACE_NUM_IDS], begin[TRACE_NUM_IDS], when;
+  bool        open[TRACE_NUM_IDS];
+  struct S_Trace_Event  *event;
+  bool        was_active = Event_Trace_Active;
+
+  Serial.printf("\nEvent trace is %s. %lu events recorded, ring holds %d\n", was_active ? "running" : "stopped",
+                Event_Trace_Count, EVENT_TRACE_ENTRIES);
+  if ((entries = Event_Trace_Entries()) == 0)
+  {
+    Serial.printf("\n");
+    return;
+  }
+  Event_Trace_Active = false;                             //  Hold the ring still while we look at it
+  memset(count, 0, sizeof(count));
+  memset(total, 0, sizeof(total));
+  memset(max, 0, sizeof(max));
+  memset(open, 0, sizeof(open));
+  for (i = 0 ; i < entries ; i++)
+  {
+    event = Event_Trace_Entry(i);
+    id = event->id;
+    when = Event_Trace_Cycles_Since(Event_Trace_Entry(0), event);
+    if (event->phase == TRACE_PHASE_BEGIN)
+    {
+      begin[id] = when;
+      open[id] = true;
+    }
+    else if (open[id])
+    {
+      count[id]++;
+      total[id] += when - begin[id];
+      if ((when - begin[id]) > max[id])
+      {
+        max[id] = when - begin[id];
+      }
+      open[id] = false;
+    }
+  }
+  Event_Trace_Active = was_active;
+
+  Serial.printf("Trace point       Count    Total us      Avg us      Max us\n");
+  for (id = 0 ; id < TRACE_NUM_IDS ; id++)
+  {
+    if (count[id] == 0)
+    {
+      continue;
+    }
+    Serial.printf("%-12s  %9lu  %10lu  %10lu  %10lu\n", Trace_Names[id], count[id],
+                  (uint32_t)(total[id] * 1000 / TRACE_CYCLES_PER_MS),
+                  (uint32_t)(total[id] * 1000 / TRACE_CYCLES_PER_MS / count[id]),
+                  (uint32_t)(max[id] * 1000 / TRACE_CYCLES_PER_MS));
+  }
+  Serial.printf("\n");
+}
+
+//
+//  Write the ring as {"traceEvents":[ ... ]} , one B or E event per line. An end whose begin has already
+//  been overwritten is left out. A begin without an end is left in, and shows as running to the end of the trace
+//
+
+static char       Trace_Write_Buffer[TRACE_WRITE_BUFFER_SIZE];
+static uint32_t   Trace_Write_Length;
+
+static void Event_Trace_Write(File *file, const char *text)
+{
+  uint32_t    len = strlen(text);
+
+  if ((Trace_Write_Length + len) > TRACE_WRITE_BUFFER_SIZE)
+  {
+    file->write(Trace_Write_Buffer, Trace_Write_Length);
+    Trace_Write_Length = 0;
+  }
+  memcpy(&Trace_Write_Buffer[Trace_Write_Length], text, len);
+  Trace_Write_Length += len;
+}
+
+void Event_Trace_Save_Command(void)
+{
+  File        trace_file;
+  uint32_t    i, entries, written, ns;
+  uint32_t    depth[TRACE_NUM_IDS];
+  uint64_t    cycles;
+  struct S_Trace_Event  *event;
+  char        line[160], args[32];
+  bool        was_active = Event_Trace_Active;
+
+  if ((entries = Event_Trace_Entries()) == 0)
+  {
+    Serial.printf("The event trace is empty. Use trace on\n");
+    return;
+  }
+  Event_Trace_Active = false;                             //  Also keeps our own SD writes out of the trace
+  if (!(trace_file = SD.open(TRACE_FILE_NAME, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Can't open %s\n", TRACE_FILE_NAME);
+    Event_Trace_Active = was_active;
+    return;
+  }
+  Trace_Write_Length = 0;
+  Event_Trace_Write(&trace_file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  memset(depth, 0, sizeof(depth));
+  written = 0;
+  for (i = 0 ; i < entries ; i++)
+  {
+    event = Event_Trace_Entry(i);
+    if (event->phase == TRACE_PHASE_BEGIN)
+    {
+      depth[event->id]++;
+    }
+    else if (depth[event->id] == 0)
+    {
+      continue;
+    }
+    else
+    {
+      depth[event->id]--;
+    }
+    cycles = Event_Trace_Cycles_Since(Event_Trace_Entry(0), event);
+    ns = (uint32_t)((cycles * 1000000) / TRACE_CYCLES_PER_MS % 1000);
+    args[0] = 0;
+    if (Trace_Arg_Names[event->id] != NULL)
+    {
+      sprintf(args, ",\"args\":{\"%s\":%u}", Trace_Arg_Names[event->id], event->arg);
+    }
+    sprintf(line, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,\"pid\":1,\"tid\":1%s}", written ? ",\n" : "",
+            Trace_Names[event->id], (event->phase == TRACE_PHASE_BEGIN) ? 'B' : 'E',
+            (uint32_t)(cycles * 1000 / TRACE_CYCLES_PER_MS), ns, args);
+    Event_Trace_Write(&trace_file, line);
+    written++;
+  }
+  Event_Trace_Write(&trace_file, "\n]}\n");
+  trace_file.write(Trace_Write_Buffer, Trace_Write_Length);
+  trace_file.close();
+  Event_Trace_Active = was_active;
+  Serial.printf("Wrote %lu events to %s\n", written, TRACE_FILE_NAME);
+}
+
+#else
+
+void Event_Trace_Record(uint8_t id, uint8_t phase, uint16_t arg, uint32_t cycles)
+{
+}
+
+void Event_Trace_On_Command(void)
+{
+  Serial.printf("Event tracing is not enabled. Set ENABLE_EVENT_TRACE in EBTKS_Config.h and rebuild\n");
+}
+
+void Event_Trace_Off_Command(void)
+{
+  Event_Trace_On_Command();
+}
+
+void Event_Trace_Report(void)
+{
+  Event_Trace_On_Command();
+}
+
+void Event_Trace_Save_Command(void)
+{
+  Event_Trace_On_Command();
+}
+
+#endif
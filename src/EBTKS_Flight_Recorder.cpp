@@ -0,0 +1,343 @@
+//
+//      11/15/2020      Continuous bus flight recorder, streamed to the SD Card
+//
+//  Unlike the Logic Analyzer, which captures around a trigger, the flight recorder records every bus cycle
+//  until it is stopped or the file is full. onPhi_1_Rise() calls Flight_Recorder_Sample(), which appends
+//  Logic_Analyzer_main_sample to a ring of 32 bit words in PSRAM. Flight_Recorder_Poll() (from loop() )
+//  drains the ring to /FLIGHT.BIN in FR_WRITE_WORDS * 4 byte (sector multiple) writes. The file is
+//  preallocated, so it is contiguous and the writes need no FAT updates. A write is only started when the
+//  SD Card is not busy, so loop() is held up for the time of one write at most.
+//
+//  At about 625000 bus cycles per second, the recorder produces 2.5 MB/s, and the ring holds about 0.8 seconds
+//  of that, to ride out the SD Card's occasional long writes. If the ring fills anyway, samples are counted as
+//  dropped, and a drop marker is put in the ring when there is room again.
+//
+//  As with deep Logic Analyzer captures, the ISR's stores into PSRAM would stall on cache line fills, so
+//  Flight_Recorder_Poll() also reads ahead of the ISR to keep the next FR_PREFETCH_WORDS in the data cache.
+//  DMA cycles are recorded by the DMA engine (interrupts are off during DMA), tagged as for the Logic Analyzer.
+//
+//  File format: a 512 byte text header (zero padded), then 32 bit little endian words:
+//      0x0xxxxxxx    A bus cycle. Same layout as Logic_Analyzer_main_sample, see EBTKS_Bus_Interface_ISR.cpp
+//      0x1xxxxxxx    Also a bus cycle, an opcode fetch (IFETCH, bit 28). Not in Format 1 files
+//      0x800000rr    RSELEC changed to rr, for the following cycles. Also the first word of the recording
+//      0x4nnnnnnn    nnnnnnn bus cycles were dropped here
+//
+//  Serial commands:
+//      fr start      Prompt for the file size, create and preallocate /FLIGHT.BIN, and start recording
+//      fr stop       Stop recording, write what is in the ring, and trim the file
+//      fr            Show the recorder status
+//
+//      11/26/2020      The ring is 2 MB, so the default EXTMEM fits in an 8 MB PSRAM (see the PSRAM budget in
+//                      EBTKS_Config.h), and "fr start" checks that the ring ends within the fitted PSRAM rather than
+//                      adding up sizes, as the linker may put it anywhere in EXTMEM
+//
+//      11/26/2020      DMA cycles are only recorded if Flight_Recorder_Store_Is_Cached(), as Flight_Recorder_Poll() can't
+//                      prefetch while interrupts are off for DMA. Others are counted as dropped, see EBTKS_DMA.cpp.
+//                      FR_Prefetch() no longer starts again when it has stopped a cache line past FR_PREFETCH_WORDS
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+extern "C" uint8_t external_psram_size;                   //  In MB, set by startup.c. 0 if no PSRAM is fitted
+
+#define FR_RING_MASK                  (FLIGHT_RECORDER_RING_WORDS - 1)
+#define FR_WRITE_WORDS                (8192)              //  32 KB, 64 sectors. FLIGHT_RECORDER_RING_WORDS must be a multiple of this
+#define FR_PREFETCH_WORDS             (4096)              //  16 KB, half the data cache
+#define FR_HEADER_BYTES               (512)
+#define FR_RSELEC_MARKER              (0x80000000U)
+#define FR_DROP_MARKER                (0x40000000U)
+#define FR_FILE_NAME                  "/FLIGHT.BIN"
+
+enum fr_state
+{
+  FR_IDLE = 0,
+  FR_RECORDING,
+  FR_STOPPING
+};
+
+#if ENABLE_FLIGHT_RECORDER
+EXTMEM static uint32_t  FR_Ring[FLIGHT_RECORDER_RING_WORDS] __attribute__ ((aligned (32)));
+#endif
+
+static volatile uint32_t    FR_Head;                      //  Only written by the ISR
+static volatile uint32_t    FR_Tail;                      //  Only written by Flight_Recorder_Poll()
+static volatile uint32_t    FR_Samples;                   //  Only written by the ISR
+static volatile uint32_t    FR_Dropped;                   //  Only written by the ISR
+static uint32_t             FR_Drop_Pending;              //  Only used by the ISR, dropped since the last drop marker
+static uint32_t             FR_Last_Rselec;               //  Only used by the ISR
+
+static enum fr_state        FR_State = FR_IDLE;
+static File                 FR_File;
+static uint64_t             FR_File_Bytes;                //  Preallocated size, less the header
+static uint64_t             FR_Bytes_Written;
+static uint32_t             FR_Prefetch_Index;
+static uint32_t             FR_High_Water;                //  Most words waiting in the ring
+static uint32_t             FR_Start_ms;
+static uint32_t             FR_Write_us_Max;
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+//  Called from onPhi_1_Rise() while Flight_Recorder_Active
+//
+
+FASTRUN void Flight_Recorder_Sample(void)
+{
+#if ENABLE_FLIGHT_RECORDER
+  uint32_t    head = FR_Head;
+
+  FR_Samples++;
+  if ((head - FR_Tail) > (FLIGHT_RECORDER_RING_WORDS - 3))    //  Room for a drop marker, an RSELEC marker, and the sample
+  {
+    FR_Dropped++;
+    FR_Drop_Pending++;
+    return;
+  }
+  if (FR_Drop_Pending)
+  {
+    FR_Ring[head++ & FR_RING_MASK] = FR_DROP_MARKER | (FR_Drop_Pending & 0x3FFFFFFFU);
+    FR_Drop_Pending = 0;
+  }
+  if (Logic_Analyzer_aux_sample != FR_Last_Rselec)
+  {
+    FR_Last_Rselec = Logic_Analyzer_aux_sample;
+    FR_Ring[head++ & FR_RING_MASK] = FR_RSELEC_MARKER | FR_Last_Rselec;
+  }
+  FR_Ring[head++ & FR_RING_MASK] = Logic_Analyzer_main_sample;
+  FR_Head = head;
+#endif
+}
+
+//
+//  For DMA_LA_Sample(), which runs with interrupts off. True if the next 3 words of the ring (a drop marker, an
+//  RSELEC marker, and the sample) were prefetched
+//
+
+FASTRUN bool Flight_Recorder_Store_Is_Cached(void)
+{
+  uint32_t    ahead = FR_Prefetch_Index - FR_Head;
+
+  return (ahead >= 3) && (ahead <= FR_PREFETCH_WORDS + 8);
+}
+
+//
+//  A cycle that could not be stored in time. A drop marker is put in the ring with the next sample
+//
+
+FASTRUN void Flight_Recorder_Drop(void)
+{
+  FR_Samples++;
+  FR_Dropped++;
+  FR_Drop_Pending++;
+}
+
+#if ENABLE_FLIGHT_RECORDER
+
+//
+//  Keep the cache lines ahead of the ISR loaded, see above
+//
+
+static void FR_Prefetch(void)
+{
+  uint32_t    head = FR_Head;
+
+  if ((FR_Prefetch_Index - head) > FR_PREFETCH_WORDS + 8)  //  The loop below can stop up to a line past FR_PREFETCH_WORDS
+  {     //  The ISR has overtaken us. Start again at the next cache line
+    FR_Prefetch_Index = (head + 8) & ~7U;
+  }
+  while ((FR_Prefetch_Index - head) < FR_PREFETCH_WORDS)
+  {
+    (void)*(volatile uint32_t *)&FR_Ring[FR_Prefetch_Index & FR_RING_MASK];
+    FR_Prefetch_Index += 8;                               //  32 byte cache lines
+  }
+}
+
+static void FR_Finish(const char *reason)
+{
+  Flight_Recorder_Active = false;
+  FR_File.truncate(FR_HEADER_BYTES + FR_Bytes_Written);
+  FR_File.close();
+  FR_State = FR_IDLE;
+  Serial.printf("Flight recorder stopped (%s). %lu cycles, %lu dropped, %llu bytes in %s\n", reason, FR_Samples, FR_Dropped,
+                FR_HEADER_BYTES + FR_Bytes_Written, FR_FILE_NAME);
+}
+
+#endif
+
+//
+//  For DMA_Session(), before it takes the bus
+//
+
+void Flight_Recorder_Prefetch(void)
+{
+#if ENABLE_FLIGHT_RECORDER
+  if (FR_State == FR_RECORDING)
+  {
+    FR_Prefetch();
+  }
+#endif
+}
+
+void Flight_Recorder_Poll(void)
+{
+#if ENABLE_FLIGHT_RECORDER
+  uint32_t    used, words, tail, start_us, elapsed_us;
+
+  if (FR_State == FR_IDLE)
+  {
+    return;
+  }
+  if (FR_State == FR_RECORDING)
+  {
+    FR_Prefetch();
+  }
+
+  tail = FR_Tail;
+  used = FR_Head - tail;
+  if (used > FR_High_Water)
+  {
+    FR_High_Water = used;
+  }
+  if ((used < FR_WRITE_WORDS) && ((FR_State == FR_RECORDING) || (used == 0)))
+  {
+    if (FR_State == FR_STOPPING)
+    {
+      FR_Finish("stop command");
+    }
+    return;
+  }
+  if (SD.card()->isBusy())
+  {
+    return;                                               //  Don't wait for the card, try again on the next poll
+  }
+
+  words = (used < FR_WRITE_WORDS) ? used : FR_WRITE_WORDS;
+  if (words > FLIGHT_RECORDER_RING_WORDS - (tail & FR_RING_MASK))
+  {
+    words = FLIGHT_RECORDER_RING_WORDS - (tail & FR_RING_MASK);     //  Only when stopping, as full writes never span the end of the ring
+  }
+  if (FR_Bytes_Written + words * sizeof(uint32_t) > FR_File_Bytes)
+  {
+    FR_Finish("file is full");
+    return;
+  }
+  start_us = micros();
+  if (FR_File.write(&FR_Ring[tail & FR_RING_MASK], words * sizeof(uint32_t)) != words * sizeof(uint32_t))
+  {
+    FR_Finish("SD Card write failed");
+    return;
+  }
+  elapsed_us = micros() - start_us;
+  if (elapsed_us > FR_Write_us_Max)
+  {
+    FR_Write_us_Max = elapsed_us;
+  }
+  FR_Bytes_Written += words * sizeof(uint32_t);
+  FR_Tail = tail + words;
+#endif
+}
+
+void Flight_Recorder_Start_Command(void)
+{
+#if ENABLE_FLIGHT_RECORDER
+  uint32_t    file_mb;
+  char        header[FR_HEADER_BYTES];
+
+  if (FR_State != FR_IDLE)
+  {
+    Serial.printf("Flight recorder is already running\n");
+    return;
+  }
+  if (!PSRAM_HOLDS(&FR_Ring[FLIGHT_RECORDER_RING_WORDS]))
+  {
+    Serial.printf("Not enough PSRAM for the flight recorder (%d MB fitted)\n", external_psram_size);
+    return;
+  }
+
+  Serial.printf("File size in MB (about 150 MB per minute)[%d]:", FLIGHT_RECORDER_FILE_MB);
+  if (!wait_for_serial_string())
+  {
+    return;                                               //  Got a Ctrl-C , so abort command
+  }
+  file_mb = FLIGHT_RECORDER_FILE_MB;
+  if (strlen(serial_string) != 0)
+  {
+    sscanf(serial_string, "%lu", &file_mb);
+  }
+  serial_string_used();
+  if (file_mb == 0)
+  {
+    return;
+  }
+
+  if (!(FR_File = SD.open(FR_FILE_NAME, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Can't open %s\n", FR_FILE_NAME);
+    return;
+  }
+  FR_File_Bytes = (uint64_t)file_mb << 20;
+  if (!FR_File.preAllocate(FR_HEADER_BYTES + FR_File_Bytes))
+  {
+    Serial.printf("Can't preallocate %lu MB for %s. Is the SD Card full?\n", file_mb, FR_FILE_NAME);
+    FR_File.close();
+    return;
+  }
+  memset(header, 0, sizeof(header));
+  snprintf(header, sizeof(header), "EBTKS flight recorder\r\nFormat 2, 32 bit little endian words after this %d byte header. "
+           "See EBTKS_Flight_Recorder.cpp\r\n", FR_HEADER_BYTES);
+  FR_File.write(header, FR_HEADER_BYTES);
+
+  FR_Head           = 0;
+  FR_Tail           = 0;
+  FR_Samples        = 0;
+  FR_Dropped        = 0;
+  FR_Drop_Pending   = 0;
+  FR_Last_Rselec    = 0xFFFFFFFFU;                        //  So the first sample is preceded by an RSELEC marker
+  FR_Bytes_Written  = 0;
+  FR_Prefetch_Index = 0;
+  FR_High_Water     = 0;
+  FR_Write_us_Max   = 0;
+  FR_Prefetch();
+  DMA_LA_Sample_Reset();
+  FR_Start_ms       = millis();
+  FR_State          = FR_RECORDING;
+  Flight_Recorder_Active = true;
+  Serial.printf("Flight recorder started, writing to %s\n", FR_FILE_NAME);
+#else
+  Serial.printf("Flight recorder is not enabled. Set ENABLE_FLIGHT_RECORDER in EBTKS_Config.h and rebuild\n");
+#endif
+}
+
+void Flight_Recorder_Stop_Command(void)
+{
+  if (FR_State != FR_RECORDING)
+  {
+    Serial.printf("Flight recorder is not running\n");
+    return;
+  }
+  Flight_Recorder_Active = false;
+  FR_State = FR_STOPPING;                                 //  Flight_Recorder_Poll() writes the rest of the ring, then closes the file
+}
+
+void Flight_Recorder_Report(void)
+{
+#if ENABLE_FLIGHT_RECORDER
+  uint32_t    seconds;
+
+  seconds = (millis() - FR_Start_ms) / 1000;
+  Serial.printf("\nFlight recorder is %s\n", (FR_State == FR_IDLE) ? "idle" : ((FR_State == FR_RECORDING) ? "recording" : "stopping"));
+  Serial.printf("Cycles recorded %lu, dropped %lu\n", FR_Samples - FR_Dropped, FR_Dropped);
+  Serial.printf("Written %llu of %llu MB, ring high water %lu of %d words, longest write %lu us\n", FR_Bytes_Written >> 20,
+                FR_File_Bytes >> 20, FR_High_Water, FLIGHT_RECORDER_RING_WORDS, FR_Write_us_Max);
+  if ((FR_State != FR_IDLE) && seconds)
+  {
+    Serial.printf("Running %lu seconds, %llu KB/s to the SD Card\n", seconds, (FR_Bytes_Written >> 10) / seconds);
+  }
+  DMA_LA_Sample_Report();
+  Serial.printf("\n");
+#else
+  Serial.printf("Flight recorder is not enabled. Set ENABLE_FLIGHT_RECORDER in EBTKS_Config.h and rebuild\n");
+#endif
+}
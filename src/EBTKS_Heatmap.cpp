@@ -0,0 +1,260 @@
+//
+//      11/17/2020      ROM bank and page read heatmap
+//      11/26/2020      Off by default. Without ENABLE_HEATMAP the counters, and the ISR increment, are not built
+//
+//  Counts the reads that EBTKS supplies, for each (RSELEC bank, 256 byte page) pair of the bank switched
+//  ROM area 060000..077777, and for each page of the HP85A 16K RAM module. This shows which option ROMs
+//  are actually used, and how busy the AUXROM RAM window (070000..075777 as the HP85 sees it) is.
+//
+//  Each page descriptor has a heat_ptr, and onReadData() just does (*page->heat_ptr)++ , with no test.
+//  buildRomPageTable() points the 32 ROM pages at the counters for the selected bank each time RSELEC
+//  changes, and Heatmap_Bind_Pages() does the 16K RAM pages. All other pages, and all pages while the
+//  heatmap is off, point at Heatmap_Discard[], which is never looked at.
+//
+//  Serial commands:
+//      heat on       Clear the counters and start counting
+//      heat off      Stop counting
+//      heat          Show the totals by ROM bank, the AUXROM RAM window, and the 16K RAM
+//      heat save     Write the full bank by page matrix to /HEATMAP.CSV on the SD Card
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_HEATMAP
+
+#define HEAT_ROM_PAGES                (ROM_PAGE_SIZE >> 8)                                  //  32
+#define HEAT_RAM16K_PAGES             ((IO_ADDR - HP85A_16K_RAM_module_base_addr) >> 8)     //  63, the last page is I/O
+#define HEAT_RAM16K_FIRST_PAGE        (HP85A_16K_RAM_module_base_addr >> 8)
+#define HEAT_WINDOW_FIRST_PAGE        (AUXROM_RAM_WINDOW_START >> 8)
+#define HEAT_WINDOW_LAST_PAGE         (AUXROM_RAM_WINDOW_LAST >> 8)
+#define HEAT_FILE_NAME                "/HEATMAP.CSV"
+
+static DMAMEM uint32_t    Heat_ROM[256][HEAT_ROM_PAGES];          //  32 KB, so keep it out of DTCM. Indexed by RSELEC
+static uint32_t           Heat_RAM16K[HEAT_RAM16K_PAGES];
+static uint32_t           Heatmap_Discard[HEAT_ROM_PAGES];        //  Written while the heatmap is off, never read
+static volatile bool      Heatmap_Active = false;
+static bool               Heatmap_Cleared = false;                //  Heat_ROM[] is garbage until the first heat on
+static uint32_t           Heatmap_Start_Time;
+
+//
+//  Called by buildRomPageTable(), which may be running within an ISR, keep it short and fast.
+//
+
+FASTRUN uint32_t * Heatmap_ROM_Counters(uint8_t bank)
+{
+  return Heatmap_Active ? Heat_ROM[bank] : Heatmap_Discard;
+}
+
+//
+//  Point the page descriptors outside the ROM area at their counters. Called at the end of buildPageTable(),
+//  and when the heatmap is started or stopped. Only heat_ptr is touched, and a pointer store is atomic, so
+//  the ISR can keep running. The ROM pages are left to buildRomPageTable()
+//
+
+void Heatmap_Bind_Pages(void)
+{
+  uint32_t    page;
+
+  for (page = 0 ; page < 256 ; page++)
+  {
+    if ((page >= (ROM_PAGE >> 8)) && (page < ((ROM_PAGE + ROM_PAGE_SIZE) >> 8)))
+    {
+      continue;
+    }
+    if (Heatmap_Active && (Page_Table[page].flags & PAGE_FLAG_RAM16K))
+    {
+      Page_Table[page].heat_ptr = &Heat_RAM16K[page - HEAT_RAM16K_FIRST_PAGE];
+    }
+    else
+    {
+      Page_Table[page].heat_ptr = &Heatmap_Discard[0];
+    }
+  }
+}
+
+static uint32_t Heat_Bank_Total(uint32_t bank)
+{
+  uint32_t    page, total = 0;
+
+  for (page = 0 ; page < HEAT_ROM_PAGES ; page++)
+  {
+    total += Heat_ROM[bank][page];
+  }
+  return total;
+}
+
+void Heatmap_On_Command(void)
+{
+  Heatmap_Active = false;
+  Heatmap_Bind_Pages();
+  Rom_Page_Table_Stale = true;                                    //  The ISR rebinds the ROM pages before the next read
+  memset(Heat_ROM, 0, sizeof(Heat_ROM));                          //  DMAMEM is not cleared at startup
+  memset(Heat_RAM16K, 0, sizeof(Heat_RAM16K));
+  Heatmap_Cleared = true;
+  Heatmap_Start_Time = millis();
+  Heatmap_Active = true;
+  Heatmap_Bind_Pages();
+  Rom_Page_Table_Stale = true;
+  Serial.printf("Heatmap started\n");
+}
+
+void Heatmap_Off_Command(void)
+{
+  Heatmap_Active = false;
+  Heatmap_Bind_Pages();
+  Rom_Page_Table_Stale = true;
+  Serial.printf("Heatmap stopped after %lu ms\n", millis() - Heatmap_Start_Time);
+}
+
+//
+//  One line per ROM bank that has been read, hottest page shown, then the AUXROM RAM window and the 16K RAM
+//
+
+void Heatmap_Report(void)
+{
+  uint32_t    bank, page, total, grand_total, hottest, window_total, ram_total;
+
+  if (!Heatmap_Cleared)
+  {
+    Serial.printf("\nHeatmap has not been started. Use heat on\n\n");
+    return;
+  }
+  grand_total = 0;
+  for (bank = 0 ; bank < 256 ; bank++)
+  {
+    grand_total += Heat_Bank_Total(bank);
+  }
+  ram_total = 0;
+  for (page = 0 ; page < HEAT_RAM16K_PAGES ; page++)
+  {
+    ram_total += Heat_RAM16K[page];
+  }
+  grand_total += ram_total;
+
+  Serial.printf("\nHeatmap is %s. %lu reads counted\n", Heatmap_Active ? "running" : "stopped", grand_total);
+  if (grand_total == 0)
+  {
+    Serial.printf("No reads. Use heat on\n\n");
+    return;
+  }
+  Serial.printf("RSELEC        Reads    %%  Hottest page      Reads\n");
+  window_total = 0;
+  for (bank = 0 ; bank < 256 ; bank++)
+  {
+    if ((total = Heat_Bank_Total(bank)) == 0)
+    {
+      continue;
+    }
+    hottest = 0;
+    for (page = 0 ; page < HEAT_ROM_PAGES ; page++)
+    {
+      if (Heat_ROM[bank][page] > Heat_ROM[bank][hottest])
+      {
+        hottest = page;
+      }
+      if ((bank >= AUXROM_PRIMARY_ID) && (bank <= AUXROM_SECONDARY_ID_END) &&
+          (page >= HEAT_WINDOW_FIRST_PAGE) && (page <= HEAT_WINDOW_LAST_PAGE))
+      {
+        window_total += Heat_ROM[bank][page];
+      }
+    }
+    Serial.printf("  %03lo  %11lu  %3lu       %06lo  %11lu\n", bank, total, (uint32_t)((total * 100ULL) / grand_total),
+                  ROM_PAGE + (hottest << 8), Heat_ROM[bank][hottest]);
+  }
+  Serial.printf("AUXROM RAM window  %11lu  %3lu\n", window_total, (uint32_t)((window_total * 100ULL) / grand_total));
+  Serial.printf("16K RAM module     %11lu  %3lu\n\n", ram_total, (uint32_t)((ram_total * 100ULL) / grand_total));
+}
+
+//
+//  Rows are ROM banks (only the ones that have been read) then the 16K RAM, columns are the total and then
+//  the pages. The 16K RAM row has HEAT_RAM16K_PAGES page columns, starting at 0140000
+//
+
+void Heatmap_Save_Command(void)
+{
+  File        heat_file;
+  uint32_t    bank, page, rows, ram_total;
+  char        line[24];
+
+  if (!Heatmap_Cleared)
+  {
+    Serial.printf("Heatmap has not been started. Use heat on\n");
+    return;
+  }
+  if (!(heat_file = SD.open(HEAT_FILE_NAME, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Can't open %s\n", HEAT_FILE_NAME);
+    return;
+  }
+  heat_file.write("bank,total", 10);
+  for (page = 0 ; page < HEAT_ROM_PAGES ; page++)
+  {
+    sprintf(line, ",%06lo", ROM_PAGE + (page << 8));
+    heat_file.write(line, strlen(line));
+  }
+  heat_file.write("\r\n", 2);
+
+  rows = 0;
+  for (bank = 0 ; bank < 256 ; bank++)
+  {
+    if (Heat_Bank_Total(bank) == 0)
+    {
+      continue;
+    }
+    sprintf(line, "%03lo,%lu", bank, Heat_Bank_Total(bank));
+    heat_file.write(line, strlen(line));
+    for (page = 0 ; page < HEAT_ROM_PAGES ; page++)
+    {
+      sprintf(line, ",%lu", Heat_ROM[bank][page]);
+      heat_file.write(line, strlen(line));
+    }
+    heat_file.write("\r\n", 2);
+    rows++;
+  }
+
+  ram_total = 0;
+  for (page = 0 ; page < HEAT_RAM16K_PAGES ; page++)
+  {
+    ram_total += Heat_RAM16K[page];
+  }
+  sprintf(line, "ram16k,%lu", ram_total);
+  heat_file.write(line, strlen(line));
+  for (page = 0 ; page < HEAT_RAM16K_PAGES ; page++)
+  {
+    sprintf(line, ",%lu", Heat_RAM16K[page]);
+    heat_file.write(line, strlen(line));
+  }
+  heat_file.write("\r\n", 2);
+  heat_file.close();
+  Serial.printf("Wrote %lu ROM banks and the 16K RAM to %s\n", rows, HEAT_FILE_NAME);
+}
+
+#else
+
+void Heatmap_Bind_Pages(void)
+{
+}
+
+void Heatmap_On_Command(void)
+{
+  Serial.printf("Heatmap is not enabled. Set ENABLE_HEATMAP in EBTKS_Config.h and rebuild\n");
+}
+
+void Heatmap_Off_Command(void)
+{
+  Heatmap_On_Command();
+}
+
+void Heatmap_Report(void)
+{
+  Heatmap_On_Command();
+}
+
+void Heatmap_Save_Command(void)
+{
+  Heatmap_On_Command();
+}
+
+#endif
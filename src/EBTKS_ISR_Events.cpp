@@ -0,0 +1,194 @@
+//
+//      11/05/2020      ISR to background event ring
+//
+//  The I/O handlers that run within pinChange_isr() used to tell the background polls about new work
+//  through single volatile flags (new_AUXROM_Alert, tapeRequest/newBlockNum, obf/ob).
+//  A second event could overwrite the first before it was consumed, and the background side needed
+//  __disable_irq() / __enable_irq() pairs to read the flag and its data atomically.
+//
+//  Now the ISR pushes typed events into a single-producer / single-consumer ring:
+//    Producer: only ever pinChange_isr() (and the I/O handlers it calls). Only it writes ISR_Event_Head
+//    Consumer: only ever the background loop, via ISR_Event_Poll(). Only it writes ISR_Event_Tail
+//  Neither side ever disables interrupts. The ISR cannot be interrupted by the background loop, and the
+//  event is completely written before ISR_Event_Head is advanced, so the consumer never sees a partial event.
+//
+//  ISR_Event_Poll() hands each event to the subsystem that owns it. If that subsystem is still busy with
+//  the previous event of the same type, the event is left in the ring and delivered on a later poll, so
+//  events are never lost or re-ordered. The HP85 side protocols (obf, the AUXROM mailbox handshake, and
+//  the tape block request) mean there is normally at most one event of each type outstanding.
+//
+//      11/05/2020      Deferred I/O writes
+//
+//  I/O write handlers registered with setIOWriteFunc(addr, func, true) don't run within the ISR. Instead
+//  onWriteData() calls Deferred_IO_Write_Push() which just saves the address and data in a second ring,
+//  and ISR_Event_Poll() calls the handlers in the order the writes happened. This is a separate ring from
+//  the events, as these are far more numerous (every CRT write) and are never held back. If this ring
+//  overflows, the write is lost (and counted), as running it inline would run it out of order.
+//
+//      11/26/2020      Deferred_IO_Writes_Lost() tells the background how many writes were lost since it last asked,
+//                      so loop() can resync the CRT mirror (see CRT_Mirror_Poll() )
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define ISR_EVENT_RING_SIZE           (32)                          //  Must be a power of two
+#define ISR_EVENT_RING_MASK           (ISR_EVENT_RING_SIZE - 1)
+#define DEFERRED_IO_RING_SIZE         (1024)                        //  Must be a power of two. About one screen of CRT writes
+#define DEFERRED_IO_RING_MASK         (DEFERRED_IO_RING_SIZE - 1)
+
+extern ioWriteFuncPtr_t ioWriteFuncs[256];
+extern bool ioWriteDeferred[256];
+
+struct S_Deferred_IO_Write
+{
+  uint8_t     addr;
+  uint8_t     data;
+};
+
+static volatile struct S_ISR_Event  ISR_Event_Ring[ISR_EVENT_RING_SIZE];
+static volatile uint32_t            ISR_Event_Head = 0;             //  Free running. Only written by the ISR
+static volatile uint32_t            ISR_Event_Tail = 0;             //  Free running. Only written by ISR_Event_Poll()
+static volatile uint32_t            ISR_Event_Overflows = 0;        //  Only written by the ISR
+static uint32_t                     ISR_Event_High_Water = 0;       //  Maintained by the background loop
+
+static volatile struct S_Deferred_IO_Write  Deferred_IO_Ring[DEFERRED_IO_RING_SIZE];
+static volatile uint32_t            Deferred_IO_Head = 0;           //  Only written by the ISR
+static volatile uint32_t            Deferred_IO_Tail = 0;           //  Only written by ISR_Event_Poll()
+static volatile uint32_t            Deferred_IO_Overflows = 0;      //  Only written by the ISR
+static uint32_t                     Deferred_IO_Overflows_Seen = 0; //  Only written by Deferred_IO_Writes_Lost()
+static uint32_t                     Deferred_IO_High_Water = 0;
+
+//
+//  Returns false if the ring is full, in which case the caller should leave its own state such that
+//  the event will be retried (or accept that it is lost). ISR_Event_Overflows counts these.
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+
+FASTRUN bool ISR_Event_Push(uint8_t type, uint8_t data, uint8_t aux, uint32_t value)
+{
+  uint32_t    head = ISR_Event_Head;
+  volatile struct S_ISR_Event *event;
+
+  if ((head - ISR_Event_Tail) >= ISR_EVENT_RING_SIZE)
+  {
+    ISR_Event_Overflows++;
+    return false;
+  }
+  event = &ISR_Event_Ring[head & ISR_EVENT_RING_MASK];
+  event->type  = type;
+  event->data  = data;
+  event->aux   = aux;
+  event->value = value;
+  ISR_Event_Head = head + 1;                    //  Publish. Must be after the event is written, guaranteed by volatile
+  return true;
+}
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+
+FASTRUN void Deferred_IO_Write_Push(uint8_t addr, uint8_t data)
+{
+  uint32_t    head = Deferred_IO_Head;
+
+  if ((head - Deferred_IO_Tail) >= DEFERRED_IO_RING_SIZE)
+  {
+    Deferred_IO_Overflows++;
+    return;
+  }
+  Deferred_IO_Ring[head & DEFERRED_IO_RING_MASK].addr = addr;
+  Deferred_IO_Ring[head & DEFERRED_IO_RING_MASK].data = data;
+  Deferred_IO_Head = head + 1;
+}
+
+//
+//  Returns the number of deferred I/O writes lost to a full ring since the last call, 0 if none. Background only
+//
+
+uint32_t Deferred_IO_Writes_Lost(void)
+{
+  uint32_t    overflows = Deferred_IO_Overflows;
+  uint32_t    lost;
+
+  lost = overflows - Deferred_IO_Overflows_Seen;
+  Deferred_IO_Overflows_Seen = overflows;
+  return lost;
+}
+
+//
+//  Run the deferred I/O write handlers, then deliver pending events to their owners. Called from loop(), and from anywhere in the background that
+//  busy waits for an event (such as readOb() in EBTKS_1MB5.cpp)
+//
+
+void ISR_Event_Poll(void)
+{
+  uint32_t    tail = ISR_Event_Tail;
+  uint32_t    pending;
+  volatile struct S_ISR_Event *event;
+  bool        delivered;
+  uint32_t    io_tail = Deferred_IO_Tail;
+
+  pending = Deferred_IO_Head - io_tail;
+  if (pending > Deferred_IO_High_Water)
+  {
+    Deferred_IO_High_Water = pending;
+  }
+  while (io_tail != Deferred_IO_Head)
+  {
+    (ioWriteFuncs[Deferred_IO_Ring[io_tail & DEFERRED_IO_RING_MASK].addr])(Deferred_IO_Ring[io_tail & DEFERRED_IO_RING_MASK].data);
+    io_tail++;
+    Deferred_IO_Tail = io_tail;
+  }
+
+  pending = ISR_Event_Head - tail;
+  if (pending > ISR_Event_High_Water)
+  {
+    ISR_Event_High_Water = pending;
+  }
+
+  while (tail != ISR_Event_Head)
+  {
+    event = &ISR_Event_Ring[tail & ISR_EVENT_RING_MASK];
+    switch (event->type)
+    {
+      case ISR_EVENT_AUXROM_ALERT:
+        delivered = AUXROM_Alert_Event(event->data);
+        break;
+      case ISR_EVENT_TAPE_BLOCK_REQUEST:
+        delivered = tape_block_request_event(event->value);
+        break;
+      case ISR_EVENT_1MB5_OB:
+        delivered = translator_OB_event(event->data, event->aux);
+        break;
+      default:
+        delivered = true;                       //  Should never happen, throw it away
+        break;
+    }
+    if (!delivered)
+    {
+      break;                                    //  Owner is still busy with the last one. Leave this one in the ring
+    }
+    tail++;
+    ISR_Event_Tail = tail;                      //  Give the slot back to the ISR
+  }
+}
+
+void ISR_Event_Report(void)
+{
+  Serial.printf("\nISR event ring: %d slots, %lu pending, high water %lu, overflows %lu\n", ISR_EVENT_RING_SIZE,
+                ISR_Event_Head - ISR_Event_Tail, ISR_Event_High_Water, ISR_Event_Overflows);
+  Serial.printf("Deferred I/O writes: %d slots, %lu pending, high water %lu, overflows %lu\n", DEFERRED_IO_RING_SIZE,
+                Deferred_IO_Head - Deferred_IO_Tail, Deferred_IO_High_Water, Deferred_IO_Overflows);
+  Serial.printf("Deferred I/O registers:");
+  for (int addr = 0 ; addr < 256 ; addr++)
+  {
+    if (ioWriteDeferred[addr])
+    {
+      Serial.printf(" %06o", IO_ADDR + addr);
+    }
+  }
+  Serial.printf("\n\n");
+}
@@ -0,0 +1,227 @@
+//
+//      11/04/2020      ISR cycle budget profiler
+//
+//  Everything in ioReadFuncs[] / ioWriteFuncs[], the memory reads and writes, and the Logic Analyzer
+//  run within pinChange_isr(). onPhi_1_Rise() must finish within the 200 ns Phi 1 window, or the call
+//  to onPhi_1_Fall() is late (see the comments in pinChange_isr() ). This profiler answers the many
+//  "Need to document Max Duration" notes.
+//
+//  With ENABLE_ISR_PROFILER set in EBTKS_Config.h, the ISR_PROFILE_START() / ISR_PROFILE_END() macros
+//  (see EBTKS.h) stamp ARM_DWT_CYCCNT around each profiled piece of code, and ISR_Profiler_Record()
+//  keeps count, min, max, total, and a histogram for each slot. The stamps themselves and the call to
+//  ISR_Profiler_Record() are overhead that is not included in the measurement, but it does eat into
+//  the bus cycle, so only enable this for diagnostics.
+//
+//  ISR_Profiler_Record() only depends on the cycle count it is handed, not on any hardware.
+//
+//      11/10/2020      Cost by bus cycle type
+//
+//  onPhi_1_Rise() and onPhi_2_Rise() are also recorded in one of 8 slots each, by the bus cycle type
+//  (/WR /RD /LMA). This is the number to watch when changing the ISR, since the worst case for each
+//  cycle type is what has to fit, and the mix of cycle types is what sets the average load (see
+//  "bus stats" for the mix). These slots are shown in their own table rather than in the worst list.
+//
+//  Serial commands:
+//      isr prof          Show the worst offenders, relative to the Phi 1 window
+//      isr prof clear    Reset all the statistics
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define ISR_PROFILE_PHI_1_WINDOW_NS       (200)
+#define ISR_PROFILE_REPORT_LINES          (24)
+
+static DMAMEM struct S_ISR_Profile ISR_Profile[ISR_PROFILE_NUM_SLOTS];     //  About 27 KB, so keep it out of DTCM
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+
+FASTRUN void ISR_Profiler_Record(uint32_t slot, uint32_t cycles)
+{
+  struct S_ISR_Profile *prof = &ISR_Profile[slot];
+  uint32_t    bucket;
+
+  prof->count++;
+  prof->total += cycles;
+  if (cycles < prof->min)
+  {
+    prof->min = cycles;
+  }
+  if (cycles > prof->max)
+  {
+    prof->max = cycles;
+  }
+  bucket = cycles / ISR_PROFILE_BUCKET_CYCLES;
+  if (bucket >= ISR_PROFILE_NUM_BUCKETS)
+  {
+    bucket = ISR_PROFILE_NUM_BUCKETS - 1;
+  }
+  prof->histogram[bucket]++;
+}
+
+//
+//  DMAMEM is not cleared at startup, so this must be called from setup()
+//
+
+void ISR_Profiler_Clear(void)
+{
+  __disable_irq();
+  memset(ISR_Profile, 0, sizeof(ISR_Profile));
+  for (int slot = 0 ; slot < ISR_PROFILE_NUM_SLOTS ; slot++)
+  {
+    ISR_Profile[slot].min = 0xFFFFFFFFU;
+  }
+  __enable_irq();
+}
+
+//
+//  A consistent copy of one slot
+//
+
+void ISR_Profiler_Get(uint32_t slot, struct S_ISR_Profile *prof)
+{
+  __disable_irq();
+  *prof = ISR_Profile[slot];
+  __enable_irq();
+}
+
+//
+//  The report, and the helpers below, are only built with ENABLE_ISR_PROFILER. The recording functions above
+//  are always built, so test/test_isr_profiler can check them
+//
+
+#if ENABLE_ISR_PROFILER
+
+static const char * ISR_Profile_Cycle_Type_Names[8] =
+{
+  "Int Ack", "DMA Ack", "LMA + WR", "Write", "LMA + RD", "Read", "LMA", "Idle"
+};
+
+static uint32_t cycles_to_ns(uint32_t cycles)
+{
+  return (uint32_t)(((uint64_t)cycles * 1000U) / (F_CPU_ACTUAL / 1000000U));
+}
+
+static void ISR_Profiler_Slot_Name(uint32_t slot, char *name)
+{
+  if (slot < ISR_PROFILE_SLOT_IO_WRITE)
+  {
+    sprintf(name, "I/O Rd %06o", (unsigned int)(IO_ADDR + slot - ISR_PROFILE_SLOT_IO_READ));
+    return;
+  }
+  if (slot < ISR_PROFILE_SLOT_MEMORY_READ)
+  {
+    sprintf(name, "I/O Wr %06o", (unsigned int)(IO_ADDR + slot - ISR_PROFILE_SLOT_IO_WRITE));
+    return;
+  }
+  if ((slot >= ISR_PROFILE_SLOT_PHI_2_BY_TYPE) && (slot < ISR_PROFILE_SLOT_PHI_2_BY_TYPE + 8))
+  {
+    sprintf(name, "Phi 2 %s", ISR_Profile_Cycle_Type_Names[(slot - ISR_PROFILE_SLOT_PHI_2_BY_TYPE) & 0x07U]);
+    return;
+  }
+  if ((slot >= ISR_PROFILE_SLOT_PHI_1_BY_TYPE) && (slot < ISR_PROFILE_SLOT_PHI_2_BY_TYPE))
+  {
+    sprintf(name, "Phi 1 %s", ISR_Profile_Cycle_Type_Names[(slot - ISR_PROFILE_SLOT_PHI_1_BY_TYPE) & 0x07U]);
+    return;
+  }
+  switch (slot)
+  {
+    case ISR_PROFILE_SLOT_MEMORY_READ:    strcpy(name, "Memory Read");    break;
+    case ISR_PROFILE_SLOT_MEMORY_WRITE:   strcpy(name, "Memory Write");   break;
+    case ISR_PROFILE_SLOT_LOGIC_ANALYZER: strcpy(name, "Logic Analyzer"); break;
+    case ISR_PROFILE_SLOT_PHI_1_RISE:     strcpy(name, "onPhi_1_Rise");   break;
+    case ISR_PROFILE_SLOT_PHI_2_RISE:     strcpy(name, "onPhi_2_Rise");   break;
+    case ISR_PROFILE_SLOT_DMA_LA_SAMPLE:  strcpy(name, "DMA LA Sample");  break;
+    default:                              strcpy(name, "Unknown");        break;
+  }
+}
+
+static void ISR_Profiler_Show_Slot(uint32_t slot)
+{
+  char        name[20];
+  struct S_ISR_Profile  prof;
+
+  ISR_Profiler_Get(slot, &prof);
+
+  ISR_Profiler_Slot_Name(slot, name);
+  if (prof.count == 0)
+  {
+    Serial.printf("%-15s %10lu\n", name, prof.count);
+    return;
+  }
+  Serial.printf("%-15s %10lu  %4lu %4lu %4lu  %6lu  %6lu%%  ", name, prof.count, prof.min,
+                (uint32_t)(prof.total / prof.count), prof.max, cycles_to_ns(prof.max),
+                (cycles_to_ns(prof.max) * 100U) / ISR_PROFILE_PHI_1_WINDOW_NS);
+  for (int bucket = 0 ; bucket < ISR_PROFILE_NUM_BUCKETS ; bucket++)
+  {
+    Serial.printf(" %lu", prof.histogram[bucket]);
+  }
+  Serial.printf("\n");
+}
+
+#endif
+
+//
+//  Show the slots with the largest max time, worst first, then the cost by bus cycle type
+//
+
+void ISR_Profiler_Report(void)
+{
+#if ENABLE_ISR_PROFILER
+  bool        reported[ISR_PROFILE_NUM_SLOTS];
+  uint32_t    line, slot, worst_slot, worst_max;
+
+  memset(reported, 0, sizeof(reported));
+  for (slot = ISR_PROFILE_SLOT_PHI_1_BY_TYPE ; slot < ISR_PROFILE_SLOT_PHI_2_BY_TYPE + 8 ; slot++)
+  {
+    reported[slot] = true;                        //  These have their own table
+  }
+
+  Serial.printf("\nISR profiler. Phi 1 window is %d ns (%d cycles at %d MHz). Histogram buckets are %d ns\n",
+                ISR_PROFILE_PHI_1_WINDOW_NS, (int)((ISR_PROFILE_PHI_1_WINDOW_NS * (F_CPU_ACTUAL / 1000000U)) / 1000U),
+                (int)(F_CPU_ACTUAL / 1000000U), (int)cycles_to_ns(ISR_PROFILE_BUCKET_CYCLES));
+  Serial.printf("Slot              Count       Min  Avg  Max   Max ns  %% Phi 1   Histogram\n");
+
+  for (line = 0 ; line < ISR_PROFILE_REPORT_LINES ; line++)
+  {
+    worst_slot = ISR_PROFILE_NUM_SLOTS;
+    worst_max  = 0;
+    for (slot = 0 ; slot < ISR_PROFILE_NUM_SLOTS ; slot++)
+    {
+      if (!reported[slot] && ISR_Profile[slot].count && (ISR_Profile[slot].max >= worst_max))
+      {
+        worst_max  = ISR_Profile[slot].max;
+        worst_slot = slot;
+      }
+    }
+    if (worst_slot == ISR_PROFILE_NUM_SLOTS)
+    {
+      break;                                      //  No more slots with any samples
+    }
+    reported[worst_slot] = true;
+    ISR_Profiler_Show_Slot(worst_slot);
+  }
+  if (line == 0)
+  {
+    Serial.printf("No samples yet\n");
+  }
+
+  Serial.printf("\nBy bus cycle type. Phi 2 DMA Ack includes taking the bus for DMA\n");
+  for (slot = ISR_PROFILE_SLOT_PHI_1_BY_TYPE ; slot < ISR_PROFILE_SLOT_PHI_2_BY_TYPE + 8 ; slot++)
+  {
+    ISR_Profiler_Show_Slot(slot);
+  }
+  Serial.printf("\n");
+#else
+  Serial.printf("ISR profiler is not enabled. Set ENABLE_ISR_PROFILER in EBTKS_Config.h and rebuild\n");
+#endif
+}
+
+void ISR_Profiler_Clear_Command(void)
+{
+  ISR_Profiler_Clear();
+  Serial.printf("ISR profiler statistics cleared\n");
+}
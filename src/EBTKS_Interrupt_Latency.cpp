@@ -0,0 +1,274 @@
+//
+//      11/19/2020      Interrupt latency tracing for the emulated devices
+//      11/26/2020      The request is stamped before interruptReq is set. Stamped after, the bus ISR could assert
+//                      /IRL in between, and the interrupt was counted as Other, with no request to IRL time
+//
+//  An interrupt from one of our devices goes through these steps, and each is stamped with ARM_DWT_CYCCNT:
+//    Request     Just before interruptReq is set (requestInterrupt() in EBTKS_1MB5.cpp, and the other places
+//                that do it)
+//    IRL         onPhi_2_Rise() sees the request with interrupts enabled, and asserts /IRL (intrState 0 -> 1)
+//    Handoff     An interrupt acknowledge cycle where the priority chain comes to us (IPRIH not low), and we
+//                put interruptVector on the bus. If a higher priority device takes the acknowledge instead,
+//                we let go of /IRL and try again, and that is counted as lost
+//    Vector      The CPU reads the interrupt register (onReadInterrupt() ), only for sources that have one
+//
+//  The source is decided by interruptVector at the time of the request. For each source, the time between the
+//  steps, and from request to handoff, are kept as min/avg/max, and request to handoff also as a histogram.
+//  Times are shown in bus cycles (1.6 us). ARM_DWT_CYCCNT wraps after about 7 seconds, so a request that
+//  waits longer than that (interrupts disabled) is reported short.
+//
+//  The hooks only run when the interrupt state changes, so there is no per bus cycle cost.
+//
+//  Serial commands:
+//      int lat         Show the latencies by source
+//      int lat clear   Clear them
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define INT_LAT_BUS_CYCLE_NS          (1600)
+#define INT_LAT_CYCLES_PER_BUS_CYCLE  ((F_CPU_ACTUAL / 1000000U) * INT_LAT_BUS_CYCLE_NS / 1000U)
+#define INT_LAT_BUCKETS               (16)                //  Request to handoff, in powers of 2 bus cycles
+#define INT_LAT_NUM_SOURCES           (3)
+#define INT_LAT_OTHER                 (INT_LAT_NUM_SOURCES - 1)
+
+enum int_lat_step
+{
+  INT_LAT_IDLE = 0,
+  INT_LAT_REQUESTED,
+  INT_LAT_IRL,
+  INT_LAT_HANDOFF
+};
+
+enum int_lat_interval
+{
+  INT_LAT_REQ_TO_IRL = 0,
+  INT_LAT_IRL_TO_HANDOFF,
+  INT_LAT_HANDOFF_TO_VECTOR,
+  INT_LAT_REQ_TO_HANDOFF,
+  INT_LAT_NUM_INTERVALS
+};
+
+struct S_Int_Lat_Stat
+{
+  uint32_t    count;
+  uint32_t    min;                                        //  In CPU cycles
+  uint32_t    max;
+  uint64_t    sum;
+};
+
+struct S_Int_Lat_Source
+{
+  uint8_t     vector;
+  const char  *name;
+  uint32_t    requests;
+  uint32_t    handoffs;
+  uint32_t    lost;                                       //  Acknowledge went to a higher priority device
+  struct S_Int_Lat_Stat   interval[INT_LAT_NUM_INTERVALS];
+  uint32_t    histogram[INT_LAT_BUCKETS];
+};
+
+static struct S_Int_Lat_Source  Int_Lat_Sources[INT_LAT_NUM_SOURCES] =
+{
+  {0x10, "1MB5"},
+  {0x12, "AUXINT"},
+  {0x00, "Other"}
+};
+
+static const char * const Int_Lat_Interval_Names[INT_LAT_NUM_INTERVALS] =
+{
+  "Request to IRL", "IRL to handoff", "Handoff to vector", "Request to handoff"
+};
+
+static volatile enum int_lat_step   Int_Lat_Step = INT_LAT_IDLE;
+static struct S_Int_Lat_Source      *Int_Lat_Current;
+static uint32_t     Int_Lat_Request_Stamp;
+static uint32_t     Int_Lat_IRL_Stamp;
+static uint32_t     Int_Lat_Handoff_Stamp;
+
+static FASTRUN void Int_Lat_Add(struct S_Int_Lat_Stat *stat, uint32_t cycles)
+{
+  if ((stat->count == 0) || (cycles < stat->min))
+  {
+    stat->min = cycles;
+  }
+  if (cycles > stat->max)
+  {
+    stat->max = cycles;
+  }
+  stat->sum += cycles;
+  stat->count++;
+}
+
+static FASTRUN uint32_t Int_Lat_Bus_Cycles(uint32_t cycles)
+{
+  return cycles / INT_LAT_CYCLES_PER_BUS_CYCLE;
+}
+
+//
+//  Call after setting interruptVector, and just before setting interruptReq, so the request is stamped before
+//  onPhi_2_Rise() can see it. This runs in ISR context too: requestInterrupt(1) is called from onWriteOb() and
+//  onReadIB() . So the background requests (loopTranslator() and proc_auxint() ) set interruptVector, call this
+//  and set interruptReq with interrupts disabled, or an isr request could land part way through
+//
+//  A source without an interrupt register never gets to Interrupt_Latency_Vector_Read(), so once the handoff
+//  is done, a new request starts a new measurement
+//
+
+void Interrupt_Latency_Request(void)
+{
+  uint32_t    i;
+
+  if ((Int_Lat_Step == INT_LAT_REQUESTED) || (Int_Lat_Step == INT_LAT_IRL))
+  {
+    return;                                               //  Already on its way, the first request is the one that counts
+  }
+  for (i = 0 ; i < INT_LAT_OTHER ; i++)
+  {
+    if (Int_Lat_Sources[i].vector == interruptVector)
+    {
+      break;
+    }
+  }
+  Int_Lat_Current = &Int_Lat_Sources[i];
+  Int_Lat_Current->requests++;
+  Int_Lat_Request_Stamp = ARM_DWT_CYCCNT;
+  Int_Lat_Step = INT_LAT_REQUESTED;
+}
+
+//
+//  These are running within an ISR, keep them short and fast.
+//
+
+FASTRUN void Interrupt_Latency_IRL(void)
+{
+  if (Int_Lat_Step == INT_LAT_IRL)
+  {
+    return;                                               //  Asserting /IRL again after losing an acknowledge
+  }
+  Int_Lat_IRL_Stamp = ARM_DWT_CYCCNT;
+  if (Int_Lat_Step != INT_LAT_REQUESTED)
+  {                                                       //  Request that didn't come through Interrupt_Latency_Request()
+    Int_Lat_Current = &Int_Lat_Sources[INT_LAT_OTHER];
+    Int_Lat_Current->requests++;
+    Int_Lat_Request_Stamp = Int_Lat_IRL_Stamp;
+  }
+  Int_Lat_Add(&Int_Lat_Current->interval[INT_LAT_REQ_TO_IRL], Int_Lat_IRL_Stamp - Int_Lat_Request_Stamp);
+  Int_Lat_Step = INT_LAT_IRL;
+}
+
+FASTRUN void Interrupt_Latency_Lost(void)
+{
+  if (Int_Lat_Step == INT_LAT_IRL)
+  {
+    Int_Lat_Current->lost++;
+  }
+}
+
+FASTRUN void Interrupt_Latency_Handoff(void)
+{
+  uint32_t    total, bucket;
+
+  if (Int_Lat_Step != INT_LAT_IRL)
+  {
+    return;
+  }
+  Int_Lat_Handoff_Stamp = ARM_DWT_CYCCNT;
+  total = Int_Lat_Handoff_Stamp - Int_Lat_Request_Stamp;
+  Int_Lat_Add(&Int_Lat_Current->interval[INT_LAT_IRL_TO_HANDOFF], Int_Lat_Handoff_Stamp - Int_Lat_IRL_Stamp);
+  Int_Lat_Add(&Int_Lat_Current->interval[INT_LAT_REQ_TO_HANDOFF], total);
+  Int_Lat_Current->handoffs++;
+  bucket = 32 - __builtin_clz(Int_Lat_Bus_Cycles(total) | 1);          //  1 for 0 or 1 bus cycles, 2 for 2..3, ...
+  Int_Lat_Current->histogram[(bucket < INT_LAT_BUCKETS) ? bucket : INT_LAT_BUCKETS - 1]++;
+  Int_Lat_Step = INT_LAT_HANDOFF;
+}
+
+FASTRUN void Interrupt_Latency_Vector_Read(void)
+{
+  if (Int_Lat_Step != INT_LAT_HANDOFF)
+  {
+    return;
+  }
+  Int_Lat_Add(&Int_Lat_Current->interval[INT_LAT_HANDOFF_TO_VECTOR], ARM_DWT_CYCCNT - Int_Lat_Handoff_Stamp);
+  Int_Lat_Step = INT_LAT_IDLE;
+}
+
+void Interrupt_Latency_Report(void)
+{
+  uint32_t    i, j, bucket;
+  struct S_Int_Lat_Source   *source;
+  struct S_Int_Lat_Stat     *stat;
+
+  Serial.printf("\nInterrupt latency in bus cycles (%d ns)\n", INT_LAT_BUS_CYCLE_NS);
+  for (i = 0 ; i < INT_LAT_NUM_SOURCES ; i++)
+  {
+    source = &Int_Lat_Sources[i];
+    if (source->requests == 0)
+    {
+      continue;
+    }
+    Serial.printf("\n%-8s requests %lu, handoffs %lu, lost to higher priority %lu\n", source->name, source->requests,
+                  source->handoffs, source->lost);
+    Serial.printf("  Interval                Count       Min       Avg       Max\n");
+    for (j = 0 ; j < INT_LAT_NUM_INTERVALS ; j++)
+    {
+      stat = &source->interval[j];
+      if (stat->count == 0)
+      {
+        continue;
+      }
+      Serial.printf("  %-18s  %9lu %9lu %9lu %9lu\n", Int_Lat_Interval_Names[j], stat->count, Int_Lat_Bus_Cycles(stat->min),
+                    Int_Lat_Bus_Cycles((uint32_t)(stat->sum / stat->count)), Int_Lat_Bus_Cycles(stat->max));
+    }
+    Serial.printf("  Request to handoff histogram\n");
+    for (bucket = 0 ; bucket < INT_LAT_BUCKETS ; bucket++)
+    {
+      if (source->histogram[bucket])
+      {
+        Serial.printf("    < %6lu  %9lu\n", 1UL << bucket, source->histogram[bucket]);
+      }
+    }
+  }
+  if ((Int_Lat_Step == INT_LAT_REQUESTED) || (Int_Lat_Step == INT_LAT_IRL))
+  {
+    Serial.printf("\nAn interrupt from %s is in progress\n", Int_Lat_Current->name);
+  }
+  Serial.printf("\n");
+}
+
+//
+//  The counts for the source with this vector (Other, for a vector that isn't one of ours)
+//
+
+void Interrupt_Latency_Get_Counts(uint8_t vector, uint32_t *requests, uint32_t *irls, uint32_t *handoffs)
+{
+  uint32_t    i;
+
+  for (i = 0 ; i < INT_LAT_OTHER ; i++)
+  {
+    if (Int_Lat_Sources[i].vector == vector)
+    {
+      break;
+    }
+  }
+  *requests = Int_Lat_Sources[i].requests;
+  *irls     = Int_Lat_Sources[i].interval[INT_LAT_REQ_TO_IRL].count;
+  *handoffs = Int_Lat_Sources[i].handoffs;
+}
+
+void Interrupt_Latency_Clear_Command(void)
+{
+  uint32_t    i;
+
+  for (i = 0 ; i < INT_LAT_NUM_SOURCES ; i++)
+  {
+    Int_Lat_Sources[i].requests = 0;
+    Int_Lat_Sources[i].handoffs = 0;
+    Int_Lat_Sources[i].lost     = 0;
+    memset(Int_Lat_Sources[i].interval, 0, sizeof(Int_Lat_Sources[i].interval));
+    memset(Int_Lat_Sources[i].histogram, 0, sizeof(Int_Lat_Sources[i].histogram));
+  }
+  Serial.printf("Interrupt latency cleared\n");
+}
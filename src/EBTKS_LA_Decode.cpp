@@ -0,0 +1,384 @@
+//
+//      11/18/2020      Capricorn trace decoder for Logic Analyzer captures
+//
+//  "la decode" (see EBTKS_LA_Export.cpp) feeds the last capture, oldest sample first, through
+//  Capricorn_Trace_Sample(), and this turns it into one line per instruction in /LA_DECODE.TXT:
+//
+//      Sample   RSELEC:Address  Cyc  Bytes            Instruction      Accesses
+//        -123   361:070104        5  250 002 377      LDB DR,=         R 177402 KEYSTS 040
+//
+//  An instruction starts at a read with IFETCH set (LA_SAMPLE_IFETCH, see EBTKS_Logic_Analyzer.h), and runs
+//  until the next one, so the decoder doesn't need to know instruction lengths (which depend on DRP for the
+//  multi-byte literal forms). The reads that follow the opcode at consecutive addresses are its operand bytes,
+//  any other reads and writes are listed as accesses, with the I/O register name for the I/O page. DMA cycles
+//  that steal the bus during an instruction are counted separately, and an interrupt acknowledge cycle
+//  (/WR /RD /LMA all asserted) is shown with the vector on the data bus. Samples before the first opcode fetch
+//  are skipped.
+//
+//  The cycles from one opcode fetch to the next, less any DMA cycles, are that instruction's cycle count.
+//  Capricorn_Trace_Finish() writes a per-opcode count and cycles per instruction table at the end of the file,
+//  and Capricorn_Trace_Summary() shows the totals and the most frequent opcodes.
+//
+//  Mnemonics follow the opcode table in the HP-85 Assembler ROM manual. The operands are shown as the bytes
+//  fetched, except for the relative jumps and JSB =, where the target address is also shown.
+//
+//      11/26/2020      The same code decodes on the PC: tools/la_decode builds it against the Teensy stand-in in
+//                      test/native/EBTKS_Native, for "la dump" streams and flight recorder files. Numbers are cast to
+//                      long for printf, as long is 64 bits there
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define TRACE_MAX_BYTES               (8)                 //  Opcode and operand bytes kept per instruction
+#define TRACE_SHOW_BYTES              (4)
+#define TRACE_MAX_ACCESSES            (4)                 //  Accesses listed per instruction, the rest are counted
+#define TRACE_SUMMARY_LINES           (16)
+
+struct S_Trace_Instruction
+{
+  int32_t     relative;                                   //  Sample number of the opcode fetch, relative to the trigger
+  uint32_t    address;
+  uint32_t    rselec;
+  uint8_t     bytes[TRACE_MAX_BYTES];
+  uint32_t    num_bytes;
+  uint32_t    cycles;
+  uint32_t    dma_cycles;
+  uint32_t    num_accesses;
+  bool        operands_done;                              //  Set by the first access that is not the next operand byte
+  bool        interrupt;
+  uint8_t     vector;
+  bool        trigger;
+  char        accesses[TRACE_MAX_ACCESSES * 24];
+};
+
+struct S_IO_Register_Name
+{
+  uint16_t    address;
+  const char  *name;
+};
+
+static const struct S_IO_Register_Name IO_Register_Names[] =
+{
+  {GINTEN,   "GINTEN"},   {GINTDS,   "GINTDS"},   {KEYSTS,   "KEYSTS"},   {KEYCOD,   "KEYCOD"},
+  {CRTSAD,   "CRTSAD"},   {CRTBAD,   "CRTBAD"},   {CRTSTS,   "CRTSTS"},   {CRTDAT,   "CRTDAT"},
+  {TAPSTS,   "TAPSTS"},   {TAPDAT,   "TAPDAT"},   {CLKSTS,   "CLKSTS"},   {CLKDAT,   "CLKDAT"},
+  {PRMLEN,   "PRMLEN"},   {PRCHAR,   "PRCHAR"},   {PRSTS,    "PRSTS"},    {PRDATA,   "PRDATA"},
+  {IOSTAT,   "IOSTAT"},   {IOINTC,   "IOINTC"},   {IODATA,   "IODATA"},   {PPOLL,    "PPOLL"},
+  {MLAD,     "MLAD"},     {SERPOL,   "SERPOL"},   {EXSTAT,   "EXSTAT"},   {RSELEC,   "RSELEC"},
+  {HEYEBTKS, "HEYEBTKS"}
+};
+
+//
+//  0200..0237, one register operand
+//
+
+static const char * const Capricorn_Ops_200[32] =
+{
+  "ELB",  "ELM",  "ERB",  "ERM",  "LLB",  "LLM",  "LRB",  "LRM",
+  "ICB",  "ICM",  "DCB",  "DCM",  "TCB",  "TCM",  "NCB",  "NCM",
+  "TSB",  "TSM",  "CLB",  "CLM",  "ORB",  "ORM",  "XRB",  "XRM",
+  "BIN",  "BCD",  "SAD",  "DCE",  "ICE",  "CLE",  "RTN",  "PAD"
+};
+
+//
+//  0240..0357, loads, stores, arithmetic, and the stack
+//
+
+static const char * const Capricorn_Ops_240[80] =
+{
+  "LDB DR,AR",    "LDM DR,AR",    "STB DR,AR",    "STM DR,AR",    "LDBD DR,AR",   "LDMD DR,AR",   "STBD DR,AR",   "STMD DR,AR",
+  "LDB DR,=",     "LDM DR,=",     "STB DR,=",     "STM DR,=",     "LDBI DR,AR",   "LDMI DR,AR",   "STBI DR,AR",   "STMI DR,AR",
+  "LDBD DR,=",    "LDMD DR,=",    "STBD DR,=",    "STMD DR,=",    "LDBD DR,X",    "LDMD DR,X",    "STBD DR,X",    "STMD DR,X",
+  "LDBI DR,=",    "LDMI DR,=",    "STBI DR,=",    "STMI DR,=",    "LDBI DR,X",    "LDMI DR,X",    "STBI DR,X",    "STMI DR,X",
+  "CMB DR,AR",    "CMM DR,AR",    "ADB DR,AR",    "ADM DR,AR",    "SBB DR,AR",    "SBM DR,AR",    "JSB X",        "ANM DR,AR",
+  "CMB DR,=",     "CMM DR,=",     "ADB DR,=",     "ADM DR,=",     "SBB DR,=",     "SBM DR,=",     "JSB =",        "ANM DR,=",
+  "CMBD DR,AR",   "CMMD DR,AR",   "ADBD DR,AR",   "ADMD DR,AR",   "SBBD DR,AR",   "SBMD DR,AR",   "???",          "ANMD DR,AR",
+  "CMBD DR,=",    "CMMD DR,=",    "ADBD DR,=",    "ADMD DR,=",    "SBBD DR,=",    "SBMD DR,=",    "???",          "ANMD DR,=",
+  "POBD DR,+AR",  "POMD DR,+AR",  "PUBD DR,+AR",  "PUMD DR,+AR",  "POBD DR,-AR",  "POMD DR,-AR",  "PUBD DR,-AR",  "PUMD DR,-AR",
+  "POBI DR,+AR",  "POMI DR,+AR",  "PUBI DR,+AR",  "PUMI DR,+AR",  "POBI DR,-AR",  "POMI DR,-AR",  "PUBI DR,-AR",  "PUMI DR,-AR"
+};
+
+//
+//  0360..0377, relative jumps with a 1 byte offset from the next instruction
+//
+
+static const char * const Capricorn_Ops_360[16] =
+{
+  "JMP",  "JNO",  "JOD",  "JEV",  "JNG",  "JPS",  "JNZ",  "JZR",
+  "JEN",  "JEZ",  "JNC",  "JCY",  "JLZ",  "JLN",  "JRZ",  "JRN"
+};
+
+#define CAPRICORN_JSB_LITERAL         (0316)
+
+static struct S_Trace_Instruction   Trace;
+static bool         Trace_Active;                         //  Trace holds an instruction
+static uint32_t     Trace_Count[256];                     //  Instructions, by opcode
+static uint32_t     Trace_Cycles[256];                    //  Bus cycles, by opcode, DMA not included
+static uint32_t     Trace_Instructions;
+static uint32_t     Trace_Total_Cycles;
+static uint32_t     Trace_DMA_Cycles;
+static uint32_t     Trace_Interrupts;
+static uint32_t     Trace_Skipped;                        //  Samples before the first opcode fetch
+
+static const char * IO_Register_Name(uint32_t address)
+{
+  uint32_t    i;
+
+  for (i = 0 ; i < (sizeof(IO_Register_Names) / sizeof(IO_Register_Names[0])) ; i++)
+  {
+    if (IO_Register_Names[i].address == address)
+    {
+      return IO_Register_Names[i].name;
+    }
+  }
+  return "";
+}
+
+static void Capricorn_Mnemonic(const struct S_Trace_Instruction *insn, char *text, int max)
+{
+  uint8_t     opcode = insn->bytes[0];
+  uint32_t    target;
+
+  if (opcode < 0100)
+  {
+    snprintf(text, max, "ARP R%o", opcode);
+  }
+  else if (opcode < 0200)
+  {
+    snprintf(text, max, "DRP R%o", opcode & 077U);
+  }
+  else if (opcode < 0240)
+  {
+    snprintf(text, max, "%s", Capricorn_Ops_200[opcode - 0200]);
+  }
+  else if (opcode < 0360)
+  {
+    if ((opcode == CAPRICORN_JSB_LITERAL) && (insn->num_bytes >= 3))
+    {
+      snprintf(text, max, "JSB =%06o", insn->bytes[1] | (insn->bytes[2] << 8));
+    }
+    else
+    {
+      snprintf(text, max, "%s", Capricorn_Ops_240[opcode - 0240]);
+    }
+  }
+  else if (insn->num_bytes >= 2)
+  {
+    target = (insn->address + 2 + (int8_t)insn->bytes[1]) & 0xFFFFU;
+    snprintf(text, max, "%s %06lo", Capricorn_Ops_360[opcode - 0360], (unsigned long)target);
+  }
+  else
+  {
+    snprintf(text, max, "%s", Capricorn_Ops_360[opcode - 0360]);
+  }
+}
+
+static void Trace_Write_Instruction(void)
+{
+  char        where[12];
+  char        bytes[TRACE_SHOW_BYTES * 4 + 2];
+  char        mnemonic[24];
+  uint32_t    i, pos;
+
+  Trace_Count[Trace.bytes[0]]++;
+  Trace_Cycles[Trace.bytes[0]] += Trace.cycles;
+  Trace_Instructions++;
+  Trace_Total_Cycles += Trace.cycles;
+  Trace_DMA_Cycles   += Trace.dma_cycles;
+
+  if ((Trace.address >= ROM_PAGE) && (Trace.address < (ROM_PAGE + ROM_PAGE_SIZE)))
+  {
+    sprintf(where, "%03o:%06o", (unsigned)(Trace.rselec & 0xFFU), (unsigned)(Trace.address & 0xFFFFU));
+  }
+  else
+  {
+    sprintf(where, "    %06o", (unsigned)(Trace.address & 0xFFFFU));
+  }
+  pos = 0;
+  for (i = 0 ; (i < Trace.num_bytes) && (i < TRACE_SHOW_BYTES) ; i++)
+  {
+    pos += sprintf(&bytes[pos], "%03o ", Trace.bytes[i]);
+  }
+  if (Trace.num_bytes > TRACE_SHOW_BYTES)
+  {
+    bytes[pos - 1] = '+';
+  }
+  bytes[pos] = 0;
+  Capricorn_Mnemonic(&Trace, mnemonic, sizeof(mnemonic));
+
+  Logic_Analyzer_Text_Printf("%8ld  %s  %3lu  %-16s %-16s %s", (long)Trace.relative, where, (unsigned long)Trace.cycles, bytes, mnemonic,
+                             Trace.accesses);
+  if (Trace.num_accesses > TRACE_MAX_ACCESSES)
+  {
+    Logic_Analyzer_Text_Printf(" +%lu more", (unsigned long)(Trace.num_accesses - TRACE_MAX_ACCESSES));
+  }
+  if (Trace.dma_cycles)
+  {
+    Logic_Analyzer_Text_Printf(" DMA %lu cycles", (unsigned long)Trace.dma_cycles);
+  }
+  if (Trace.interrupt)
+  {
+    Logic_Analyzer_Text_Printf(" INTERRUPT vector %03o", Trace.vector);
+  }
+  Logic_Analyzer_Text_Printf("%s\n", Trace.trigger ? "  <-- Trigger" : "");
+}
+
+void Capricorn_Trace_Begin(void)
+{
+  memset(Trace_Count, 0, sizeof(Trace_Count));
+  memset(Trace_Cycles, 0, sizeof(Trace_Cycles));
+  Trace_Active       = false;
+  Trace_Instructions = 0;
+  Trace_Total_Cycles = 0;
+  Trace_DMA_Cycles   = 0;
+  Trace_Interrupts   = 0;
+  Trace_Skipped      = 0;
+  Logic_Analyzer_Text_Printf("EBTKS Logic Analyzer capture decoded into Capricorn instructions. See EBTKS_LA_Decode.cpp\n\n");
+  Logic_Analyzer_Text_Printf("  Sample  RSELEC:Address  Cyc  Bytes            Instruction      Accesses\n");
+}
+
+void Capricorn_Trace_Sample(uint32_t main, uint32_t aux, int32_t relative)
+{
+  uint32_t    address = (main >> 8) & 0xFFFFU;
+  uint8_t     data    = main & 0xFFU;
+  bool        rd      = !(main & BIT_MASK_RD);            //  Active low in the sample
+  bool        wr      = !(main & BIT_MASK_WR);
+  bool        lma     = !(main & BIT_MASK_LMA);
+  bool        trigger = (relative == 0) && (Logic_Analyzer_Index_of_Trigger >= 0);
+  uint32_t    len;
+
+  if (!(main & 0x08000000U) && (main & LA_SAMPLE_IFETCH) && rd && !wr)
+  {                                                       //  Opcode fetch, so the previous instruction is complete
+    if (Trace_Active)
+    {
+      Trace_Write_Instruction();
+    }
+    memset(&Trace, 0, sizeof(Trace));
+    Trace.relative  = relative;
+    Trace.address   = address;
+    Trace.rselec    = aux & 0xFFU;
+    Trace.bytes[0]  = data;
+    Trace.num_bytes = 1;
+    Trace.cycles    = 1;
+    Trace.trigger   = trigger;
+    Trace_Active    = true;
+    return;
+  }
+  if (!Trace_Active)
+  {
+    Trace_Skipped++;
+    return;
+  }
+  Trace.trigger |= trigger;
+  if (main & 0x08000000U)
+  {
+    Trace.dma_cycles++;
+    return;
+  }
+  Trace.cycles++;
+  if (rd && wr && lma)
+  {                                                       //  Interrupt acknowledge, the device puts its vector on the bus
+    Trace.interrupt = true;
+    Trace.vector    = data;
+    Trace_Interrupts++;
+    return;
+  }
+  if (rd == wr)
+  {                                                       //  Address (/LMA) or idle cycle
+    return;
+  }
+  if (rd && !Trace.operands_done && (address == ((Trace.address + Trace.num_bytes) & 0xFFFFU)) &&
+      (Trace.num_bytes < TRACE_MAX_BYTES))
+  {
+    Trace.bytes[Trace.num_bytes++] = data;
+    return;
+  }
+  Trace.operands_done = true;
+  if (Trace.num_accesses++ < TRACE_MAX_ACCESSES)
+  {
+    len = strlen(Trace.accesses);
+    snprintf(&Trace.accesses[len], sizeof(Trace.accesses) - len, "%s%c %06lo %s%s%03o", len ? "  " : "", rd ? 'R' : 'W',
+             (unsigned long)address, IO_Register_Name(address), (address >= IO_ADDR) ? " " : "", data);
+  }
+}
+
+//
+//  Write the last instruction, and the cycles per instruction table
+//
+
+void Capricorn_Trace_Finish(void)
+{
+  uint32_t    opcode;
+  struct S_Trace_Instruction  insn;
+  char        mnemonic[24];
+
+  if (Trace_Active)
+  {
+    Trace_Write_Instruction();
+    Trace_Active = false;
+  }
+  Logic_Analyzer_Text_Printf("\n%lu instructions, %lu bus cycles, %.2f cycles per instruction. %lu DMA cycles, %lu interrupts\n",
+                             (unsigned long)Trace_Instructions, (unsigned long)Trace_Total_Cycles,
+                             Trace_Instructions ? (double)Trace_Total_Cycles / Trace_Instructions : 0.0,
+                             (unsigned long)Trace_DMA_Cycles, (unsigned long)Trace_Interrupts);
+  Logic_Analyzer_Text_Printf("\nOpcode  Instruction        Count      Cycles   CPI\n");
+  memset(&insn, 0, sizeof(insn));
+  insn.num_bytes = 1;                                     //  Just the mnemonic, no jump targets
+  for (opcode = 0 ; opcode < 256 ; opcode++)
+  {
+    if (Trace_Count[opcode] == 0)
+    {
+      continue;
+    }
+    insn.bytes[0] = opcode;
+    Capricorn_Mnemonic(&insn, mnemonic, sizeof(mnemonic));
+    Logic_Analyzer_Text_Printf("  %03lo   %-16s %8lu  %10lu  %5.2f\n", (unsigned long)opcode, mnemonic, (unsigned long)Trace_Count[opcode],
+                               (unsigned long)Trace_Cycles[opcode], (double)Trace_Cycles[opcode] / Trace_Count[opcode]);
+  }
+}
+
+//
+//  Totals and the most frequent opcodes, on the serial port
+//
+
+void Capricorn_Trace_Summary(void)
+{
+  uint32_t    line, opcode, busiest;
+  bool        reported[256];
+  struct S_Trace_Instruction  insn;
+  char        mnemonic[24];
+
+  if (Trace_Instructions == 0)
+  {
+    Serial.printf("No opcode fetches found in %lu samples. Check IFETCH_ACTIVE_HIGH in EBTKS_Config.h\n", (unsigned long)Trace_Skipped);
+    return;
+  }
+  Serial.printf("%lu instructions, %.2f cycles per instruction, %lu DMA cycles, %lu interrupts\n", (unsigned long)Trace_Instructions,
+                (double)Trace_Total_Cycles / Trace_Instructions, (unsigned long)Trace_DMA_Cycles, (unsigned long)Trace_Interrupts);
+  Serial.printf("Opcode  Instruction        Count   CPI\n");
+  memset(reported, 0, sizeof(reported));
+  memset(&insn, 0, sizeof(insn));
+  insn.num_bytes = 1;
+  for (line = 0 ; line < TRACE_SUMMARY_LINES ; line++)
+  {
+    busiest = 256;
+    for (opcode = 0 ; opcode < 256 ; opcode++)
+    {
+      if (!reported[opcode] && Trace_Count[opcode] && ((busiest == 256) || (Trace_Count[opcode] > Trace_Count[busiest])))
+      {
+        busiest = opcode;
+      }
+    }
+    if (busiest == 256)
+    {
+      break;
+    }
+    reported[busiest] = true;
+    insn.bytes[0] = busiest;
+    Capricorn_Mnemonic(&insn, mnemonic, sizeof(mnemonic));
+    Serial.printf("  %03lo   %-16s %8lu  %5.2f\n", (unsigned long)busiest, mnemonic, (unsigned long)Trace_Count[busiest],
+                  (double)Trace_Cycles[busiest] / Trace_Count[busiest]);
+  }
+}
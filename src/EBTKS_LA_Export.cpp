@@ -0,0 +1,482 @@
+//
+//      11/14/2020      Bulk export of Logic Analyzer captures
+//
+//  The results display in Logic_Analyzer_Poll() formats every sample with Serial.printf(), which is fine for
+//  a 32 sample capture but hopeless for a deep one. These export the whole capture, oldest sample first, in
+//  one of two forms:
+//
+//      la vcd      Write /LA_CAPTURE.VCD on the SD Card, a Value Change Dump that GTKWave and sigrok can open.
+//                  One bus cycle is 1.6 us, so the timescale is 100 ns and the time advances 16 per sample
+//      la dump     Binary framed dump over USB Serial, for a host side program to capture. tools/la_decode decodes
+//                  the captured stream on the PC
+//      la decode   Write /LA_DECODE.TXT on the SD Card, the capture decoded into Capricorn instructions. See
+//                  EBTKS_LA_Decode.cpp
+//
+//  The capture must be complete (or stopped), and a new capture can't be started until the export is done.
+//  Logic_Analyzer_Export_Poll() is called from loop() and does LA_EXPORT_CHUNK samples, or LA_EXPORT_BUDGET_US
+//  of work, at a time, so loop() is never held up for long. USB Serial output is only written when there is
+//  room (Serial.availableForWrite() ), so a slow host just slows the export down.
+//
+//  Binary frame format, all multi-byte values are little endian:
+//      0xA5 0x5A         Sync
+//      type              'S' samples, 'E' end
+//      length            2 bytes, of the payload
+//      payload
+//      checksum          1 byte, such that the 8 bit sum of type, length, payload, and checksum is 0
+//
+//  'S' payload:  4 byte signed sample number of the first sample, relative to the trigger (without a trigger,
+//                numbered from the start of the capture), then up to LA_EXPORT_FRAME_SAMPLES samples, each 5 bytes:
+//                the 4 byte Logic_Analyzer_main_sample (see EBTKS_Bus_Interface_ISR.cpp) and the RSELEC byte
+//  'E' payload:  4 byte total samples, 1 byte flags (bit 0 triggered, bit 1 compressed capture)
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define LA_EXPORT_CHUNK               (256)               //  Samples per call of Logic_Analyzer_Export_Poll()
+#define LA_EXPORT_BUDGET_US           (2000)
+#define LA_EXPORT_FRAME_SAMPLES       (64)
+#define LA_EXPORT_FRAME_MAX           (5 + 4 + LA_EXPORT_FRAME_SAMPLES * 5 + 1)
+#define LA_TEXT_BUFFER_SIZE           (4096)
+#define LA_TEXT_MAX_LINE              (256)               //  Most text one sample can add
+#define LA_VCD_TICKS_PER_SAMPLE       (16)
+
+enum la_export_state
+{
+  LA_EXPORT_IDLE = 0,
+  LA_EXPORT_VCD,
+  LA_EXPORT_BINARY,
+  LA_EXPORT_DECODE
+};
+
+static enum la_export_state   LA_Export_State = LA_EXPORT_IDLE;
+static uint32_t     LA_Export_Start;                      //  Raw capture: buffer index of the oldest sample
+static uint32_t     LA_Export_Count;                      //  Raw capture: number of samples
+static uint32_t     LA_Export_Index;                      //  Raw capture: next sample to export
+static int32_t      LA_Export_Zero;                       //  Sample number (raw: index from the oldest) of the trigger
+static uint32_t     LA_Export_Samples;                    //  Exported so far
+static bool         LA_Export_Done;                       //  No more samples
+
+static File         LA_Text_File;
+static char         LA_Text_Buffer[LA_TEXT_BUFFER_SIZE];
+static uint32_t     LA_Text_Pos;
+static uint32_t     LA_VCD_Prev_Main;
+static uint32_t     LA_VCD_Prev_Aux;
+static int32_t      LA_VCD_First;
+
+static uint8_t      LA_Frame[LA_EXPORT_FRAME_MAX];
+static uint32_t     LA_Frame_Len;
+static uint32_t     LA_Frame_Sent;
+
+bool Logic_Analyzer_Export_Busy(void)
+{
+  return LA_Export_State != LA_EXPORT_IDLE;
+}
+
+//
+//  Set up to read the capture, oldest sample first, for both raw and compressed captures
+//
+
+static bool LA_Export_Begin(void)
+{
+  if (Logic_Analyzer_State != ANALYZER_IDLE)
+  {
+    Serial.printf("Logic Analyzer is busy\n");
+    return false;
+  }
+  if (LA_Export_State != LA_EXPORT_IDLE)
+  {
+    Serial.printf("Logic Analyzer export already in progress\n");
+    return false;
+  }
+  if (Logic_Analyzer_Valid_Samples == 0)
+  {
+    Serial.printf("Nothing has been captured. Use la setup and la go first\n");
+    return false;
+  }
+  LA_Export_Samples = 0;
+  LA_Export_Done    = false;
+  if (Logic_Analyzer_Compressed)
+  {
+    LA_Export_Zero = (Logic_Analyzer_Index_of_Trigger >= 0) ? Logic_Analyzer_Index_of_Trigger : 0;
+    return Logic_Analyzer_Decode_First();
+  }
+  if (Logic_Analyzer_Valid_Samples < Logic_Analyzer_Current_Buffer_Length)
+  {
+    LA_Export_Start = 0;
+    LA_Export_Count = Logic_Analyzer_Valid_Samples;
+  }
+  else
+  {
+    LA_Export_Start = Logic_Analyzer_Data_index;          //  Where the next sample would have gone, so the oldest
+    LA_Export_Count = Logic_Analyzer_Current_Buffer_Length;
+  }
+  LA_Export_Index = 0;
+  LA_Export_Zero  = (Logic_Analyzer_Index_of_Trigger >= 0) ?
+                    (int32_t)((Logic_Analyzer_Index_of_Trigger - LA_Export_Start) & Logic_Analyzer_Current_Index_Mask) : 0;
+  return true;
+}
+
+static bool LA_Export_Next(uint32_t *main, uint32_t *aux, int32_t *relative)
+{
+  uint32_t    j;
+  int32_t     sample_number;
+
+  if (LA_Export_Done)
+  {
+    return false;
+  }
+  if (Logic_Analyzer_Compressed)
+  {
+    if (!Logic_Analyzer_Decode_Next(main, aux, &sample_number))
+    {
+      LA_Export_Done = true;
+      return false;
+    }
+    *relative = sample_number - LA_Export_Zero;
+  }
+  else
+  {
+    if (LA_Export_Index >= LA_Export_Count)
+    {
+      LA_Export_Done = true;
+      return false;
+    }
+    j = (LA_Export_Start + LA_Export_Index) & Logic_Analyzer_Current_Index_Mask;
+    *main     = Logic_Analyzer_Data_1[j];
+    *aux      = Logic_Analyzer_Data_2[j];
+    *relative = LA_Export_Index++ - LA_Export_Zero;
+  }
+  LA_Export_Samples++;
+  return true;
+}
+
+static void LA_Text_Flush(void)
+{
+  if (LA_Text_Pos)
+  {
+    LA_Text_File.write(LA_Text_Buffer, LA_Text_Pos);
+    LA_Text_Pos = 0;
+  }
+}
+
+//
+//  Buffered text output to LA_Text_File, for the VCD export and the trace decoder
+//
+
+void Logic_Analyzer_Text_Printf(const char *format, ...)
+{
+  va_list     args;
+  int         len;
+
+  va_start(args, format);
+  len = vsnprintf(&LA_Text_Buffer[LA_Text_Pos], LA_TEXT_BUFFER_SIZE - LA_Text_Pos, format, args);
+  va_end(args);
+  if (len > 0)
+  {
+    LA_Text_Pos += len;
+  }
+  if (LA_Text_Pos > (LA_TEXT_BUFFER_SIZE - LA_TEXT_MAX_LINE))
+  {
+    LA_Text_Flush();
+  }
+}
+
+static void LA_VCD_Binary(uint32_t value, int bits, char id)
+{
+  char        text[20];
+  int         i;
+
+  for (i = 0 ; i < bits ; i++)
+  {
+    text[i] = (value & (1U << (bits - 1 - i))) ? '1' : '0';
+  }
+  text[bits] = 0;
+  Logic_Analyzer_Text_Printf("b%s %c\n", text, id);
+}
+
+//
+//  VCD export
+//
+//  Write the values that changed since the last sample, or all of them if all is true
+//
+
+static void LA_VCD_Sample(uint32_t main, uint32_t aux, int32_t relative, bool all)
+{
+  uint32_t    changed = all ? 0xFFFFFFFFU : (main ^ LA_VCD_Prev_Main);
+
+  if (changed & 0x00FFFF00U)
+  {
+    LA_VCD_Binary((main >> 8) & 0xFFFFU, 16, '!');
+  }
+  if (changed & 0x000000FFU)
+  {
+    LA_VCD_Binary(main & 0xFFU, 8, '"');
+  }
+  if (changed & BIT_MASK_WR)
+  {
+    Logic_Analyzer_Text_Printf("%c#\n", (main & BIT_MASK_WR) ? '1' : '0');
+  }
+  if (changed & BIT_MASK_RD)
+  {
+    Logic_Analyzer_Text_Printf("%c$\n", (main & BIT_MASK_RD) ? '1' : '0');
+  }
+  if (changed & BIT_MASK_LMA)
+  {
+    Logic_Analyzer_Text_Printf("%c%%\n", (main & BIT_MASK_LMA) ? '1' : '0');
+  }
+  if (changed & 0x08000000U)
+  {
+    Logic_Analyzer_Text_Printf("%c&\n", (main & 0x08000000U) ? '1' : '0');
+  }
+  if (changed & LA_SAMPLE_IFETCH)
+  {
+    Logic_Analyzer_Text_Printf("%c)\n", (main & LA_SAMPLE_IFETCH) ? '1' : '0');
+  }
+  if (all || (aux != LA_VCD_Prev_Aux))
+  {
+    LA_VCD_Binary(aux & 0xFFU, 8, '\'');
+  }
+  if (all || (relative == 0) || (relative == 1))
+  {
+    Logic_Analyzer_Text_Printf("%c(\n", ((relative == 0) && (Logic_Analyzer_Index_of_Trigger >= 0)) ? '1' : '0');
+  }
+  LA_VCD_Prev_Main = main;
+  LA_VCD_Prev_Aux  = aux;
+}
+
+void Logic_Analyzer_VCD_Command(void)
+{
+  if (!LA_Export_Begin())
+  {
+    return;
+  }
+  if (!(LA_Text_File = SD.open("/LA_CAPTURE.VCD", O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Can't open /LA_CAPTURE.VCD\n");
+    return;
+  }
+  LA_Text_Pos = 0;
+  Logic_Analyzer_Text_Printf("$version EBTKS Logic Analyzer $end\n");
+  Logic_Analyzer_Text_Printf("$comment %s capture, trigger at time 0 if triggered $end\n", Logic_Analyzer_Compressed ? "Compressed" : "Raw");
+  Logic_Analyzer_Text_Printf("$timescale 100 ns $end\n");
+  Logic_Analyzer_Text_Printf("$scope module hp85 $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 16 ! address $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 8 \" data $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 1 # WR_n $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 1 $ RD_n $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 1 %% LMA_n $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 1 & DMA $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 8 ' RSELEC $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 1 ( trigger $end\n");
+  Logic_Analyzer_Text_Printf("$var wire 1 ) IFETCH $end\n");
+  Logic_Analyzer_Text_Printf("$upscope $end\n");
+  Logic_Analyzer_Text_Printf("$enddefinitions $end\n");
+  LA_Export_State = LA_EXPORT_VCD;
+  Serial.printf("Writing /LA_CAPTURE.VCD in the background\n");
+}
+
+static void LA_VCD_Poll(void)
+{
+  uint32_t    main, aux, count;
+  int32_t     relative;
+
+  for (count = 0 ; count < LA_EXPORT_CHUNK ; count++)
+  {
+    if (!LA_Export_Next(&main, &aux, &relative))
+    {
+      LA_Text_Flush();
+      LA_Text_File.close();
+      LA_Export_State = LA_EXPORT_IDLE;
+      Serial.printf("Wrote %lu samples to /LA_CAPTURE.VCD\n", LA_Export_Samples);
+      return;
+    }
+    if (LA_Export_Samples == 1)
+    {
+      LA_VCD_First = relative;
+      Logic_Analyzer_Text_Printf("#%ld\n$dumpvars\n", (relative - LA_VCD_First) * LA_VCD_TICKS_PER_SAMPLE);
+      LA_VCD_Sample(main, aux, relative, true);
+      Logic_Analyzer_Text_Printf("$end\n");
+      continue;
+    }
+    Logic_Analyzer_Text_Printf("#%ld\n", (relative - LA_VCD_First) * LA_VCD_TICKS_PER_SAMPLE);
+    LA_VCD_Sample(main, aux, relative, false);
+  }
+}
+
+//
+//  Capricorn trace decode. EBTKS_LA_Decode.cpp does the work, and writes with Logic_Analyzer_Text_Printf()
+//
+
+void Logic_Analyzer_Decode_Command(void)
+{
+  if (!LA_Export_Begin())
+  {
+    return;
+  }
+  if (!(LA_Text_File = SD.open("/LA_DECODE.TXT", O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Can't open /LA_DECODE.TXT\n");
+    return;
+  }
+  LA_Text_Pos = 0;
+  Capricorn_Trace_Begin();
+  LA_Export_State = LA_EXPORT_DECODE;
+  Serial.printf("Writing /LA_DECODE.TXT in the background\n");
+}
+
+static void LA_Decode_Poll(void)
+{
+  uint32_t    main, aux, count;
+  int32_t     relative;
+
+  for (count = 0 ; count < LA_EXPORT_CHUNK ; count++)
+  {
+    if (!LA_Export_Next(&main, &aux, &relative))
+    {
+      Capricorn_Trace_Finish();
+      LA_Text_Flush();
+      LA_Text_File.close();
+      LA_Export_State = LA_EXPORT_IDLE;
+      Serial.printf("Decoded %lu samples to /LA_DECODE.TXT\n", LA_Export_Samples);
+      Capricorn_Trace_Summary();
+      return;
+    }
+    Capricorn_Trace_Sample(main, aux, relative);
+  }
+}
+
+//
+//  Binary export over USB Serial
+//
+
+static void LA_Frame_Put_32(uint32_t *pos, uint32_t val)
+{
+  LA_Frame[(*pos)++] = val;
+  LA_Frame[(*pos)++] = val >> 8;
+  LA_Frame[(*pos)++] = val >> 16;
+  LA_Frame[(*pos)++] = val >> 24;
+}
+
+static void LA_Frame_Finish(uint8_t type, uint32_t len)
+{
+  uint8_t     sum;
+  uint32_t    i;
+
+  LA_Frame[0] = 0xA5;
+  LA_Frame[1] = 0x5A;
+  LA_Frame[2] = type;
+  LA_Frame[3] = (len - 5);                                //  Payload starts at LA_Frame[5]
+  LA_Frame[4] = (len - 5) >> 8;
+  sum = 0;
+  for (i = 2 ; i < len ; i++)
+  {
+    sum += LA_Frame[i];
+  }
+  LA_Frame[len] = -sum;
+  LA_Frame_Len  = len + 1;
+  LA_Frame_Sent = 0;
+}
+
+void Logic_Analyzer_Dump_Command(void)
+{
+  if (!LA_Export_Begin())
+  {
+    return;
+  }
+  Serial.printf("Binary Logic Analyzer dump follows\n");
+  LA_Frame_Len    = 0;
+  LA_Frame_Sent   = 0;
+  LA_Export_State = LA_EXPORT_BINARY;
+}
+
+static void LA_Binary_Poll(void)
+{
+  uint32_t    main, aux, pos, count;
+  int32_t     relative;
+  int         room;
+
+  while (1)
+  {
+    if (LA_Frame_Sent < LA_Frame_Len)
+    {
+      room = Serial.availableForWrite();
+      if (room <= 0)
+      {
+        return;                                           //  Try again on the next poll
+      }
+      if ((uint32_t)room > LA_Frame_Len - LA_Frame_Sent)
+      {
+        room = LA_Frame_Len - LA_Frame_Sent;
+      }
+      Serial.write(&LA_Frame[LA_Frame_Sent], room);
+      LA_Frame_Sent += room;
+      if (LA_Frame_Sent < LA_Frame_Len)
+      {
+        return;
+      }
+      if (LA_Frame[2] == 'E')
+      {
+        LA_Export_State = LA_EXPORT_IDLE;
+        Serial.printf("\nBinary Logic Analyzer dump complete, %lu samples\n", LA_Export_Samples);
+      }
+      return;                                             //  One frame per call keeps the time per call short
+    }
+
+    pos = 5;
+    for (count = 0 ; count < LA_EXPORT_FRAME_SAMPLES ; count++)
+    {
+      if (!LA_Export_Next(&main, &aux, &relative))
+      {
+        break;
+      }
+      if (count == 0)
+      {
+        LA_Frame_Put_32(&pos, relative);
+      }
+      LA_Frame_Put_32(&pos, main);
+      LA_Frame[pos++] = aux;
+    }
+    if (count)
+    {
+      LA_Frame_Finish('S', pos);
+      continue;
+    }
+    pos = 5;
+    LA_Frame_Put_32(&pos, LA_Export_Samples);
+    LA_Frame[pos++] = ((Logic_Analyzer_Index_of_Trigger >= 0) ? 0x01 : 0x00) | (Logic_Analyzer_Compressed ? 0x02 : 0x00);
+    LA_Frame_Finish('E', pos);
+  }
+}
+
+//
+//  Called from loop()
+//
+
+void Logic_Analyzer_Export_Poll(void)
+{
+  uint32_t    start;
+
+  if (LA_Export_State == LA_EXPORT_IDLE)
+  {
+    return;
+  }
+  start = micros();
+  do
+  {
+    if (LA_Export_State == LA_EXPORT_VCD)
+    {
+      LA_VCD_Poll();
+    }
+    else if (LA_Export_State == LA_EXPORT_DECODE)
+    {
+      LA_Decode_Poll();
+    }
+    else
+    {
+      LA_Binary_Poll();
+    }
+  } while ((LA_Export_State != LA_EXPORT_IDLE) && ((micros() - start) < LA_EXPORT_BUDGET_US) &&
+           ((LA_Export_State != LA_EXPORT_BINARY) || (Serial.availableForWrite() > 0)));
+}
@@ -0,0 +1,303 @@
+//
+//      11/13/2020      Multi-stage sequential trigger for the Logic Analyzer
+//
+//  The trigger is a table of up to LA_TRIGGER_MAX_STAGES stages, matched in order. Stage 1 is the pattern,
+//  mask and Event Count from "la setup". Stages 2 and on are set with "la stages". Each stage has:
+//    A pattern and mask for Logic_Analyzer_main_sample (and for stage 1, Logic_Analyzer_aux_sample too)
+//    An occurrence count, how many matches are needed to move to the next stage
+//    An optional window: the stage must complete within that many bus cycles of being entered
+//    An optional reset pattern: if it is seen while in this stage, start again at stage 1
+//  When the last stage completes, the Logic Analyzer triggers. So "a write to 0177740 followed by a read of
+//  0177741 within 200 cycles" is two stages.
+//
+//  Logic_Analyzer_Trigger_Compile() builds the table when the Logic Analyzer is started. After that, only the
+//  current stage is looked at, so the per-cycle cost in onPhi_1_Rise() is the same however many stages are
+//  used: the window and reset compares, then the pattern compare. If the window has expired or the reset
+//  pattern matches, that takes priority over a pattern match on the same cycle. Moving to the next stage
+//  uses up the cycle, so consecutive stages can't match the same bus cycle.
+//
+//  Bus cycles are counted with Logic_Analyzer_Valid_Samples, which Logic_Analyzer_Capture() increments after the
+//  check. DMA cycles are counted too, and can match a stage (see EBTKS_Logic_Analyzer.h for their source tag).
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#define LA_CYCLE_BITS                 (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA)
+
+struct S_LA_Trigger_Stage
+{
+  uint32_t    mask_1;                                     //  Logic_Analyzer_main_sample
+  uint32_t    value_1;
+  uint32_t    mask_2;                                     //  Logic_Analyzer_aux_sample
+  uint32_t    value_2;
+  uint32_t    reset_mask;                                 //  Logic_Analyzer_main_sample. 0 if there is no reset pattern
+  uint32_t    reset_value;
+  int32_t     count;
+  uint32_t    window;                                     //  Bus cycles, 0 for no limit
+};
+
+static struct S_LA_Trigger_Stage    LA_Trigger_Table[LA_TRIGGER_MAX_STAGES];     //  [0] is filled in from the "la setup" values
+static uint32_t                     LA_Trigger_Num_Stages = 1;
+static struct S_LA_Trigger_Stage    *LA_Trigger_Current = LA_Trigger_Table;
+static struct S_LA_Trigger_Stage    *LA_Trigger_Last    = LA_Trigger_Table;
+static uint32_t                     LA_Trigger_Deadline;
+
+//
+//  Build the trigger table. Must only be called when the Logic Analyzer is not acquiring
+//
+
+void Logic_Analyzer_Trigger_Compile(void)
+{
+  LA_Trigger_Table[0].mask_1      = Logic_Analyzer_Trigger_Mask_1;
+  LA_Trigger_Table[0].value_1     = Logic_Analyzer_Trigger_Value_1;
+  LA_Trigger_Table[0].mask_2      = Logic_Analyzer_Trigger_Mask_2;
+  LA_Trigger_Table[0].value_2     = Logic_Analyzer_Trigger_Value_2;
+  LA_Trigger_Table[0].reset_mask  = 0;
+  LA_Trigger_Table[0].reset_value = 0;
+  LA_Trigger_Table[0].count       = Logic_Analyzer_Event_Count_Init;
+  LA_Trigger_Table[0].window      = 0;
+
+  LA_Trigger_Current         = LA_Trigger_Table;
+  LA_Trigger_Last            = &LA_Trigger_Table[LA_Trigger_Num_Stages - 1];
+  Logic_Analyzer_Event_Count = LA_Trigger_Table[0].count;
+}
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+//  Called from onPhi_1_Rise() for each sample until triggered. Returns true when the last stage completes
+//
+
+FASTRUN bool Logic_Analyzer_Trigger_Check(void)
+{
+  struct S_LA_Trigger_Stage   *stage = LA_Trigger_Current;
+  uint32_t                    main   = Logic_Analyzer_main_sample;
+
+  if ((stage->window && ((int32_t)(Logic_Analyzer_Valid_Samples - LA_Trigger_Deadline) > 0)) ||
+      (stage->reset_mask && ((main & stage->reset_mask) == stage->reset_value)))
+  {   //  Window expired, or reset pattern seen. Back to stage 1
+    LA_Trigger_Current = LA_Trigger_Table;
+    Logic_Analyzer_Event_Count = LA_Trigger_Table[0].count;
+    return false;
+  }
+  if (((main & stage->mask_1) != stage->value_1) || ((Logic_Analyzer_aux_sample & stage->mask_2) != stage->value_2))
+  {
+    return false;
+  }
+  if (--Logic_Analyzer_Event_Count > 0)                   //  Event Count is how many match events needed to complete the stage
+  {
+    return false;
+  }
+  if (stage == LA_Trigger_Last)
+  {
+    return true;
+  }
+  LA_Trigger_Current = ++stage;
+  Logic_Analyzer_Event_Count = stage->count;
+  LA_Trigger_Deadline = Logic_Analyzer_Valid_Samples + stage->window;
+  return false;
+}
+
+//
+//  Stage number (1 ..) the trigger is waiting in, for the heartbeat message
+//
+
+uint32_t Logic_Analyzer_Trigger_Stage(void)
+{
+  return (LA_Trigger_Current - LA_Trigger_Table) + 1;
+}
+
+//
+//  Cycle pattern text is 3 characters for /WR /RD /LMA, each 1, 0, or x for don't care
+//
+
+static bool LA_Parse_Cycle(const char *text, uint32_t *mask, uint32_t *value)
+{
+  static const uint32_t   bits[3] = {BIT_MASK_WR, BIT_MASK_RD, BIT_MASK_LMA};
+  int                     i;
+
+  if (strlen(text) != 3)
+  {
+    return false;
+  }
+  *mask  = 0;
+  *value = 0;
+  for (i = 0 ; i < 3 ; i++)
+  {
+    switch (text[i])
+    {
+      case '1':
+        *value |= bits[i];
+        //  Fall through
+      case '0':
+        *mask  |= bits[i];
+        break;
+      case 'x':
+      case 'X':
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static void LA_Cycle_Text(uint32_t mask, uint32_t value, char *text)
+{
+  text[0] = (mask & BIT_MASK_WR)  ? ((value & BIT_MASK_WR)  ? '1' : '0') : 'x';
+  text[1] = (mask & BIT_MASK_RD)  ? ((value & BIT_MASK_RD)  ? '1' : '0') : 'x';
+  text[2] = (mask & BIT_MASK_LMA) ? ((value & BIT_MASK_LMA) ? '1' : '0') : 'x';
+  text[3] = 0;
+}
+
+static void LA_Show_Stages(void)
+{
+  struct S_LA_Trigger_Stage   *stage;
+  uint32_t                    i;
+  char                        cycle[4], reset_cycle[4];
+
+  Serial.printf("\nStage  WRL  Address Mask    Data Mask    Count   Window   Reset WRL Address Mask\n");
+  for (i = 1 ; i < LA_Trigger_Num_Stages ; i++)
+  {
+    stage = &LA_Trigger_Table[i];
+    LA_Cycle_Text(stage->mask_1, stage->value_1, cycle);
+    Serial.printf("  %lu    %s  %06lo  %06lo  %03lo  %03lo  %6ld  %7lu   ", i + 1, cycle,
+                  (stage->value_1 >> 8) & 0xFFFFU, (stage->mask_1 >> 8) & 0xFFFFU, stage->value_1 & 0xFFU, stage->mask_1 & 0xFFU,
+                  stage->count, stage->window);
+    if (stage->reset_mask)
+    {
+      LA_Cycle_Text(stage->reset_mask, stage->reset_value, reset_cycle);
+      Serial.printf("      %s %06lo  %06lo\n", reset_cycle, (stage->reset_value >> 8) & 0xFFFFU, (stage->reset_mask >> 8) & 0xFFFFU);
+    }
+    else
+    {
+      Serial.printf("      none\n");
+    }
+  }
+  Serial.printf("Stage 1 is the \"la setup\" trigger. Window is in bus cycles, 0 is no limit\n\n");
+}
+
+//
+//  la stages       Set the number of trigger stages, and the patterns for stages 2 and on
+//
+
+void Logic_Analyzer_Stages_Command(void)
+{
+  struct S_LA_Trigger_Stage   *stage;
+  uint32_t                    num_stages, i;
+  unsigned int                address, address_mask, data, data_mask;
+  long                        count;
+  unsigned long               window;
+  uint32_t                    cycle_mask, cycle_value;
+  char                        cycle[8], cur_cycle[4];
+
+  if (Logic_Analyzer_State != ANALYZER_IDLE)
+  {
+    Serial.printf("Logic Analyzer is busy\n");
+    return;
+  }
+
+redo_num_stages:
+  Serial.printf("Number of trigger stages 1..%d[%lu]:", LA_TRIGGER_MAX_STAGES, LA_Trigger_Num_Stages);
+  if (!wait_for_serial_string())
+  {
+    return;                           //  Got a Ctrl-C , so abort command
+  }
+  num_stages = LA_Trigger_Num_Stages;
+  if (strlen(serial_string) == 0)
+  {      //  Keep existing value
+    Serial.printf("Using prior value\n");
+  }
+  else
+  {
+    sscanf(serial_string, "%lu", &num_stages);
+  }
+  serial_string_used();
+  if ((num_stages < 1) || (num_stages > LA_TRIGGER_MAX_STAGES))
+  {
+    goto redo_num_stages;
+  }
+
+  for (i = 1 ; i < num_stages ; i++)
+  {
+    stage = &LA_Trigger_Table[i];
+    if (i >= LA_Trigger_Num_Stages)
+    {   //  New stage, default to anything once, no window, no reset
+      memset(stage, 0, sizeof(struct S_LA_Trigger_Stage));
+      stage->count = 1;
+    }
+
+redo_stage:
+    LA_Cycle_Text(stage->mask_1, stage->value_1, cur_cycle);
+    Serial.printf("Stage %lu: WRL(1/0/x) Address Mask Data Mask (octal) Count Window[%s %06lo %06lo %03lo %03lo %ld %lu]:", i + 1, cur_cycle,
+                  (stage->value_1 >> 8) & 0xFFFFU, (stage->mask_1 >> 8) & 0xFFFFU, stage->value_1 & 0xFFU, stage->mask_1 & 0xFFU,
+                  stage->count, stage->window);
+    if (!wait_for_serial_string())
+    {
+      return;                         //  Got a Ctrl-C , so abort command
+    }
+    if (strlen(serial_string) == 0)
+    {      //  Keep existing value
+      Serial.printf("Using prior value\n");
+    }
+    else
+    {
+      if ((sscanf(serial_string, "%7s %o %o %o %o %ld %lu", cycle, &address, &address_mask, &data, &data_mask, &count, &window) != 7) ||
+          !LA_Parse_Cycle(cycle, &cycle_mask, &cycle_value) || (count < 1))
+      {
+        serial_string_used();
+        goto redo_stage;
+      }
+      stage->mask_1  = cycle_mask  | ((address_mask & 0xFFFFU) << 8) | (data_mask & 0xFFU);
+      stage->value_1 = cycle_value | ((address      & 0xFFFFU) << 8) | (data      & 0xFFU);
+      stage->value_1 &= stage->mask_1;
+      stage->count   = count;
+      stage->window  = window;
+    }
+    serial_string_used();
+
+redo_reset:
+    if (stage->reset_mask)
+    {
+      LA_Cycle_Text(stage->reset_mask, stage->reset_value, cur_cycle);
+      Serial.printf("Stage %lu reset: WRL(1/0/x) Address Mask (octal), or none[%s %06lo %06lo]:", i + 1, cur_cycle,
+                    (stage->reset_value >> 8) & 0xFFFFU, (stage->reset_mask >> 8) & 0xFFFFU);
+    }
+    else
+    {
+      Serial.printf("Stage %lu reset: WRL(1/0/x) Address Mask (octal), or none[none]:", i + 1);
+    }
+    if (!wait_for_serial_string())
+    {
+      return;                         //  Got a Ctrl-C , so abort command
+    }
+    if (strlen(serial_string) == 0)
+    {      //  Keep existing value
+      Serial.printf("Using prior value\n");
+    }
+    else if (strcasecmp(serial_string, "none") == 0)
+    {
+      stage->reset_mask  = 0;
+      stage->reset_value = 0;
+    }
+    else
+    {
+      if ((sscanf(serial_string, "%7s %o %o", cycle, &address, &address_mask) != 3) ||
+          !LA_Parse_Cycle(cycle, &cycle_mask, &cycle_value))
+      {
+        serial_string_used();
+        goto redo_reset;
+      }
+      stage->reset_mask  = cycle_mask  | ((address_mask & 0xFFFFU) << 8);
+      stage->reset_value = cycle_value | ((address      & 0xFFFFU) << 8);
+      stage->reset_value &= stage->reset_mask;
+    }
+    serial_string_used();
+  }
+
+  LA_Trigger_Num_Stages = num_stages;
+  LA_Show_Stages();
+  Serial.printf("Type la go to start\n\n");
+}
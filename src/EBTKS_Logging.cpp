@@ -1,6 +1,8 @@
 //
 //	08/07/2020	Initial Creation. PMF
 //
+//	11/20/2020	flush_logfile() is a trace point for "trace on" (EBTKS_Event_Trace.cpp)
+//
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
@@ -44,7 +46,9 @@ void flush_logfile(void)
 {
   if (logfile_active)
   {
+    TRACE_BEGIN(TRACE_LOG_FLUSH, 0);
     logfile.flush();
+    TRACE_END(TRACE_LOG_FLUSH, 0);
   }
 }
 
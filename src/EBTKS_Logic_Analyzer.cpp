@@ -0,0 +1,677 @@
+//
+//      11/11/2020      Logic Analyzer capture buffers, with optional deep capture in PSRAM
+//
+//  The capture code in onPhi_1_Rise() (and DMA tracing in EBTKS_DMA.cpp) writes through the pointers
+//  Logic_Analyzer_Data_1 and Logic_Analyzer_Data_2, with the modulo index scheme unchanged
+//  (Logic_Analyzer_Data_index &= Logic_Analyzer_Current_Index_Mask). Logic_Analyzer_Select_Buffer()
+//  points them at:
+//    The internal buffers (LOGIC_ANALYZER_BUFFER_SIZE samples) for short captures
+//    The PSRAM buffers (LOGIC_ANALYZER_PSRAM_SAMPLES samples, EXTMEM) for anything longer
+//  The buffer length is still set in "la setup", any power of two from 32 up to the maximum.
+//
+//  EXTMEM is cached write-back / write-allocate, so a store by the ISR to a line that isn't in the
+//  data cache stalls while the 32 byte line is read from PSRAM. That would make the capture cost
+//  per sample anything but flat, and could push onPhi_1_Rise() past the Phi 1 window. So while
+//  capturing to PSRAM, Logic_Analyzer_Prefetch() (called from Logic_Analyzer_Poll() in loop() )
+//  reads ahead of the ISR, keeping the next LA_PREFETCH_SAMPLES of both buffers in the cache. The line
+//  fills, and the write back of the dirty lines they evict, then happen in the background. If the
+//  background loop is blocked for longer than the prefetch distance lasts (about 3 ms), the ISR sees
+//  the stalls again, but no samples are lost.
+//
+//  "la bench" measures the cost of one sample store for the internal buffers, for PSRAM with a cold
+//  cache, and for PSRAM after prefetching, and compares them with the Phi 1 window.
+//
+//      11/12/2020      Delta compressed capture
+//
+//  With Logic_Analyzer_Compressed set ("la setup"), onPhi_1_Rise() calls Logic_Analyzer_Compress_Sample()
+//  instead of storing the 8 byte sample pair. The same memory (both buffers) is used as a ring of
+//  LA_BLOCK_SIZE byte blocks of variable length records. Each block starts with a LA_REC_BLOCK record
+//  holding a complete sample and its sample number, so decoding can start at the oldest block that
+//  has not been overwritten. A record never spans blocks. The records, by the first byte, are:
+//
+//    00nnnnnn  SEQ    n+1 samples, each address + 1, same control bits and RSELEC. n+1 data bytes follow
+//    01nnnnnn  SAME   n+1 samples, same address, control bits and RSELEC. n+1 data bytes follow
+//    10nnnnnn  IDLE   n+1 idle cycles (/WR /RD /LMA all high) at the same address. No data, it is junk anyway
+//    110cccca  CTRL   1 sample, control + DMA bits (sample bits 27..24) are cccc, IFETCH clear, address + a. 1 data byte follows
+//    11100000  JUMP   1 sample, same control bits and RSELEC, new address. Address high, low, and data follow
+//    11100001  FULL   1 sample, the 4 byte main sample (MSB first) and the RSELEC byte follow
+//    1110cccc  CJUMP  1 sample, as CTRL (cccc is 2 to 15) but at a new address. Address high, low, and data follow
+//    1111000a  FETCH  1 sample, IFETCH (bit 28) toggled, other control bits and RSELEC same, address + a. 1 data byte follows
+//    1111001a  OPCODE 1 sample, opcode fetch (a read with IFETCH set), address + a. 1 data byte follows
+//    11110100  OPJUMP 1 sample, opcode fetch at a new address. Address high, low, and data follow
+//    11111110  BLOCK  Block start. 4 byte sample number, 4 byte main sample, RSELEC follow
+//    11111111  END    Rest of the block is unused
+//
+//  A run is extended by incrementing its count in place, so the common case (a read or write at the next
+//  address, or an idle cycle) costs one or two byte stores. The sample number is kept in
+//  Logic_Analyzer_Data_index, so the trigger (Logic_Analyzer_Index_of_Trigger) is a sample number.
+//
+//  Post trigger, Logic_Analyzer_Samples_Till_Done counts blocks rather than samples. It is set so that
+//  the pre-trigger part of the ring is the same fraction as Logic_Analyzer_Pre_Trigger_Samples is of
+//  Logic_Analyzer_Current_Buffer_Length. How many samples that is depends on the bus activity; the
+//  display shows the compression ratio that was achieved.
+//
+//      11/18/2020      IFETCH is part of the control bits. The CTRL record keeps it, and FETCH covers the opcode fetch
+//                      after an operand read (and back), so instruction streams still take 2 bytes per cycle
+//
+//      11/26/2020      Deep capture is allowed only if both PSRAM buffers end within the fitted PSRAM. They are placed
+//                      by the linker after any other EXTMEM, so their size alone says nothing
+//
+//      11/26/2020      An opcode fetch after an idle or /LMA cycle took a FULL record, as did the first read or write
+//                      after an address load. OPCODE, OPJUMP and CJUMP cover them, and CTRL now clears IFETCH, so the
+//                      cycle after an opcode fetch is 2 bytes whatever it is. test/test_la_compress measures the ratio
+//
+//      11/26/2020      Logic_Analyzer_Store_Is_Cached(), for DMA_LA_Sample(). loop() does not run during a DMA session, so
+//                      DMA cycles past the prefetched part of the PSRAM buffers are not captured, rather than stalling
+//                      past Phi 2 falling. Logic_Analyzer_Prefetch() could stop up to a cache line past its distance, which
+//                      it then took as being overtaken, and started again from the write index every time
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+extern "C" uint8_t external_psram_size;                   //  In MB, set by startup.c. 0 if no PSRAM is fitted
+
+#define LA_CACHE_LINE_SAMPLES         (8)                 //  32 byte cache lines
+#define LA_PREFETCH_SAMPLES           (2048)              //  8 KB per buffer, 16 KB of the 32 KB data cache
+#define LA_PREFETCH_BYTES             (2 * LA_PREFETCH_SAMPLES * sizeof(uint32_t))    //  The same, for compressed capture
+#define LA_BENCH_SAMPLES              (4096)
+#define LA_PHI_1_WINDOW_NS            (200)
+
+static uint32_t   Logic_Analyzer_Internal_1[LOGIC_ANALYZER_BUFFER_SIZE] __attribute__ ((aligned (32)));
+static uint32_t   Logic_Analyzer_Internal_2[LOGIC_ANALYZER_BUFFER_SIZE] __attribute__ ((aligned (32)));
+#if ENABLE_LA_PSRAM
+EXTMEM static uint32_t  Logic_Analyzer_PSRAM_1[LOGIC_ANALYZER_PSRAM_SAMPLES] __attribute__ ((aligned (32)));
+EXTMEM static uint32_t  Logic_Analyzer_PSRAM_2[LOGIC_ANALYZER_PSRAM_SAMPLES] __attribute__ ((aligned (32)));
+#endif
+
+#define LA_BLOCK_SIZE                 (256)
+#define LA_MAX_RECORD                 (6)                 //  Longest record other than LA_REC_BLOCK
+#define LA_RUN_MAX                    (64)
+#define LA_REC_SEQ                    (0x00)
+#define LA_REC_SAME                   (0x40)
+#define LA_REC_IDLE                   (0x80)
+#define LA_REC_CTRL                   (0xC0)
+#define LA_REC_JUMP                   (0xE0)
+#define LA_REC_FULL                   (0xE1)
+#define LA_REC_FETCH                  (0xF0)
+#define LA_REC_OPCODE                 (0xF2)
+#define LA_REC_OPJUMP                 (0xF4)
+#define LA_REC_BLOCK                  (0xFE)
+#define LA_REC_END                    (0xFF)
+#define LA_REC_NONE                   (0xFF)              //  For LA_Comp_Run_Type, no run in progress
+#define LA_SAMPLE_CTRL_BITS           (0x1F000000U)       //  /WR /RD /LMA, the DMA bit, and IFETCH
+#define LA_SAMPLE_IDLE                (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA)
+#define LA_SAMPLE_OPCODE              (LA_SAMPLE_IFETCH | BIT_MASK_WR | BIT_MASK_LMA)      //  Read with IFETCH
+#define LA_SAMPLE_CJUMP_MIN           (0x02000000U)       //  Control bits 0 and 1 would be JUMP and FULL
+#define LA_COMPRESSED_MIN_BLOCKS      (8)
+
+static bool       LA_Using_PSRAM = false;
+static uint32_t   LA_Prefetch_Index;                      //  Next sample index to prefetch, always a multiple of LA_CACHE_LINE_SAMPLES.
+                                                          //  For compressed capture, the next byte position in the ring of blocks
+
+static uint8_t    *LA_Comp_Block_Ptr;                     //  Start of the block being written
+static uint32_t   LA_Comp_Pos;                            //  Next free byte in that block
+static uint32_t   LA_Comp_Block;                          //  Which block
+static uint32_t   LA_Comp_Num_Blocks;
+static uint32_t   LA_Comp_Blocks_Written;                 //  Free running, so we know if the ring has wrapped
+static uint32_t   LA_Comp_Run_Pos;                        //  Position of the current run record in the block
+static uint8_t    LA_Comp_Run_Type;                       //  LA_REC_SEQ, LA_REC_SAME, LA_REC_IDLE, or LA_REC_NONE
+static uint32_t   LA_Comp_Prev_Main;
+static uint32_t   LA_Comp_Prev_Aux;
+
+//
+//  The largest buffer length "la setup" should allow
+//
+
+uint32_t Logic_Analyzer_Max_Buffer_Length(void)
+{
+#if ENABLE_LA_PSRAM
+  if (PSRAM_HOLDS(&Logic_Analyzer_PSRAM_1[LOGIC_ANALYZER_PSRAM_SAMPLES]) &&
+      PSRAM_HOLDS(&Logic_Analyzer_PSRAM_2[LOGIC_ANALYZER_PSRAM_SAMPLES]))
+  {
+    return LOGIC_ANALYZER_PSRAM_SAMPLES;
+  }
+#endif
+  return LOGIC_ANALYZER_BUFFER_SIZE;
+}
+
+//
+//  Point Logic_Analyzer_Data_1/2 at the right buffers for Logic_Analyzer_Current_Buffer_Length, and clear
+//  the part that will be used. Must only be called when the Logic Analyzer is not acquiring
+//
+
+void Logic_Analyzer_Select_Buffer(void)
+{
+  if (Logic_Analyzer_Current_Buffer_Length > Logic_Analyzer_Max_Buffer_Length())
+  {
+    Logic_Analyzer_Current_Buffer_Length = Logic_Analyzer_Max_Buffer_Length();
+    Logic_Analyzer_Current_Index_Mask    = Logic_Analyzer_Current_Buffer_Length - 1;
+  }
+
+  LA_Using_PSRAM = false;
+  Logic_Analyzer_Data_1 = Logic_Analyzer_Internal_1;
+  Logic_Analyzer_Data_2 = Logic_Analyzer_Internal_2;
+#if ENABLE_LA_PSRAM
+  if (Logic_Analyzer_Current_Buffer_Length > LOGIC_ANALYZER_BUFFER_SIZE)
+  {
+    LA_Using_PSRAM = true;
+    Logic_Analyzer_Data_1 = Logic_Analyzer_PSRAM_1;
+    Logic_Analyzer_Data_2 = Logic_Analyzer_PSRAM_2;
+  }
+#endif
+  memset(Logic_Analyzer_Data_1, 0, Logic_Analyzer_Current_Buffer_Length * sizeof(uint32_t));
+  memset(Logic_Analyzer_Data_2, 0, Logic_Analyzer_Current_Buffer_Length * sizeof(uint32_t));
+
+  //
+  //  Compressed capture uses both buffers as one ring of blocks. Needs to be at least a few blocks
+  //
+  LA_Comp_Num_Blocks     = (Logic_Analyzer_Current_Buffer_Length * 2 * sizeof(uint32_t)) / LA_BLOCK_SIZE;
+  LA_Comp_Block          = LA_Comp_Num_Blocks - 1;        //  So the first sample starts block 0
+  LA_Comp_Block_Ptr      = (uint8_t *)Logic_Analyzer_Data_1;
+  LA_Comp_Pos            = LA_BLOCK_SIZE;
+  LA_Comp_Blocks_Written = 0;
+  LA_Comp_Run_Type       = LA_REC_NONE;
+  if (Logic_Analyzer_Compressed && (LA_Comp_Num_Blocks < LA_COMPRESSED_MIN_BLOCKS))
+  {
+    Logic_Analyzer_Compressed = false;
+    Serial.printf("Buffer is too short for compressed capture, using normal capture\n");
+  }
+
+  LA_Prefetch_Index = 0;
+  Logic_Analyzer_Prefetch();                              //  So the first samples don't stall
+}
+
+//
+//  For compressed capture, how many blocks to capture after the trigger
+//
+
+uint32_t Logic_Analyzer_Post_Trigger_Blocks(void)
+{
+  uint32_t    pre_blocks;
+
+  pre_blocks = (uint32_t)(((uint64_t)LA_Comp_Num_Blocks * Logic_Analyzer_Pre_Trigger_Samples) / Logic_Analyzer_Current_Buffer_Length);
+  if (pre_blocks > LA_Comp_Num_Blocks - 2)
+  {
+    pre_blocks = LA_Comp_Num_Blocks - 2;
+  }
+  return LA_Comp_Num_Blocks - 1 - pre_blocks;             //  The block with the trigger in it must not be overwritten
+}
+
+//
+//  Blocks are in Logic_Analyzer_Data_1, then Logic_Analyzer_Data_2
+//
+
+static inline uint8_t * LA_Block_Address(uint32_t block)
+{
+  uint32_t    half = LA_Comp_Num_Blocks >> 1;
+
+  if (block < half)
+  {
+    return (uint8_t *)Logic_Analyzer_Data_1 + block * LA_BLOCK_SIZE;
+  }
+  return (uint8_t *)Logic_Analyzer_Data_2 + (block - half) * LA_BLOCK_SIZE;
+}
+
+static inline void LA_Put_32(uint8_t *p, uint32_t val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >>  8;
+  p[3] = val;
+}
+
+static inline uint32_t LA_Get_32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+//  Close the current block and start the next one with a LA_REC_BLOCK record for this sample. Once triggered,
+//  this is also where we count down to the end of acquisition
+//
+
+static FASTRUN void LA_Start_Block(uint32_t main, uint32_t aux)
+{
+  uint8_t     *p;
+
+  if (LA_Comp_Pos < LA_BLOCK_SIZE)
+  {
+    LA_Comp_Block_Ptr[LA_Comp_Pos] = LA_REC_END;
+  }
+  if (Logic_Analyzer_Triggered)
+  {
+    if (--Logic_Analyzer_Samples_Till_Done == 0)
+    {
+      Logic_Analyzer_State = ANALYZER_ACQUISITION_DONE;
+      return;
+    }
+  }
+  if (++LA_Comp_Block == LA_Comp_Num_Blocks)
+  {
+    LA_Comp_Block = 0;
+  }
+  LA_Comp_Blocks_Written++;
+  p = LA_Comp_Block_Ptr = LA_Block_Address(LA_Comp_Block);
+  p[0] = LA_REC_BLOCK;
+  LA_Put_32(&p[1], Logic_Analyzer_Data_index - 1);
+  LA_Put_32(&p[5], main);
+  p[9] = aux;
+  LA_Comp_Pos       = 10;
+  LA_Comp_Run_Type  = LA_REC_NONE;
+  LA_Comp_Prev_Main = main;
+  LA_Comp_Prev_Aux  = aux;
+}
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+//  Encode Logic_Analyzer_main_sample and Logic_Analyzer_aux_sample. Called from Logic_Analyzer_Capture(), for both
+//  onPhi_1_Rise() and DMA cycles
+//
+
+FASTRUN void Logic_Analyzer_Compress_Sample(void)
+{
+  uint32_t    main  = Logic_Analyzer_main_sample;
+  uint32_t    aux   = Logic_Analyzer_aux_sample;
+  uint32_t    ctrl  = main & LA_SAMPLE_CTRL_BITS;
+  uint32_t    delta = ((main >> 8) - (LA_Comp_Prev_Main >> 8)) & 0x0000FFFFU;
+  uint32_t    pos   = LA_Comp_Pos;
+  uint8_t     *p    = LA_Comp_Block_Ptr;
+  uint8_t     type;
+
+  Logic_Analyzer_Data_index++;                            //  Sample number of the next sample
+  if (pos > (LA_BLOCK_SIZE - LA_MAX_RECORD))
+  {
+    LA_Start_Block(main, aux);
+    return;
+  }
+
+  if ((aux == LA_Comp_Prev_Aux) && (ctrl == (LA_Comp_Prev_Main & LA_SAMPLE_CTRL_BITS)) && (delta <= 1))
+  {
+    if (delta)
+    {
+      type = LA_REC_SEQ;
+    }
+    else
+    {
+      type = (ctrl == LA_SAMPLE_IDLE) ? LA_REC_IDLE : LA_REC_SAME;
+    }
+    if ((type == LA_Comp_Run_Type) && ((p[LA_Comp_Run_Pos] & 0x3FU) != (LA_RUN_MAX - 1)))
+    {
+      p[LA_Comp_Run_Pos]++;                               //  Extend the current run
+    }
+    else
+    {
+      LA_Comp_Run_Type = type;
+      LA_Comp_Run_Pos  = pos;
+      p[pos++] = type;                                    //  New run of 1
+    }
+    if (type != LA_REC_IDLE)
+    {
+      p[pos++] = main;
+    }
+  }
+  else
+  {
+    LA_Comp_Run_Type = LA_REC_NONE;
+    if ((aux == LA_Comp_Prev_Aux) && (delta <= 1) && !(ctrl & LA_SAMPLE_IFETCH))
+    {
+      p[pos++] = LA_REC_CTRL | ((ctrl >> 23) & 0x1EU) | delta;
+      p[pos++] = main;
+    }
+    else if ((aux == LA_Comp_Prev_Aux) && (delta <= 1) && (ctrl == LA_SAMPLE_OPCODE))
+    {
+      p[pos++] = LA_REC_OPCODE | delta;
+      p[pos++] = main;
+    }
+    else if ((aux == LA_Comp_Prev_Aux) && (delta <= 1) && ((ctrl ^ (LA_Comp_Prev_Main & LA_SAMPLE_CTRL_BITS)) == LA_SAMPLE_IFETCH))
+    {
+      p[pos++] = LA_REC_FETCH | delta;
+      p[pos++] = main;
+    }
+    else if ((aux == LA_Comp_Prev_Aux) &&
+             ((ctrl == (LA_Comp_Prev_Main & LA_SAMPLE_CTRL_BITS)) || (ctrl == LA_SAMPLE_OPCODE) ||
+              (!(ctrl & LA_SAMPLE_IFETCH) && (ctrl >= LA_SAMPLE_CJUMP_MIN))))
+    {
+      if (ctrl == (LA_Comp_Prev_Main & LA_SAMPLE_CTRL_BITS))
+      {
+        p[pos++] = LA_REC_JUMP;
+      }
+      else if (ctrl == LA_SAMPLE_OPCODE)
+      {
+        p[pos++] = LA_REC_OPJUMP;
+      }
+      else
+      {
+        p[pos++] = LA_REC_JUMP | (ctrl >> 24);            //  CJUMP
+      }
+      p[pos++] = main >> 16;
+      p[pos++] = main >>  8;
+      p[pos++] = main;
+    }
+    else
+    {
+      p[pos++] = LA_REC_FULL;
+      LA_Put_32(&p[pos], main);
+      p[pos + 4] = aux;
+      pos += 5;
+    }
+  }
+  LA_Comp_Pos       = pos;
+  LA_Comp_Prev_Main = main;
+  LA_Comp_Prev_Aux  = aux;
+}
+
+//
+//  Decode a compressed capture, oldest sample first. Logic_Analyzer_Decode_First() must be called, and
+//  the Logic Analyzer must not be acquiring
+//
+
+static uint32_t   LA_Dec_Block;
+static uint32_t   LA_Dec_Blocks_Left;
+static uint32_t   LA_Dec_Pos;
+static uint32_t   LA_Dec_End;
+static uint8_t    *LA_Dec_Ptr;
+static uint8_t    LA_Dec_Run_Type;
+static uint32_t   LA_Dec_Run_Left;
+static uint32_t   LA_Dec_Main;
+static uint32_t   LA_Dec_Aux;
+static int32_t    LA_Dec_Sample;
+
+static void LA_Decode_Block(void)
+{
+  LA_Dec_Ptr      = LA_Block_Address(LA_Dec_Block);
+  LA_Dec_Pos      = 0;
+  LA_Dec_End      = (LA_Dec_Block == LA_Comp_Block) ? LA_Comp_Pos : LA_BLOCK_SIZE;
+  LA_Dec_Run_Left = 0;
+}
+
+bool Logic_Analyzer_Decode_First(void)
+{
+  if (LA_Comp_Blocks_Written == 0)
+  {
+    return false;
+  }
+  if (LA_Comp_Blocks_Written > LA_Comp_Num_Blocks)
+  {   //  The ring has wrapped, the oldest block is the one after the current one
+    LA_Dec_Block       = (LA_Comp_Block + 1 == LA_Comp_Num_Blocks) ? 0 : LA_Comp_Block + 1;
+    LA_Dec_Blocks_Left = LA_Comp_Num_Blocks;
+  }
+  else
+  {
+    LA_Dec_Block       = 0;
+    LA_Dec_Blocks_Left = LA_Comp_Blocks_Written;
+  }
+  LA_Decode_Block();
+  return true;
+}
+
+bool Logic_Analyzer_Decode_Next(uint32_t *main, uint32_t *aux, int32_t *sample_number)
+{
+  uint8_t     record;
+  uint8_t     *p;
+
+  while (1)
+  {
+    p = LA_Dec_Ptr;
+    if (LA_Dec_Run_Left)
+    {
+      LA_Dec_Run_Left--;
+      if (LA_Dec_Run_Type == LA_REC_SEQ)
+      {
+        LA_Dec_Main = (LA_Dec_Main & 0xFF000000U) | ((LA_Dec_Main + 0x00000100U) & 0x00FFFF00U) | p[LA_Dec_Pos++];
+      }
+      else if (LA_Dec_Run_Type == LA_REC_SAME)
+      {
+        LA_Dec_Main = (LA_Dec_Main & 0xFFFFFF00U) | p[LA_Dec_Pos++];
+      }
+      break;                                              //  LA_REC_IDLE, the sample is unchanged
+    }
+    if ((LA_Dec_Pos >= LA_Dec_End) || (p[LA_Dec_Pos] == LA_REC_END))
+    {
+      if (--LA_Dec_Blocks_Left == 0)
+      {
+        return false;
+      }
+      LA_Dec_Block = (LA_Dec_Block + 1 == LA_Comp_Num_Blocks) ? 0 : LA_Dec_Block + 1;
+      LA_Decode_Block();
+      continue;
+    }
+    record = p[LA_Dec_Pos++];
+    if (record < LA_REC_CTRL)
+    {
+      LA_Dec_Run_Type = record & 0xC0U;
+      LA_Dec_Run_Left = (record & 0x3FU) + 1;
+      continue;
+    }
+    if (record < LA_REC_JUMP)
+    {
+      LA_Dec_Main = ((uint32_t)(record & 0x1EU) << 23) |
+                    ((LA_Dec_Main + ((record & 0x01U) << 8)) & 0x00FFFF00U) | p[LA_Dec_Pos++];
+      break;
+    }
+    if ((record & 0xFEU) == LA_REC_FETCH)
+    {
+      LA_Dec_Main = ((LA_Dec_Main ^ LA_SAMPLE_IFETCH) & 0xFF000000U) | ((LA_Dec_Main + ((record & 0x01U) << 8)) & 0x00FFFF00U) |
+                    p[LA_Dec_Pos++];
+      break;
+    }
+    if ((record & 0xFEU) == LA_REC_OPCODE)
+    {
+      LA_Dec_Main = LA_SAMPLE_OPCODE | ((LA_Dec_Main + ((record & 0x01U) << 8)) & 0x00FFFF00U) | p[LA_Dec_Pos++];
+      break;
+    }
+    if ((record == LA_REC_OPJUMP) || (((record & 0xF0U) == LA_REC_JUMP) && (record != LA_REC_FULL)))
+    {
+      if (record == LA_REC_OPJUMP)
+      {
+        LA_Dec_Main = LA_SAMPLE_OPCODE;
+      }
+      else if (record != LA_REC_JUMP)
+      {
+        LA_Dec_Main = (uint32_t)(record & 0x0FU) << 24;   //  CJUMP
+      }
+      LA_Dec_Main = (LA_Dec_Main & 0xFF000000U) | ((uint32_t)p[LA_Dec_Pos] << 16) | ((uint32_t)p[LA_Dec_Pos + 1] << 8) | p[LA_Dec_Pos + 2];
+      LA_Dec_Pos += 3;
+      break;
+    }
+    if (record == LA_REC_FULL)
+    {
+      LA_Dec_Main = LA_Get_32(&p[LA_Dec_Pos]);
+      LA_Dec_Aux  = p[LA_Dec_Pos + 4];
+      LA_Dec_Pos += 5;
+      break;
+    }
+    //  LA_REC_BLOCK
+    LA_Dec_Sample = LA_Get_32(&p[LA_Dec_Pos]) - 1;        //  Incremented below
+    LA_Dec_Main   = LA_Get_32(&p[LA_Dec_Pos + 4]);
+    LA_Dec_Aux    = p[LA_Dec_Pos + 8];
+    LA_Dec_Pos   += 9;
+    break;
+  }
+  *main          = LA_Dec_Main;
+  *aux           = LA_Dec_Aux;
+  *sample_number = ++LA_Dec_Sample;
+  return true;
+}
+
+//
+//  Bytes used by a compressed capture, for the compression ratio
+//
+
+uint32_t Logic_Analyzer_Compressed_Bytes(void)
+{
+  if (LA_Comp_Blocks_Written > LA_Comp_Num_Blocks)
+  {
+    return (LA_Comp_Num_Blocks - 1) * LA_BLOCK_SIZE + LA_Comp_Pos;
+  }
+  return LA_Comp_Blocks_Written ? (LA_Comp_Blocks_Written - 1) * LA_BLOCK_SIZE + LA_Comp_Pos : 0;
+}
+
+//
+//  Compressed capture writes one block at a time, so prefetch the byte ring rather than both buffers
+//
+
+static void LA_Prefetch_Compressed(void)
+{
+  uint32_t    ring_bytes = LA_Comp_Num_Blocks * LA_BLOCK_SIZE;
+  uint32_t    write_pos  = LA_Comp_Block * LA_BLOCK_SIZE + LA_Comp_Pos;
+  uint32_t    ahead;
+
+  if (write_pos >= ring_bytes)
+  {
+    write_pos = 0;                                        //  Before the first block is started
+  }
+  ahead = (LA_Prefetch_Index + ring_bytes - write_pos) % ring_bytes;
+  if (ahead > LA_PREFETCH_BYTES + 32)                     //  The loop below can stop up to a line past LA_PREFETCH_BYTES
+  {     //  The ISR has overtaken us. Start again just ahead of it
+    LA_Prefetch_Index = ((write_pos + 32) & ~31U) % ring_bytes;
+    ahead = 0;
+  }
+  while ((ahead < LA_PREFETCH_BYTES) && (ahead < ring_bytes - LA_BLOCK_SIZE))
+  {
+    (void)*(volatile uint8_t *)(LA_Block_Address(LA_Prefetch_Index / LA_BLOCK_SIZE) + (LA_Prefetch_Index % LA_BLOCK_SIZE));
+    LA_Prefetch_Index = (LA_Prefetch_Index + 32) % ring_bytes;
+    ahead += 32;
+  }
+}
+
+//
+//  Keep the cache lines ahead of the ISR's write index loaded. Only does anything while capturing to PSRAM
+//
+
+void Logic_Analyzer_Prefetch(void)
+{
+  uint32_t    ahead;
+
+  if (!LA_Using_PSRAM)
+  {
+    return;
+  }
+  if (Logic_Analyzer_Compressed)
+  {
+    LA_Prefetch_Compressed();
+    return;
+  }
+  ahead = (LA_Prefetch_Index - Logic_Analyzer_Data_index) & Logic_Analyzer_Current_Index_Mask;
+  if (ahead > LA_PREFETCH_SAMPLES + LA_CACHE_LINE_SAMPLES)  //  The loop below can stop up to a line past LA_PREFETCH_SAMPLES
+  {     //  The ISR has overtaken us. Start again just ahead of it
+    LA_Prefetch_Index = (Logic_Analyzer_Data_index + LA_CACHE_LINE_SAMPLES) & ~(LA_CACHE_LINE_SAMPLES - 1) & Logic_Analyzer_Current_Index_Mask;
+    ahead = 0;
+  }
+  while ((ahead < LA_PREFETCH_SAMPLES) && (ahead < Logic_Analyzer_Current_Buffer_Length - LA_CACHE_LINE_SAMPLES))
+  {
+    (void)*(volatile uint32_t *)&Logic_Analyzer_Data_1[LA_Prefetch_Index];
+    (void)*(volatile uint32_t *)&Logic_Analyzer_Data_2[LA_Prefetch_Index];
+    LA_Prefetch_Index = (LA_Prefetch_Index + LA_CACHE_LINE_SAMPLES) & Logic_Analyzer_Current_Index_Mask;
+    ahead += LA_CACHE_LINE_SAMPLES;
+  }
+}
+
+//
+//  For DMA_LA_Sample(), which runs with interrupts off. True if the store of the next sample (or, for compressed
+//  capture, the rest of this block and the start of the next) is to cache lines that were prefetched
+//
+
+FASTRUN bool Logic_Analyzer_Store_Is_Cached(void)
+{
+  uint32_t    ring_bytes, write_pos, ahead;
+
+  if (!LA_Using_PSRAM)
+  {
+    return true;
+  }
+  if (Logic_Analyzer_Compressed)
+  {
+    ring_bytes = LA_Comp_Num_Blocks * LA_BLOCK_SIZE;      //  A power of 2, as the buffer length is
+    write_pos  = LA_Comp_Block * LA_BLOCK_SIZE + LA_Comp_Pos;
+    if (write_pos >= ring_bytes)
+    {
+      write_pos = 0;
+    }
+    ahead = (LA_Prefetch_Index - write_pos) & (ring_bytes - 1);
+    return (ahead >= LA_BLOCK_SIZE + 32) && (ahead <= LA_PREFETCH_BYTES + 32);
+  }
+  ahead = (LA_Prefetch_Index - Logic_Analyzer_Data_index) & Logic_Analyzer_Current_Index_Mask;
+  return (ahead != 0) && (ahead <= LA_PREFETCH_SAMPLES + LA_CACHE_LINE_SAMPLES);
+}
+
+//
+//  Time LA_BENCH_SAMPLES stores of a sample pair, exactly as onPhi_1_Rise() does them. Interrupts are left on,
+//  since the HP85 bus must keep being serviced, so the occasional measurement includes an ISR. Hence
+//  the median and 90th percentile are the useful numbers, rather than the max
+//
+
+static int LA_Bench_Compare(const void *a, const void *b)
+{
+  return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+static void LA_Bench_Run(const char *name, uint32_t *buf_1, uint32_t *buf_2, uint32_t length, bool prefetch)
+{
+  uint16_t    *cycles;
+  uint32_t    index, start, mask = length - 1;
+  uint32_t    cycles_per_us = F_CPU_ACTUAL / 1000000U;
+
+  if ((cycles = (uint16_t *)malloc(LA_BENCH_SAMPLES * sizeof(uint16_t))) == NULL)
+  {
+    Serial.printf("Not enough memory for la bench\n");
+    return;
+  }
+  arm_dcache_flush_delete(buf_1, length * sizeof(uint32_t));      //  Start with none of the buffer in the cache
+  arm_dcache_flush_delete(buf_2, length * sizeof(uint32_t));
+  if (prefetch)
+  {
+    for (index = 0 ; index < LA_BENCH_SAMPLES ; index += LA_CACHE_LINE_SAMPLES)
+    {
+      (void)*(volatile uint32_t *)&buf_1[index & mask];
+      (void)*(volatile uint32_t *)&buf_2[index & mask];
+    }
+  }
+  for (index = 0 ; index < LA_BENCH_SAMPLES ; index++)
+  {
+    start = ARM_DWT_CYCCNT;
+    buf_1[index & mask] = Logic_Analyzer_main_sample;
+    buf_2[index & mask] = Logic_Analyzer_aux_sample;
+#ifndef EBTKS_NATIVE
+    __asm__ volatile("dsb");                              //  Make sure the stores have completed before we stop the clock
+#endif
+    start = ARM_DWT_CYCCNT - start;
+    cycles[index] = (start > 0xFFFFU) ? 0xFFFFU : start;
+  }
+  qsort(cycles, LA_BENCH_SAMPLES, sizeof(uint16_t), LA_Bench_Compare);
+  Serial.printf("%-20s  %5u  %6u  %6u  %6u   %6lu ns  %4lu%%\n", name, cycles[0], cycles[LA_BENCH_SAMPLES / 2],
+                cycles[(LA_BENCH_SAMPLES * 9) / 10], cycles[LA_BENCH_SAMPLES - 1],
+                ((uint32_t)cycles[(LA_BENCH_SAMPLES * 9) / 10] * 1000U) / cycles_per_us,
+                ((uint32_t)cycles[(LA_BENCH_SAMPLES * 9) / 10] * 1000U * 100U) / cycles_per_us / LA_PHI_1_WINDOW_NS);
+  free(cycles);
+}
+
+void Logic_Analyzer_Bench(void)
+{
+  if (Logic_Analyzer_State != ANALYZER_IDLE)
+  {
+    Serial.printf("Logic Analyzer is busy\n");
+    return;
+  }
+  Serial.printf("\nCost of storing one Logic Analyzer sample, in CPU cycles. %d stores each. Phi 1 window is %d ns\n",
+                LA_BENCH_SAMPLES, LA_PHI_1_WINDOW_NS);
+  Serial.printf("Buffer                  Min  Median    90%%     Max   90%% time  of Phi 1\n");
+  LA_Bench_Run("Internal", Logic_Analyzer_Internal_1, Logic_Analyzer_Internal_2, LOGIC_ANALYZER_BUFFER_SIZE, false);
+#if ENABLE_LA_PSRAM
+  if (Logic_Analyzer_Max_Buffer_Length() > LOGIC_ANALYZER_BUFFER_SIZE)
+  {
+    LA_Bench_Run("PSRAM, cold cache", Logic_Analyzer_PSRAM_1, Logic_Analyzer_PSRAM_2, LOGIC_ANALYZER_PSRAM_SAMPLES, false);
+    LA_Bench_Run("PSRAM, prefetched", Logic_Analyzer_PSRAM_1, Logic_Analyzer_PSRAM_2, LOGIC_ANALYZER_PSRAM_SAMPLES, true);
+  }
+  else
+  {
+    Serial.printf("Not enough PSRAM for deep capture (%d MB fitted)\n", external_psram_size);
+  }
+#endif
+  Serial.printf("Max includes the occasional bus ISR that happened during a measurement\n\n");
+}
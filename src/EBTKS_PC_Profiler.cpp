@@ -0,0 +1,273 @@
+//
+//      11/08/2020      Statistical program counter profiler, using the Capricorn IFETCH signal
+//      11/26/2020      Off by default. Without ENABLE_PC_PROFILER the ring, the histogram, and the ISR test are not built
+//
+//  Capricorn asserts IFETCH during the read of an opcode, so at Phi 2 of a read cycle with IFETCH
+//  asserted, addReg is the address of the instruction being executed (the PC). onPhi_2_Rise() counts
+//  these, and every PC_PROFILE_DECIMATION th one is pushed by PC_Profile_Sample() into a ring, along with
+//  RSELEC if the address is in the bank switched ROM area. PC_PROFILE_DECIMATION is prime so that we
+//  don't lock onto loops with a matching period. The ISR cost is bounded: a decrement and compare for
+//  every opcode fetch, and a ring push for the sampled ones.
+//
+//  PC_Profiler_Poll() (called from loop() ) drains the ring into PC_Histogram[], a hash table keyed by
+//  bank and address. If the table is full, or the ring overflows, samples are counted as dropped.
+//
+//  Serial commands:
+//      pc prof on        Clear the histogram and start sampling
+//      pc prof off       Stop sampling
+//      pc prof           Show the hottest addresses
+//      pc prof save      Write the whole histogram, sorted hottest first, to /PC_PROFILE.TXT on the SD Card.
+//                        This sorts the hash table in place, so the histogram is cleared afterwards
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_PC_PROFILER
+
+#define PC_PROFILE_RING_SIZE          (1024)                    //  Must be a power of two
+#define PC_PROFILE_RING_MASK          (PC_PROFILE_RING_SIZE - 1)
+#define PC_HISTOGRAM_SIZE             (8192)                    //  Must be a power of two
+#define PC_HISTOGRAM_SHIFT            (32 - 13)                 //  log2(PC_HISTOGRAM_SIZE)
+#define PC_HISTOGRAM_MAX_PROBES       (32)
+#define PC_PROFILE_REPORT_LINES       (24)
+
+#define PC_KEY_BANKED                 (0x01000000U)             //  Set if the address is in the bank switched ROM area
+#define PC_KEY_RSELEC_SHIFT           (16)
+
+struct S_PC_Histogram_Entry
+{
+  uint32_t    key;                                              //  PC_KEY_BANKED | RSELEC << 16 | address
+  uint32_t    count;                                            //  0 means the entry is empty
+};
+
+static volatile uint32_t    PC_Profile_Ring[PC_PROFILE_RING_SIZE];
+static volatile uint32_t    PC_Profile_Head = 0;                //  Only written by the ISR
+static volatile uint32_t    PC_Profile_Tail = 0;                //  Only written by PC_Profiler_Poll()
+static volatile uint32_t    PC_Profile_Ring_Overflows = 0;      //  Only written by the ISR
+
+static DMAMEM struct S_PC_Histogram_Entry   PC_Histogram[PC_HISTOGRAM_SIZE];    //  64 KB, so keep it out of DTCM
+static uint32_t             PC_Histogram_Samples;
+static uint32_t             PC_Histogram_Entries;
+static uint32_t             PC_Histogram_Dropped;
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+
+FASTRUN void PC_Profile_Sample(uint16_t address)
+{
+  uint32_t    head = PC_Profile_Head;
+  uint32_t    key  = address;
+
+  if ((address >= 060000) && (address < 0100000))
+  {
+    key |= PC_KEY_BANKED | ((uint32_t)getRselec() << PC_KEY_RSELEC_SHIFT);
+  }
+  if ((head - PC_Profile_Tail) >= PC_PROFILE_RING_SIZE)
+  {
+    PC_Profile_Ring_Overflows++;
+    return;
+  }
+  PC_Profile_Ring[head & PC_PROFILE_RING_MASK] = key;
+  PC_Profile_Head = head + 1;
+}
+
+static void PC_Histogram_Add(uint32_t key)
+{
+  uint32_t    index, probe;
+
+  index = (key * 2654435761U) >> PC_HISTOGRAM_SHIFT;            //  Fibonacci hashing
+  for (probe = 0 ; probe < PC_HISTOGRAM_MAX_PROBES ; probe++)
+  {
+    if (PC_Histogram[index].count == 0)
+    {
+      PC_Histogram[index].key   = key;
+      PC_Histogram[index].count = 1;
+      PC_Histogram_Entries++;
+      return;
+    }
+    if (PC_Histogram[index].key == key)
+    {
+      PC_Histogram[index].count++;
+      return;
+    }
+    index = (index + 1) & (PC_HISTOGRAM_SIZE - 1);
+  }
+  PC_Histogram_Dropped++;
+}
+
+void PC_Profiler_Poll(void)
+{
+  uint32_t    tail = PC_Profile_Tail;
+
+  while (tail != PC_Profile_Head)
+  {
+    PC_Histogram_Add(PC_Profile_Ring[tail & PC_PROFILE_RING_MASK]);
+    PC_Histogram_Samples++;
+    tail++;
+    PC_Profile_Tail = tail;
+  }
+}
+
+static void PC_Histogram_Clear(void)
+{
+  memset(PC_Histogram, 0, sizeof(PC_Histogram));                //  DMAMEM is not cleared at startup, so this must be done before use
+  PC_Histogram_Samples = 0;
+  PC_Histogram_Entries = 0;
+  PC_Histogram_Dropped = 0;
+  PC_Profile_Ring_Overflows = 0;
+}
+
+static void PC_Key_To_Text(uint32_t key, char *text)
+{
+  if (key & PC_KEY_BANKED)
+  {
+    sprintf(text, "%03lo:%06lo", (key >> PC_KEY_RSELEC_SHIFT) & 0xFFU, key & 0xFFFFU);     //  RSELEC:address
+  }
+  else
+  {
+    sprintf(text, "    %06lo", key & 0xFFFFU);
+  }
+}
+
+void PC_Profiler_On_Command(void)
+{
+  PC_Profile_Active = false;
+  PC_Profiler_Poll();                                           //  Throw away anything left in the ring
+  PC_Histogram_Clear();
+  PC_Profile_Countdown = PC_PROFILE_DECIMATION;
+  PC_Profile_Active = true;
+  Serial.printf("PC profiler started, sampling 1 in %d opcode fetches\n", PC_PROFILE_DECIMATION);
+}
+
+void PC_Profiler_Off_Command(void)
+{
+  PC_Profile_Active = false;
+  PC_Profiler_Poll();
+  Serial.printf("PC profiler stopped. %lu samples\n", PC_Histogram_Samples);
+}
+
+//
+//  Show the hottest addresses, hottest first
+//
+
+void PC_Profiler_Report(void)
+{
+  bool        *reported;
+  uint32_t    line, index, hottest, hottest_count;
+  char        text[16];
+
+  PC_Profiler_Poll();
+  Serial.printf("\nPC profiler is %s. Samples %lu, addresses %lu, dropped %lu, ring overflows %lu\n",
+                PC_Profile_Active ? "running" : "stopped", PC_Histogram_Samples, PC_Histogram_Entries,
+                PC_Histogram_Dropped, PC_Profile_Ring_Overflows);
+  if (PC_Histogram_Samples == 0)
+  {
+    Serial.printf("No samples. Use pc prof on\n\n");
+    return;
+  }
+  if ((reported = (bool *)calloc(PC_HISTOGRAM_SIZE, sizeof(bool))) == NULL)
+  {
+    Serial.printf("Not enough memory for report\n");
+    return;
+  }
+  Serial.printf("RSELEC:Address    Samples   %%\n");
+  for (line = 0 ; line < PC_PROFILE_REPORT_LINES ; line++)
+  {
+    hottest = PC_HISTOGRAM_SIZE;
+    hottest_count = 0;
+    for (index = 0 ; index < PC_HISTOGRAM_SIZE ; index++)
+    {
+      if (!reported[index] && (PC_Histogram[index].count > hottest_count))
+      {
+        hottest_count = PC_Histogram[index].count;
+        hottest = index;
+      }
+    }
+    if (hottest == PC_HISTOGRAM_SIZE)
+    {
+      break;
+    }
+    reported[hottest] = true;
+    PC_Key_To_Text(PC_Histogram[hottest].key, text);
+    Serial.printf("%s  %10lu  %3lu\n", text, hottest_count, (hottest_count * 100U) / PC_Histogram_Samples);
+  }
+  Serial.printf("\n");
+  free(reported);
+}
+
+static int PC_Histogram_Compare(const void *a, const void *b)
+{
+  uint32_t    count_a = ((const struct S_PC_Histogram_Entry *)a)->count;
+  uint32_t    count_b = ((const struct S_PC_Histogram_Entry *)b)->count;
+
+  return (count_a < count_b) ? 1 : ((count_a > count_b) ? -1 : 0);      //  Descending
+}
+
+void PC_Profiler_Save_Command(void)
+{
+  File        prof_file;
+  bool        was_active;
+  uint32_t    index;
+  char        text[16];
+  char        line[64];
+
+  was_active = PC_Profile_Active;
+  PC_Profile_Active = false;
+  PC_Profiler_Poll();
+  if (!(prof_file = SD.open("/PC_PROFILE.TXT", O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Can't open /PC_PROFILE.TXT\n");
+    PC_Profile_Active = was_active;
+    return;
+  }
+  qsort(PC_Histogram, PC_HISTOGRAM_SIZE, sizeof(struct S_PC_Histogram_Entry), PC_Histogram_Compare);
+
+  sprintf(line, "Samples %lu  Decimation %d  Dropped %lu\r\n", PC_Histogram_Samples, PC_PROFILE_DECIMATION,
+          PC_Histogram_Dropped + PC_Profile_Ring_Overflows);
+  prof_file.write(line, strlen(line));
+  sprintf(line, "RSELEC:Address    Samples    %%\r\n");
+  prof_file.write(line, strlen(line));
+  for (index = 0 ; (index < PC_HISTOGRAM_SIZE) && PC_Histogram[index].count ; index++)
+  {
+    PC_Key_To_Text(PC_Histogram[index].key, text);
+    sprintf(line, "%s  %10lu  %5.2f\r\n", text, PC_Histogram[index].count,
+            (PC_Histogram[index].count * 100.0) / PC_Histogram_Samples);
+    prof_file.write(line, strlen(line));
+  }
+  prof_file.close();
+  Serial.printf("Wrote %lu addresses to /PC_PROFILE.TXT. Histogram cleared\n", index);
+
+  PC_Histogram_Clear();                                         //  The hash table is no longer valid after sorting
+  PC_Profile_Active = was_active;
+}
+
+#else
+
+void PC_Profiler_Poll(void)
+{
+}
+
+void PC_Profiler_On_Command(void)
+{
+  Serial.printf("PC profiler is not enabled. Set ENABLE_PC_PROFILER in EBTKS_Config.h and rebuild\n");
+}
+
+void PC_Profiler_Off_Command(void)
+{
+  PC_Profiler_On_Command();
+}
+
+void PC_Profiler_Report(void)
+{
+  PC_Profiler_On_Command();
+}
+
+void PC_Profiler_Save_Command(void)
+{
+  PC_Profiler_On_Command();
+}
+
+#endif
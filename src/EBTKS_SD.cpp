@@ -1,6 +1,9 @@
 //
 //	06/27/2020	All this wonderful code came from Russell.
 //
+//	11/22/2020	"dmaRefresh" in CONFIG.TXT sets the DMA refresh scheduler for each machine model
+//	11/26/2020	"lmaBusy" is gone from "dmaRefresh", the LMA cycles are always counted
+//
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
@@ -183,8 +186,21 @@ void saveConfiguration(const char *filename)
   doc["machineName"] = "HP85A";
   doc["flags"] = 173368985; //  0x0A556699    Hex constants are not allowed with this SdFat library
   doc["ram16k"] = false;    //  For safety, since we don't know what machine we are plugged into
+  doc["dramShadow"] = false;
   doc["screenEmu"] = false;
 
+  // DMA refresh scheduler, per machine model. See EBTKS_DMA_Scheduler.cpp
+
+  const char *dmaMachineNames[] = {"HP85A", "HP85B", "HP86", "HP87"};
+  JsonObject dmaRefresh = doc.createNestedObject("dmaRefresh");
+  for (int i = 0; i < MACH_NUM; i++)
+  {
+    JsonObject dmaMachine = dmaRefresh.createNestedObject(dmaMachineNames[i]);
+    dmaMachine["interval"] = DMA_REFRESH_INTERVAL;
+    dmaMachine["postponed"] = DMA_REFRESH_POSTPONED;
+    dmaMachine["grantDebt"] = DMA_REFRESH_GRANT_DEBT;
+  }
+
   // tape drive
 
   JsonObject tape = doc.createNestedObject("tape");
@@ -376,7 +392,25 @@ bool loadConfiguration(const char *filename)
     machineNum++;
   }
 
+  //
+  //  DMA refresh scheduler settings for this machine model. Anything missing gets the default
+  //
+
+  if (machineNum < MACH_NUM)
+  {
+    JsonObject dmaMachine = doc["dmaRefresh"][machineNames[machineNum]];
+    if (!DMA_Sched_Configure(&DMA_Sched, dmaMachine["interval"] | DMA_REFRESH_INTERVAL, dmaMachine["postponed"] | DMA_REFRESH_POSTPONED,
+                             dmaMachine["grantDebt"] | DMA_REFRESH_GRANT_DEBT))
+    {
+      LOGPRINTF("dmaRefresh for %s is out of range, using the defaults\n", machineNames[machineNum]);
+      DMA_Sched_Configure(&DMA_Sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED, DMA_REFRESH_GRANT_DEBT);
+    }
+  }
+  LOGPRINTF("DMA Refresh:          interval %lu, postponed %lu, grant debt %lu\n", DMA_Sched.interval, DMA_Sched.postponed,
+            DMA_Sched.grant_debt);
+
   enHP85RamExp(doc["ram16k"] | false);
+  DRAM_Shadow_Enable(doc["dramShadow"] | false);    //  After machineNum and ram16k, as both affect which pages are shadowed
   //bool enScreenEmu = doc["screenEmu"] | false;
   bool tapeEn = doc["tape"]["enable"] | false;
 
@@ -386,6 +420,8 @@ bool loadConfiguration(const char *filename)
 
   LOGPRINTF("Screen Emulation:     %s\n", (doc["screenEmu"] | false) ? "Active" : "Inactive");
 
+  LOGPRINTF("DRAM Shadow:          %s\n", (doc["dramShadow"] | false) ? "Active" : "Inactive");
+
   //LOGPRINTF("Tape Drive Emulation: %s\n", tapeEn ? "Active" : "Inactive");
 
   const char *tapeFname = doc["tape"]["filename"] | "tape1.tap";
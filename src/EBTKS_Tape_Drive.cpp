@@ -10,6 +10,11 @@
 //				a higher level function via loop() takes care
 //				of moving data into/out of ram to the disk file
 //
+//	11/05/2020	Block requests now go to the background through the ISR event ring,
+//			so Tape::poll() no longer needs to disable interrupts
+//
+//	11/20/2020	Block reads and writes are trace points for "trace on" (EBTKS_Event_Trace.cpp)
+//
 
 #include <Arduino.h>
 
@@ -38,10 +43,11 @@ static volatile uint8_t ioTapDat;
 
 static volatile uint16_t tapeBlock[TAPE_BLOCKSIZE];
 static volatile bool blockDirty = false;
-static volatile uint32_t newBlockNum = 0;
-static uint32_t currBlockNum = 10000; //use illegal value to force load
+static volatile uint32_t currBlockNum = 10000; //use illegal value to force load. Only written by the background
 static volatile uint32_t tapeInCount = 5;
-static uint32_t tapeRequest = 0;
+static volatile uint32_t tapeRequest = 0;       //set by the ISR when it queues a block request, cleared by the background when the block is loaded
+static uint32_t requestedBlockNum = 0;          //background only, see tape_block_request_event()
+static bool blockRequestPending = false;        //background only
 static volatile uint32_t wState = 0;
 
 // everett's tape emulation
@@ -229,8 +235,10 @@ FASTRUN bool readTapeStatus(void)
             // request new block
             if (tapeRequest == 0)
             {
-                newBlockNum = blk;
-                tapeRequest++;
+                if (ISR_Event_Push(ISR_EVENT_TAPE_BLOCK_REQUEST, 0, 0, blk))
+                {
+                    tapeRequest = 1; //if the ring was full, we try again on the next status read
+                }
             }
         }
     }
@@ -323,6 +331,7 @@ bool Tape::blockRead(uint32_t blkNum)
 {
     bool retval = false; //default to fail
 
+    TRACE_BEGIN(TRACE_TAPE_READ, blkNum);
     if (!_tapeFile.seek(blkNum * TAPE_BLOCKSIZE * 2))
         {
         Serial.printf("Tape seek error on block %d\n", blkNum);                      //  Maybe this should be pushed to the screen
@@ -338,12 +347,14 @@ bool Tape::blockRead(uint32_t blkNum)
         retval = true;
         }
 
+    TRACE_END(TRACE_TAPE_READ, blkNum);
     LOGPRINTF_TAPE("Read Block %06d\n", blkNum);
     return retval;
 }
 
 void Tape::blockWrite(int blkNum)
 {
+    TRACE_BEGIN(TRACE_TAPE_WRITE, blkNum);
     if (!_tapeFile.seek(blkNum * TAPE_BLOCKSIZE * 2))
         {
         Serial.printf("Tape seek error %d\n", blkNum);                      //  Maybe this should be pushed to the screen
@@ -354,6 +365,7 @@ void Tape::blockWrite(int blkNum)
         blockDirty = false;
         LOGPRINTF_TAPE("Write Block %06d\n", blkNum);
     }
+    TRACE_END(TRACE_TAPE_WRITE, blkNum);
 }
 
 void Tape::flush(void)
@@ -399,7 +411,7 @@ void Tape::poll(void)
         }
     }
 
-    if (tapeRequest)
+    if (blockRequestPending)
     {
         if (blockDirty == true)
         {
@@ -407,11 +419,10 @@ void Tape::poll(void)
             _downCount = 50; //5 seconds to flush tape
             blockDirty = false;
         }
-        blockRead(newBlockNum);
-        __disable_irq();
-        currBlockNum = newBlockNum;
+        blockRead(requestedBlockNum);
+        blockRequestPending = false;
+        currBlockNum = requestedBlockNum; //must be before tapeRequest is cleared, as that lets the ISR use the block
         tapeRequest = 0;
-        __enable_irq();
     }
 
     if (ioTapCtl != _prevCtrl)
@@ -426,6 +437,22 @@ bool Tape::is_tape_loaded(void)
   return _tape_inserted;
 }
 
+//
+//  Called by ISR_Event_Poll() in the background. The ISR only queues a new request once the
+//  previous one has been serviced (tapeRequest), so there should never be one pending already
+//
+
+bool tape_block_request_event(uint32_t block_num)
+{
+    if (blockRequestPending)
+    {
+        return false;
+    }
+    requestedBlockNum = block_num;
+    blockRequestPending = true;
+    return true;
+}
+
 void tape_handle_command_load(void)
 {
   Serial.printf("\nLoad new tape file. Enter filename including path: ");
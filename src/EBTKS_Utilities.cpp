@@ -184,7 +184,47 @@ struct S_Command_Entry Command_Table[] =
   {"sdreadtimer",      diag_sdread_1},
   {"la setup",         Setup_Logic_Analyzer},
   {"la go",            Logic_analyzer_go},
+  {"la stages",        Logic_Analyzer_Stages_Command},
+  {"la vcd",           Logic_Analyzer_VCD_Command},
+  {"la dump",          Logic_Analyzer_Dump_Command},
+  {"la decode",        Logic_Analyzer_Decode_Command},
+  {"la bench",         Logic_Analyzer_Bench},
+  {"dma bench",        DMA_Session_Bench},
+  {"dma sched",        DMA_Sched_Report},
+  {"dma sched set",    DMA_Sched_Set_Command},
+  {"dma sched check",  DMA_Sched_Check_Command},
+  {"dma queue",        DMA_Queue_Report},
+  {"dma timing",       DMA_Timing_Check_Command},
   {"addr",             proc_addr},
+  {"isr prof",         ISR_Profiler_Report},
+  {"isr prof clear",   ISR_Profiler_Clear_Command},
+  {"isr events",       ISR_Event_Report},
+  {"int lat",          Interrupt_Latency_Report},
+  {"int lat clear",    Interrupt_Latency_Clear_Command},
+  {"bus stats",        Bus_Stats_Report},
+  {"pc prof",          PC_Profiler_Report},
+  {"pc prof on",       PC_Profiler_On_Command},
+  {"pc prof off",      PC_Profiler_Off_Command},
+  {"pc prof save",     PC_Profiler_Save_Command},
+  {"wp",               Watchpoint_Report},
+  {"wp set",           Watchpoint_Set_Command},
+  {"wp clear",         Watchpoint_Clear_Command},
+  {"fr",               Flight_Recorder_Report},
+  {"fr start",         Flight_Recorder_Start_Command},
+  {"fr stop",          Flight_Recorder_Stop_Command},
+  {"heat",             Heatmap_Report},
+  {"heat on",          Heatmap_On_Command},
+  {"heat off",         Heatmap_Off_Command},
+  {"heat save",        Heatmap_Save_Command},
+  {"trace",            Event_Trace_Report},
+  {"trace on",         Event_Trace_On_Command},
+  {"trace off",        Event_Trace_Off_Command},
+  {"trace save",       Event_Trace_Save_Command},
+  {"shadow",           DRAM_Shadow_Status},
+  {"shadow on",        DRAM_Shadow_On_Command},
+  {"shadow off",       DRAM_Shadow_Off_Command},
+  {"shadow check",     DRAM_Shadow_Check_Command},
+  {"shadow verify",    DRAM_Shadow_Verify_Command},
   {"show logfile",     show_logfile},
   {"clean logfile",    clean_logfile},
   {"show file",        show_file},
@@ -468,7 +508,36 @@ void help_2(void)
   Serial.printf("sdreadtimer   Test Reading with different start positions\n");
   Serial.printf("la setup      Set up the logic analyzer\n");
   Serial.printf("la go         Start the logic analyzer\n");
+  Serial.printf("la stages     Set up a multi-stage trigger, after la setup\n");
+  Serial.printf("la vcd        Write the last capture to /LA_CAPTURE.VCD for GTKWave/sigrok\n");
+  Serial.printf("la dump       Send the last capture over USB Serial as binary frames\n");
+  Serial.printf("la decode     Decode the last capture into Capricorn instructions in /LA_DECODE.TXT\n");
+  Serial.printf("la bench      Measure the cost of a sample store, internal vs PSRAM\n");
+  Serial.printf("dma bench     Compare HP85 bus stall time, one DMA session vs a bus grant per operation\n");
+  Serial.printf("dma sched     Show the DMA refresh scheduler settings and burst statistics\n");
+  Serial.printf("dma sched set   Change the DMA refresh scheduler settings until restart\n");
+  Serial.printf("dma sched check Check every legal refresh setting against the 1MA2 model\n");
+  Serial.printf("dma queue     Show the background DMA job queue, and jobs and slices by client\n");
+  Serial.printf("dma timing    Check DMA edge timing against setup/hold rules (needs ENABLE_DMA_TIMING_CHECK)\n");
   Serial.printf("addr          Instantly show where HP85 is executing\n");
+  Serial.printf("isr prof      Show ISR handler timing (needs ENABLE_ISR_PROFILER)\n");
+  Serial.printf("isr prof clear  Clear ISR handler timing\n");
+  Serial.printf("isr events    Show ISR event ring usage and overflows\n");
+  Serial.printf("int lat       Show interrupt latency by source. int lat clear to reset\n");
+  Serial.printf("bus stats     Show bus cycles per second by cycle type\n");
+  Serial.printf("pc prof on    Start the IFETCH PC profiler. Also pc prof off\n");
+  Serial.printf("pc prof       Show where the HP85 is spending its time\n");
+  Serial.printf("pc prof save  Save the sorted PC profile to /PC_PROFILE.TXT\n");
+  Serial.printf("wp set        Add an address watchpoint (read, write, fetch)\n");
+  Serial.printf("wp            Show watchpoints, hit counts, and recent hits. wp clear removes all\n");
+  Serial.printf("fr start      Record every bus cycle to /FLIGHT.BIN until fr stop. fr shows status\n");
+  Serial.printf("heat on       Count reads by ROM bank and page, and 16K RAM page. Also heat off\n");
+  Serial.printf("heat          Show reads by ROM bank. heat save writes /HEATMAP.CSV\n");
+  Serial.printf("trace on      Trace tape, disk, AUXROM, 1MB5, log flush and DMA timing. Also trace off\n");
+  Serial.printf("trace         Show event trace status. trace save writes Chrome trace JSON to /TRACE.JSON\n");
+  Serial.printf("shadow        Show DRAM shadow status. Also shadow on, shadow off\n");
+  Serial.printf("shadow check  Compare the DRAM shadow with DMA reads of the HP85 DRAM\n");
+  Serial.printf("shadow verify Toggle checking every DRAM shadow read against DMA\n");
   Serial.printf("show logfile  Show the logfile\n");
   Serial.printf("clean logfile Clean_logfile\n");
   Serial.printf("show file     You will be prompted for a file path/name to be displayed\n");
@@ -758,8 +827,13 @@ void proc_addr(void)
 
 void proc_auxint(void)
 {
+  __disable_irq();                  //  The 1MB5 can request an interrupt from the isr, with its own vector
   interruptVector = 0x12; //SPAR1
+#if ENABLE_INTERRUPT_LATENCY
+  Interrupt_Latency_Request();
+#endif
   interruptReq = true;
+  __enable_irq();
   ASSERT_INT;
 }
 
@@ -1154,15 +1228,13 @@ rselec_mask_done:
                               (Logic_Analyzer_Trigger_Mask_2 >>  0) & 0x000000FF);
 
 //
-//  Set the buffer length 32 .. 1024 , must be power of 2
+//  Set the buffer length 32 .. Logic_Analyzer_Max_Buffer_Length() , must be power of 2
+//  Lengths above LOGIC_ANALYZER_BUFFER_SIZE are in PSRAM
 //
 
-#if LOGIC_ANALYZER_BUFFER_SIZE > 8192
-#error This code needs to be modified for the changed LOGIC_ANALYZER_BUFFER_SIZE
-#endif
-
 redo_buffer_length:
-  Serial.printf("Set the buffer length 32 .. %d , must be power of 2)[%d]:", LOGIC_ANALYZER_BUFFER_SIZE, Logic_Analyzer_Current_Buffer_Length);
+  Serial.printf("Set the buffer length 32 .. %lu , must be power of 2, above %d uses PSRAM)[%d]:", Logic_Analyzer_Max_Buffer_Length(),
+                LOGIC_ANALYZER_BUFFER_SIZE, Logic_Analyzer_Current_Buffer_Length);
   if (!wait_for_serial_string())
   {
     Ctrl_C_seen = false; return;                           //  Got a Ctrl-C , so abort command
@@ -1177,15 +1249,9 @@ redo_buffer_length:
     sscanf(serial_string, "%d", (int *)&Logic_Analyzer_Current_Buffer_Length);
   }
   serial_string_used();
-  if ((Logic_Analyzer_Current_Buffer_Length !=   32) &&
-     (Logic_Analyzer_Current_Buffer_Length !=   64) &&
-     (Logic_Analyzer_Current_Buffer_Length !=  128) &&
-     (Logic_Analyzer_Current_Buffer_Length !=  256) &&
-     (Logic_Analyzer_Current_Buffer_Length !=  512) &&
-     (Logic_Analyzer_Current_Buffer_Length != 1024) &&
-     (Logic_Analyzer_Current_Buffer_Length != 2048) &&
-     (Logic_Analyzer_Current_Buffer_Length != 4096) &&
-     (Logic_Analyzer_Current_Buffer_Length != 8192)    )
+  if ((Logic_Analyzer_Current_Buffer_Length < 32) ||
+      (Logic_Analyzer_Current_Buffer_Length > Logic_Analyzer_Max_Buffer_Length()) ||
+      (Logic_Analyzer_Current_Buffer_Length & (Logic_Analyzer_Current_Buffer_Length - 1)))     //  Not a power of 2
   {
     goto redo_buffer_length;
   }
@@ -1241,6 +1307,26 @@ redo_buffer_length:
   }
   serial_string_used();
 
+//
+//  Compressed capture stores the same buffers as variable length records, so holds many more samples,
+//  see EBTKS_Logic_Analyzer.cpp. Pretrigger samples then sets the fraction of the buffers used before the trigger
+//
+  Serial.printf("Compressed capture (y/n)[%c]:", Logic_Analyzer_Compressed ? 'y' : 'n');
+  if (!wait_for_serial_string())
+  {
+    Ctrl_C_seen = false; return;                           //  Got a Ctrl-C , so abort command
+  }
+
+  if (strlen(serial_string) == 0)
+  {      //  Keep existing value
+    Serial.printf("Using prior value\n");
+  }
+  else
+  {
+    Logic_Analyzer_Compressed = (serial_string[0] == 'y') || (serial_string[0] == 'Y');
+  }
+  serial_string_used();
+
   Logic_Analyzer_Samples_Till_Done     = Logic_Analyzer_Current_Buffer_Length - Logic_Analyzer_Pre_Trigger_Samples;
   Logic_Analyzer_Event_Count           = Logic_Analyzer_Event_Count_Init;
 
@@ -1249,46 +1335,97 @@ redo_buffer_length:
 
 static  uint32_t    LA_Heartbeat_Timer;
 
+//
+//  One line of the Logic Analyzer results. main and aux are a Logic_Analyzer_Data_1/2 pair
+//
+
+static void LA_Show_Sample(int32_t sample_number_relative_to_trigger, uint32_t main, uint32_t aux, bool is_trigger)
+{
+  if ((main & (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR)) == (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR))
+  { //  All 3 control lines are high (not asserted, so data bus is junque)
+    Serial.printf("   %-4d %06o/%04X  xxx/xx  ", sample_number_relative_to_trigger, (main >> 8) & 0x0000FFFFU,
+                                                           (main >> 8) & 0x0000FFFFU );
+  }
+  else
+  {
+    Serial.printf("   %-4d %06o/%04X  %03o/%02X  ", sample_number_relative_to_trigger, (main >> 8) & 0x0000FFFFU,
+                                                           (main >> 8) & 0x0000FFFFU,
+                                                           main & 0x000000FFU,
+                                                           main & 0x000000FFU);
+  }
+  Serial.printf("%c", (main & BIT_MASK_WR)  ? '-' : 'W');   //  Remember that these 3 signals are active low
+  Serial.printf("%c", (main & BIT_MASK_RD)  ? '-' : 'R');
+  Serial.printf("%c", (main & BIT_MASK_LMA) ? '-' : 'L');
+  Serial.printf("%c", (main & LA_SAMPLE_IFETCH) ? 'F' : '-');   //  Opcode fetch, active high in the sample
+  Serial.printf("   %03o", aux & 0x000000FF);
+
+  if (is_trigger)
+  {
+    Serial.printf("  Trigger\n");
+  }
+  else if (main & 0x08000000)                               //  See if the DMA bit is set
+  {                                                         //  WE DO NOT TRACE THE DMA LMA Cycles, or the Refresh Cycles. We do not support triggering on DMA
+    Serial.printf("  DMA\n");
+  }
+  else
+  {
+    Serial.printf("\n");
+  }
+  Serial.flush();
+}
+
 void Logic_analyzer_go(void)
 {
+  if (Logic_Analyzer_Export_Busy())
+  {
+    Serial.printf("Logic Analyzer export in progress, try again when it is done\n");
+    return;
+  }
 //
 //  This re-initialization allows re issuing la_go without re-entering parameters
 //
-  memset(Logic_Analyzer_Data_1, 0, 1024);
-  memset(Logic_Analyzer_Data_2, 0, 1024);
   Logic_Analyzer_Data_index         = 0;
+  Logic_Analyzer_Select_Buffer();                                     //  Internal or PSRAM buffers, and clear them
   Logic_Analyzer_Valid_Samples      = 0;
   Logic_Analyzer_Index_of_Trigger   = -1;                             //  A negative value means that if we display the buffer without a trigger event (time out) we won't display the Trigger message
   Logic_Analyzer_Triggered          = false;
-  Logic_Analyzer_Event_Count        = Logic_Analyzer_Event_Count_Init;
-  Logic_Analyzer_Samples_Till_Done  = Logic_Analyzer_Current_Buffer_Length - Logic_Analyzer_Pre_Trigger_Samples;
+  Logic_Analyzer_Trigger_Compile();                                   //  Also sets Logic_Analyzer_Event_Count
+  Logic_Analyzer_Samples_Till_Done  = Logic_Analyzer_Compressed ? Logic_Analyzer_Post_Trigger_Blocks() :
+                                      Logic_Analyzer_Current_Buffer_Length - Logic_Analyzer_Pre_Trigger_Samples;
   LA_Heartbeat_Timer                = systick_millis_count + 1000;    //  Do heartbeat message every 1000 ms
   Logic_Analyzer_Valid_Samples_1_second_ago = -100000;
+  DMA_LA_Sample_Reset();
   Logic_Analyzer_State              = ANALYZER_ACQUIRING;
 }
 
 void Logic_Analyzer_Poll(void)
 {
   uint32_t      temp;
-  int16_t       sample_number_relative_to_trigger;
-  int16_t       i, j;
-  int16_t       Samples_to_display;
-  int16_t       Display_starting_index;
+  int32_t       sample_number_relative_to_trigger;
+  int32_t       i, j;
+  int32_t       Samples_to_display;
+  int32_t       Display_starting_index;
+  int32_t       first_sample, sample_number;
+  uint32_t      aux, decoded;
 
   if (Logic_Analyzer_State == ANALYZER_IDLE)
   {
     return;
   }
+  if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
+  {
+    Logic_Analyzer_Prefetch();                    //  Only does anything for PSRAM buffers
+  }
 
   if (LA_Heartbeat_Timer < systick_millis_count)
   {
     Serial.printf("Heartbeat Timer %10d    systick_millis_count %10d\n", LA_Heartbeat_Timer, systick_millis_count);
     Serial.printf("waiting... Valid Samples:%4d Samples till done:%d\n", Logic_Analyzer_Valid_Samples, Logic_Analyzer_Samples_Till_Done);
-    Serial.printf("Current Sample:%08X-%08X Mask:%08X-%08X TrigPattern:%08X-%08X Event Counter:%d Current RSELEC %03o\n\n",
+    Serial.printf("Current Sample:%08X-%08X Mask:%08X-%08X TrigPattern:%08X-%08X Event Counter:%d Stage:%lu Current RSELEC %03o\n\n",
                     Logic_Analyzer_main_sample, Logic_Analyzer_aux_sample,
                     Logic_Analyzer_Trigger_Mask_1,  Logic_Analyzer_Trigger_Mask_2,
                     Logic_Analyzer_Trigger_Value_1, Logic_Analyzer_Trigger_Value_2,
-                    Logic_Analyzer_Event_Count, getRselec());
+                    Logic_Analyzer_Event_Count, Logic_Analyzer_Trigger_Stage(), getRselec());
 
     //Serial.printf("Mailboxes 0..6  :");
     //show_mailboxes_and_usage();
@@ -1376,45 +1513,41 @@ la_display_results:
   // __enable_irq();
   // Serial.printf("PRIMASK Expect 1     = %08X\n", temp);           //  It will be a real surprise if this works. Expect LSB to be 1. Tested, It works and shows Global Interrupt enable
   Serial.printf("\n\n");
+  DMA_LA_Sample_Report();
 
   Serial.printf("Sample  Address      Data    Cycle  RSELEC\n");
-  Serial.printf("                             WRL\n");
+  Serial.printf("                             WRLF\n");
   sample_number_relative_to_trigger = - Logic_Analyzer_Pre_Trigger_Samples;
 
-  for (i = 0 ; i < Samples_to_display ; i++)
-  {
-    j = (i + Display_starting_index) & Logic_Analyzer_Current_Index_Mask;
-    temp = Logic_Analyzer_Data_1[j];
-    if ((temp & (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR)) == (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR))
-    { //  All 3 control lines are high (not asserted, so data bus is junque)
-      Serial.printf("   %-4d %06o/%04X  xxx/xx  ", sample_number_relative_to_trigger++, (temp >> 8) & 0x0000FFFFU,
-                                                             (temp >> 8) & 0x0000FFFFU );
-    }
-    else
+  if (Logic_Analyzer_Compressed)
+  {   //  Decode from the oldest block, and skip samples before the pre-trigger samples
+    first_sample = (Logic_Analyzer_Index_of_Trigger >= 0) ? Logic_Analyzer_Index_of_Trigger - Logic_Analyzer_Pre_Trigger_Samples :
+                                                            (int32_t)Logic_Analyzer_Data_index - Logic_Analyzer_Current_Buffer_Length;
+    decoded = 0;
+    if (Logic_Analyzer_Decode_First())
     {
-      Serial.printf("   %-4d %06o/%04X  %03o/%02X  ", sample_number_relative_to_trigger++, (temp >> 8) & 0x0000FFFFU,
-                                                             (temp >> 8) & 0x0000FFFFU,
-                                                             temp & 0x000000FFU,
-                                                             temp & 0x000000FFU);
+      while (Logic_Analyzer_Decode_Next(&temp, &aux, &sample_number))
+      {
+        decoded++;
+        if (sample_number < first_sample)
+        {
+          continue;
+        }
+        LA_Show_Sample(sample_number - first_sample - Logic_Analyzer_Pre_Trigger_Samples, temp, aux,
+                       sample_number == Logic_Analyzer_Index_of_Trigger);
+      }
     }
-    Serial.printf("%c", (temp & BIT_MASK_WR)  ? '-' : 'W');   //  Remember that these 3 signals are active low
-    Serial.printf("%c", (temp & BIT_MASK_RD)  ? '-' : 'R');
-    Serial.printf("%c", (temp & BIT_MASK_LMA) ? '-' : 'L');
-    Serial.printf("    %03o", Logic_Analyzer_Data_2[j] & 0x000000FF);
+    Serial.printf("\n%lu samples in %lu bytes, compression ratio %.1f : 1\n", decoded, Logic_Analyzer_Compressed_Bytes(),
+                  Logic_Analyzer_Compressed_Bytes() ? (decoded * 8.0) / Logic_Analyzer_Compressed_Bytes() : 0.0);
+    Serial.printf("\n\n");
+    return;
+  }
 
-    if (j == Logic_Analyzer_Index_of_Trigger)
-    {
-      Serial.printf("  Trigger\n");
-    }
-    else if (temp & 0x08000000)                               //  See if the DMA bit is set
-    {                                                         //  WE DO NOT TRACE THE DMA LMA Cycles, or the Refresh Cycles. We do not support triggering on DMA
-      Serial.printf("  DMA\n");
-    }
-    else
-    {
-      Serial.printf("\n");
-    }
-    Serial.flush();
+  for (i = 0 ; i < Samples_to_display ; i++)
+  {
+    j = (i + Display_starting_index) & Logic_Analyzer_Current_Index_Mask;
+    LA_Show_Sample(sample_number_relative_to_trigger++, Logic_Analyzer_Data_1[j], Logic_Analyzer_Data_2[j],
+                   j == Logic_Analyzer_Index_of_Trigger);
   }
   Serial.printf("\n\n");
 }
@@ -0,0 +1,320 @@
+//
+//      11/09/2020      Address watchpoints
+//      11/26/2020      Off by default. Without ENABLE_WATCHPOINTS the tables, and the ISR lookups, are not built
+//
+//  Up to MAX_WATCHPOINTS watchpoints, each an address range and any combination of read, write and
+//  opcode fetch. They are compiled by Watchpoint_Compile() into two tables that the ISR can use with
+//  almost no overhead:
+//    Watch_Page_Slot[256]   One byte per 256 byte page. 0 if no watchpoint touches the page, else
+//                           1 + the index of that page's access map in Watch_Pages[]
+//    Watch_Pages[][256]     One byte per address, the OR of the WATCH_READ/WRITE/FETCH bits of every
+//                           watchpoint that covers it
+//  onPhi_1_Rise() looks up Watch_Page_Slot[addReg >> 8] every bus cycle, and only calls
+//  Watchpoint_Check() if it is non zero. onPhi_2_Rise() samples IFETCH for reads of watched pages.
+//
+//  Hits are pushed into a ring with the address, data, RSELEC, access type, and ARM_DWT_CYCCNT.
+//  Watchpoint_Poll() (called from loop() ) drains the ring, counts hits per watchpoint, keeps the most
+//  recent hits for "wp", and prints each hit for watchpoints that were set with "log".
+//
+//  Like the Logic Analyzer, only bus cycles driven by the CPU are seen. EBTKS's own DMA is not.
+//
+//  Serial commands:
+//      wp set      Add a watchpoint. Prompts for:  start(8) end(8) access [log]
+//                  access is any of r w f, such as rw.  end is inclusive
+//      wp          Show the watchpoints, their hit counts, and the most recent hits
+//      wp clear    Remove all watchpoints
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_WATCHPOINTS
+
+#define WATCH_HIT_RING_SIZE           (256)                     //  Must be a power of two
+#define WATCH_HIT_RING_MASK           (WATCH_HIT_RING_SIZE - 1)
+#define WATCH_RECENT_HITS             (16)                      //  Kept for the "wp" report
+#define WATCH_LOG_PER_POLL            (8)                       //  Limit Serial output per Watchpoint_Poll()
+
+struct S_Watchpoint
+{
+  uint16_t    start;
+  uint16_t    end;                                              //  Inclusive
+  uint8_t     access;                                           //  WATCH_READ | WATCH_WRITE | WATCH_FETCH
+  bool        log;                                              //  Print every hit, else just count them
+  uint32_t    hits;
+};
+
+struct S_Watch_Hit
+{
+  uint16_t    addr;
+  uint8_t     data;
+  uint8_t     rselec;
+  uint8_t     access;                                           //  What kind of cycle this was, only one of the WATCH_ bits (fetch is just WATCH_FETCH)
+  uint32_t    cycles;                                           //  ARM_DWT_CYCCNT at the time of the hit
+};
+
+static struct S_Watchpoint  Watchpoints[MAX_WATCHPOINTS];
+static uint32_t             Watchpoint_Count = 0;
+static uint8_t              Watch_Pages[WATCH_MAX_PAGES][256];
+
+static volatile struct S_Watch_Hit  Watch_Hit_Ring[WATCH_HIT_RING_SIZE];
+static volatile uint32_t    Watch_Hit_Head = 0;                 //  Only written by the ISR
+static volatile uint32_t    Watch_Hit_Tail = 0;                 //  Only written by Watchpoint_Poll()
+static volatile uint32_t    Watch_Hit_Overflows = 0;            //  Only written by the ISR
+
+static struct S_Watch_Hit   Watch_Recent[WATCH_RECENT_HITS];
+static uint32_t             Watch_Recent_Count = 0;             //  Free running, index is modulo WATCH_RECENT_HITS
+static uint32_t             Watch_Log_Skipped = 0;
+static uint32_t             Watch_Last_Cycles = 0;
+
+//
+//  This function is running within an ISR, keep it short and fast.
+//
+//  Only called when Watch_Page_Slot[addr >> 8] is non zero, and slot is that value. Passing it in
+//  rather than reading it again means a concurrent Watchpoint_Compile() can't give us a slot of 0
+//
+
+FASTRUN void Watchpoint_Check(uint16_t addr, uint8_t data, uint32_t slot)
+{
+  uint8_t     access;
+  uint32_t    head;
+  volatile struct S_Watch_Hit *hit;
+
+  if (schedule_write)
+  {
+    access = WATCH_WRITE;
+  }
+  else if (schedule_read)
+  {
+    access = Watch_Fetch_Cycle ? (WATCH_READ | WATCH_FETCH) : WATCH_READ;
+  }
+  else
+  {
+    return;
+  }
+  if ((access & Watch_Pages[slot - 1][addr & 0xFFU]) == 0)
+  {
+    return;
+  }
+  head = Watch_Hit_Head;
+  if ((head - Watch_Hit_Tail) >= WATCH_HIT_RING_SIZE)
+  {
+    Watch_Hit_Overflows++;
+    return;
+  }
+  hit = &Watch_Hit_Ring[head & WATCH_HIT_RING_MASK];
+  hit->addr   = addr;
+  hit->data   = data;
+  hit->rselec = getRselec();
+  hit->access = (access & WATCH_FETCH) ? WATCH_FETCH : access;
+  hit->cycles = ARM_DWT_CYCCNT;
+  Watch_Hit_Head = head + 1;
+}
+
+//
+//  Rebuild Watch_Page_Slot[] and Watch_Pages[] from Watchpoints[]. The ISR may be running, so the
+//  slots are cleared first and each slot is only set after its access map is complete.
+//  Returns false if the watchpoints need more than WATCH_MAX_PAGES pages
+//
+
+static bool Watchpoint_Compile(void)
+{
+  uint32_t    page, wp, addr, slots_used = 0;
+  uint8_t     page_slot[256];
+
+  memset((void *)Watch_Page_Slot, 0, sizeof(Watch_Page_Slot));
+  memset(Watch_Pages, 0, sizeof(Watch_Pages));
+  memset(page_slot, 0, sizeof(page_slot));
+
+  for (wp = 0 ; wp < Watchpoint_Count ; wp++)
+  {
+    for (addr = Watchpoints[wp].start ; addr <= Watchpoints[wp].end ; addr++)
+    {
+      page = addr >> 8;
+      if (page_slot[page] == 0)
+      {
+        if (slots_used == WATCH_MAX_PAGES)
+        {
+          return false;
+        }
+        page_slot[page] = ++slots_used;
+      }
+      Watch_Pages[page_slot[page] - 1][addr & 0xFFU] |= Watchpoints[wp].access;
+    }
+  }
+  for (page = 0 ; page < 256 ; page++)
+  {
+    Watch_Page_Slot[page] = page_slot[page];
+  }
+  return true;
+}
+
+static const char * Watch_Access_Name(uint8_t access)
+{
+  static char   name[4];
+
+  name[0] = (access & WATCH_READ)  ? 'r' : '-';
+  name[1] = (access & WATCH_WRITE) ? 'w' : '-';
+  name[2] = (access & WATCH_FETCH) ? 'f' : '-';
+  name[3] = 0;
+  return name;
+}
+
+static void Watch_Show_Hit(const struct S_Watch_Hit *hit, uint32_t prior_cycles)
+{
+  Serial.printf("WP %s %06o data %03o RSELEC %03o  cycle %10lu  +%lu us\n", Watch_Access_Name(hit->access),
+                hit->addr, hit->data, hit->rselec, hit->cycles, (hit->cycles - prior_cycles) / (F_CPU_ACTUAL / 1000000U));
+}
+
+void Watchpoint_Poll(void)
+{
+  uint32_t    tail = Watch_Hit_Tail;
+  uint32_t    wp, logged = 0;
+  struct S_Watch_Hit  hit;
+  bool        log;
+
+  while (tail != Watch_Hit_Head)
+  {
+    hit.addr   = Watch_Hit_Ring[tail & WATCH_HIT_RING_MASK].addr;
+    hit.data   = Watch_Hit_Ring[tail & WATCH_HIT_RING_MASK].data;
+    hit.rselec = Watch_Hit_Ring[tail & WATCH_HIT_RING_MASK].rselec;
+    hit.access = Watch_Hit_Ring[tail & WATCH_HIT_RING_MASK].access;
+    hit.cycles = Watch_Hit_Ring[tail & WATCH_HIT_RING_MASK].cycles;
+    tail++;
+    Watch_Hit_Tail = tail;
+
+    log = false;
+    for (wp = 0 ; wp < Watchpoint_Count ; wp++)
+    {
+      if ((hit.addr >= Watchpoints[wp].start) && (hit.addr <= Watchpoints[wp].end) &&
+          ((Watchpoints[wp].access & hit.access) || ((Watchpoints[wp].access & WATCH_READ) && (hit.access & WATCH_FETCH))))
+      {
+        Watchpoints[wp].hits++;
+        log |= Watchpoints[wp].log;
+      }
+    }
+    if (log)
+    {
+      if (logged++ < WATCH_LOG_PER_POLL)
+      {
+        Watch_Show_Hit(&hit, Watch_Last_Cycles);
+      }
+      else
+      {
+        Watch_Log_Skipped++;
+      }
+    }
+    Watch_Last_Cycles = hit.cycles;
+    Watch_Recent[Watch_Recent_Count++ % WATCH_RECENT_HITS] = hit;
+  }
+}
+
+void Watchpoint_Report(void)
+{
+  uint32_t    wp, index, first;
+
+  Watchpoint_Poll();
+  Serial.printf("\n%lu of %d watchpoints. Ring overflows %lu, log lines skipped %lu\n", Watchpoint_Count, MAX_WATCHPOINTS,
+                Watch_Hit_Overflows, Watch_Log_Skipped);
+  for (wp = 0 ; wp < Watchpoint_Count ; wp++)
+  {
+    Serial.printf("%2lu  %06o..%06o  %s %s  hits %lu\n", wp, Watchpoints[wp].start, Watchpoints[wp].end,
+                  Watch_Access_Name(Watchpoints[wp].access), Watchpoints[wp].log ? "log" : "   ", Watchpoints[wp].hits);
+  }
+  if (Watch_Recent_Count)
+  {
+    Serial.printf("Most recent hits, oldest first\n");
+    first = (Watch_Recent_Count > WATCH_RECENT_HITS) ? Watch_Recent_Count - WATCH_RECENT_HITS : 0;
+    for (index = first ; index < Watch_Recent_Count ; index++)
+    {
+      Watch_Show_Hit(&Watch_Recent[index % WATCH_RECENT_HITS],
+                     (index == first) ? Watch_Recent[index % WATCH_RECENT_HITS].cycles : Watch_Recent[(index - 1) % WATCH_RECENT_HITS].cycles);
+    }
+  }
+  Serial.printf("\n");
+}
+
+void Watchpoint_Set_Command(void)
+{
+  unsigned int    start, end;
+  char            access_text[8], log_text[8];
+  int             fields;
+  uint8_t         access = 0;
+
+  if (Watchpoint_Count == MAX_WATCHPOINTS)
+  {
+    Serial.printf("All %d watchpoints are in use. Use wp clear\n", MAX_WATCHPOINTS);
+    return;
+  }
+  Serial.printf("Watchpoint start(8) end(8) access(r w f) [log], such as 100000 100377 w log\n:");
+  if (!wait_for_serial_string())
+  {
+    return;                                                     //  Got a Ctrl-C , so abort command
+  }
+  log_text[0] = 0;
+  fields = sscanf(serial_string, "%o %o %7s %7s", &start, &end, access_text, log_text);
+  serial_string_used();
+  if (fields < 3)
+  {
+    Serial.printf("Need at least a start address, end address, and access\n");
+    return;
+  }
+  access |= strchr(access_text, 'r') ? WATCH_READ  : 0;
+  access |= strchr(access_text, 'w') ? WATCH_WRITE : 0;
+  access |= strchr(access_text, 'f') ? WATCH_FETCH : 0;
+  if ((access == 0) || (start > end) || (end > 0177777))
+  {
+    Serial.printf("Bad watchpoint\n");
+    return;
+  }
+
+  Watchpoints[Watchpoint_Count].start  = start;
+  Watchpoints[Watchpoint_Count].end    = end;
+  Watchpoints[Watchpoint_Count].access = access;
+  Watchpoints[Watchpoint_Count].log    = (strcmp(log_text, "log") == 0);
+  Watchpoints[Watchpoint_Count].hits   = 0;
+  Watchpoint_Count++;
+  if (!Watchpoint_Compile())
+  {
+    Watchpoint_Count--;
+    Watchpoint_Compile();
+    Serial.printf("Too many pages. All watchpoints together can cover at most %d pages of 256 bytes\n", WATCH_MAX_PAGES);
+    return;
+  }
+  Watchpoint_Report();
+}
+
+void Watchpoint_Clear_Command(void)
+{
+  Watchpoint_Count = 0;
+  Watchpoint_Compile();
+  Watchpoint_Poll();                                            //  Throw away anything left in the ring
+  Watch_Recent_Count  = 0;
+  Watch_Hit_Overflows = 0;
+  Watch_Log_Skipped   = 0;
+  Serial.printf("All watchpoints removed\n");
+}
+
+#else
+
+void Watchpoint_Poll(void)
+{
+}
+
+void Watchpoint_Report(void)
+{
+  Serial.printf("Watchpoints are not enabled. Set ENABLE_WATCHPOINTS in EBTKS_Config.h and rebuild\n");
+}
+
+void Watchpoint_Set_Command(void)
+{
+  Watchpoint_Report();
+}
+
+void Watchpoint_Clear_Command(void)
+{
+  Watchpoint_Report();
+}
+
+#endif
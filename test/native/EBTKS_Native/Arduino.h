@@ -0,0 +1,340 @@
+//
+//      11/25/2020      Host stand-in for the parts of the Teensy 4.1 core that EBTKS uses, for the [env:native] tests
+//
+//  The firmware sources are compiled unchanged against this header. The GPIO registers are memory backed, with the
+//  same DR / DR_SET / DR_CLEAR / DR_TOGGLE / GDIR / PSR / IMR / ISR behavior as the i.MX RT1062:
+//      DR_SET, DR_CLEAR and DR_TOGGLE change DR
+//      PSR reads DR for the pins that are outputs (GDIR set), and Native_GPIO[].pins for the inputs
+//      ISR is write 1 to clear
+//  ARM_DWT_CYCCNT reads Native_Cycles, which only moves when something advances it, so a test decides what time is.
+//  Every GPIO register access calls Native_Access_Hook (if set), before a read and after a write. This is how the
+//  bus model in Native_Bus.h advances the clock and moves the Phi 1 and Phi 2 pins while the firmware polls them.
+//
+//  __disable_irq() / __enable_irq() block and unblock Native_IRQ_Signal (if set), so a test can use a POSIX signal
+//  as the "interrupt" and the firmware's critical regions work as they do on the Teensy.
+//
+//  EXTMEM variables are put in their own section, and PSRAM_START_ADDRESS is its start, so the checks against
+//  external_psram_size (Native_Stubs.cpp, which a test may change) see the same layout as on the Teensy.
+//
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <signal.h>
+
+#define FASTRUN
+#define DMAMEM
+#define EXTMEM                        __attribute__ ((section ("extmem")))       //  As .externalram on the Teensy
+
+extern "C" char __start_extmem[];                                               //  From the linker, for the section above
+#define PSRAM_START_ADDRESS           ((uintptr_t)__start_extmem)
+#define FLASHMEM
+#define PROGMEM
+#define F(x)                          (x)
+
+#define interrupt(type)               used        //  For __attribute__ ((interrupt ("IRQ"))) , which is ARM only
+
+#define F_CPU                         (600000000)
+#define F_CPU_ACTUAL                  (600000000U)
+
+#define HIGH                          (1)
+#define LOW                           (0)
+#define INPUT                         (0)
+#define OUTPUT                        (1)
+#define INPUT_PULLUP                  (2)
+#define RISING                        (1)
+#define FALLING                       (2)
+#define CHANGE                        (3)
+#define DEC                           (10)
+#define HEX                           (16)
+
+typedef bool      boolean;
+typedef uint8_t   byte;
+
+template <class A, class B> inline auto min(A a, B b) -> decltype(a < b ? a : b)  { return (a < b) ? a : b; }
+template <class A, class B> inline auto max(A a, B b) -> decltype(a > b ? a : b)  { return (a > b) ? a : b; }
+#define constrain(x, a, b)            ((x) < (a) ? (a) : ((x) > (b) ? (b) : (x)))
+
+////////////////////////////////////////////////////////////  Simulated time
+
+inline uint64_t   Native_Cycles = 0;                            //  CPU cycles at 600 MHz, what ARM_DWT_CYCCNT reads
+
+#define ARM_DWT_CYCCNT                ((uint32_t)Native_Cycles)
+
+inline uint32_t millis(void)            { return (uint32_t)(Native_Cycles / (F_CPU_ACTUAL / 1000U)); }
+inline uint32_t micros(void)            { return (uint32_t)(Native_Cycles / (F_CPU_ACTUAL / 1000000U)); }
+inline void delay(uint32_t ms)          { Native_Cycles += (uint64_t)ms * (F_CPU_ACTUAL / 1000U); }
+inline void delayMicroseconds(uint32_t us)  { Native_Cycles += (uint64_t)us * (F_CPU_ACTUAL / 1000000U); }
+inline void delayNanoseconds(uint32_t ns)   { Native_Cycles += ((uint64_t)ns * (F_CPU_ACTUAL / 1000000U)) / 1000U; }
+inline void yield(void)                 {}
+
+////////////////////////////////////////////////////////////  GPIO
+
+enum { NATIVE_DR = 0, NATIVE_DR_SET, NATIVE_DR_CLEAR, NATIVE_DR_TOGGLE, NATIVE_GDIR, NATIVE_PSR, NATIVE_IMR, NATIVE_ISR, NATIVE_NUM_REGS };
+
+struct Native_GPIO_Port
+{
+  uint32_t    dr;
+  uint32_t    gdir;
+  uint32_t    pins;                                             //  Levels driven by the outside world onto the input pins
+  uint32_t    imr;
+  uint32_t    isr;
+};
+
+inline struct Native_GPIO_Port  Native_GPIO[10];                //  Only 6 to 9 are used
+inline uint32_t   Native_GPIO_Accesses = 0;                     //  Every register read or write
+inline void     (*Native_Access_Hook)(uint32_t port, uint32_t reg, bool write) = NULL;
+
+class Native_GPIO_Reg
+{
+  public:
+  uint8_t     port;
+  uint8_t     reg;
+
+  uint32_t read(void) const
+  {
+    struct Native_GPIO_Port *p = &Native_GPIO[port];
+
+    Native_GPIO_Accesses++;
+    if (Native_Access_Hook)
+    {
+      Native_Access_Hook(port, reg, false);
+    }
+    switch (reg)
+    {
+      case NATIVE_PSR:    return (p->dr & p->gdir) | (p->pins & ~p->gdir);
+      case NATIVE_GDIR:   return p->gdir;
+      case NATIVE_IMR:    return p->imr;
+      case NATIVE_ISR:    return p->isr;
+      default:            return p->dr;                         //  DR_SET etc. read back as DR
+    }
+  }
+
+  void write(uint32_t value) const
+  {
+    struct Native_GPIO_Port *p = &Native_GPIO[port];
+
+    Native_GPIO_Accesses++;
+    switch (reg)
+    {
+      case NATIVE_DR:         p->dr    = value;     break;
+      case NATIVE_DR_SET:     p->dr   |= value;     break;
+      case NATIVE_DR_CLEAR:   p->dr   &= ~value;    break;
+      case NATIVE_DR_TOGGLE:  p->dr   ^= value;     break;
+      case NATIVE_GDIR:       p->gdir  = value;     break;
+      case NATIVE_IMR:        p->imr   = value;     break;
+      case NATIVE_ISR:        p->isr  &= ~value;    break;
+      default:                                      break;    //  PSR is read only
+    }
+    if (Native_Access_Hook)
+    {
+      Native_Access_Hook(port, reg, true);
+    }
+  }
+
+  operator uint32_t() const                                 { return read(); }
+  const Native_GPIO_Reg &operator=(uint32_t value) const    { write(value); return *this; }
+  const Native_GPIO_Reg &operator=(const Native_GPIO_Reg &other) const  { write(other.read()); return *this; }
+  const Native_GPIO_Reg &operator|=(uint32_t value) const   { write(read() | value); return *this; }
+  const Native_GPIO_Reg &operator&=(uint32_t value) const   { write(read() & value); return *this; }
+};
+
+#define NATIVE_GPIO_REGS(n)                                                 \
+  inline const Native_GPIO_Reg GPIO##n##_DR        = {n, NATIVE_DR};        \
+  inline const Native_GPIO_Reg GPIO##n##_DR_SET    = {n, NATIVE_DR_SET};    \
+  inline const Native_GPIO_Reg GPIO##n##_DR_CLEAR  = {n, NATIVE_DR_CLEAR};  \
+  inline const Native_GPIO_Reg GPIO##n##_DR_TOGGLE = {n, NATIVE_DR_TOGGLE}; \
+  inline const Native_GPIO_Reg GPIO##n##_GDIR      = {n, NATIVE_GDIR};      \
+  inline const Native_GPIO_Reg GPIO##n##_PSR       = {n, NATIVE_PSR};       \
+  inline const Native_GPIO_Reg GPIO##n##_IMR       = {n, NATIVE_IMR};       \
+  inline const Native_GPIO_Reg GPIO##n##_ISR       = {n, NATIVE_ISR};
+
+NATIVE_GPIO_REGS(6)
+NATIVE_GPIO_REGS(7)
+NATIVE_GPIO_REGS(8)
+NATIVE_GPIO_REGS(9)
+
+//
+//  Pad mux registers are only written at power up, so they all share one dummy
+//
+
+inline volatile uint32_t  Native_IOMUXC;
+
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B0_02   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B0_03   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B0_12   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B0_13   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_00   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_01   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_02   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_03   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_06   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_07   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_08   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_09   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_10   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_11   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_14   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_15   Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_00      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_01      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_02      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_03      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_10      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_11      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_12      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B1_00      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B1_01      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B1_02      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B1_03      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B1_12      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_B1_13      Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_04     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_05     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_06     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_07     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_08     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_31     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_32     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_36     Native_IOMUXC
+#define IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_37     Native_IOMUXC
+
+inline void pinMode(uint8_t, uint8_t)             {}
+inline void digitalWrite(uint8_t, uint8_t)        {}
+inline void digitalWriteFast(uint8_t, uint8_t)    {}
+inline int  digitalRead(uint8_t)                  { return 0; }
+inline int  digitalReadFast(uint8_t)              { return 0; }
+inline void attachInterrupt(uint8_t, void (*)(void), int)  {}
+
+////////////////////////////////////////////////////////////  Interrupts
+
+#define IRQ_GPIO6789                  (157)
+
+inline void     (*_VectorsRam[256])(void);
+inline int        Native_IRQ_Signal = 0;                        //  0 for none, else the signal that stands in for interrupts
+inline uint32_t   Native_IRQ_Disables = 0;
+
+inline void Native_IRQ_Mask(bool block)
+{
+  sigset_t    set;
+
+  if (Native_IRQ_Signal)
+  {
+    sigemptyset(&set);
+    sigaddset(&set, Native_IRQ_Signal);
+    sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+  }
+}
+
+#define __disable_irq()               do { Native_IRQ_Disables++; Native_IRQ_Mask(true); } while(0)
+#define __enable_irq()                Native_IRQ_Mask(false)
+#define NVIC_ENABLE_IRQ(n)            do {} while(0)
+#define NVIC_DISABLE_IRQ(n)           do {} while(0)
+#define NVIC_CLEAR_PENDING(n)         do {} while(0)
+#define NVIC_SET_PRIORITY(n, p)       do {} while(0)
+
+inline void attachInterruptVector(int irq, void (*function)(void))  { _VectorsRam[irq + 16] = function; }
+
+inline void arm_dcache_flush(void *, uint32_t)          {}
+inline void arm_dcache_delete(void *, uint32_t)         {}
+inline void arm_dcache_flush_delete(void *, uint32_t)   {}
+
+extern "C"
+{
+  inline volatile uint32_t  systick_millis_count = 0;
+  inline volatile uint32_t  systick_cycle_count = 0;
+}
+
+////////////////////////////////////////////////////////////  Print and Serial
+
+class Print
+{
+  public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t    count = 0;
+
+    while (size--)
+    {
+      count += write(*buffer++);
+    }
+    return count;
+  }
+  size_t write(const char *str)                     { return write((const uint8_t *)str, strlen(str)); }
+  size_t write(const char *buffer, size_t size)     { return write((const uint8_t *)buffer, size); }
+  virtual int availableForWrite(void)               { return 0; }
+  virtual void flush(void)                          {}
+
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    char      buffer[1024];
+    va_list   args;
+    int       length;
+
+    va_start(args, format);
+    length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    write((const uint8_t *)buffer, strlen(buffer));
+    return length;
+  }
+  size_t print(const char *str)                     { return write(str); }
+  size_t print(char c)                              { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC)              { return printf(base == HEX ? "%lX" : "%ld", n); }
+  size_t print(unsigned long n, int base = DEC)     { return printf(base == HEX ? "%lX" : "%lu", n); }
+  size_t print(int n, int base = DEC)               { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC)      { return print((unsigned long)n, base); }
+  size_t print(double n, int digits = 2)            { return printf("%.*f", digits, n); }
+  size_t println(void)                              { return write("\r\n"); }
+  template <typename T> size_t println(T value)     { return print(value) + println(); }
+  template <typename T> size_t println(T value, int format)  { return print(value, format) + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+  virtual int available(void)                       { return 0; }
+  virtual int read(void)                            { return -1; }
+  virtual int peek(void)                            { return -1; }
+};
+
+//
+//  Output goes to stdout, unless Native_Serial_Quiet is set. Input comes from Native_Serial_Input, if set
+//
+
+inline bool         Native_Serial_Quiet = false;
+inline const char  *Native_Serial_Input = NULL;
+
+class usb_serial_class : public Stream
+{
+  public:
+  void begin(long)                                  {}
+  operator bool()                                   { return true; }
+  size_t write(uint8_t b)                           { if (!Native_Serial_Quiet) { putchar(b); } return 1; }
+  using Print::write;
+  int availableForWrite(void)                       { return 64; }
+  void flush(void)                                  { fflush(stdout); }
+  int available(void)                               { return (Native_Serial_Input && *Native_Serial_Input) ? (int)strlen(Native_Serial_Input) : 0; }
+  int read(void)                                    { return available() ? (uint8_t)*Native_Serial_Input++ : -1; }
+  int peek(void)                                    { return available() ? (uint8_t)*Native_Serial_Input : -1; }
+};
+
+inline usb_serial_class   Serial;
+
+class String
+{
+  public:
+  String(const char *str = "")                      { (void)str; }
+  const char *c_str(void) const                     { return ""; }
+};
+
+#endif
@@ -0,0 +1,34 @@
+//
+//      11/25/2020      Host stand-in for FastLED, for the [env:native] tests. The LEDs don't light
+//
+
+#ifndef NATIVE_FASTLED_H
+#define NATIVE_FASTLED_H
+
+#include "Arduino.h"
+
+struct CRGB
+{
+  uint8_t     r, g, b;
+
+  CRGB()                                            : r(0), g(0), b(0) {}
+  CRGB(uint8_t red, uint8_t green, uint8_t blue)    : r(red), g(green), b(blue) {}
+  CRGB(uint32_t rgb)                                : r(rgb >> 16), g(rgb >> 8), b(rgb) {}
+  enum { Black = 0x000000, Red = 0xFF0000, Green = 0x008000, Blue = 0x0000FF, White = 0xFFFFFF, Yellow = 0xFFFF00,
+         Orange = 0xFFA500, Purple = 0x800080, Cyan = 0x00FFFF, Magenta = 0xFF00FF };
+};
+
+enum { WS2812, WS2812B, NEOPIXEL, GRB, RGB };
+
+class CFastLED
+{
+  public:
+  template <int TYPE, int PIN, int ORDER = RGB> void addLeds(CRGB *, int)   {}
+  void show(void)                                   {}
+  void setBrightness(uint8_t)                       {}
+  void clear(bool = false)                          {}
+};
+
+inline CFastLED FastLED;
+
+#endif
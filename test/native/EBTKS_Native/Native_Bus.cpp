@@ -0,0 +1,94 @@
+//
+//      11/25/2020      Model of the HP85 bus clock for the [env:native] tests, see Native_Bus.h
+//
+
+#include "Native_Bus.h"
+
+static bool   Native_Bus_Running = false;
+
+//
+//  Set the Phi pins for the current time. A rising edge since the last update sets its GPIO6_ISR bit, as the
+//  pin interrupt would
+//
+
+void Native_Bus_Update(void)
+{
+  uint32_t    phase = Native_Bus_Phase_ns();
+  uint32_t    pins  = Native_GPIO[6].pins & ~(NATIVE_PHI_1_BIT | NATIVE_PHI_2_BIT);
+
+  if (phase < NATIVE_PHI_1_FALL_NS)
+  {
+    pins |= NATIVE_PHI_1_BIT;
+  }
+  if ((phase >= NATIVE_PHI_2_RISE_NS) && (phase < NATIVE_PHI_2_FALL_NS))
+  {
+    pins |= NATIVE_PHI_2_BIT;
+  }
+  Native_GPIO[6].isr |= pins & ~Native_GPIO[6].pins & (NATIVE_PHI_1_BIT | NATIVE_PHI_2_BIT);
+  Native_GPIO[6].pins = pins;
+}
+
+static void Native_Bus_Access(uint32_t port, uint32_t reg, bool write)
+{
+  (void)port;
+  (void)reg;
+  (void)write;
+  Native_Cycles += NATIVE_CPU_PER_ACCESS;
+  Native_Bus_Update();
+}
+
+void Native_Bus_Start(void)
+{
+  Native_Bus_Running = true;
+  Native_Access_Hook = &Native_Bus_Access;
+  Native_Bus_Update();
+  Native_GPIO[6].isr = 0;
+}
+
+void Native_Bus_Stop(void)
+{
+  Native_Bus_Running = false;
+  Native_Access_Hook = NULL;
+}
+
+//
+//  ns since the last Phi 1 rise
+//
+
+uint32_t Native_Bus_Phase_ns(void)
+{
+  return NATIVE_CPU_TO_NS(Native_Cycles) % NATIVE_BUS_CYCLE_NS;
+}
+
+void Native_Bus_Advance(uint64_t cycles)
+{
+  Native_Cycles += cycles;
+  if (Native_Bus_Running)
+  {
+    Native_Bus_Update();
+  }
+}
+
+//
+//  Advance to the next time that is phase_ns after a Phi 1 rise. Used by the tests to step from edge to edge
+//
+
+void Native_Bus_Run_To(uint32_t phase_ns)
+{
+  uint64_t    now_ns = NATIVE_CPU_TO_NS(Native_Cycles);
+  uint64_t    target = (now_ns / NATIVE_BUS_CYCLE_NS) * NATIVE_BUS_CYCLE_NS + phase_ns;
+
+  if (target <= now_ns)
+  {
+    target += NATIVE_BUS_CYCLE_NS;
+  }
+  Native_Cycles = NATIVE_NS_TO_CPU(target);
+  while (NATIVE_CPU_TO_NS(Native_Cycles) < target)
+  {
+    Native_Cycles++;                                      //  Round up, so the phase is not one cycle short
+  }
+  if (Native_Bus_Running)
+  {
+    Native_Bus_Update();
+  }
+}
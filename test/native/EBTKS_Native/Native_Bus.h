@@ -0,0 +1,45 @@
+//
+//      11/25/2020      Model of the HP85 bus clock for the [env:native] tests
+//
+//  Time is Native_Cycles, in Teensy CPU cycles at 600 MHz. Once Native_Bus_Start() is called, every GPIO register
+//  access costs NATIVE_CPU_PER_ACCESS cycles, and the Phi 1 and Phi 2 pins (and their bits in GPIO6_ISR) follow the
+//  clock below. So the firmware's own WAIT_WHILE_PHI_1_HIGH etc. see the edges move while they poll, and the busy
+//  waits EBTKS_delay_ns() and EBTKS_delay_for_LMA_start() (see Native_Stubs.cpp) move time by what they take on the
+//  Teensy. Code between register accesses takes no time at all in this model.
+//
+//  Capricorn clock of 613 kHz: a bus cycle is 1632 ns, Phi 1 high for the first 200 ns, Phi 2 high 816 ns later
+//
+//           0 ns    200 ns          816 ns   1016 ns       1632 ns
+//  Phi 1   _/‾‾‾‾‾‾‾\_______________________________________/‾‾‾‾‾
+//  Phi 2   _________________________/‾‾‾‾‾‾‾‾\__________________
+//
+//  The control lines and data bus driven by the HP85 side are Native_GPIO[6].pins, which the test sets.
+//
+
+#ifndef NATIVE_BUS_H
+#define NATIVE_BUS_H
+
+#include "Arduino.h"
+
+#define NATIVE_NS_TO_CPU(ns)          ((uint64_t)(ns) * 600U / 1000U)
+#define NATIVE_CPU_TO_NS(cycles)      ((uint64_t)(cycles) * 1000U / 600U)
+
+#define NATIVE_BUS_CYCLE_NS           (1632)
+#define NATIVE_PHI_1_RISE_NS          (0)
+#define NATIVE_PHI_1_FALL_NS          (200)
+#define NATIVE_PHI_2_RISE_NS          (816)
+#define NATIVE_PHI_2_FALL_NS          (1016)
+
+#define NATIVE_CPU_PER_ACCESS         (2)           //  A read or write of a GPIO6..9 register, which are on the fast AHB path
+
+#define NATIVE_PHI_1_BIT              (1U << 27)    //  BIT_MASK_PHASE1
+#define NATIVE_PHI_2_BIT              (1U << 28)    //  BIT_MASK_PHASE2
+
+void      Native_Bus_Start(void);
+void      Native_Bus_Stop(void);
+void      Native_Bus_Update(void);
+uint32_t  Native_Bus_Phase_ns(void);
+void      Native_Bus_Run_To(uint32_t phase_ns);
+void      Native_Bus_Advance(uint64_t cycles);
+
+#endif
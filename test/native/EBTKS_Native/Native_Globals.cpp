@@ -0,0 +1,8 @@
+//
+//      11/25/2020      The firmware globals for the [env:native] tests. This does what EBTKS.cpp does on the Teensy
+//
+
+#include <Arduino.h>
+
+#define ALLOCATE  1
+#include "Inc_Common_Headers.h"
@@ -0,0 +1,53 @@
+//
+//      11/26/2020      A POSIX timer signal as the interrupt, see Native_IRQ.h
+//
+
+#include <sys/time.h>
+
+#include "Native_IRQ.h"
+
+static void       (*Native_IRQ_Handler)(void) = NULL;
+static volatile uint32_t  Native_IRQ_Calls = 0;
+
+static void Native_IRQ_Signal_Handler(int sig)
+{
+  (void)sig;
+  Native_IRQ_Calls++;
+  Native_IRQ_Handler();
+}
+
+void Native_IRQ_Start(void (*isr)(void), uint32_t period_us)
+{
+  struct sigaction    action;
+  struct itimerval    timer;
+
+  Native_IRQ_Handler = isr;
+  Native_IRQ_Calls   = 0;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &Native_IRQ_Signal_Handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGALRM, &action, NULL);
+  Native_IRQ_Signal = SIGALRM;
+  Native_IRQ_Mask(false);
+
+  timer.it_interval.tv_sec  = 0;
+  timer.it_interval.tv_usec = period_us;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+void Native_IRQ_Stop(void)
+{
+  struct itimerval    timer;
+
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_REAL, &timer, NULL);
+  signal(SIGALRM, SIG_IGN);
+  Native_IRQ_Mask(false);
+  Native_IRQ_Signal = 0;
+}
+
+uint32_t Native_IRQ_Count(void)
+{
+  return Native_IRQ_Calls;
+}
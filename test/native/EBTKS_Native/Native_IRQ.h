@@ -0,0 +1,19 @@
+//
+//      11/26/2020      A POSIX timer signal as the interrupt, for the [env:native] stress tests
+//
+//  Native_IRQ_Start() calls isr from SIGALRM every period_us, at whatever point the test's own code (the
+//  "background") happens to be, as the pin interrupt does on the Teensy. It sets Native_IRQ_Signal, so the
+//  firmware's __disable_irq() / __enable_irq() critical regions hold it off, as they do on the Teensy.
+//  The isr must not use the Unity assert macros, record failures for the test to check afterwards.
+//
+
+#ifndef NATIVE_IRQ_H
+#define NATIVE_IRQ_H
+
+#include "Arduino.h"
+
+void      Native_IRQ_Start(void (*isr)(void), uint32_t period_us);
+void      Native_IRQ_Stop(void);
+uint32_t  Native_IRQ_Count(void);
+
+#endif
@@ -0,0 +1,55 @@
+//
+//      11/25/2020      Stand-ins for the firmware that is not in the [env:native] build (see build_src_filter in
+//                      platformio.ini), and for the ARM busy waits
+//
+//  These are weak, so a test can supply its own to see the calls.
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+#include "Native_Bus.h"
+
+#define NATIVE_WEAK                   __attribute__((weak))
+
+extern "C" uint8_t external_psram_size;
+uint8_t         external_psram_size = 8;              //  In MB. One 8 MB PSRAM chip is the usual EBTKS build
+
+const char b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+NATIVE_WEAK Tape::Tape()                                  {}
+NATIVE_WEAK bool AUXROM_Alert_Event(uint8_t)              { return true; }
+NATIVE_WEAK bool tape_block_request_event(uint32_t)       { return true; }
+NATIVE_WEAK void append_to_logfile(const char *)          {}
+NATIVE_WEAK int  getMachineNum(void)                      { return MACH_HP85A; }
+NATIVE_WEAK bool wait_for_serial_string(void)             { return false; }
+NATIVE_WEAK void serial_string_used(void)                 {}
+NATIVE_WEAK void Logic_Analyzer_Text_Printf(const char *, ...)  {}
+
+//
+//  The busy waits take the time they take on the Teensy. EBTKS_delay_ns() is modeled on the oscilloscope
+//  measurements in EBTKS_Utilities.cpp: about 50 ns for a count below 69, and then the count rounded down
+//  to 10 ns steps from the 59 ns fixed overhead, plus 2 ns
+//
+
+NATIVE_WEAK void EBTKS_delay_ns(int32_t count)
+{
+  uint32_t    ns = (count < 69) ? 50 : (59 + ((count - 59) / 10) * 10 + 2);
+
+  Native_Bus_Advance(NATIVE_NS_TO_CPU(ns));
+}
+
+//
+//  12 and 16 NOPs, at one a cycle, plus the call and return. The 14 ns for the call comes from the 34 ns
+//  that the name EBTKS_delay_34_ns() records for 12 NOPs
+//
+
+NATIVE_WEAK void EBTKS_delay_34_ns(void)
+{
+  Native_Bus_Advance(NATIVE_NS_TO_CPU(34));
+}
+
+NATIVE_WEAK void EBTKS_delay_for_LMA_start(void)
+{
+  Native_Bus_Advance(16 + NATIVE_NS_TO_CPU(14));
+}
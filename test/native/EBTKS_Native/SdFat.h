@@ -0,0 +1,75 @@
+//
+//      11/25/2020      Host stand-in for SdFat, for the [env:native] tests
+//
+//  There is no SD card. SD.open() always fails, so code that writes to the card takes its error path.
+//
+
+#ifndef NATIVE_SDFAT_H
+#define NATIVE_SDFAT_H
+
+#include "Arduino.h"
+
+#define O_RDONLY                      (0x00)
+#define O_READ                        O_RDONLY
+#define O_WRONLY                      (0x01)
+#define O_WRITE                       O_WRONLY
+#define O_RDWR                        (0x02)
+#define O_AT_END                      (0x04)
+#define O_APPEND                      (0x08)
+#define O_CREAT                       (0x10)
+#define O_TRUNC                       (0x20)
+#define O_EXCL                        (0x40)
+#define FILE_READ                     O_RDONLY
+#define FILE_WRITE                    (O_RDWR | O_CREAT | O_AT_END)
+
+typedef int oflag_t;
+
+class FsFile : public Stream
+{
+  public:
+  operator bool() const                             { return false; }
+  bool isOpen(void) const                           { return false; }
+  bool open(const char *, oflag_t = O_RDONLY)       { return false; }
+  bool close(void)                                  { return true; }
+  int read(void)                                    { return -1; }
+  int read(void *, size_t)                          { return -1; }
+  size_t write(uint8_t)                             { return 0; }
+  size_t write(const void *, size_t)                { return 0; }
+  using Print::write;
+  void flush(void)                                  {}
+  bool sync(void)                                   { return false; }
+  bool seek(uint64_t)                               { return false; }
+  bool seekSet(uint64_t)                            { return false; }
+  uint64_t position(void)                           { return 0; }
+  uint64_t size(void)                               { return 0; }
+  uint64_t fileSize(void)                           { return 0; }
+  bool truncate(uint64_t)                           { return false; }
+  bool preAllocate(uint64_t)                        { return false; }
+  int available(void)                               { return 0; }
+};
+
+typedef FsFile  File;
+
+class SdCard
+{
+  public:
+  uint32_t sectorCount(void)                        { return 0; }
+  bool isBusy(void)                                 { return false; }
+};
+
+class SdFat
+{
+  public:
+  bool begin(int = 0)                               { return false; }
+  File open(const char *, oflag_t = O_RDONLY)       { return File(); }
+  bool exists(const char *)                         { return false; }
+  bool remove(const char *)                         { return false; }
+  SdCard *card(void)                                { return &_card; }
+
+  private:
+  SdCard      _card;
+};
+
+typedef SdFat   SdFs;
+
+#endif
@@ -0,0 +1,3 @@
+//
+//      11/25/2020      Host stand-in for sdios.h, for the [env:native] tests. Nothing in it is used by the tested code
+//
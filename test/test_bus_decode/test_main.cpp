@@ -0,0 +1,156 @@
+//
+//      11/26/2020      Bus_Cycle_Decode_Table[] checked against Russell's equations
+//
+//  onPhi_2_Rise() decodes the cycle with a lookup in Bus_Cycle_Decode_Table[] , which initBusCycleDecodeTable()
+//  builds from the boolean equations that used to be in onPhi_2_Rise(). The equations are copied below, as they
+//  were, and carry their own state from cycle to cycle. The real ISR is run for the Phi 2 rise of every sequence of
+//  three cycle types (all 32 entries of the table, from every state that can lead to them), and then for a long
+//  pseudo random run, with addReg both in and out of the I/O page. After each cycle, every schedule flag must match.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+
+#define TEST_RANDOM_CYCLES            (200000)
+
+extern int intrState;                                   //  In EBTKS_Bus_Interface_ISR.cpp
+
+//
+//  The reference, the equations from onPhi_2_Rise() before Bus_Cycle_Decode_Table[]
+//
+
+struct S_Ref_Decode
+{
+  bool      schedule_read;
+  bool      schedule_write;
+  bool      schedule_address_increment;
+  bool      schedule_address_load;
+  bool      delayed_lma;
+  bool      DMA_Acknowledge;
+  bool      Interrupt_Acknowledge;
+};
+
+static struct S_Ref_Decode  Ref;
+
+static void Ref_Phi_2_Rise(uint32_t bus_cycle_info, uint16_t address)
+{
+  bool      lma, rd, wr;
+
+  lma = !(bus_cycle_info & BIT_MASK_LMA);
+  rd  = !(bus_cycle_info & BIT_MASK_RD );
+  wr  = !(bus_cycle_info & BIT_MASK_WR );
+
+  Ref.schedule_read  = rd && !wr;
+  Ref.schedule_write = wr && !rd;
+  Ref.schedule_address_increment = ((address >> 8) != 0xff) &&
+                                    !(!Ref.schedule_address_load & Ref.delayed_lma) &&
+                                    (Ref.schedule_read | Ref.schedule_write);
+  Ref.schedule_address_load = !Ref.schedule_address_load && Ref.delayed_lma;
+  Ref.delayed_lma = lma;
+  Ref.DMA_Acknowledge = wr && rd && !lma;
+  Ref.Interrupt_Acknowledge = wr && rd && lma;
+}
+
+//
+//  One Phi 2 rise through pinChange_isr(), with the control lines and IFETCH as given. ctrl is /WR /RD /LMA
+//  as in bits 26..24 of GPIO6, so 7 is an idle cycle
+//
+
+static void Test_Phi_2_Rise(uint32_t ctrl, uint16_t address, bool ifetch)
+{
+  char        msg[64];
+
+  addReg = address;
+  Native_GPIO[6].pins = (Native_GPIO[6].pins & ~(BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA)) | (ctrl << BIT_POSITION_LMA);
+  Native_GPIO[7].pins = ifetch ? (Native_GPIO[7].pins | BIT_MASK_IFETCH) : (Native_GPIO[7].pins & ~BIT_MASK_IFETCH);
+  Native_GPIO[6].isr  = BIT_MASK_PHASE2;
+  pinChange_isr();
+  Ref_Phi_2_Rise(ctrl << BIT_POSITION_LMA, address);
+
+  snprintf(msg, sizeof(msg), "/WR /RD /LMA %d%d%d, addReg %06o", (ctrl >> 2) & 1, (ctrl >> 1) & 1, ctrl & 1, address);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.schedule_read,              schedule_read,              msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.schedule_write,             schedule_write,             msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.schedule_address_increment, schedule_address_increment, msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.schedule_address_load,      schedule_address_load,      msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.delayed_lma,                delayed_lma,                msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.DMA_Acknowledge,            DMA_Acknowledge,            msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref.Interrupt_Acknowledge,      Interrupt_Acknowledge,      msg);
+  TEST_ASSERT_EQUAL_HEX32_MESSAGE((ctrl << BIT_POSITION_LMA) | (ifetch ? LA_SAMPLE_IFETCH : 0),
+                                  Logic_Analyzer_current_bus_cycle_state_LA, msg);
+}
+
+//
+//  Two idle cycles take both the table state and the reference to schedule_address_load and delayed_lma false
+//
+
+static void Test_Reset_State(void)
+{
+  Test_Phi_2_Rise(7, 0, false);
+  Test_Phi_2_Rise(7, 0, false);
+}
+
+void test_all_three_cycle_sequences(void)
+{
+  uint32_t    first, second, third, high;
+
+  for (high = 0 ; high < 2 ; high++)
+  {
+    for (first = 0 ; first < 8 ; first++)
+    {
+      for (second = 0 ; second < 8 ; second++)
+      {
+        for (third = 0 ; third < 8 ; third++)
+        {
+          Test_Reset_State();
+          Test_Phi_2_Rise(first,  high ? 0177410 : 0100010, false);
+          Test_Phi_2_Rise(second, high ? 0177420 : 0100020, true);
+          Test_Phi_2_Rise(third,  high ? 0177430 : 0100030, false);
+        }
+      }
+    }
+  }
+}
+
+void test_random_cycles(void)
+{
+  uint32_t    cycle, random = 12345;
+  uint16_t    address;
+
+  Test_Reset_State();
+  for (cycle = 0 ; cycle < TEST_RANDOM_CYCLES ; cycle++)
+  {
+    random  = random * 1103515245U + 12345U;
+    address = (random >> 8) & 0xFFFF;
+    if ((random >> 28) < 4)
+    {
+      address |= 0xFF00;                                //  A quarter of them in the I/O page
+    }
+    Test_Phi_2_Rise((random >> 4) & 0x07, address, (random >> 7) & 1);
+  }
+}
+
+void setUp(void)
+{
+  initIOfuncTable();
+  intrState = 0;
+  interruptReq = false;
+  DMA_Request = false;
+  DMA_has_been_Requested = false;
+  Native_GPIO[8].pins |= BIT_MASK_IPRIH_IN;             //  No higher priority interrupt
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_all_three_cycle_sequences);
+  RUN_TEST(test_random_cycles);
+  return UNITY_END();
+}
@@ -0,0 +1,534 @@
+//
+//      11/26/2020      Bus trace replay through pinChange_isr()
+//
+//  Each bus cycle of a trace is played through the real ISR, on the HP85 clock of Native_Bus.h: the control lines are
+//  set and pinChange_isr() is run at the Phi 2 rise, then the data bus is set and it is run again at the Phi 1 rise,
+//  where it waits out Phi 1 high and does onPhi_1_Fall(), as on the Teensy. After each Phi 2, EBTKS must be driving
+//  the data bus (buffer enabled, direction to the HP85, pins as outputs) exactly on the read cycles it answers, with
+//  the right byte, and after Phi 1 it must have let go. At each Phi 1 the ISR's own Logic_Analyzer_main_sample must
+//  match the trace, which checks the address register is tracked through the /LMA loads and increments.
+//
+//  Trace entries use the Logic_Analyzer_main_sample layout (control lines, IFETCH, address, data), so a logic analyzer
+//  capture can be replayed the same way. The traces here are made by a small model of the HP85 side, with the data
+//  EBTKS should supply taken from the test's own copy of the ROM and RAM contents.
+//
+//  The bench at the end replays a random trace with the clock stopped, and shows per cycle type the GPIO register
+//  accesses and the host time of each ISR entry. The accesses are what the Teensy also does; the ns are only good for
+//  comparing one version of the ISR with another. Run with "pio test -e native -f test_bus_replay -v" to see them.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+
+#include "Inc_Common_Headers.h"
+#include "Native_Bus.h"
+
+void ioWriteRSELEC(uint8_t val);                        //  In EBTKS_Bank_Switched_ROM.cpp
+extern volatile uint8_t rselec;
+extern uint8_t *currRom;
+extern uint8_t *romMap[256];
+extern bool enRam16k;
+extern int intrState;                                   //  In EBTKS_Bus_Interface_ISR.cpp
+extern volatile bool intEn_1MB5;
+extern uint16_t badAddr;                                //  In EBTKS_CRT.cpp
+
+#define TEST_ROM_ID                   (0320)
+#define TEST_IO_ADDR                  (0177702)         //  A register nobody else uses, with the test's handlers
+#define TEST_IO_READ_DATA             (0x5A)
+#define TEST_RAM_BASE                 (0140000)         //  The 16K RAM module
+#define TEST_RAM_END                  (0177400)
+#define TEST_MAX_CYCLES               (200000)
+#define TEST_RANDOM_OPS               (20000)
+#define TEST_BENCH_PASSES             (20)
+
+#define CTRL_IDLE                     (7)               //  /WR /RD /LMA as in bits 26..24 of GPIO6, all active low
+#define CTRL_LMA                      (6)
+#define CTRL_RD                       (5)
+#define CTRL_WR                       (3)
+#define CTRL_INT_ACK                  (0)
+
+enum
+{
+  CYCLE_IDLE = 0, CYCLE_LMA, CYCLE_ROM_READ, CYCLE_RAM_READ, CYCLE_IO_READ, CYCLE_OTHER_READ,
+  CYCLE_RAM_WRITE, CYCLE_IO_WRITE, CYCLE_OTHER_WRITE, CYCLE_INT_ACK, CYCLE_NUM_TYPES
+};
+
+static const char *Cycle_Names[CYCLE_NUM_TYPES] =
+{
+  "Idle", "/LMA", "ROM read (ours)", "16K RAM read", "I/O read (ours)", "Read, not ours",
+  "16K RAM write", "I/O write", "Write, not ours", "Interrupt ack"
+};
+
+struct S_Replay_Cycle
+{
+  uint32_t    sample;                                   //  Logic_Analyzer_main_sample at Phi 1
+  bool        ours;                                     //  EBTKS drives the data bus for this cycle
+  uint8_t     type;
+};
+
+static struct S_Replay_Cycle  Trace[TEST_MAX_CYCLES];
+static uint32_t     Trace_Length;
+static uint16_t     Trace_Addr;                         //  The address register as the HP85 side sees it
+static uint8_t      Trace_RAM[EXP_RAM_SIZE];            //  What the 16K RAM should hold
+static uint8_t      IO_Written[16];
+static uint32_t     IO_Writes;
+static uint32_t     Random = 1;
+
+static uint32_t Test_Random(void)
+{
+  Random = Random * 1103515245U + 12345U;
+  return Random >> 8;
+}
+
+static bool Test_IO_Read(void)
+{
+  readData = TEST_IO_READ_DATA;
+  return true;
+}
+
+static void Test_IO_Write(uint8_t val)
+{
+  IO_Written[IO_Writes++ & 0x0F] = val;
+}
+
+//
+//  The HP85 side. Each function adds the bus cycles of one access
+//
+
+static void Trace_Add(uint32_t ctrl, uint8_t data, bool ifetch, bool ours, uint8_t type)
+{
+  struct S_Replay_Cycle *cycle = &Trace[Trace_Length++];
+
+  cycle->sample = (ifetch ? LA_SAMPLE_IFETCH : 0) | (ctrl << BIT_POSITION_LMA) | ((uint32_t)Trace_Addr << 8) | data;
+  cycle->ours   = ours;
+  cycle->type   = type;
+}
+
+static void Trace_Address(uint16_t addr)
+{
+  Trace_Add(CTRL_LMA, addr & 0xFF, false, false, CYCLE_LMA);
+  Trace_Add(CTRL_LMA, addr >> 8,   false, false, CYCLE_LMA);
+  Trace_Addr = addr;
+}
+
+static void Trace_Next(void)
+{
+  if ((Trace_Addr >> 8) != 0xFF)
+  {
+    Trace_Addr++;                                       //  The I/O page doesn't auto increment
+  }
+}
+
+static uint8_t Test_ROM_Byte(uint16_t addr)
+{
+  return (addr & (ROM_PAGE_SIZE - 1)) * 3;
+}
+
+static void Trace_Read(bool ifetch)
+{
+  uint16_t    addr = Trace_Addr;
+
+  if ((addr & 0xE000) == ROM_PAGE)
+  {
+    Trace_Add(CTRL_RD, Test_ROM_Byte(addr), ifetch, true, CYCLE_ROM_READ);
+  }
+  else if ((addr >= TEST_RAM_BASE) && (addr < TEST_RAM_END))
+  {
+    Trace_Add(CTRL_RD, Trace_RAM[addr & 0x3FFF], ifetch, true, CYCLE_RAM_READ);
+  }
+  else if (addr == TEST_IO_ADDR)
+  {
+    Trace_Add(CTRL_RD, TEST_IO_READ_DATA, ifetch, true, CYCLE_IO_READ);
+  }
+  else
+  {
+    Trace_Add(CTRL_RD, (addr * 7) >> 3, ifetch, false, CYCLE_OTHER_READ);   //  The system ROM or DRAM answers
+  }
+  Trace_Next();
+}
+
+static void Trace_Write(uint8_t data)
+{
+  uint16_t    addr = Trace_Addr;
+
+  if ((addr >= TEST_RAM_BASE) && (addr < TEST_RAM_END))
+  {
+    Trace_RAM[addr & 0x3FFF] = data;
+    Trace_Add(CTRL_WR, data, false, false, CYCLE_RAM_WRITE);
+  }
+  else if ((addr >> 8) == 0xFF)
+  {
+    Trace_Add(CTRL_WR, data, false, false, CYCLE_IO_WRITE);
+  }
+  else
+  {
+    Trace_Add(CTRL_WR, data, false, false, CYCLE_OTHER_WRITE);
+  }
+  Trace_Next();
+}
+
+static void Trace_Idle(uint32_t cycles)
+{
+  while (cycles--)
+  {
+    Trace_Add(CTRL_IDLE, 0xFF, false, false, CYCLE_IDLE);
+  }
+}
+
+//
+//  What EBTKS is doing to the data bus: the byte it drives, or -1 if it isn't driving
+//
+
+static int Test_Driven_Byte(void)
+{
+  bool        outputs = (Native_GPIO[6].gdir & DATA_BUS_MASK) == DATA_BUS_MASK;
+  bool        to_hp85 = (Native_GPIO[6].dr & BIT_MASK_DIR_RC) != 0;
+  bool        enabled = (Native_GPIO[6].dr & BIT_MASK_BUFEN) == 0;
+
+  if (outputs && to_hp85 && enabled)
+  {
+    return (Native_GPIO[6].dr >> BIT_POSITION_DB0) & 0xFF;
+  }
+  return -1;
+}
+
+//
+//  Play one cycle through the ISR, on the bus clock: Phi 2 rise with the control lines, then the Phi 1 rise (and
+//  fall) with the data. The HP85 side always puts something on the data pins, so a byte that EBTKS claims to drive
+//  but doesn't would show up in the sample
+//
+
+static void Replay_Cycle(const struct S_Replay_Cycle *cycle, uint32_t index)
+{
+  uint32_t    ctrl = (cycle->sample >> BIT_POSITION_LMA) & 0x07;
+  uint8_t     data = cycle->sample & 0xFF;
+  int         driven;
+  char        msg[96];
+
+  snprintf(msg, sizeof(msg), "Cycle %lu, /WR /RD /LMA %d%d%d, address %06o, data %03o",
+           (unsigned long)index, (ctrl >> 2) & 1, (ctrl >> 1) & 1, ctrl & 1, (cycle->sample >> 8) & 0xFFFF, data);
+
+  Native_GPIO[6].pins = (Native_GPIO[6].pins & ~(BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA)) | (ctrl << BIT_POSITION_LMA);
+  Native_GPIO[7].pins = (cycle->sample & LA_SAMPLE_IFETCH) ? (Native_GPIO[7].pins | BIT_MASK_IFETCH) :
+                                                             (Native_GPIO[7].pins & ~BIT_MASK_IFETCH);
+  Native_Bus_Run_To(NATIVE_PHI_2_RISE_NS);
+  TEST_ASSERT_TRUE_MESSAGE(Native_GPIO[6].isr & BIT_MASK_PHASE2, msg);
+  pinChange_isr();
+
+  driven = Test_Driven_Byte();
+  if (cycle->ours)
+  {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(data, driven, msg);
+  }
+  else
+  {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, driven, msg);
+  }
+
+  Native_GPIO[6].pins = (Native_GPIO[6].pins & ~DATA_BUS_MASK) |
+                        ((uint32_t)(cycle->ours ? (uint8_t)~data : data) << BIT_POSITION_DB0);
+  Native_Bus_Run_To(NATIVE_PHI_1_RISE_NS);
+  TEST_ASSERT_TRUE_MESSAGE(Native_GPIO[6].isr & BIT_MASK_PHASE1, msg);
+  pinChange_isr();
+
+  TEST_ASSERT_EQUAL_HEX32_MESSAGE(cycle->sample, Logic_Analyzer_main_sample, msg);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(-1, Test_Driven_Byte(), msg);                     //  Let go at the Phi 1 fall
+  TEST_ASSERT_TRUE_MESSAGE(Native_Bus_Phase_ns() >= NATIVE_PHI_1_FALL_NS, msg);   //  onPhi_1_Fall() was after the edge
+  TEST_ASSERT_TRUE_MESSAGE(Native_Bus_Phase_ns() < NATIVE_PHI_2_RISE_NS, msg);
+}
+
+static void Replay(void)
+{
+  uint32_t    index;
+
+  Native_Bus_Run_To(NATIVE_PHI_1_FALL_NS);              //  Start with both clocks low, the first edge is the Phi 2 rise
+  Native_Bus_Start();
+  for (index = 0 ; index < Trace_Length ; index++)
+  {
+    Replay_Cycle(&Trace[index], index);
+  }
+  Native_Bus_Stop();
+}
+
+//
+//  Power up state: the test ROM loaded but not selected, 16K RAM on, the test I/O register, CRT mirror
+//
+
+static void Test_Setup(void)
+{
+  uint32_t    i;
+
+  memset(romMap, 0, sizeof(romMap));
+  currRom  = NULL;
+  rselec   = 0;
+  enRam16k = false;
+  initIOfuncTable();
+  initRoms();
+  initCrtEmu();
+  setIOReadFunc(TEST_IO_ADDR & 0xFF, &Test_IO_Read);
+  setIOWriteFunc(TEST_IO_ADDR & 0xFF, &Test_IO_Write);
+  for (i = 0 ; i < ROM_PAGE_SIZE ; i++)
+  {
+    getRomSlotPtr(0)[i] = Test_ROM_Byte(i);
+  }
+  setRomMap(TEST_ROM_ID, 0);
+  for (i = 0 ; i < EXP_RAM_SIZE ; i++)
+  {
+    HP85A_16K_RAM_module[i] = i * 13 + 4;
+  }
+  memcpy(Trace_RAM, HP85A_16K_RAM_module, sizeof(Trace_RAM));
+  enHP85RamExp(true);
+  buildRomPageTable();
+
+  memset(Native_GPIO, 0, sizeof(Native_GPIO));
+  Native_GPIO[6].pins = BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA;
+  Native_GPIO[8].pins = BIT_MASK_IPRIH_IN;              //  No higher priority interrupt
+  intrState      = 0;
+  interruptReq   = false;
+  globalIntEn    = false;
+  intEn_1MB5     = false;
+  DMA_Request    = false;
+  HP85_Read_Us   = false;
+  Trace_Length   = 0;
+  Trace_Addr     = 0;
+  addReg         = 0;                                   //  Where the last test left it otherwise
+  IO_Writes      = 0;
+  Trace_Idle(3);                                        //  Gets the decode state to idle, whatever it was
+}
+
+//
+//  A little of everything, in the order a program might do it
+//
+
+void test_replay_basic_trace(void)
+{
+  uint32_t    i;
+
+  Trace_Address(0100020);                               //  Something the system ROM answers
+  for (i = 0 ; i < 4 ; i++)
+  {
+    Trace_Read(i == 0);
+  }
+  Trace_Address(RSELEC);                                //  Select the test ROM. It must be answered from the next cycle on
+  Trace_Write(TEST_ROM_ID);
+  Trace_Address(ROM_PAGE + 0100);
+  for (i = 0 ; i < 16 ; i++)
+  {
+    Trace_Read((i & 3) == 0);
+  }
+  Trace_Address(TEST_RAM_BASE + 0400);                  //  Write 8 bytes of the 16K RAM, then read them back
+  for (i = 0 ; i < 8 ; i++)
+  {
+    Trace_Write(0x30 + i);
+  }
+  Trace_Idle(2);
+  Trace_Address(TEST_RAM_BASE + 0400);
+  for (i = 0 ; i < 8 ; i++)
+  {
+    Trace_Read(false);
+  }
+  Trace_Address(TEST_IO_ADDR);                          //  I/O register, read twice and written twice at the same address
+  Trace_Read(false);
+  Trace_Read(false);
+  Trace_Write(0x77);
+  Trace_Write(0x78);
+  Trace_Address(CRTBAD);                                //  Deferred CRT mirror writes
+  Trace_Write(0x40);
+  Trace_Write(0x00);
+  Trace_Address(CRTDAT);
+  Trace_Write('E');
+  Trace_Idle(2);
+
+  Replay();
+  TEST_ASSERT_EQUAL_UINT8(TEST_ROM_ID, getRselec());
+  TEST_ASSERT_EQUAL_UINT32(2, IO_Writes);
+  TEST_ASSERT_EQUAL_HEX8(0x77, IO_Written[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x78, IO_Written[1]);
+  TEST_ASSERT_EQUAL_MEMORY(Trace_RAM, HP85A_16K_RAM_module, EXP_RAM_SIZE);
+  ISR_Event_Poll();
+  TEST_ASSERT_EQUAL_HEX16(0x0042, badAddr);            //  The CRT mirror saw the address and one data byte
+}
+
+//
+//  Random accesses of every kind, checked cycle by cycle
+//
+
+static void Trace_Random(uint32_t ops)
+{
+  uint32_t    op, count, i;
+
+  Trace_Address(RSELEC);
+  Trace_Write(TEST_ROM_ID);
+  for (op = 0 ; op < ops ; op++)
+  {
+    count = 1 + (Test_Random() & 7);
+    switch (Test_Random() % 7)
+    {
+      case 0:                                           //  ROM
+        Trace_Address(ROM_PAGE + (Test_Random() % (ROM_PAGE_SIZE - 8)));
+        for (i = 0 ; i < count ; i++)
+        {
+          Trace_Read(i == 0);
+        }
+        break;
+      case 1:                                           //  16K RAM write
+        Trace_Address(TEST_RAM_BASE + (Test_Random() % (TEST_RAM_END - TEST_RAM_BASE - 8)));
+        for (i = 0 ; i < count ; i++)
+        {
+          Trace_Write(Test_Random());
+        }
+        break;
+      case 2:                                           //  16K RAM read
+        Trace_Address(TEST_RAM_BASE + (Test_Random() % (TEST_RAM_END - TEST_RAM_BASE - 8)));
+        for (i = 0 ; i < count ; i++)
+        {
+          Trace_Read(false);
+        }
+        break;
+      case 3:                                           //  Our I/O register
+        Trace_Address(TEST_IO_ADDR);
+        Trace_Read(false);
+        Trace_Write(Test_Random());
+        break;
+      case 4:                                           //  System ROM and DRAM, not ours
+        Trace_Address(Test_Random() % ROM_PAGE);
+        for (i = 0 ; i < count ; i++)
+        {
+          if (Test_Random() & 1)
+          {
+            Trace_Read(i == 0);
+          }
+          else
+          {
+            Trace_Write(Test_Random());
+          }
+        }
+        break;
+      case 5:
+        Trace_Idle(count);
+        break;
+      case 6:                                           //  Another I/O register, not ours
+        Trace_Address(0177740 + (Test_Random() & 0x0F));
+        Trace_Read(false);
+        break;
+    }
+  }
+}
+
+void test_replay_random_trace(void)
+{
+  Trace_Random(TEST_RANDOM_OPS);
+  TEST_ASSERT_LESS_THAN_UINT32(TEST_MAX_CYCLES, Trace_Length);
+  Replay();
+  TEST_ASSERT_EQUAL_MEMORY(Trace_RAM, HP85A_16K_RAM_module, EXP_RAM_SIZE);
+}
+
+//
+//  The 1MB5 interrupt: /IRL is asserted at a Phi 2, and EBTKS supplies the vector in the interrupt acknowledge cycle
+//
+
+void test_replay_interrupt_acknowledge(void)
+{
+  interruptVector = 0x10;
+  interruptReq    = true;
+  globalIntEn     = true;
+  intEn_1MB5      = true;
+  Trace_Idle(2);
+  Trace_Add(CTRL_INT_ACK, 0x10, false, true, CYCLE_INT_ACK);    //  /LMA is low, so the decode takes it as the start of an
+                                                                //  address load. What the CPU does next isn't modelled
+
+  Replay();
+  TEST_ASSERT_FALSE(interruptReq);
+  TEST_ASSERT_TRUE(globalIntAck);
+  TEST_ASSERT_EQUAL_INT(0, intrState);
+}
+
+//
+//  Cost of each ISR entry by cycle type, with the bus clock stopped so the Phi 1 entry doesn't wait. The trace is
+//  played the same way, without the checks
+//
+
+void test_replay_bench(void)
+{
+  uint32_t    pass, index, type;
+  uint64_t    accesses[2][CYCLE_NUM_TYPES] = {}, calls[CYCLE_NUM_TYPES] = {};
+  double      ns[2][CYCLE_NUM_TYPES] = {}, empty_ns;
+  const struct S_Replay_Cycle *cycle;
+  uint32_t    before;
+
+  Trace_Random(TEST_RANDOM_OPS);
+  auto start = std::chrono::steady_clock::now();
+  for (index = 0 ; index < 100000 ; index++)
+  {
+    auto t = std::chrono::steady_clock::now();
+    (void)t;
+  }
+  empty_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / 100000;
+
+  for (pass = 0 ; pass < TEST_BENCH_PASSES ; pass++)
+  {
+    for (index = 0 ; index < Trace_Length ; index++)
+    {
+      cycle = &Trace[index];
+      type  = cycle->type;
+      Native_GPIO[6].pins = (Native_GPIO[6].pins & ~(BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA | BIT_MASK_PHASE1)) |
+                            (cycle->sample & (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA));
+      Native_GPIO[6].isr  = BIT_MASK_PHASE2;
+      before = Native_GPIO_Accesses;
+      auto t0 = std::chrono::steady_clock::now();
+      pinChange_isr();
+      auto t1 = std::chrono::steady_clock::now();
+      accesses[1][type] += Native_GPIO_Accesses - before;
+      ns[1][type] += std::chrono::duration<double, std::nano>(t1 - t0).count();
+
+      Native_GPIO[6].pins = (Native_GPIO[6].pins & ~DATA_BUS_MASK) | ((cycle->sample & 0xFF) << BIT_POSITION_DB0);
+      Native_GPIO[6].isr  = BIT_MASK_PHASE1;
+      before = Native_GPIO_Accesses;
+      t0 = std::chrono::steady_clock::now();
+      pinChange_isr();
+      t1 = std::chrono::steady_clock::now();
+      accesses[0][type] += Native_GPIO_Accesses - before;
+      ns[0][type] += std::chrono::duration<double, std::nano>(t1 - t0).count();
+      calls[type]++;
+    }
+  }
+
+  printf("\nISR cost per entry by cycle type, %lu cycles x %d. GPIO accesses, and host ns less %.1f ns timer overhead\n",
+         (unsigned long)Trace_Length, TEST_BENCH_PASSES, empty_ns);
+  printf("                      Phi 1 rise+fall       Phi 2 rise\n");
+  printf("Cycle type            GPIO        ns       GPIO        ns\n");
+  for (type = 0 ; type < CYCLE_NUM_TYPES ; type++)
+  {
+    if (calls[type] == 0)
+    {
+      continue;
+    }
+    printf("%-18s  %6.1f  %8.1f     %6.1f  %8.1f\n", Cycle_Names[type],
+           (double)accesses[0][type] / calls[type], ns[0][type] / calls[type] - empty_ns,
+           (double)accesses[1][type] / calls[type], ns[1][type] / calls[type] - empty_ns);
+  }
+  TEST_ASSERT_TRUE(calls[CYCLE_ROM_READ] > 0);
+}
+
+void setUp(void)
+{
+  Test_Setup();
+}
+
+void tearDown(void)
+{
+  Native_Bus_Stop();
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_basic_trace);
+  RUN_TEST(test_replay_random_trace);
+  RUN_TEST(test_replay_interrupt_acknowledge);
+  RUN_TEST(test_replay_bench);
+  return UNITY_END();
+}
@@ -0,0 +1,175 @@
+//
+//      11/26/2020      Deferred CRT mirror writes, lost writes, and the resync
+//
+//  The ISR's deferred I/O ring drops writes when it is full. A lost CRTSAD or CRTBAD byte puts sadFlag / badFlag out
+//  of step with the HP85, so every later address is wrong until CRT_Mirror_Poll() resyncs the mirror. Here the ring is
+//  overfilled directly with Deferred_IO_Write_Push(), as onWriteData() would, and CRT_Mirror_Resync() is given the
+//  values CRT_Mirror_Poll() would have read from CRTBYT / CRTRAM / CRTWRS by DMA.
+//
+//  The last test times the worst case CRT mirror write (CRTDAT at an odd address) run inline, as it was within the
+//  Phi 1 window, against the Deferred_IO_Write_Push() that replaced it.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+
+#include "Inc_Common_Headers.h"
+
+#define TEST_RING_SIZE                (1024)            //  DEFERRED_IO_RING_SIZE in EBTKS_ISR_Events.cpp
+#define TEST_ADDR                     (0x21)
+#define TEST_BENCH_WRITES             (1000000)
+
+//  In EBTKS_CRT.cpp
+
+extern bool     badFlag, sadFlag;
+extern uint16_t badAddr, sadAddr;
+void ioWriteCrtSad(uint8_t val);
+void ioWriteCrtBad(uint8_t val);
+void ioWriteCrtCtrl(uint8_t val);
+void ioWriteCrtDat(uint8_t val);
+
+static uint32_t   Delivered;
+static bool       Out_Of_Order;
+
+static void Test_Handler(uint8_t data)
+{
+  if (data != (Delivered & 0xFF))
+  {
+    Out_Of_Order = true;
+  }
+  Delivered++;
+}
+
+void test_overflow_is_counted_once(void)
+{
+  uint32_t    i;
+
+  setIOWriteFunc(TEST_ADDR, &Test_Handler, true);
+  for (i = 0 ; i < TEST_RING_SIZE + 10 ; i++)
+  {
+    Deferred_IO_Write_Push(TEST_ADDR, i & 0xFF);
+  }
+  TEST_ASSERT_EQUAL_UINT32(10, Deferred_IO_Writes_Lost());
+  TEST_ASSERT_EQUAL_UINT32(0, Deferred_IO_Writes_Lost());         //  Only reported once
+  ISR_Event_Poll();
+  TEST_ASSERT_EQUAL_UINT32(TEST_RING_SIZE, Delivered);            //  The first ones, the rest were dropped
+  TEST_ASSERT_FALSE(Out_Of_Order);
+
+  Deferred_IO_Write_Push(TEST_ADDR, Delivered & 0xFF);            //  Room again
+  ISR_Event_Poll();
+  TEST_ASSERT_EQUAL_UINT32(TEST_RING_SIZE + 1, Delivered);
+  TEST_ASSERT_EQUAL_UINT32(0, Deferred_IO_Writes_Lost());
+  removeIOWriteFunc(TEST_ADDR);
+}
+
+//
+//  The ring fills with CRTDAT writes, and the high byte of a CRTBAD pair is lost
+//
+
+void test_lost_crtbad_byte_and_resync(void)
+{
+  uint32_t    i;
+
+  CRT_Mirror_Resync(0, 0, 0);
+  for (i = 0 ; i < TEST_RING_SIZE - 1 ; i++)
+  {
+    Deferred_IO_Write_Push(CRTDAT & 0xFF, ' ');
+  }
+  Deferred_IO_Write_Push(CRTBAD & 0xFF, 0x40);                    //  Low byte, the last free slot
+  Deferred_IO_Write_Push(CRTBAD & 0xFF, 0x01);                    //  High byte, lost
+  ISR_Event_Poll();
+  TEST_ASSERT_TRUE(badFlag);                                      //  Out of step, the next low byte would be taken as high
+
+  Deferred_IO_Write_Push(CRTBAD & 0xFF, 0x80);                    //  The HP85 moves on to 0x0080
+  Deferred_IO_Write_Push(CRTBAD & 0xFF, 0x00);
+  ISR_Event_Poll();
+  TEST_ASSERT_NOT_EQUAL(0x0080, badAddr);
+
+  TEST_ASSERT_NOT_EQUAL(0, Deferred_IO_Writes_Lost());            //  CRT_Mirror_Poll() would resync now
+  CRT_Mirror_Resync(0x0080, 0x0200, 0x00);                        //  With what the ROM has in CRTBYT, CRTRAM and CRTWRS
+  TEST_ASSERT_FALSE(badFlag);
+  TEST_ASSERT_FALSE(sadFlag);
+  TEST_ASSERT_TRUE(writeCRTflag);
+
+  Deferred_IO_Write_Push(CRTBAD & 0xFF, 0x20);                    //  Back in step
+  Deferred_IO_Write_Push(CRTBAD & 0xFF, 0x01);
+  Deferred_IO_Write_Push(CRTSAD & 0xFF, 0x00);
+  Deferred_IO_Write_Push(CRTSAD & 0xFF, 0x04);
+  ISR_Event_Poll();
+  TEST_ASSERT_EQUAL_HEX16(0x0120, badAddr);
+  TEST_ASSERT_EQUAL_HEX16(0x0400, sadAddr);
+}
+
+void test_resync_masks_to_mode(void)
+{
+  CRT_Mirror_Resync(0x3FFE, 0, 0x00);                             //  Alpha
+  TEST_ASSERT_EQUAL_HEX16(0x0FFE, badAddr);
+  CRT_Mirror_Resync(0x3FFE, 0, 0x80);                             //  Graphics
+  TEST_ASSERT_EQUAL_HEX16(0x3FFE, badAddr);
+  TEST_ASSERT_EQUAL_HEX8(0x80, crtControl);
+}
+
+//
+//  What moving the CRT mirror handlers out of the ISR saves, per write, in the worst case. Host time, so only the
+//  ratio carries over to the Teensy
+//
+
+void test_bench_inline_against_deferred(void)
+{
+  void        (*volatile handler)(uint8_t) = &ioWriteCrtDat;
+  void        (*volatile push)(uint8_t, uint8_t) = &Deferred_IO_Write_Push;
+  uint32_t    i;
+  double      inline_ns, push_ns;
+  char        msg[128];
+
+  CRT_Mirror_Resync(0x0001, 0, 0x80);                             //  Odd address, graphics: the nibble split path
+  auto start = std::chrono::steady_clock::now();
+  for (i = 0 ; i < TEST_BENCH_WRITES ; i++)
+  {
+    badAddr |= 1;
+    handler(i);
+  }
+  auto mid = std::chrono::steady_clock::now();
+  for (i = 0 ; i < TEST_BENCH_WRITES ; i++)
+  {
+    push(TEST_ADDR, i);
+    if ((i & (TEST_RING_SIZE / 2 - 1)) == 0)
+    {
+      ISR_Event_Poll();                                           //  Outside the timing would be better, but it is 1 in 512
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  Deferred_IO_Writes_Lost();
+
+  inline_ns = std::chrono::duration<double, std::nano>(mid - start).count() / TEST_BENCH_WRITES;
+  push_ns   = std::chrono::duration<double, std::nano>(end - mid).count() / TEST_BENCH_WRITES;
+  snprintf(msg, sizeof(msg), "CRTDAT odd address: inline %.1f ns, deferred push %.1f ns (host)", inline_ns, push_ns);
+  TEST_MESSAGE(msg);
+}
+
+void setUp(void)
+{
+  initCrtEmu();
+  ISR_Event_Poll();
+  Deferred_IO_Writes_Lost();
+  Delivered = 0;
+  Out_Of_Order = false;
+  writeCRTflag = false;
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_overflow_is_counted_once);
+  RUN_TEST(test_lost_crtbad_byte_and_resync);
+  RUN_TEST(test_resync_masks_to_mode);
+  RUN_TEST(test_bench_inline_against_deferred);
+  return UNITY_END();
+}
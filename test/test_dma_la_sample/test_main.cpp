@@ -0,0 +1,152 @@
+//
+//      11/26/2020      DMA cycles into the Logic Analyzer, against the prefetched part of the PSRAM buffers
+//
+//  DMA_Read_Block() runs on the Phi 1 / Phi 2 clock model, with the bus already granted (DMA_Active), and every
+//  cycle goes through DMA_LA_Sample(). With the internal buffers, every DMA cycle is captured. With a deep capture
+//  in PSRAM, only the cycles whose stores were prefetched are captured, as nothing prefetches during the session;
+//  the rest are counted in DMA_LA_Skipped. Logic_Analyzer_Prefetch() between sessions (DMA_Session() does it
+//  before it asks for the bus) lets the next session be captured again. The same for compressed capture.
+//
+//  The host has no cache, so DMA_LA_Max_Cycles only counts the GPIO accesses in DMA_LA_Sample(). The window
+//  check is done on the Teensy, shown with the LA results and by "fr".
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+#include "Native_Bus.h"
+
+extern "C" uint8_t external_psram_size;
+
+#define TEST_DMA_ADDR                 (0x8000)
+#define TEST_LA_PREFETCH_SAMPLES      (2048)            //  LA_PREFETCH_SAMPLES in EBTKS_Logic_Analyzer.cpp
+#define TEST_BURST_BYTES              (3000)            //  Longer than the prefetch distance
+#define TEST_LONG_BURST_BYTES         (24000)           //  Reads at the next address take a byte each compressed, this is more than 16 KB
+
+static uint8_t    Test_Buffer[TEST_LONG_BURST_BYTES];
+
+static void Test_Start_Capture(uint32_t length, bool compressed)
+{
+  Logic_Analyzer_Current_Buffer_Length = length;
+  Logic_Analyzer_Current_Index_Mask    = length - 1;
+  Logic_Analyzer_Compressed            = compressed;
+  Logic_Analyzer_Data_index            = 0;
+  Logic_Analyzer_Select_Buffer();
+  Logic_Analyzer_Valid_Samples         = 0;
+  Logic_Analyzer_Index_of_Trigger      = -1;
+  Logic_Analyzer_Triggered             = false;
+  Logic_Analyzer_Pre_Trigger_Samples   = 0x7FFFFFFF;    //  Never allowed to trigger, so it never finishes
+  DMA_LA_Sample_Reset();
+  Logic_Analyzer_State                 = ANALYZER_ACQUIRING;
+}
+
+//
+//  One DMA_Read_Block(), as DMA_Session() does it once it has the bus
+//
+
+static void Test_DMA_Read(uint32_t bytes)
+{
+  DMA_Active = true;
+  Native_Bus_Run_To(NATIVE_PHI_1_FALL_NS);
+  Native_Bus_Start();
+  DMA_Read_Block(TEST_DMA_ADDR, Test_Buffer, bytes);
+  Native_Bus_Stop();
+  __enable_irq();                                       //  As release_DMA_request() would
+  DMA_Active = false;
+}
+
+void test_internal_buffers_capture_every_dma_cycle(void)
+{
+  Test_Start_Capture(LOGIC_ANALYZER_BUFFER_SIZE, false);
+  Test_DMA_Read(100);
+  TEST_ASSERT_TRUE(DMA_LA_Samples >= 100 + 2);          //  The reads, the 2 LMA cycles, and any refresh breaks
+  TEST_ASSERT_EQUAL_UINT32(0, DMA_LA_Skipped);
+  TEST_ASSERT_EQUAL_UINT32(DMA_LA_Samples, Logic_Analyzer_Valid_Samples);
+  TEST_ASSERT_EQUAL_UINT32(0, DMA_LA_Overruns);
+}
+
+void test_psram_capture_stops_at_the_prefetched_samples(void)
+{
+  char      msg[100];
+
+  Test_Start_Capture(LOGIC_ANALYZER_PSRAM_SAMPLES, false);
+  Test_DMA_Read(TEST_BURST_BYTES);
+  snprintf(msg, sizeof(msg), "%lu DMA cycles, %lu captured, %lu skipped", (unsigned long)DMA_LA_Samples,
+           (unsigned long)Logic_Analyzer_Valid_Samples, (unsigned long)DMA_LA_Skipped);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(DMA_LA_Samples, Logic_Analyzer_Valid_Samples + DMA_LA_Skipped);
+  TEST_ASSERT_TRUE(Logic_Analyzer_Valid_Samples <= TEST_LA_PREFETCH_SAMPLES);
+  TEST_ASSERT_TRUE(Logic_Analyzer_Valid_Samples >= TEST_LA_PREFETCH_SAMPLES - 8);   //  Less a cache line at most
+  TEST_ASSERT_TRUE(DMA_LA_Skipped >= TEST_BURST_BYTES - TEST_LA_PREFETCH_SAMPLES);
+
+  //
+  //  The next session starts with a prefetch, and is captured until it too runs past it
+  //
+  Logic_Analyzer_Prefetch();
+  DMA_LA_Sample_Reset();
+  Logic_Analyzer_Valid_Samples = 0;
+  Test_DMA_Read(100);
+  TEST_ASSERT_EQUAL_UINT32(0, DMA_LA_Skipped);
+  TEST_ASSERT_EQUAL_UINT32(DMA_LA_Samples, Logic_Analyzer_Valid_Samples);
+}
+
+void test_compressed_psram_capture_stops_at_the_prefetched_blocks(void)
+{
+  uint32_t    main, aux, decoded = 0;
+  int32_t     sample_number;
+
+  Test_Start_Capture(LOGIC_ANALYZER_PSRAM_SAMPLES, true);
+  Test_DMA_Read(TEST_LONG_BURST_BYTES);
+  TEST_ASSERT_TRUE(DMA_LA_Skipped > 0);
+  TEST_ASSERT_TRUE(Logic_Analyzer_Compressed_Bytes() <= 2 * TEST_LA_PREFETCH_SAMPLES * 4);     //  No more than was prefetched
+  TEST_ASSERT_EQUAL_UINT32(DMA_LA_Samples, Logic_Analyzer_Valid_Samples + DMA_LA_Skipped);
+
+  Logic_Analyzer_Prefetch();
+  DMA_LA_Sample_Reset();
+  Test_DMA_Read(100);
+  TEST_ASSERT_EQUAL_UINT32(0, DMA_LA_Skipped);
+
+  TEST_ASSERT_TRUE(Logic_Analyzer_Decode_First());      //  What was captured still decodes
+  while (Logic_Analyzer_Decode_Next(&main, &aux, &sample_number))
+  {
+    TEST_ASSERT_EQUAL_HEX32(0x08000000U, main & 0x08000000U);                     //  All DMA cycles
+    decoded++;
+  }
+  TEST_ASSERT_EQUAL_UINT32(Logic_Analyzer_Valid_Samples, decoded);
+}
+
+void test_no_sampling_when_nothing_is_recording(void)
+{
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  DMA_LA_Sample_Reset();
+  Test_DMA_Read(100);
+  TEST_ASSERT_EQUAL_UINT32(0, DMA_LA_Samples);
+}
+
+void setUp(void)
+{
+  DMA_Sched_Configure(&DMA_Sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED,     //  As setup() does
+                      DMA_REFRESH_GRANT_DEBT);
+  external_psram_size = 16;
+  Logic_Analyzer_State = ANALYZER_IDLE;
+}
+
+void tearDown(void)
+{
+  external_psram_size = 8;
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  Logic_Analyzer_Compressed = false;
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_internal_buffers_capture_every_dma_cycle);
+  RUN_TEST(test_psram_capture_stops_at_the_prefetched_samples);
+  RUN_TEST(test_compressed_psram_capture_stops_at_the_prefetched_blocks);
+  RUN_TEST(test_no_sampling_when_nothing_is_recording);
+  return UNITY_END();
+}
@@ -0,0 +1,254 @@
+//
+//      11/26/2020      Background DMA jobs on the Phi 1 / Phi 2 clock model
+//
+//  A SIGALRM handler stands in for the bus ISR's DMA grant (see Native_IRQ.h): when DMA_Session() asks for the
+//  bus it sets DMA_Active and counts the grant, and release_DMA_request() hands the bus back on the clock model.
+//  Each slice is one grant, so the grant count at the time a job's callback runs shows how the engine sliced it
+//  and took turns:
+//
+//      Jobs from one client finish in the order they were submitted, whatever the other clients have queued
+//      Slices keep to DMA_QUEUE_SLICE_BYTES, DMA_QUEUE_SLICE_OPS and DMA_QUEUE_POLL_READS
+//      Clients take turns a slice at a time, so a short job isn't held up by a long one
+//      The CRT restore and the Term85 screen update are one grant each, whatever their size
+//      DMA_Queue_Run() from a job callback, or with the queue full, runs the job at once in one grant
+//
+//  The data bus reads as 0, so a poll for CRTSTS bit 7 clear is met at once, and one for it set never is.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "EBTKS_Term85.h"                             //  With Inc_Common_Headers.h
+#include "Native_Bus.h"
+#include "Native_IRQ.h"
+
+#define TEST_DMA_ADDR                 (0x8000)
+#define TEST_GRANT_PERIOD_US          (20)
+#define TEST_MAX_JOBS                 (DMA_QUEUE_LENGTH + 1)
+
+static volatile uint32_t  Test_Grants;
+
+static uint8_t            Test_Buffer[2048];
+static struct S_DMA_Op    Test_Ops[TEST_MAX_JOBS][DMA_QUEUE_SLICE_OPS * 3];
+static struct S_DMA_Job   Test_Jobs[TEST_MAX_JOBS];
+static uint32_t           Test_Done_Grants[TEST_MAX_JOBS];    //  Test_Grants when each job's callback ran
+static uint32_t           Test_Done_Order[TEST_MAX_JOBS];
+static uint32_t           Test_Num_Done;
+
+static struct S_DMA_Job   *Test_Callback_Runs;                //  Run by Test_Run_From_Callback()
+static bool               Test_Callback_Run_Result;
+static uint32_t           Test_Callback_Run_Grants;
+
+static void Test_Grant_ISR(void)
+{
+  if (DMA_Request && !DMA_Active)
+  {
+    DMA_Request = false;
+    Test_Grants++;
+    DMA_Active  = true;
+  }
+}
+
+static void Test_Job_Done(struct S_DMA_Job *job)
+{
+  uint32_t    id = job - Test_Jobs;
+
+  Test_Done_Grants[id]            = Test_Grants;
+  Test_Done_Order[Test_Num_Done++] = id;
+}
+
+static void Test_Run_From_Callback(struct S_DMA_Job *job)
+{
+  uint32_t    start = Test_Grants;
+
+  Test_Job_Done(job);
+  Test_Callback_Run_Result = DMA_Queue_Run(Test_Callback_Runs);
+  Test_Callback_Run_Grants = Test_Grants - start;
+}
+
+//
+//  Job id with one operation per entry of ops
+//
+
+static struct S_DMA_Job *Test_Job(uint32_t id, uint8_t client, const struct S_DMA_Op *ops, uint32_t op_count)
+{
+  memcpy(Test_Ops[id], ops, op_count * sizeof(struct S_DMA_Op));
+  Test_Jobs[id] = {Test_Ops[id], op_count, client, false, &Test_Job_Done};
+  return &Test_Jobs[id];
+}
+
+static struct S_DMA_Job *Test_Read_Job(uint32_t id, uint8_t client, uint16_t count)
+{
+  struct S_DMA_Op   op = {DMA_OP_READ, 0, 0, TEST_DMA_ADDR, count, Test_Buffer};
+
+  return Test_Job(id, client, &op, 1);
+}
+
+static void Test_Run_Queue(void)
+{
+  uint32_t    id;
+  bool        queued;
+
+  do
+  {
+    DMA_Engine_Poll();
+    queued = false;
+    for (id = 0 ; id < TEST_MAX_JOBS ; id++)
+    {
+      queued |= (Test_Jobs[id].state == DMA_JOB_QUEUED);
+    }
+  } while (queued);
+}
+
+void test_jobs_from_one_client_run_in_order(void)
+{
+  Test_Read_Job(0, DMA_CLIENT_AUXROM, 100);
+  Test_Read_Job(1, DMA_CLIENT_OTHER, 300);
+  Test_Read_Job(2, DMA_CLIENT_AUXROM, 10);
+  Test_Read_Job(3, DMA_CLIENT_AUXROM, 200);
+  Test_Read_Job(4, DMA_CLIENT_OTHER, 1);
+  for (uint32_t id = 0 ; id < 5 ; id++)
+  {
+    TEST_ASSERT_TRUE(DMA_Queue_Submit(&Test_Jobs[id]));
+  }
+  TEST_ASSERT_FALSE(DMA_Queue_Submit(&Test_Jobs[2]));               //  Already queued
+  Test_Run_Queue();
+
+  TEST_ASSERT_EQUAL_UINT32(5, Test_Num_Done);
+  TEST_ASSERT_TRUE(Test_Done_Grants[0] < Test_Done_Grants[2]);
+  TEST_ASSERT_TRUE(Test_Done_Grants[2] < Test_Done_Grants[3]);
+  TEST_ASSERT_TRUE(Test_Done_Grants[1] < Test_Done_Grants[4]);
+  for (uint32_t id = 0 ; id < 5 ; id++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(DMA_JOB_DONE, Test_Jobs[id].state);
+  }
+}
+
+void test_slices_keep_to_the_limits(void)
+{
+  struct S_DMA_Op   ops[DMA_QUEUE_SLICE_OPS * 3];
+  uint32_t          i, start;
+
+  start = Test_Grants;                                                //  Bytes: 200 is 64 + 64 + 64 + 8
+  TEST_ASSERT_TRUE(DMA_Queue_Run(Test_Read_Job(0, DMA_CLIENT_AUXROM, 200)));
+  TEST_ASSERT_EQUAL_UINT32(4, Test_Grants - start);
+
+  for (i = 0 ; i < DMA_QUEUE_SLICE_OPS * 3 ; i++)                     //  Operations: 48 one byte reads
+  {
+    ops[i] = {DMA_OP_READ, 0, 0, (uint16_t)(TEST_DMA_ADDR + i), 1, &Test_Buffer[i]};
+  }
+  start = Test_Grants;
+  TEST_ASSERT_TRUE(DMA_Queue_Run(Test_Job(1, DMA_CLIENT_AUXROM, ops, DMA_QUEUE_SLICE_OPS * 3)));
+  TEST_ASSERT_EQUAL_UINT32(3, Test_Grants - start);
+
+  ops[0] = {DMA_OP_WRITE_PACED, 0x80, 0x00, CRTDAT, 20, Test_Buffer, 0, CRTSTS};    //  A poll and a write per byte
+  start = Test_Grants;
+  TEST_ASSERT_TRUE(DMA_Queue_Run(Test_Job(2, DMA_CLIENT_OTHER, ops, 1)));
+  TEST_ASSERT_EQUAL_UINT32((20 * 2 + DMA_QUEUE_SLICE_OPS - 1) / DMA_QUEUE_SLICE_OPS, Test_Grants - start);
+
+  ops[0] = {DMA_OP_POLL, 0x80, 0x80, CRTSTS, 0, NULL, DMA_QUEUE_POLL_READS * 2 + 1};  //  Never met
+  start = Test_Grants;
+  TEST_ASSERT_FALSE(DMA_Queue_Run(Test_Job(3, DMA_CLIENT_OTHER, ops, 1)));
+  TEST_ASSERT_EQUAL_UINT32(3, Test_Grants - start);
+  TEST_ASSERT_EQUAL_UINT8(DMA_JOB_FAILED, Test_Jobs[3].state);
+  TEST_ASSERT_EQUAL_UINT32(0, Test_Jobs[3].ops_done);
+}
+
+void test_clients_take_turns(void)
+{
+  uint32_t    start = Test_Grants;
+
+  Test_Read_Job(0, DMA_CLIENT_OTHER, DMA_QUEUE_SLICE_BYTES * 10);
+  Test_Read_Job(1, DMA_CLIENT_TERM85, DMA_QUEUE_SLICE_BYTES * 3);
+  Test_Read_Job(2, DMA_CLIENT_AUXROM, DMA_QUEUE_SLICE_BYTES);
+  TEST_ASSERT_TRUE(DMA_Queue_Submit(&Test_Jobs[0]));
+  TEST_ASSERT_TRUE(DMA_Queue_Submit(&Test_Jobs[1]));
+  TEST_ASSERT_TRUE(DMA_Queue_Submit(&Test_Jobs[2]));
+  Test_Run_Queue();
+
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(3, Test_Done_Grants[2] - start);   //  One slice, with no more than one of each other client first
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(3 * 2 + 1, Test_Done_Grants[1] - start);
+  TEST_ASSERT_EQUAL_UINT32(10 + 3 + 1, Test_Done_Grants[0] - start);
+}
+
+void test_screen_jobs_are_one_grant(void)
+{
+  Term85      term;
+  MapScreen   screen(&term);
+  uint32_t    start, i;
+
+  start = Test_Grants;
+  CRT_restore_screen();
+  TEST_ASSERT_EQUAL_UINT32(1, Test_Grants - start);
+
+  term.begin(HP85_WIDTH, HP85_LINES);
+  screen.update();                                                    //  Submitted, with an AUXROM job behind it
+  TEST_ASSERT_TRUE(DMA_Queue_Submit(Test_Read_Job(0, DMA_CLIENT_AUXROM, DMA_QUEUE_SLICE_BYTES * 2)));
+  start = Test_Grants;
+  for (i = 0 ; i < DMA_QUEUE_LENGTH ; i++)                            //  Each call runs at least one slice
+  {
+    DMA_Engine_Poll();
+  }
+  TEST_ASSERT_EQUAL_UINT8(DMA_JOB_DONE, Test_Jobs[0].state);
+  TEST_ASSERT_EQUAL_UINT32(1 + 2, Test_Grants - start);
+}
+
+void test_run_from_a_callback_is_at_once(void)
+{
+  uint32_t    id, start;
+
+  Test_Callback_Runs = Test_Read_Job(1, DMA_CLIENT_AUXROM, DMA_QUEUE_SLICE_BYTES * 4);
+  Test_Read_Job(0, DMA_CLIENT_AUXROM, 10)->callback = &Test_Run_From_Callback;
+  TEST_ASSERT_TRUE(DMA_Queue_Submit(&Test_Jobs[0]));
+  Test_Run_Queue();
+  TEST_ASSERT_TRUE(Test_Callback_Run_Result);
+  TEST_ASSERT_EQUAL_UINT32(1, Test_Callback_Run_Grants);
+  TEST_ASSERT_EQUAL_UINT8(DMA_JOB_DONE, Test_Jobs[1].state);
+  TEST_ASSERT_EQUAL_UINT32(1, Test_Jobs[1].ops_done);
+  TEST_ASSERT_EQUAL_UINT32(2, Test_Num_Done);                         //  Its own callback too
+
+  for (id = 0 ; id < DMA_QUEUE_LENGTH ; id++)                         //  Fill the queue
+  {
+    TEST_ASSERT_TRUE(DMA_Queue_Submit(Test_Read_Job(id, DMA_CLIENT_OTHER, 1)));
+  }
+  Test_Num_Done = 0;
+  start = Test_Grants;
+  TEST_ASSERT_TRUE(DMA_Queue_Run(Test_Read_Job(DMA_QUEUE_LENGTH, DMA_CLIENT_AUXROM, DMA_QUEUE_SLICE_BYTES * 4)));
+  TEST_ASSERT_EQUAL_UINT32(1, Test_Grants - start);
+  TEST_ASSERT_EQUAL_UINT8(DMA_JOB_DONE, Test_Jobs[DMA_QUEUE_LENGTH].state);
+  TEST_ASSERT_EQUAL_UINT32(1, Test_Num_Done);
+  Test_Run_Queue();
+  TEST_ASSERT_EQUAL_UINT32(DMA_QUEUE_LENGTH + 1, Test_Num_Done);
+}
+
+void setUp(void)
+{
+  DMA_Sched_Configure(&DMA_Sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED,     //  As setup() does
+                      DMA_REFRESH_GRANT_DEBT);
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  memset(Test_Jobs, 0, sizeof(Test_Jobs));
+  memset(Test_Done_Grants, 0, sizeof(Test_Done_Grants));
+  Test_Num_Done = 0;
+  Native_Bus_Run_To(NATIVE_PHI_1_FALL_NS);
+  Native_Bus_Start();
+  Native_IRQ_Start(&Test_Grant_ISR, TEST_GRANT_PERIOD_US);
+}
+
+void tearDown(void)
+{
+  Native_IRQ_Stop();
+  Native_Bus_Stop();
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_jobs_from_one_client_run_in_order);
+  RUN_TEST(test_slices_keep_to_the_limits);
+  RUN_TEST(test_clients_take_turns);
+  RUN_TEST(test_screen_jobs_are_one_grant);
+  RUN_TEST(test_run_from_a_callback_is_at_once);
+  return UNITY_END();
+}
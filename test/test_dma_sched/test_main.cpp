@@ -0,0 +1,205 @@
+//
+//      11/26/2020      The DMA refresh scheduler against the 1MA2 refresh rule
+//
+//  The rule: the 1MA2 asks for a refresh every interval bus cycles, does one in each cycle without a DRAM access,
+//  and can have no more than postponed waiting. DMA_Sched_Check_Setting() ("dma sched check") runs the scheduler's
+//  decisions through a model of that, at every phase, for every legal setting, and must find no violations. It
+//  must find them when the 1MA2 can postpone fewer requests than the setting says, or it isn't checking anything.
+//
+//  DMA_Read_Block() is then run on the Phi 1 / Phi 2 clock model with the Logic Analyzer capturing every DMA
+//  cycle, and the LMA, read and idle cycles it actually put on the bus go through this file's own model of the
+//  rule, at every phase. No block may start with more busy cycles than the 2 LMA and 15 data cycles of the fixed
+//  bursts that the scheduler replaced.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+#include "Native_Bus.h"
+
+#define TEST_DMA_ADDR                 (0x8000)
+#define TEST_FIXED_BURST_BUSY         (2 + 15)          //  LMA cycles and MAX_DMA_BURST_LENGTH , before the scheduler
+#define TEST_CTRL_SHIFT               (24)              //  /WR /RD /LMA in the sample, as onPhi_1_Rise() builds it
+#define TEST_CTRL_MASK                (0x07U)
+#define TEST_CTRL_IDLE                (0x07U)
+
+static uint8_t    Test_Buffer[256];
+static uint8_t    Test_Cycles[LOGIC_ANALYZER_BUFFER_SIZE];  //  1 for a DRAM access (LMA, read or write), 0 for idle
+static uint32_t   Test_Num_Cycles;
+
+void test_every_legal_setting_passes(void)
+{
+  uint32_t    interval, postponed, grant_debt, settings = 0, runs = 0, violations = 0;
+  char        msg[100];
+
+  for (interval = DMA_REFRESH_INTERVAL_MIN ; interval <= DMA_REFRESH_INTERVAL_MAX ; interval++)
+  {
+    for (postponed = DMA_REFRESH_POSTPONED_MIN ; postponed <= DMA_REFRESH_POSTPONED_MAX ; postponed++)
+    {
+      for (grant_debt = 0 ; grant_debt < postponed ; grant_debt++)
+      {
+        settings++;
+        violations += DMA_Sched_Check_Setting(interval, postponed, grant_debt, postponed, &runs);
+      }
+    }
+  }
+  snprintf(msg, sizeof(msg), "%lu settings, %lu runs", (unsigned long)settings, (unsigned long)runs);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(runs > settings * DMA_REFRESH_INTERVAL_MIN);
+  TEST_ASSERT_EQUAL_UINT32(0, violations);
+}
+
+void test_the_check_finds_a_1ma2_that_postpones_fewer(void)
+{
+  uint32_t    interval, postponed, runs = 0;
+
+  for (interval = DMA_REFRESH_INTERVAL_MIN ; interval <= DMA_REFRESH_INTERVAL_MAX ; interval++)
+  {
+    for (postponed = 2 ; postponed <= DMA_REFRESH_POSTPONED_MAX ; postponed++)
+    {
+      TEST_ASSERT_TRUE(DMA_Sched_Check_Setting(interval, postponed, 0, postponed - 1, &runs) > 0);
+    }
+  }
+}
+
+void test_out_of_range_settings_are_refused(void)
+{
+  struct S_DMA_Sched    sched;
+
+  TEST_ASSERT_FALSE(DMA_Sched_Configure(&sched, DMA_REFRESH_INTERVAL_MIN - 1, 2, 0));
+  TEST_ASSERT_FALSE(DMA_Sched_Configure(&sched, DMA_REFRESH_INTERVAL_MAX + 1, 2, 0));
+  TEST_ASSERT_FALSE(DMA_Sched_Configure(&sched, 9, DMA_REFRESH_POSTPONED_MIN - 1, 0));
+  TEST_ASSERT_FALSE(DMA_Sched_Configure(&sched, 9, DMA_REFRESH_POSTPONED_MAX + 1, 0));
+  TEST_ASSERT_FALSE(DMA_Sched_Configure(&sched, 9, 2, 2));
+  TEST_ASSERT_TRUE(DMA_Sched_Configure(&sched, 9, 2, 1));
+}
+
+void test_default_block_start_is_no_longer_than_the_fixed_bursts(void)
+{
+  struct S_DMA_Sched    sched;
+  uint32_t              idle, burst;
+
+  DMA_Sched_Configure(&sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED, DMA_REFRESH_GRANT_DEBT);
+  DMA_Sched_Grant(&sched, UINT32_MAX);
+  idle  = DMA_Sched_Block_Start(&sched);
+  burst = DMA_Sched_Burst(&sched, MAX_DMA_TRANSFER_LENGTH);
+  TEST_ASSERT_EQUAL_UINT32(0, idle);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_FIXED_BURST_BUSY, 2 + burst);
+  TEST_ASSERT_TRUE(sched.busy_cycles <= TEST_FIXED_BURST_BUSY);
+}
+
+//
+//  The 1MA2 rule, written here from scratch. The CPU's last cycle before the grant is a DRAM access, so a request
+//  may already be waiting when our first cycle starts. Returns the most requests waiting in any of our cycles
+//
+
+static uint32_t Test_1MA2_Worst(uint32_t interval, uint32_t phase)
+{
+  uint32_t    counter = phase, pending = 0, worst = 0, i;
+
+  for (i = 0 ; i <= Test_Num_Cycles ; i++)
+  {
+    if (++counter == interval)
+    {
+      counter = 0;
+      pending++;
+    }
+    if ((i > 0) && !Test_Cycles[i - 1] && pending)                    //  Cycle 0 is the CPU's
+    {
+      pending--;
+    }
+    if ((i > 0) && (pending > worst))
+    {
+      worst = pending;
+    }
+  }
+  return worst;
+}
+
+void test_dma_read_block_bus_cycles_keep_to_the_1ma2_rule(void)
+{
+  uint32_t    i, phase, run = 0, longest = 0, first = 0;
+  char        msg[120];
+
+  Logic_Analyzer_Current_Buffer_Length = LOGIC_ANALYZER_BUFFER_SIZE;
+  Logic_Analyzer_Current_Index_Mask    = LOGIC_ANALYZER_BUFFER_SIZE - 1;
+  Logic_Analyzer_Compressed            = false;
+  Logic_Analyzer_Data_index            = 0;
+  Logic_Analyzer_Select_Buffer();
+  Logic_Analyzer_Valid_Samples         = 0;
+  Logic_Analyzer_Index_of_Trigger      = -1;
+  Logic_Analyzer_Triggered             = false;
+  Logic_Analyzer_Pre_Trigger_Samples   = 0x7FFFFFFF;
+  Logic_Analyzer_State                 = ANALYZER_ACQUIRING;
+
+  DMA_Active = true;                                    //  One grant, a long block and a short one
+  Native_Bus_Run_To(NATIVE_PHI_1_FALL_NS);
+  Native_Bus_Start();
+  DMA_Read_Block(TEST_DMA_ADDR, Test_Buffer, 256);
+  DMA_Read_Block(TEST_DMA_ADDR, Test_Buffer, 40);
+  Native_Bus_Stop();
+  __enable_irq();
+  DMA_Sched_Release();
+  DMA_Active = false;
+  Logic_Analyzer_State = ANALYZER_IDLE;
+
+  Test_Num_Cycles = Logic_Analyzer_Valid_Samples;         //  From index 0, and it didn't wrap
+  TEST_ASSERT_TRUE(Test_Num_Cycles >= 256 + 40 + 4);
+  TEST_ASSERT_TRUE(Test_Num_Cycles < LOGIC_ANALYZER_BUFFER_SIZE);
+  for (i = 0 ; i < Test_Num_Cycles ; i++)
+  {
+    Test_Cycles[i] = (((Logic_Analyzer_Data_1[i] >> TEST_CTRL_SHIFT) & TEST_CTRL_MASK) != TEST_CTRL_IDLE);
+  }
+
+  for (i = 0 ; i < Test_Num_Cycles ; i++)
+  {
+    if (Test_Cycles[i])
+    {
+      run++;
+      longest = (run > longest) ? run : longest;
+    }
+    else
+    {
+      if ((first == 0) && run)
+      {
+        first = run;
+      }
+      run = 0;
+    }
+  }
+  snprintf(msg, sizeof(msg), "%lu bus cycles, first run of busy cycles %lu, longest %lu", (unsigned long)Test_Num_Cycles,
+           (unsigned long)first, (unsigned long)longest);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_FIXED_BURST_BUSY, first);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(DMA_REFRESH_INTERVAL * DMA_REFRESH_POSTPONED - 1, longest);
+
+  for (phase = 0 ; phase < DMA_REFRESH_INTERVAL ; phase++)
+  {
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(DMA_REFRESH_POSTPONED, Test_1MA2_Worst(DMA_REFRESH_INTERVAL, phase));
+  }
+}
+
+void setUp(void)
+{
+  DMA_Sched_Configure(&DMA_Sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED,     //  As setup() does
+                      DMA_REFRESH_GRANT_DEBT);
+  Logic_Analyzer_State = ANALYZER_IDLE;
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_every_legal_setting_passes);
+  RUN_TEST(test_the_check_finds_a_1ma2_that_postpones_fewer);
+  RUN_TEST(test_out_of_range_settings_are_refused);
+  RUN_TEST(test_default_block_start_is_no_longer_than_the_fixed_bursts);
+  RUN_TEST(test_dma_read_block_bus_cycles_keep_to_the_1ma2_rule);
+  return UNITY_END();
+}
@@ -0,0 +1,89 @@
+//
+//      11/26/2020      The DMA timing check on the Phi 1 / Phi 2 clock model
+//
+//  "dma timing" (DMA_Timing_Check() in EBTKS_DMA_Timing.cpp) runs here as it does on the Teensy, with [env:native]
+//  setting ENABLE_DMA_TIMING_CHECK. A SIGALRM handler stands in for the bus ISR's DMA grant, the Phi edges come
+//  from Native_Bus.h, and the busy waits (EBTKS_delay_ns() etc.) take their Teensy times, so the stamps are the
+//  waveform of DMA_Read_Block() and DMA_Write_Block() as they stand. Every rule must pass, and a tweak that is
+//  out by a little more than the rules allow must be caught.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+#include "Native_Bus.h"
+#include "Native_IRQ.h"
+
+#define TEST_GRANT_PERIOD_US          (20)
+#define TEST_MISTUNE_NS               (80)          //  Address and data hold after Phi 1 falls is allowed 40 to 150 ns
+
+static uint32_t           Test_Delay_Extra_ns;
+
+static void Test_Grant_ISR(void)
+{
+  if (DMA_Request && !DMA_Active)
+  {
+    DMA_Request = false;
+    DMA_Active  = true;
+  }
+}
+
+//
+//  The model's EBTKS_delay_ns() (Native_Stubs.cpp), with an error added to every tweak
+//
+
+void EBTKS_delay_ns(int32_t count)
+{
+  uint32_t    ns = (count < 69) ? 50 : (59 + ((count - 59) / 10) * 10 + 2);
+
+  Native_Bus_Advance(NATIVE_NS_TO_CPU(ns + Test_Delay_Extra_ns));
+}
+
+static uint32_t Test_Check(void)
+{
+  uint32_t    failures;
+
+  Native_Bus_Run_To(NATIVE_PHI_1_FALL_NS);
+  Native_Bus_Start();
+  Native_IRQ_Start(&Test_Grant_ISR, TEST_GRANT_PERIOD_US);
+  failures = DMA_Timing_Check();
+  Native_IRQ_Stop();
+  Native_Bus_Stop();
+  return failures;
+}
+
+void test_the_dma_code_keeps_to_the_rules(void)
+{
+  TEST_ASSERT_EQUAL_UINT32(0, Test_Check());
+}
+
+void test_a_mistuned_delay_is_caught(void)
+{
+  Test_Delay_Extra_ns = TEST_MISTUNE_NS;
+  Native_Serial_Quiet = true;
+  TEST_ASSERT_TRUE(Test_Check() > 0);
+}
+
+void setUp(void)
+{
+  DMA_Sched_Configure(&DMA_Sched, DMA_REFRESH_INTERVAL, DMA_REFRESH_POSTPONED,     //  As setup() does
+                      DMA_REFRESH_GRANT_DEBT);
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  Test_Delay_Extra_ns  = 0;
+}
+
+void tearDown(void)
+{
+  Native_Serial_Quiet = false;
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_the_dma_code_keeps_to_the_rules);
+  RUN_TEST(test_a_mistuned_delay_is_caught);
+  return UNITY_END();
+}
@@ -0,0 +1,147 @@
+//
+//      11/26/2020      Interrupt latency stamps with the bus ISR running
+//
+//  A SIGALRM handler stands in for onPhi_2_Rise() (see Native_IRQ.h), with its intrState steps 0 and 1: it
+//  asserts /IRL when it sees interruptReq, and takes the acknowledge on its next run. The requests come from
+//  the background, through the IOP reset in loopTranslator() , and from the ISR, through requestInterrupt() as
+//  onWriteOb() makes them. Every request has to be stamped before the ISR sees it, so every one is counted
+//  against the 1MB5, with a request to IRL time and a handoff, and none as Other. A background request that
+//  finds the ISR's already pending is part of that one, as it is on the HP85.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+#include "Native_IRQ.h"
+
+#define TEST_REQUESTS                 (20000)
+#define TEST_ISR_PERIOD_US            (5)
+#define TEST_1MB5_VECTOR              (0x10)
+#define TEST_OTHER_VECTOR             (0x00)
+#define TEST_CCR_RESET                (0x80)
+
+//  In EBTKS_1MB5.cpp
+
+extern bool prevReset;
+
+void onWriteCCR(uint8_t val);
+void requestInterrupt(uint8_t reason);
+
+static volatile uint32_t  Test_Intr_State;
+static volatile bool      Test_ISR_Requests;
+static volatile uint32_t  ISR_Requests_Made;
+
+static void Test_Bus_ISR(void)
+{
+  switch (Test_Intr_State)
+  {
+    case 0:
+      if (interruptReq)
+      {
+        Test_Intr_State = 1;
+        Interrupt_Latency_IRL();
+      }
+      else if (Test_ISR_Requests && (Native_IRQ_Count() & 1))
+      {
+        requestInterrupt(1);                            //  The last byte of a burst write, say
+        ISR_Requests_Made++;
+      }
+      break;
+
+    case 1:
+      interruptReq    = false;
+      Test_Intr_State = 0;
+      Interrupt_Latency_Handoff();
+      break;
+  }
+}
+
+//
+//  The HP85 resets the IOP, and the background sees it
+//
+
+static void Test_IOP_Reset_Request(void)
+{
+  prevReset   = true;
+  globalIntEn = true;
+  onWriteCCR(0);
+  loopTranslator();
+}
+
+static void Test_Run(bool isr_requests)
+{
+  uint32_t    made = 0;
+
+  Test_ISR_Requests = isr_requests;
+  Native_IRQ_Start(&Test_Bus_ISR, TEST_ISR_PERIOD_US);
+  while (made < TEST_REQUESTS)
+  {
+    if (!interruptReq)
+    {
+      Test_IOP_Reset_Request();
+      made++;
+    }
+  }
+  Test_ISR_Requests = false;
+  while (interruptReq || Test_Intr_State)
+  {
+  }
+  Native_IRQ_Stop();
+}
+
+void test_background_requests_are_stamped_before_irl(void)
+{
+  uint32_t    requests, irls, handoffs;
+
+  Test_Run(false);
+  Interrupt_Latency_Get_Counts(TEST_1MB5_VECTOR, &requests, &irls, &handoffs);
+  TEST_ASSERT_EQUAL_UINT32(TEST_REQUESTS, requests);
+  TEST_ASSERT_EQUAL_UINT32(TEST_REQUESTS, irls);
+  TEST_ASSERT_EQUAL_UINT32(TEST_REQUESTS, handoffs);
+  Interrupt_Latency_Get_Counts(TEST_OTHER_VECTOR, &requests, &irls, &handoffs);
+  TEST_ASSERT_EQUAL_UINT32(0, requests);
+}
+
+void test_isr_and_background_requests_together(void)
+{
+  uint32_t    requests, irls, handoffs;
+  char        msg[100];
+
+  Test_Run(true);
+  Interrupt_Latency_Get_Counts(TEST_1MB5_VECTOR, &requests, &irls, &handoffs);
+  snprintf(msg, sizeof(msg), "%lu requests, %lu of them from the ISR, %lu interrupts", (unsigned long)requests,
+           (unsigned long)ISR_Requests_Made, (unsigned long)Native_IRQ_Count());
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(ISR_Requests_Made > 0);
+  TEST_ASSERT_TRUE(requests > ISR_Requests_Made);
+  TEST_ASSERT_TRUE(requests <= TEST_REQUESTS + ISR_Requests_Made);      //  A second request while one is pending is the same one
+  TEST_ASSERT_EQUAL_UINT32(requests, irls);
+  TEST_ASSERT_EQUAL_UINT32(requests, handoffs);
+  Interrupt_Latency_Get_Counts(TEST_OTHER_VECTOR, &requests, &irls, &handoffs);
+  TEST_ASSERT_EQUAL_UINT32(0, requests);
+}
+
+void setUp(void)
+{
+  Native_Serial_Quiet = true;
+  Interrupt_Latency_Clear_Command();
+  Native_Serial_Quiet = false;
+  Test_Intr_State   = 0;
+  ISR_Requests_Made = 0;
+  interruptReq      = false;
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_background_requests_are_stamped_before_irl);
+  RUN_TEST(test_isr_and_background_requests_together);
+  return UNITY_END();
+}
@@ -0,0 +1,334 @@
+//
+//      11/26/2020      Stress test of the ISR to background event ring and the 1MB5 handshakes
+//
+//  A SIGALRM handler stands in for pinChange_isr() (see Native_IRQ.h). It interrupts the background code of
+//  each test at random points, tens of thousands of times, as the HP85 bus does on the Teensy:
+//      Events pushed by the "ISR" are delivered by ISR_Event_Poll() once each, in order, including when the
+//      owner is busy and the event has to stay in the ring, and when the ring is full and the ISR retries
+//      Deferred I/O writes are handed to their handlers in order
+//      OB bytes written by the HP85 side through onWriteOb() all reach readOb() , in order
+//      A burst write leaves its last byte in the OB, so processOB() can read the end of the burst
+//      loadReadBuff() racing onReadInterrupt() never leaves a half loaded IB buffer
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+#include "Native_IRQ.h"
+
+#define TEST_EVENTS                   (200000)
+#define TEST_ISR_PERIOD_US            (5)
+#define TEST_PSR_PED                  (1 << 2)          //  From EBTKS_1MB5.cpp
+#define TEST_DEFERRED_ADDR            (0x21)
+#define TEST_DEFERRED_WINDOW          (512)             //  Less than the deferred ring, it doesn't overflow here
+
+//  In EBTKS_1MB5.cpp
+
+extern volatile uint8_t statusReg;
+extern volatile bool obf, ibf;
+extern volatile bool writeBurst;
+extern volatile int readCount, readIndex, writeCount, writeIndex;
+extern uint8_t readBuff[512], writeBuff[512];
+
+bool onReadStatus(void);
+bool onReadIB(void);
+bool onReadInterrupt(void);
+void onWriteOb(uint8_t val);
+bool readOb(uint8_t *val, uint8_t *ccr_val);
+void loadReadBuff(int count, bool pack);
+
+//
+//  Producer state, only written by the ISR, and the consumer state, only written by the background
+//
+
+static volatile uint32_t  Produced;
+static volatile uint32_t  Ring_Full;                    //  Pushes that found the ring full and were retried
+static volatile uint32_t  Consumed;
+static volatile uint32_t  Alerts_Produced;
+static volatile uint32_t  Alerts_Consumed;
+static volatile uint32_t  Busy_Refusals;
+static volatile bool      Out_Of_Order;
+static uint32_t           Random = 1;
+
+static uint32_t Test_Random(void)
+{
+  Random = Random * 1103515245U + 12345U;
+  return Random >> 8;
+}
+
+//
+//  The owners of the events, in place of the weak stubs in Native_Stubs.cpp. Each refuses one event in four,
+//  as if still busy, so the event stays in the ring and must come back next poll
+//
+
+bool tape_block_request_event(uint32_t block)
+{
+  if ((Test_Random() & 3) == 0)
+  {
+    Busy_Refusals++;
+    return false;
+  }
+  if (block != Consumed)
+  {
+    Out_Of_Order = true;
+  }
+  Consumed++;
+  return true;
+}
+
+bool AUXROM_Alert_Event(uint8_t mailbox)
+{
+  if (mailbox != (Alerts_Consumed & 0xFF))
+  {
+    Out_Of_Order = true;
+  }
+  Alerts_Consumed++;
+  return true;
+}
+
+//
+//  The tape and AUXROM events are separate sequences, each retried from where it stopped when the ring is full
+//
+
+static void Test_Event_ISR(void)
+{
+  uint32_t    burst = 1 + (Native_IRQ_Count() & 3);     //  1 to 4 events of each type per interrupt
+
+  while (burst--)
+  {
+    if (Produced < TEST_EVENTS)
+    {
+      if (ISR_Event_Push(ISR_EVENT_TAPE_BLOCK_REQUEST, 0, 0, Produced))
+      {
+        Produced++;
+      }
+      else
+      {
+        Ring_Full++;                                    //  Same block number next time, as the tape code does
+      }
+    }
+    if (Alerts_Produced < TEST_EVENTS)
+    {
+      if (ISR_Event_Push(ISR_EVENT_AUXROM_ALERT, Alerts_Produced & 0xFF, 0, 0))
+      {
+        Alerts_Produced++;
+      }
+      else
+      {
+        Ring_Full++;
+      }
+    }
+  }
+}
+
+void test_event_ring_in_order_under_interrupts(void)
+{
+  Native_IRQ_Start(&Test_Event_ISR, TEST_ISR_PERIOD_US);
+  while ((Consumed < TEST_EVENTS) || (Alerts_Consumed < TEST_EVENTS))
+  {
+    ISR_Event_Poll();
+  }
+  Native_IRQ_Stop();
+
+  TEST_ASSERT_FALSE(Out_Of_Order);
+  TEST_ASSERT_EQUAL_UINT32(TEST_EVENTS, Produced);
+  TEST_ASSERT_EQUAL_UINT32(TEST_EVENTS, Alerts_Produced);
+  TEST_ASSERT_EQUAL_UINT32(TEST_EVENTS, Consumed);
+  TEST_ASSERT_EQUAL_UINT32(TEST_EVENTS, Alerts_Consumed);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, Busy_Refusals);
+  printf("%lu interrupts, %lu busy refusals, %lu pushes retried on a full ring\n",
+         (unsigned long)Native_IRQ_Count(), (unsigned long)Busy_Refusals, (unsigned long)Ring_Full);
+}
+
+//
+//  Deferred I/O writes
+//
+
+static void Test_Deferred_Handler(uint8_t data)
+{
+  if (data != (Consumed & 0xFF))
+  {
+    Out_Of_Order = true;
+  }
+  Consumed++;
+}
+
+static void Test_Deferred_ISR(void)
+{
+  uint32_t    burst = 1 + (Test_Random() & 15);
+
+  while (burst-- && (Produced < TEST_EVENTS) && ((Produced - Consumed) < TEST_DEFERRED_WINDOW))
+  {
+    Deferred_IO_Write_Push(TEST_DEFERRED_ADDR, Produced & 0xFF);
+    Produced++;
+  }
+}
+
+void test_deferred_writes_in_order_under_interrupts(void)
+{
+  setIOWriteFunc(TEST_DEFERRED_ADDR, &Test_Deferred_Handler, true);
+  Native_IRQ_Start(&Test_Deferred_ISR, TEST_ISR_PERIOD_US);
+  while (Consumed < TEST_EVENTS)
+  {
+    ISR_Event_Poll();
+  }
+  Native_IRQ_Stop();
+  removeIOWriteFunc(TEST_DEFERRED_ADDR);
+
+  TEST_ASSERT_FALSE(Out_Of_Order);
+  TEST_ASSERT_EQUAL_UINT32(TEST_EVENTS, Consumed);
+}
+
+//
+//  The HP85 side of the OB handshake: read the status, and only write the OB when OBF is clear
+//
+
+static void Test_OB_ISR(void)
+{
+  onReadStatus();
+  if (!(readData & 0x80) && (Produced < TEST_EVENTS))
+  {
+    onWriteOb(Produced & 0xFF);
+    Produced++;
+  }
+}
+
+void test_ob_bytes_reach_readOb_in_order(void)
+{
+  uint8_t     val, ccr_val;
+
+  Native_IRQ_Start(&Test_OB_ISR, TEST_ISR_PERIOD_US);
+  while (Consumed < TEST_EVENTS)
+  {
+    if (readOb(&val, &ccr_val))
+    {
+      if (val != (Consumed & 0xFF))
+      {
+        Out_Of_Order = true;
+      }
+      Consumed++;
+    }
+  }
+  Native_IRQ_Stop();
+  TEST_ASSERT_FALSE(Out_Of_Order);
+  TEST_ASSERT_EQUAL_UINT32(TEST_EVENTS, Consumed);
+}
+
+//
+//  processOB() case 0x20 waits for writeBurst to clear, then for readOb() to return the end of the burst
+//
+
+static void Test_Burst_ISR(void)
+{
+  if (writeBurst && (Produced < 256))
+  {
+    onWriteOb(Produced);
+    Produced++;
+  }
+}
+
+void test_burst_write_leaves_last_byte_in_ob(void)
+{
+  uint8_t     val = 0, ccr_val;
+  uint32_t    polls;
+
+  writeCount = 256;
+  writeIndex = 0;
+  writeBurst = true;
+  interruptReq = false;
+  Native_IRQ_Start(&Test_Burst_ISR, TEST_ISR_PERIOD_US);
+  while (writeBurst == true)
+  {
+  };
+  for (polls = 0 ; polls < 1000000 ; polls++)
+  {
+    if (readOb(&val, &ccr_val))
+    {
+      break;
+    }
+  }
+  Native_IRQ_Stop();
+
+  TEST_ASSERT_LESS_THAN_UINT32(1000000, polls);         //  It would wait forever on the HP85
+  TEST_ASSERT_EQUAL_UINT8(255, val);
+  TEST_ASSERT_TRUE(interruptReq);
+  for (polls = 0 ; polls < 256 ; polls++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(polls, writeBuff[polls]);
+  }
+  TEST_ASSERT_FALSE(readOb(&val, &ccr_val));            //  The burst bytes before the last are not OB events
+}
+
+//
+//  The interrupt acknowledge (onReadInterrupt()) loads a 2 byte IB buffer from the ISR, whenever it happens.
+//  A 1 byte loadReadBuff() must come out whole, with PED set, or be replaced whole by the interrupt's
+//
+
+static void Test_IB_ISR(void)
+{
+  globalIntAck = true;
+  onReadInterrupt();
+}
+
+void test_loadReadBuff_is_not_torn_by_onReadInterrupt(void)
+{
+  uint32_t    round, torn = 0, interrupted = 0;
+  int         count;
+  uint8_t     status;
+
+  Native_IRQ_Start(&Test_IB_ISR, TEST_ISR_PERIOD_US);
+  for (round = 0 ; round < TEST_EVENTS ; round++)
+  {
+    readBuff[0] = round;
+    loadReadBuff(1, false);
+    __disable_irq();
+    count  = readCount;
+    status = statusReg;
+    __enable_irq();
+    if (count == 2)
+    {
+      interrupted++;                                    //  The ISR's buffer replaced ours, fine
+    }
+    else if ((count != 1) || !(status & TEST_PSR_PED))
+    {
+      torn++;
+    }
+  }
+  Native_IRQ_Stop();
+  printf("%lu interrupts, %lu loads replaced by the interrupt buffer, %lu torn\n",
+         (unsigned long)Native_IRQ_Count(), (unsigned long)interrupted, (unsigned long)torn);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, interrupted);
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+}
+
+void setUp(void)
+{
+  uint32_t    polls;
+
+  for (polls = 0 ; polls < 1000 ; polls++)
+  {
+    ISR_Event_Poll();                                   //  Empty the rings, the tape owner refuses some
+  }
+  Produced = Consumed = Alerts_Produced = Alerts_Consumed = Busy_Refusals = Ring_Full = 0;
+  Out_Of_Order = false;
+  obf = false;
+  writeBurst = false;
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_event_ring_in_order_under_interrupts);
+  RUN_TEST(test_deferred_writes_in_order_under_interrupts);
+  RUN_TEST(test_ob_bytes_reach_readOb_in_order);
+  RUN_TEST(test_burst_write_leaves_last_byte_in_ob);
+  RUN_TEST(test_loadReadBuff_is_not_torn_by_onReadInterrupt);
+  return UNITY_END();
+}
@@ -0,0 +1,130 @@
+//
+//      11/26/2020      ISR cycle budget profiler accounting
+//
+//  ISR_Profiler_Record() is handed a cycle count and only does arithmetic, so it is checked here with counts
+//  chosen to land on each side of every histogram bucket boundary, and past the last bucket.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+
+void test_clear_starts_empty(void)
+{
+  struct S_ISR_Profile  prof;
+  uint32_t    slot, bucket;
+
+  for (slot = 0 ; slot < ISR_PROFILE_NUM_SLOTS ; slot++)
+  {
+    ISR_Profiler_Get(slot, &prof);
+    TEST_ASSERT_EQUAL_UINT32(0, prof.count);
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFU, prof.min);
+    TEST_ASSERT_EQUAL_UINT32(0, prof.max);
+    TEST_ASSERT_EQUAL_UINT64(0, prof.total);
+    for (bucket = 0 ; bucket < ISR_PROFILE_NUM_BUCKETS ; bucket++)
+    {
+      TEST_ASSERT_EQUAL_UINT32(0, prof.histogram[bucket]);
+    }
+  }
+}
+
+void test_count_min_max_total(void)
+{
+  struct S_ISR_Profile  prof;
+
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_MEMORY_READ, 40);
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_MEMORY_READ, 12);
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_MEMORY_READ, 95);
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_MEMORY_READ, 33);
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_MEMORY_READ, &prof);
+  TEST_ASSERT_EQUAL_UINT32(4, prof.count);
+  TEST_ASSERT_EQUAL_UINT32(12, prof.min);
+  TEST_ASSERT_EQUAL_UINT32(95, prof.max);
+  TEST_ASSERT_EQUAL_UINT64(180, prof.total);
+}
+
+void test_histogram_buckets(void)
+{
+  struct S_ISR_Profile  prof;
+  uint32_t    bucket;
+
+  TEST_ASSERT_EQUAL_UINT32(30, ISR_PROFILE_BUCKET_CYCLES);        //  50 ns at 600 MHz
+  for (bucket = 0 ; bucket < ISR_PROFILE_NUM_BUCKETS ; bucket++)
+  {
+    ISR_Profiler_Record(ISR_PROFILE_SLOT_IO_READ + 0x40, bucket * ISR_PROFILE_BUCKET_CYCLES);            //  First of the bucket
+    ISR_Profiler_Record(ISR_PROFILE_SLOT_IO_READ + 0x40, (bucket + 1) * ISR_PROFILE_BUCKET_CYCLES - 1);  //  Last of the bucket
+  }
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_IO_READ + 0x40, 100000);                                         //  Way over, in the last bucket
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_IO_READ + 0x40, 0xFFFFFFFFU);
+
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_IO_READ + 0x40, &prof);
+  for (bucket = 0 ; bucket < ISR_PROFILE_NUM_BUCKETS - 1 ; bucket++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(2, prof.histogram[bucket]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(4, prof.histogram[ISR_PROFILE_NUM_BUCKETS - 1]);
+  TEST_ASSERT_EQUAL_UINT32(2 * ISR_PROFILE_NUM_BUCKETS + 2, prof.count);
+  TEST_ASSERT_EQUAL_UINT32(0, prof.min);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFU, prof.max);
+}
+
+//
+//  The total is 64 bits, so a busy slot doesn't wrap after 7 seconds of 1000 cycle samples
+//
+
+void test_total_does_not_wrap(void)
+{
+  struct S_ISR_Profile  prof;
+  uint32_t    i;
+
+  for (i = 0 ; i < 5 ; i++)
+  {
+    ISR_Profiler_Record(ISR_PROFILE_SLOT_PHI_1_RISE, 0xF0000000U);
+  }
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_PHI_1_RISE, &prof);
+  TEST_ASSERT_EQUAL_UINT64(5ULL * 0xF0000000ULL, prof.total);
+}
+
+void test_slots_are_separate(void)
+{
+  struct S_ISR_Profile  prof;
+
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_IO_WRITE + 0xFF, 7);
+  ISR_Profiler_Record(ISR_PROFILE_SLOT_PHI_2_BY_TYPE + BUS_STATS_IDLE, 8);
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_IO_WRITE + 0xFF, &prof);
+  TEST_ASSERT_EQUAL_UINT32(1, prof.count);
+  TEST_ASSERT_EQUAL_UINT32(7, prof.max);
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_MEMORY_READ, &prof);            //  The next slot after the I/O writes
+  TEST_ASSERT_EQUAL_UINT32(0, prof.count);
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_PHI_2_BY_TYPE + BUS_STATS_IDLE, &prof);
+  TEST_ASSERT_EQUAL_UINT32(1, prof.count);
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_DMA_LA_SAMPLE, &prof);          //  The next slot after the Phi 2 by type
+  TEST_ASSERT_EQUAL_UINT32(0, prof.count);
+
+  ISR_Profiler_Clear();
+  ISR_Profiler_Get(ISR_PROFILE_SLOT_IO_WRITE + 0xFF, &prof);
+  TEST_ASSERT_EQUAL_UINT32(0, prof.count);
+}
+
+void setUp(void)
+{
+  ISR_Profiler_Clear();
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_clear_starts_empty);
+  RUN_TEST(test_count_min_max_total);
+  RUN_TEST(test_histogram_buckets);
+  RUN_TEST(test_total_does_not_wrap);
+  RUN_TEST(test_slots_are_separate);
+  return UNITY_END();
+}
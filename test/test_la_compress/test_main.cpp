@@ -0,0 +1,367 @@
+//
+//      11/26/2020      Logic Analyzer delta compressed capture, encoder against decoder
+//
+//  Sample streams are fed to Logic_Analyzer_Compress_Sample() the way Logic_Analyzer_Capture() does, and read back
+//  with Logic_Analyzer_Decode_First() / Logic_Analyzer_Decode_Next(), which build on the host as they are. Every
+//  decoded sample must match what went in, with its sample number. The one loss is by design: idle cycles after the
+//  first of a run keep the data byte of the one before (the data bus is junk on an idle cycle).
+//
+//  The streams are:
+//      A model of Capricorn bus traffic: opcode fetches with IFETCH, operand reads, idle cycles, /LMA address loads,
+//      reads and writes away from the PC, and now and then a bank switch (RSELEC) and DMA cycles
+//      Random samples, to reach every record type and the block boundaries
+//  With the ring too short for the stream, decoding must start at the oldest block that survived and still end at
+//  the last sample.
+//
+//  The compression ratio on the Capricorn model is printed. Every read and write costs at least its data byte, and
+//  the model's data is random, so this is near the worst case for real code. It was 3.1 before OPCODE, OPJUMP and
+//  CJUMP were added and is 4.4 now; long idle stretches (the keyboard wait loop) and multi-byte operands do better.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+#include <vector>
+
+#include "Inc_Common_Headers.h"
+
+extern "C" uint8_t external_psram_size;
+
+#define TEST_LONG_BUFFER              (LOGIC_ANALYZER_PSRAM_SAMPLES)    //  Longer than the streams, uncompressed
+#define TEST_MODEL_SAMPLES            (400000)
+#define TEST_RANDOM_SAMPLES           (200000)
+#define TEST_MIN_RATIO                (4.0)
+
+#define TEST_CTRL_BITS                (0x1F000000U)     //  IFETCH, DMA, /WR /RD /LMA. As LA_SAMPLE_CTRL_BITS in EBTKS_Logic_Analyzer.cpp
+#define TEST_IDLE                     (0x07000000U)
+
+#define CTRL_IDLE                     (7)               //  /WR /RD /LMA as in bits 26..24 of the sample, all active low
+#define CTRL_LMA                      (6)
+#define CTRL_RD                       (5)
+#define CTRL_WR                       (3)
+
+struct S_Sample
+{
+  uint32_t    main;
+  uint32_t    aux;
+};
+
+static std::vector<struct S_Sample>  Stream;
+static uint32_t     Random = 1;
+
+static uint32_t Test_Random(void)
+{
+  Random = Random * 1103515245U + 12345U;
+  return Random >> 8;
+}
+
+//
+//  A stream of Capricorn bus cycles. The address register counts up after each read or write, as on the HP85
+//
+
+static uint16_t     Model_Addr;
+static uint16_t     Model_PC;
+static uint8_t      Model_Rselec;
+
+static void Model_Cycle(uint32_t ctrl, uint8_t data, bool ifetch)
+{
+  struct S_Sample   s;
+
+  s.main = (ifetch ? LA_SAMPLE_IFETCH : 0) | (ctrl << 24) | ((uint32_t)Model_Addr << 8) | data;
+  s.aux  = Model_Rselec;
+  Stream.push_back(s);
+  if ((ctrl == CTRL_RD) || (ctrl == CTRL_WR))
+  {
+    Model_Addr++;
+  }
+}
+
+static void Model_Address(uint16_t addr)
+{
+  Model_Cycle(CTRL_LMA, addr & 0xFF, false);
+  Model_Cycle(CTRL_LMA, addr >> 8, false);
+  Model_Addr = addr;
+}
+
+static void Model_DMA_Burst(void)
+{
+  uint32_t    count = 4 + (Test_Random() & 15);
+  uint16_t    addr  = Model_Addr;
+  struct S_Sample   s;
+
+  s.aux = Model_Rselec;
+  s.main = LA_SAMPLE_DMA_LMA | ((uint32_t)addr << 8) | 0x34;
+  Stream.push_back(s);
+  Stream.push_back(s);
+  addr = 0x8000 + (Test_Random() & 0x3FFF);
+  while (count--)
+  {
+    s.main = LA_SAMPLE_DMA_READ | ((uint32_t)addr++ << 8) | (Test_Random() & 0xFF);
+    Stream.push_back(s);
+  }
+  s.main = LA_SAMPLE_DMA_IDLE | ((uint32_t)addr << 8);
+  Stream.push_back(s);
+  Model_Addr = addr;
+}
+
+static void Model_Instruction(void)
+{
+  uint32_t    r = Test_Random();
+  uint32_t    operands = r & 3;
+  uint32_t    idles = 1 + ((r >> 2) & 3);
+
+  if (Model_Addr != Model_PC)
+  {
+    Model_Address(Model_PC);
+  }
+  Model_Cycle(CTRL_RD, Test_Random() & 0xFF, true);
+  while (operands--)
+  {
+    Model_Cycle(CTRL_RD, Test_Random() & 0xFF, false);
+  }
+  Model_PC = Model_Addr;
+  while (idles--)
+  {
+    Model_Cycle(CTRL_IDLE, Test_Random() & 0xFF, false);
+  }
+  switch ((r >> 4) & 15)
+  {
+    case 0:                                             //  Load 2 bytes from RAM
+    case 1:
+      Model_Address(0x8000 + ((r >> 8) & 0x3FFE));
+      Model_Cycle(CTRL_RD, Test_Random() & 0xFF, false);
+      Model_Cycle(CTRL_RD, Test_Random() & 0xFF, false);
+      break;
+    case 2:                                             //  Store 2 bytes to RAM
+      Model_Address(0x8000 + ((r >> 8) & 0x3FFE));
+      Model_Cycle(CTRL_WR, Test_Random() & 0xFF, false);
+      Model_Cycle(CTRL_WR, Test_Random() & 0xFF, false);
+      break;
+    case 3:                                             //  Jump
+      Model_PC = (r >> 8) & 0x7FFF;
+      break;
+    case 4:                                             //  Bank switch, now and then
+      if (((r >> 8) & 15) == 0)
+      {
+        Model_Address(RSELEC);
+        Model_Rselec = r >> 12;
+        Model_Cycle(CTRL_WR, Model_Rselec, false);
+      }
+      break;
+    case 5:
+      if (((r >> 8) & 15) == 0)
+      {
+        Model_DMA_Burst();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void Make_Model_Stream(uint32_t samples)
+{
+  Stream.clear();
+  Model_Addr = Model_PC = 0x6000;
+  Model_Rselec = 0;
+  while (Stream.size() < samples)
+  {
+    Model_Instruction();
+  }
+}
+
+//
+//  Random samples. Mostly small steps from the previous sample, so the runs and the short records are hit as well
+//  as JUMP and FULL
+//
+
+static void Make_Random_Stream(uint32_t samples)
+{
+  struct S_Sample   s = {0, 0};
+  uint32_t    r;
+
+  Stream.clear();
+  while (Stream.size() < samples)
+  {
+    r = Test_Random();
+    switch (r & 7)
+    {
+      case 0:   s.main = (s.main & 0xFFFFFF00U) | (r >> 8 & 0xFF);                                       break;
+      case 1:   s.main = (s.main & 0xFF000000U) | ((s.main + 0x100) & 0x00FFFF00U) | (r >> 8 & 0xFF);  break;
+      case 2:   s.main = (s.main & 0x00FFFFFFU) | ((r << 16) & TEST_CTRL_BITS);                          break;
+      case 3:   s.main = (s.main & 0x00FFFFFFU) | (CTRL_IDLE << 24);                                     break;
+      case 4:   s.main = (s.main & 0xFF0000FFU) | ((r << 8) & 0x00FFFF00U);                              break;
+      case 5:   s.main = (s.main ^ LA_SAMPLE_IFETCH) + ((r >> 8) & 0x100);                               break;
+      case 6:   s.aux  = r >> 8 & 0xFF;                                                                  break;
+      default:  s.main = (r << 5) & 0x1FFFFFFFU;                                                         break;
+    }
+    Stream.push_back(s);
+  }
+}
+
+//
+//  Capture the stream into a ring of buffer_length samples (both buffers), untriggered
+//
+
+static void Capture(uint32_t buffer_length)
+{
+  Logic_Analyzer_Compressed            = true;
+  Logic_Analyzer_Current_Buffer_Length = buffer_length;
+  Logic_Analyzer_Current_Index_Mask    = buffer_length - 1;
+  Logic_Analyzer_Data_index            = 0;
+  Logic_Analyzer_Triggered             = false;
+  Logic_Analyzer_Select_Buffer();
+  TEST_ASSERT_TRUE(Logic_Analyzer_Compressed);
+  TEST_ASSERT_EQUAL_UINT32(buffer_length, Logic_Analyzer_Current_Buffer_Length);
+  for (const struct S_Sample &s : Stream)
+  {
+    Logic_Analyzer_main_sample = s.main;
+    Logic_Analyzer_aux_sample  = s.aux;
+    Logic_Analyzer_Compress_Sample();
+  }
+  TEST_ASSERT_EQUAL_UINT32(Stream.size(), Logic_Analyzer_Data_index);
+}
+
+//
+//  Decode and compare. Returns how many samples came back, which must be the newest ones
+//
+
+static uint32_t Check_Decode(void)
+{
+  uint32_t    main, aux, expected, mask;
+  int32_t     sample_number, first = -1, next = 0;
+
+  TEST_ASSERT_TRUE(Logic_Analyzer_Decode_First());
+  while (Logic_Analyzer_Decode_Next(&main, &aux, &sample_number))
+  {
+    if (first < 0)
+    {
+      first = next = sample_number;
+      TEST_ASSERT_TRUE(first >= 0);
+    }
+    TEST_ASSERT_EQUAL_INT32(next, sample_number);
+    TEST_ASSERT_LESS_THAN_UINT32(Stream.size(), (uint32_t)sample_number);
+    expected = Stream[sample_number].main;
+    mask = 0xFFFFFFFFU;
+    if ((sample_number > 0) && ((expected & TEST_CTRL_BITS) == TEST_IDLE) && (Stream[sample_number - 1].main >> 8 == expected >> 8))
+    {
+      mask = 0xFFFFFF00U;                               //  Idle cycle run, the data is not kept
+    }
+    TEST_ASSERT_EQUAL_HEX32(expected & mask, main & mask);
+    TEST_ASSERT_EQUAL_HEX32(Stream[sample_number].aux, aux);
+    next++;
+  }
+  TEST_ASSERT_EQUAL_INT32(Stream.size(), next);                 //  Ends at the last sample
+  return next - first;
+}
+
+void test_model_stream_round_trip_and_ratio(void)
+{
+  double      ratio;
+  char        msg[100];
+
+  Make_Model_Stream(TEST_MODEL_SAMPLES);
+  Capture(TEST_LONG_BUFFER);
+  ratio = (double)Stream.size() * 2 * sizeof(uint32_t) / Logic_Analyzer_Compressed_Bytes();
+  TEST_ASSERT_EQUAL_UINT32(Stream.size(), Check_Decode());      //  The ring didn't wrap, all are there
+  snprintf(msg, sizeof(msg), "Capricorn model: %lu samples in %lu bytes, %.1f times the history",
+           (unsigned long)Stream.size(), (unsigned long)Logic_Analyzer_Compressed_Bytes(), ratio);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(ratio >= TEST_MIN_RATIO);
+}
+
+void test_random_stream_round_trip(void)
+{
+  Make_Random_Stream(TEST_RANDOM_SAMPLES);
+  Capture(TEST_LONG_BUFFER);
+  TEST_ASSERT_EQUAL_UINT32(Stream.size(), Check_Decode());
+}
+
+//
+//  The internal buffers hold 32 blocks. The oldest surviving block starts with a full sample, so decoding starts
+//  there, and runs to the last sample
+//
+
+void test_wrapped_ring_keeps_the_newest_samples(void)
+{
+  uint32_t    kept;
+  char        msg[80];
+
+  Make_Model_Stream(TEST_MODEL_SAMPLES / 10);
+  Capture(LOGIC_ANALYZER_BUFFER_SIZE);
+  kept = Check_Decode();
+  snprintf(msg, sizeof(msg), "%lu of %lu samples kept in %d bytes", (unsigned long)kept, (unsigned long)Stream.size(),
+           (int)(LOGIC_ANALYZER_BUFFER_SIZE * 2 * sizeof(uint32_t)));
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_THAN_UINT32(Stream.size(), kept);
+  TEST_ASSERT_GREATER_THAN_UINT32(LOGIC_ANALYZER_BUFFER_SIZE, kept);
+
+  Make_Random_Stream(TEST_RANDOM_SAMPLES / 10);
+  Capture(LOGIC_ANALYZER_BUFFER_SIZE);
+  Check_Decode();
+}
+
+//
+//  Once triggered, capture stops after Logic_Analyzer_Post_Trigger_Blocks() more blocks, and the block holding the
+//  trigger sample is still in the ring
+//
+
+void test_post_trigger_blocks_keep_the_trigger(void)
+{
+  uint32_t    main, aux, blocks;
+  int32_t     sample_number, oldest = -1;
+  uint32_t    trigger_at = TEST_MODEL_SAMPLES / 20;
+  uint32_t    i;
+
+  Make_Model_Stream(TEST_MODEL_SAMPLES / 10);
+  Logic_Analyzer_Pre_Trigger_Samples = LOGIC_ANALYZER_BUFFER_SIZE / 2;
+  Capture(LOGIC_ANALYZER_BUFFER_SIZE);                          //  Just to set up the buffer, the ring is restarted below
+  Logic_Analyzer_Select_Buffer();
+  Logic_Analyzer_Data_index = 0;
+  Logic_Analyzer_State = ANALYZER_ACQUIRING;
+  blocks = Logic_Analyzer_Post_Trigger_Blocks();
+  TEST_ASSERT_GREATER_THAN_UINT32(0, blocks);
+  for (i = 0 ; (i < Stream.size()) && (Logic_Analyzer_State == ANALYZER_ACQUIRING) ; i++)
+  {
+    if (i == trigger_at)
+    {
+      Logic_Analyzer_Triggered = true;
+      Logic_Analyzer_Index_of_Trigger = Logic_Analyzer_Data_index;
+      Logic_Analyzer_Samples_Till_Done = blocks;
+    }
+    Logic_Analyzer_main_sample = Stream[i].main;
+    Logic_Analyzer_aux_sample  = Stream[i].aux;
+    Logic_Analyzer_Compress_Sample();
+  }
+  TEST_ASSERT_EQUAL(ANALYZER_ACQUISITION_DONE, Logic_Analyzer_State);
+  TEST_ASSERT_TRUE(Logic_Analyzer_Decode_First());
+  TEST_ASSERT_TRUE(Logic_Analyzer_Decode_Next(&main, &aux, &sample_number));
+  oldest = sample_number;
+  TEST_ASSERT_TRUE(oldest >= 0);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(trigger_at, (uint32_t)oldest);
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  Logic_Analyzer_Pre_Trigger_Samples = 0;
+}
+
+void setUp(void)
+{
+  external_psram_size = 16;
+  Logic_Analyzer_State = ANALYZER_IDLE;
+}
+
+void tearDown(void)
+{
+  external_psram_size = 8;
+  Logic_Analyzer_Compressed = false;
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_model_stream_round_trip_and_ratio);
+  RUN_TEST(test_random_stream_round_trip);
+  RUN_TEST(test_wrapped_ring_keeps_the_newest_samples);
+  RUN_TEST(test_post_trigger_blocks_keep_the_trigger);
+  return UNITY_END();
+}
@@ -0,0 +1,319 @@
+//
+//      11/26/2020      la_decode, the host side Capricorn trace decoder (tools/la_decode)
+//
+//  Captures are built here the way the firmware writes them: "la dump" frames (EBTKS_LA_Export.cpp) and flight
+//  recorder files (EBTKS_Flight_Recorder.cpp), from samples laid out as onPhi_1_Rise() does. They go through
+//  LA_Decode_Buffer(), and the text it writes is checked for the instructions, operands, I/O register names,
+//  DMA and interrupt annotations, the trigger, and the cycles per instruction table.
+//
+//  A 1M sample capture (5 MB as a "la dump") is timed, and must decode, text and all, in under a second.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Inc_Common_Headers.h"
+#include "LA_Decode_File.h"
+
+#define CTRL_IDLE                     (7)                 //  /WR /RD /LMA as in bits 26..24 of the sample, all active low
+#define CTRL_LMA                      (6)
+#define CTRL_RD                       (5)
+#define CTRL_WR                       (3)
+#define CTRL_INT_ACK                  (0)
+
+#define TEST_FRAME_SAMPLES            (64)                //  LA_EXPORT_FRAME_SAMPLES in EBTKS_LA_Export.cpp
+#define TEST_BIG_SAMPLES              (1000000)
+#define TEST_MAX_SECONDS              (1.0)
+
+struct S_Sample
+{
+  uint32_t    main;
+  uint32_t    aux;
+};
+
+static std::vector<struct S_Sample>   Samples;
+static std::vector<uint8_t>           File_Data;
+static std::string                    Text;
+
+static void Cycle(uint32_t ctrl, uint32_t address, uint8_t data, bool ifetch = false, uint32_t rselec = 0361)
+{
+  Samples.push_back({(ifetch ? LA_SAMPLE_IFETCH : 0) | (ctrl << 24) | ((address & 0xFFFFU) << 8) | data, rselec});
+}
+
+static void DMA_Cycle(uint32_t tag, uint32_t address, uint8_t data)
+{
+  Samples.push_back({tag | ((address & 0xFFFFU) << 8) | data, 0361});
+}
+
+static void Put_LE(std::vector<uint8_t> &v, uint32_t value, int bytes)
+{
+  while (bytes--)
+  {
+    v.push_back(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+static void Frame(char type, const std::vector<uint8_t> &payload)
+{
+  uint8_t     sum;
+
+  File_Data.push_back(0xA5);
+  File_Data.push_back(0x5A);
+  File_Data.push_back(type);
+  Put_LE(File_Data, payload.size(), 2);
+  File_Data.insert(File_Data.end(), payload.begin(), payload.end());
+  sum = type + (payload.size() & 0xFF) + (payload.size() >> 8);
+  for (uint8_t b : payload)
+  {
+    sum += b;
+  }
+  File_Data.push_back(-sum);
+}
+
+//
+//  Samples as a "la dump" stream, with sample numbers relative to trigger_index (or from 0 with no trigger)
+//
+
+static void Make_Dump(int32_t trigger_index)
+{
+  std::vector<uint8_t>    payload;
+  size_t                  i, j;
+
+  for (i = 0 ; i < Samples.size() ; i += TEST_FRAME_SAMPLES)
+  {
+    payload.clear();
+    Put_LE(payload, (uint32_t)((int32_t)i - (trigger_index >= 0 ? trigger_index : 0)), 4);
+    for (j = i ; (j < i + TEST_FRAME_SAMPLES) && (j < Samples.size()) ; j++)
+    {
+      Put_LE(payload, Samples[j].main, 4);
+      payload.push_back(Samples[j].aux);
+    }
+    Frame('S', payload);
+  }
+  payload.clear();
+  Put_LE(payload, Samples.size(), 4);
+  payload.push_back(trigger_index >= 0 ? 0x01 : 0x00);
+  Frame('E', payload);
+}
+
+static void Decode(struct S_LA_Decode_Result *result)
+{
+  FILE        *out = tmpfile();
+  long        length;
+
+  TEST_ASSERT_NOT_NULL(out);
+  LA_Decode_Out = out;
+  TEST_ASSERT_TRUE(LA_Decode_Buffer(File_Data.data(), File_Data.size(), result));
+  LA_Decode_Out = NULL;
+  length = ftell(out);
+  Text.resize(length);
+  rewind(out);
+  TEST_ASSERT_EQUAL_INT(length, fread(&Text[0], 1, length, out));
+  fclose(out);
+}
+
+static void Expect(const char *what)
+{
+  char        msg[120];
+
+  snprintf(msg, sizeof(msg), "Expected \"%s\" in the decoded text", what);
+  TEST_ASSERT_TRUE_MESSAGE(Text.find(what) != std::string::npos, msg);
+}
+
+//
+//  A few instructions in ROM 361, at 070104:
+//      LDB R32,=040, then LDBD R32,=KEYSTS which reads KEYSTS       (a 2 byte and a 3 byte literal form)
+//      JSB =012345 with 3 DMA cycles stealing the bus, then an interrupt acknowledge with vector 010
+//      JNZ -4 from 070115, the trigger
+//
+
+static void Small_Program(void)
+{
+  Samples.clear();
+  File_Data.clear();
+  Cycle(CTRL_IDLE, 070077, 0);                            //  Skipped, before the first opcode fetch
+  Cycle(CTRL_RD, 070104, 0250, true);                     //  LDB DR,=
+  Cycle(CTRL_RD, 070105, 040);
+  Cycle(CTRL_RD, 070106, 0260, true);                     //  LDBD DR,=
+  Cycle(CTRL_RD, 070107, 002);
+  Cycle(CTRL_RD, 070110, 0377);
+  Cycle(CTRL_LMA, 070110, 002);
+  Cycle(CTRL_LMA, 070110, 0377);
+  Cycle(CTRL_RD, 0177402, 040);                           //  KEYSTS
+  Cycle(CTRL_RD, 070111, 0316, true);                     //  JSB =
+  Cycle(CTRL_RD, 070112, 0345);
+  DMA_Cycle(LA_SAMPLE_DMA_LMA, 0100000, 0200);
+  DMA_Cycle(LA_SAMPLE_DMA_LMA, 0100000, 0000);
+  DMA_Cycle(LA_SAMPLE_DMA_READ, 0100000, 0123);
+  Cycle(CTRL_RD, 070113, 0024);
+  Cycle(CTRL_WR, 0177000, 0114);                          //  Return address pushed
+  Cycle(CTRL_INT_ACK, 070113, 010);
+  Cycle(CTRL_RD, 070115, 0366, true);                     //  JNZ, the trigger
+  Cycle(CTRL_RD, 070116, 0374);
+  Cycle(CTRL_IDLE, 070117, 0);
+  Cycle(CTRL_RD, 070114, 0250, true);
+}
+
+void test_dump_decodes_instructions_and_annotations(void)
+{
+  struct S_LA_Decode_Result   result;
+
+  Small_Program();
+  Make_Dump(17);                                          //  The JNZ fetch
+  Decode(&result);
+  TEST_MESSAGE(Text.c_str());
+  TEST_ASSERT_FALSE(result.flight_recorder);
+  TEST_ASSERT_TRUE(result.ended);
+  TEST_ASSERT_TRUE(result.triggered);
+  TEST_ASSERT_EQUAL_UINT32(Samples.size(), result.samples);
+
+  Expect("361:070104");
+  Expect("LDB DR,=");
+  Expect("LDBD DR,=");
+  Expect("R 177402 KEYSTS 040");
+  Expect("JSB =012345");
+  Expect("DMA 3 cycles");
+  Expect("INTERRUPT vector 010");
+  Expect("W 177000 114");
+  Expect("JNZ 070113");
+  Expect("<-- Trigger");
+  Expect("      -8  361:070111    5  316 345 024      JSB =012345      W 177000 114 DMA 3 cycles INTERRUPT vector 010\n");
+  Expect("       0  361:070115    3  366 374          JNZ 070113         <-- Trigger");
+  Expect("5 instructions, 17 bus cycles");                 //  The last one is its opcode fetch alone
+  Expect("  250   LDB DR,=                2           3   1.50");
+}
+
+void test_dump_skips_noise_and_bad_frames(void)
+{
+  struct S_LA_Decode_Result   result;
+  std::vector<uint8_t>        stream;
+  const char                  *echo = "la dump\r\n";
+
+  Small_Program();
+  while (Samples.size() < 3 * TEST_FRAME_SAMPLES)
+  {
+    Samples.push_back(Samples[Samples.size() % 21]);
+  }
+  Make_Dump(-1);
+  stream.assign(echo, echo + strlen(echo));               //  The command echo comes first
+  stream.insert(stream.end(), File_Data.begin(), File_Data.end());
+  stream[strlen(echo) + 20] ^= 0x10;                      //  A bit error in the first of 4 frames
+  File_Data = stream;
+  Decode(&result);
+  TEST_ASSERT_EQUAL_UINT32(1, result.bad_frames);
+  TEST_ASSERT_EQUAL_UINT32(Samples.size() - TEST_FRAME_SAMPLES, result.samples);
+  TEST_ASSERT_TRUE(result.ended);
+  TEST_ASSERT_FALSE(result.triggered);
+  TEST_ASSERT_TRUE(Text.find("<-- Trigger") == std::string::npos);
+}
+
+//
+//  The same program as a flight recorder file, with a drop marker and an RSELEC change
+//
+
+void test_flight_recorder_file(void)
+{
+  struct S_LA_Decode_Result   result;
+  char                        header[512];
+  size_t                      i;
+
+  Small_Program();
+  memset(header, 0, sizeof(header));
+  snprintf(header, sizeof(header), "EBTKS flight recorder\r\nFormat 2, 32 bit little endian words after this 512 byte header.\r\n");
+  File_Data.assign(header, header + sizeof(header));
+  Put_LE(File_Data, 0x80000000U | 0361, 4);
+  for (i = 0 ; i < Samples.size() ; i++)
+  {
+    if (i == 9)
+    {
+      Put_LE(File_Data, 0x40000000U | 5, 4);              //  5 cycles dropped
+      Put_LE(File_Data, 0x80000000U | 0362, 4);
+    }
+    Put_LE(File_Data, Samples[i].main, 4);
+  }
+  Decode(&result);
+  TEST_ASSERT_TRUE(result.flight_recorder);
+  TEST_ASSERT_EQUAL_UINT32(Samples.size(), result.samples);
+  TEST_ASSERT_EQUAL_UINT32(5, result.dropped);
+  Expect("361:070104");
+  Expect("362:070111");                                   //  After the RSELEC marker
+  Expect("      14  362:070111");                         //  Sample 9, numbered after the 5 dropped
+}
+
+//
+//  A long capture from a simple model: opcode fetches with 0 to 2 operand bytes, now and then an idle cycle or a
+//  read or write elsewhere, and the odd DMA burst. Timed from the file in memory to the decoded text in a file
+//
+
+void test_big_capture_decodes_in_well_under_a_second(void)
+{
+  struct S_LA_Decode_Result   result;
+  uint32_t                    random = 1, pc = 060000, i, operands;
+  char                        msg[120];
+
+  Samples.clear();
+  File_Data.clear();
+  Samples.reserve(TEST_BIG_SAMPLES + 8);
+  while (Samples.size() < TEST_BIG_SAMPLES)
+  {
+    random = random * 1103515245U + 12345U;
+    Cycle(CTRL_RD, pc++, (random >> 16) & 0xFF, true);
+    operands = (random >> 8) % 3;
+    for (i = 0 ; i < operands ; i++)
+    {
+      Cycle(CTRL_RD, pc++, random >> 24);
+    }
+    switch ((random >> 4) & 7)
+    {
+      case 0:   Cycle(CTRL_IDLE, pc, 0);                                      break;
+      case 1:   Cycle(CTRL_RD, 0177400 + (random & 077), random >> 20);        break;
+      case 2:   Cycle(CTRL_WR, 0100000 + (random & 07777), random >> 20);      break;
+      case 3:   if ((random & 0x300) == 0)
+                {
+                  DMA_Cycle(LA_SAMPLE_DMA_READ, 0100000, random >> 12);
+                }
+                break;
+    }
+    if (pc >= 0100000)
+    {
+      pc = 060000;
+    }
+  }
+  Make_Dump(-1);
+
+  auto start = std::chrono::steady_clock::now();
+  Decode(&result);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  snprintf(msg, sizeof(msg), "%u samples, %lu KB \"la dump\", %lu KB of text, in %.3f s", result.samples,
+           (unsigned long)(File_Data.size() / 1024), (unsigned long)(Text.size() / 1024), seconds);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(Samples.size(), result.samples);
+  TEST_ASSERT_TRUE(seconds < TEST_MAX_SECONDS);
+}
+
+void setUp(void)
+{
+  Native_Serial_Quiet = true;                             //  Capricorn_Trace_Summary() is not used here
+}
+
+void tearDown(void)
+{
+  Native_Serial_Quiet = false;
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_dump_decodes_instructions_and_annotations);
+  RUN_TEST(test_dump_skips_noise_and_bad_frames);
+  RUN_TEST(test_flight_recorder_file);
+  RUN_TEST(test_big_capture_decodes_in_well_under_a_second);
+  return UNITY_END();
+}
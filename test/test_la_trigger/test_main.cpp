@@ -0,0 +1,334 @@
+//
+//      11/26/2020      Logic Analyzer multi-stage sequential trigger
+//
+//  Logic_Analyzer_Trigger_Check() is fed samples the way Logic_Analyzer_Capture() does (check, then count the
+//  cycle in Logic_Analyzer_Valid_Samples). Stage 1 comes from the "la setup" globals, and stages 2 and on are
+//  entered through "la stages" itself, with the serial input scripted by the test's wait_for_serial_string() in
+//  place of the weak stub. The tests cover the occurrence counts, the window at its exact boundary, the reset
+//  pattern, which of them wins on the same cycle, and that one cycle can't complete two stages.
+//
+//  The bench at the end times the check per cycle with 1 and with LA_TRIGGER_MAX_STAGES stages, waiting in the
+//  last stage, to show the cost does not grow with the number of stages. Host time, so only the ratio carries over.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+
+#include "Inc_Common_Headers.h"
+
+#define TEST_BENCH_CYCLES             (4000000)
+
+#define CTRL_IDLE                     (7)               //  /WR /RD /LMA as in bits 26..24 of the sample, all active low
+#define CTRL_RD                       (5)
+#define CTRL_WR                       (3)
+
+#define SAMPLE(ctrl, addr, data)      (((uint32_t)(ctrl) << 24) | ((uint32_t)(addr) << 8) | (data))
+#define ADDR_MASK                     (0x00FFFF00U)
+#define CTRL_MASK                     (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA)
+
+//
+//  Serial input for "la stages", one line per prompt. NULL ends it, as a Ctrl-C would
+//
+
+static const char * const   *Script;
+
+bool wait_for_serial_string(void)
+{
+  if ((Script == NULL) || (*Script == NULL))
+  {
+    return false;
+  }
+  strcpy(serial_string, *Script++);
+  return true;
+}
+
+void serial_string_used(void)
+{
+  serial_string[0] = 0;
+}
+
+static void Run_Stages_Command(const char * const *script)
+{
+  Script = script;
+  Logic_Analyzer_Stages_Command();
+  TEST_ASSERT_NULL(*Script);                                      //  Every line was used
+}
+
+//
+//  Stage 1, as "la setup" leaves it
+//
+
+static void Set_Stage_1(uint32_t ctrl, uint16_t addr, int32_t count)
+{
+  Logic_Analyzer_Trigger_Mask_1  = CTRL_MASK | ADDR_MASK;
+  Logic_Analyzer_Trigger_Value_1 = SAMPLE(ctrl, addr, 0);
+  Logic_Analyzer_Trigger_Mask_2  = 0;
+  Logic_Analyzer_Trigger_Value_2 = 0;
+  Logic_Analyzer_Event_Count_Init = count;
+}
+
+static bool Feed(uint32_t sample)
+{
+  bool        triggered;
+
+  Logic_Analyzer_main_sample = sample;
+  Logic_Analyzer_aux_sample  = 0;
+  triggered = Logic_Analyzer_Trigger_Check();
+  Logic_Analyzer_Valid_Samples++;
+  return triggered;
+}
+
+static bool Feed_Idle(uint32_t cycles)
+{
+  bool        triggered = false;
+
+  while (cycles--)
+  {
+    triggered |= Feed(SAMPLE(CTRL_IDLE, 0, 0));
+  }
+  return triggered;
+}
+
+//
+//  "Write to 0177740 followed by a read of 0177741 within 200 cycles", from the request
+//
+
+static const char * const Script_Write_Then_Read[] =
+{
+  "2",
+  "101 177741 177777 000 000 1 200",                              //  Stage 2: read of 0177741, once, within 200 cycles
+  "none",
+  NULL
+};
+
+void test_single_stage_event_count(void)
+{
+  Set_Stage_1(CTRL_WR, 0177740, 3);
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 1)));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177740, 2)));           //  Wrong cycle type
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177741, 3)));           //  Wrong address
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 4)));
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_WR, 0177740, 5)));            //  Third match
+}
+
+void test_window_boundary(void)
+{
+  Set_Stage_1(CTRL_WR, 0177740, 1);
+  Run_Stages_Command(Script_Write_Then_Read);
+
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_EQUAL_UINT32(2, Logic_Analyzer_Trigger_Stage());
+  TEST_ASSERT_FALSE(Feed_Idle(199));
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));            //  200 cycles after the write, just in time
+
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_FALSE(Feed_Idle(200));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));           //  201 cycles, too late
+  TEST_ASSERT_EQUAL_UINT32(1, Logic_Analyzer_Trigger_Stage());
+
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));           //  And it starts over
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));
+}
+
+void test_reset_pattern(void)
+{
+  static const char * const script[] =
+  {
+    "2",
+    "101 177741 177777 000 000 2 0",                              //  Stage 2: 2 reads of 0177741, no window
+    "x1x 177742 177777",                                          //  Reset on anything but a read at 0177742
+    NULL
+  };
+
+  Set_Stage_1(CTRL_WR, 0177740, 1);
+  Run_Stages_Command(script);
+  Logic_Analyzer_Trigger_Compile();
+
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177742, 0)));           //  A read, /RD is low, so no reset
+  TEST_ASSERT_EQUAL_UINT32(2, Logic_Analyzer_Trigger_Stage());
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177742, 0)));           //  Reset
+  TEST_ASSERT_EQUAL_UINT32(1, Logic_Analyzer_Trigger_Stage());
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));           //  Stage 1 again, so this doesn't count
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));            //  The count restarted with the stage
+}
+
+//
+//  A reset pattern that is also the stage's own pattern: the reset wins. So does an expired window
+//
+
+void test_reset_and_window_win_over_a_match(void)
+{
+  static const char * const script[] =
+  {
+    "2",
+    "101 177741 177777 000 000 1 5",
+    "101 177741 177777",
+    NULL
+  };
+  static const char * const script_window[] =
+  {
+    "2",
+    "101 177741 177777 000 000 1 5",
+    "none",
+    NULL
+  };
+
+  Set_Stage_1(CTRL_WR, 0177740, 1);
+  Run_Stages_Command(script);
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));
+  TEST_ASSERT_EQUAL_UINT32(1, Logic_Analyzer_Trigger_Stage());
+
+  Run_Stages_Command(script_window);
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_FALSE(Feed_Idle(5));
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));           //  Matches, but one cycle past the window
+  TEST_ASSERT_EQUAL_UINT32(1, Logic_Analyzer_Trigger_Stage());
+}
+
+//
+//  Moving to the next stage uses up the cycle. 4 stages with the same pattern need 4 matching cycles
+//
+
+void test_one_cycle_completes_one_stage(void)
+{
+  static const char * const script[] =
+  {
+    "4",
+    "011 177740 177777 000 000 1 0", "none",
+    "011 177740 177777 000 000 1 0", "none",
+    "011 177740 177777 000 000 1 0", "none",
+    NULL
+  };
+  uint32_t    i;
+
+  Set_Stage_1(CTRL_WR, 0177740, 1);
+  Run_Stages_Command(script);
+  Logic_Analyzer_Trigger_Compile();
+  for (i = 1 ; i < LA_TRIGGER_MAX_STAGES ; i++)
+  {
+    TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+    TEST_ASSERT_EQUAL_UINT32(i + 1, Logic_Analyzer_Trigger_Stage());
+  }
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+}
+
+//
+//  Bad input is asked for again, and a Ctrl-C part way leaves the number of stages as it was
+//
+
+void test_stages_command_input(void)
+{
+  static const char * const script_bad[] =
+  {
+    "5",                                                          //  More than LA_TRIGGER_MAX_STAGES
+    "2",
+    "1z1 177741 177777 000 000 1 200",                            //  Bad cycle pattern
+    "101 177741 177777 000 000 0 200",                            //  Count must be at least 1
+    "101 177741 177777 000 000 1 200",
+    "none",
+    NULL
+  };
+  static const char * const script_abort[] =
+  {
+    "3",
+    "101 177741 177777 000 000 1 200",
+    NULL                                                          //  Ctrl-C at the reset prompt
+  };
+
+  Set_Stage_1(CTRL_WR, 0177740, 1);
+  Run_Stages_Command(script_bad);
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));
+
+  Run_Stages_Command(script_abort);
+  Logic_Analyzer_Trigger_Compile();
+  TEST_ASSERT_FALSE(Feed(SAMPLE(CTRL_WR, 0177740, 0)));
+  TEST_ASSERT_TRUE(Feed(SAMPLE(CTRL_RD, 0177741, 0)));            //  Still 2 stages
+}
+
+//
+//  Waiting in the last stage, with nothing matching, is the per cycle cost while armed
+//
+
+static double Bench_Check(const char * const *script)
+{
+  uint32_t    i;
+  bool        (*volatile check)(void) = &Logic_Analyzer_Trigger_Check;
+
+  Set_Stage_1(CTRL_WR, 0177740, 1);
+  Run_Stages_Command(script);
+  Logic_Analyzer_Trigger_Compile();
+  while (Logic_Analyzer_Trigger_Stage() < (uint32_t)atoi(script[0]))
+  {
+    Feed(SAMPLE(CTRL_WR, 0177740, 0));
+  }
+  Logic_Analyzer_main_sample = SAMPLE(CTRL_RD, 0100000, 0);
+  auto start = std::chrono::steady_clock::now();
+  for (i = 0 ; i < TEST_BENCH_CYCLES ; i++)
+  {
+    check();
+    Logic_Analyzer_Valid_Samples++;
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / TEST_BENCH_CYCLES;
+}
+
+void test_bench_cost_per_cycle(void)
+{
+  static const char * const script_1[] = {"1", NULL};
+  static const char * const script_4[] =
+  {
+    "4",
+    "011 177740 177777 000 000 1 0", "none",
+    "011 177740 177777 000 000 1 0", "none",
+    "011 177741 177777 000 000 1 0", "011 177777 177777",
+    NULL
+  };
+  double      ns_1, ns_4;
+  char        msg[100];
+
+  ns_1 = Bench_Check(script_1);
+  ns_4 = Bench_Check(script_4);
+  snprintf(msg, sizeof(msg), "Trigger check per cycle: 1 stage %.1f ns, %d stages %.1f ns (host)", ns_1, LA_TRIGGER_MAX_STAGES, ns_4);
+  TEST_MESSAGE(msg);
+}
+
+void setUp(void)
+{
+  static const char * const script_1[] = {"1", NULL};
+
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  Logic_Analyzer_Valid_Samples = 0;
+  Run_Stages_Command(script_1);
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_single_stage_event_count);
+  RUN_TEST(test_window_boundary);
+  RUN_TEST(test_reset_pattern);
+  RUN_TEST(test_reset_and_window_win_over_a_match);
+  RUN_TEST(test_one_cycle_completes_one_stage);
+  RUN_TEST(test_stages_command_input);
+  RUN_TEST(test_bench_cost_per_cycle);
+  return UNITY_END();
+}
@@ -0,0 +1,452 @@
+//
+//      11/26/2020      Page descriptor table address decode, checked against the if-chain it replaced
+//
+//  onReadData() and onWriteData() used to decode the bus address with a chain of range tests (readBankRom() for
+//  the ROM area, then the 16K RAM module, then the I/O page). That chain is copied below as the reference, exactly
+//  as it was before Page_Table[], and every one of the 65536 addresses is read and written through both, for each
+//  combination of 16K RAM enable and kind of ROM selected. The result, readData, the memory written, and the I/O
+//  handlers called must all match.
+//
+//  The bench at the end times both decodes for each kind of bus cycle. It runs on the PC, so the ns are only good
+//  for comparing the two, not for the Teensy. Run with "pio test -e native -f test_page_table -v" to see them.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+#include <chrono>
+#include <vector>
+
+#include "Inc_Common_Headers.h"
+#include "Native_IRQ.h"
+
+bool Native_onReadData(uint16_t addr);                  //  In EBTKS_Bus_Interface_ISR.cpp
+void Native_onWriteData(uint16_t addr, uint8_t data);
+void ioWriteRSELEC(uint8_t val);                        //  In EBTKS_Bank_Switched_ROM.cpp
+
+extern ioReadFuncPtr_t ioReadFuncs[256];
+
+extern volatile uint8_t rselec;
+extern uint8_t *currRom;
+extern uint8_t *romMap[256];
+extern bool enRam16k;
+
+#define TEST_ROM_ID                   (0320)            //  A normal ROM that is loaded
+#define TEST_ROM_ID_MISSING           (0321)            //  Selected, but not loaded
+#define TEST_AUXROM_SECONDARY_ID      (AUXROM_PRIMARY_ID + 1)
+#define TEST_IO_READ_ADDR             (0177500 & 0xFF)  //  The only I/O register that answers a read
+#define TEST_IO_READ_DATA             (0x5A)
+
+//
+//  The reference: onReadData(), readBankRom() and onWriteData() before the page descriptor table
+//
+
+static std::vector<uint8_t>   Ref_IO_Writes;            //  Data for each I/O write handler call the reference would make
+
+static bool Ref_readBankRom(uint16_t addr)
+{
+  if ((rselec >= AUXROM_PRIMARY_ID) && (rselec <= AUXROM_SECONDARY_ID_END))
+  {
+    if ((addr >= AUXROM_RAM_WINDOW_START) && (addr <= AUXROM_RAM_WINDOW_LAST))
+    {
+      readData = AUXROM_RAM_Window.as_bytes[addr - AUXROM_RAM_WINDOW_START];
+      return true;
+    }
+  }
+  if (currRom)
+  {
+    readData = currRom[addr];
+    return true;
+  }
+  return false;
+}
+
+__attribute__((noinline)) static bool Ref_onReadData(uint16_t Current_Read_Address)
+{
+  if ((Current_Read_Address & 0xE000) == ROM_PAGE)
+  {
+    return Ref_readBankRom(Current_Read_Address & (ROM_PAGE_SIZE - 1));
+  }
+  if (enRam16k)
+  {
+    if ((Current_Read_Address >= HP85A_16K_RAM_module_base_addr) && (Current_Read_Address < IO_ADDR))
+    {
+      readData = HP85A_16K_RAM_module[Current_Read_Address & 0x3FFF];
+      return true;
+    }
+  }
+  if ((Current_Read_Address & 0xFF00U) == 0xFF00U)
+  {
+    return (ioReadFuncs[Current_Read_Address & 0x00FFU])();
+  }
+  return false;
+}
+
+//
+//  The I/O write is recorded rather than made, as the same handlers are behind both decodes
+//
+
+__attribute__((noinline)) static void Ref_onWriteData(uint16_t addr, uint8_t data, uint8_t ram[], uint8_t window[])
+{
+  if ((addr & 0xFF00U) == 0xFF00U)
+  {
+    Ref_IO_Writes.push_back(data);
+    return;
+  }
+  if (enRam16k)
+  {
+    if ((addr >= HP85A_16K_RAM_module_base_addr) && (addr < IO_ADDR))
+    {
+      ram[addr & 0x3FFFU] = data;
+      return;
+    }
+  }
+  if ((getRselec() >= AUXROM_PRIMARY_ID) && (getRselec() <= AUXROM_SECONDARY_ID_END))
+  {
+    if ((addr >= (AUXROM_RAM_WINDOW_START + 060000)) && (addr <= (AUXROM_RAM_WINDOW_LAST + 060000)))
+    {
+      window[addr - AUXROM_RAM_WINDOW_START - 060000] = data;
+      return;
+    }
+  }
+}
+
+//
+//  I/O handlers for the test
+//
+
+static std::vector<uint8_t>   IO_Writes;                //  Data for each I/O write handler call that was made
+static uint32_t               IO_Reads;
+
+static bool Test_IO_Read(void)
+{
+  IO_Reads++;
+  readData = TEST_IO_READ_DATA;
+  return true;
+}
+
+static bool Test_IO_Read_Nothing(void)
+{
+  IO_Reads++;
+  return false;
+}
+
+static void Test_IO_Write(uint8_t val)
+{
+  IO_Writes.push_back(val);
+}
+
+//
+//  Everything back to power up, with ROMs, RAM and the window filled with patterns that differ from each other
+//
+
+static void Test_Setup(bool ram16k, uint8_t rom_id)
+{
+  uint32_t    i;
+
+  memset(romMap, 0, sizeof(romMap));
+  currRom = NULL;
+  rselec  = 0;
+  enRam16k = false;
+  initIOfuncTable();
+  initRoms();
+  for (i = 0 ; i < 256 ; i++)
+  {
+    setIOReadFunc(i, &Test_IO_Read_Nothing);
+    setIOWriteFunc(i, &Test_IO_Write);                  //  Includes RSELEC, so the sweep doesn't change the ROM
+  }
+  setIOReadFunc(TEST_IO_READ_ADDR, &Test_IO_Read);
+
+  for (i = 0 ; i < ROM_PAGE_SIZE ; i++)
+  {
+    getRomSlotPtr(0)[i] = i * 3;
+    getRomSlotPtr(1)[i] = i * 5 + 1;
+    getRomSlotPtr(2)[i] = i * 7 + 2;
+  }
+  setRomMap(TEST_ROM_ID, 0);
+  setRomMap(AUXROM_PRIMARY_ID, 1);
+  setRomMap(TEST_AUXROM_SECONDARY_ID, 2);
+  for (i = 0 ; i < sizeof(AUXROM_RAM_Window.as_bytes) ; i++)
+  {
+    AUXROM_RAM_Window.as_bytes[i] = i * 11 + 3;
+  }
+  for (i = 0 ; i < EXP_RAM_SIZE ; i++)
+  {
+    HP85A_16K_RAM_module[i] = i * 13 + 4;
+  }
+
+  enHP85RamExp(ram16k);
+  ioWriteRSELEC(rom_id);                                //  As the HP85 does it, the ROM pages are now stale
+  TEST_ASSERT_TRUE(Rom_Page_Table_Stale);
+  buildRomPageTable();                                  //  As onPhi_2_Rise() does before the next read
+  IO_Writes.clear();
+  Ref_IO_Writes.clear();
+  IO_Reads = 0;
+}
+
+static void Test_Reads(bool ram16k, uint8_t rom_id)
+{
+  uint32_t    addr, io_reads, ref_io_reads;
+  bool        ours, ref_ours;
+  uint8_t     data, ref_data;
+  char        msg[80];
+
+  Test_Setup(ram16k, rom_id);
+  for (addr = 0 ; addr < 0x10000 ; addr++)
+  {
+    io_reads = IO_Reads;
+    readData = 0xA5;
+    ref_ours = Ref_onReadData(addr);
+    ref_data = readData;
+    ref_io_reads = IO_Reads - io_reads;
+
+    io_reads = IO_Reads;
+    readData = 0xA5;
+    ours = Native_onReadData(addr);
+    data = readData;
+    io_reads = IO_Reads - io_reads;
+
+    snprintf(msg, sizeof(msg), "Read %06o, 16K RAM %d, RSELEC %03o", addr, ram16k, rom_id);
+    TEST_ASSERT_EQUAL_MESSAGE(ref_ours, ours, msg);
+    TEST_ASSERT_EQUAL_MESSAGE(ref_io_reads, io_reads, msg);          //  The same I/O read handler calls
+    if (ours)
+    {
+      TEST_ASSERT_EQUAL_HEX8_MESSAGE(ref_data, data, msg);
+    }
+  }
+}
+
+static void Test_Writes(bool ram16k, uint8_t rom_id)
+{
+  uint32_t    addr;
+  uint8_t     data;
+  static uint8_t  ref_ram[EXP_RAM_SIZE], ref_window[sizeof(AUXROM_RAM_Window.as_bytes)];
+  char        msg[80];
+
+  Test_Setup(ram16k, rom_id);
+  memcpy(ref_ram, HP85A_16K_RAM_module, sizeof(ref_ram));
+  memcpy(ref_window, AUXROM_RAM_Window.as_bytes, sizeof(ref_window));
+  for (addr = 0 ; addr < 0x10000 ; addr++)
+  {
+    data = (addr * 7) ^ (addr >> 8) ^ 0x3C;
+    Ref_onWriteData(addr, data, ref_ram, ref_window);
+    Native_onWriteData(addr, data);
+  }
+  snprintf(msg, sizeof(msg), "16K RAM %d, RSELEC %03o", ram16k, rom_id);
+  TEST_ASSERT_EQUAL_MESSAGE(0, memcmp(ref_ram, HP85A_16K_RAM_module, sizeof(ref_ram)), msg);
+  TEST_ASSERT_EQUAL_MESSAGE(0, memcmp(ref_window, AUXROM_RAM_Window.as_bytes, sizeof(ref_window)), msg);
+  TEST_ASSERT_EQUAL_MESSAGE(Ref_IO_Writes.size(), IO_Writes.size(), msg);
+  TEST_ASSERT_TRUE_MESSAGE(Ref_IO_Writes == IO_Writes, msg);
+}
+
+static const uint8_t Test_Rom_Ids[] =
+{
+  TEST_ROM_ID, TEST_ROM_ID_MISSING, AUXROM_PRIMARY_ID, TEST_AUXROM_SECONDARY_ID, AUXROM_SECONDARY_ID_END
+};
+
+void test_reads_match_if_chain(void)
+{
+  for (uint32_t ram16k = 0 ; ram16k < 2 ; ram16k++)
+  {
+    for (uint32_t i = 0 ; i < sizeof(Test_Rom_Ids) ; i++)
+    {
+      Test_Reads(ram16k, Test_Rom_Ids[i]);
+    }
+  }
+}
+
+void test_writes_match_if_chain(void)
+{
+  for (uint32_t ram16k = 0 ; ram16k < 2 ; ram16k++)
+  {
+    for (uint32_t i = 0 ; i < sizeof(Test_Rom_Ids) ; i++)
+    {
+      Test_Writes(ram16k, Test_Rom_Ids[i]);
+    }
+  }
+}
+
+//
+//  The ROM pages follow RSELEC from one selection to the next, not just from power up
+//
+
+void test_rselec_changes_rebuild_rom_pages(void)
+{
+  uint32_t    i, addr;
+  uint8_t     ref_data;
+
+  Test_Setup(false, TEST_ROM_ID);
+  for (i = 0 ; i < sizeof(Test_Rom_Ids) * 4 ; i++)
+  {
+    ioWriteRSELEC(Test_Rom_Ids[(i * 3) % sizeof(Test_Rom_Ids)]);
+    buildRomPageTable();
+    for (addr = ROM_PAGE ; addr < ROM_PAGE + ROM_PAGE_SIZE ; addr += 37)
+    {
+      readData = 0xA5;
+      TEST_ASSERT_EQUAL(Ref_onReadData(addr), Native_onReadData(addr));
+      ref_data = readData;
+      Ref_onReadData(addr);
+      TEST_ASSERT_EQUAL_HEX8(readData, ref_data);
+    }
+  }
+}
+
+//
+//  The table changes under the running ISR: "shadow on" / "shadow off" and a 16K RAM enable from loadConfiguration().
+//  A timer signal stands in for the bus ISR, reading a ROM and a 16K RAM address, which must always be answered,
+//  and now and then rebuilding the ROM pages after an RSELEC write, as onPhi_2_Rise() does. A built-in DRAM page
+//  must never be marked as shadowed without a write_ptr, and the I/O page must stay the I/O page
+//
+
+#define TEST_CHANGE_ISR_RUNS          (20000)
+#define TEST_CHANGE_ISR_PERIOD_US     (5)
+#define TEST_CHANGE_DRAM_PAGE         (0100400 >> 8)
+
+static volatile uint32_t  Test_Change_Missed;
+static volatile uint32_t  Test_Change_Bad_Pages;
+
+static void Test_Change_ISR(void)
+{
+  struct S_Page_Descriptor  *page = &Page_Table[TEST_CHANGE_DRAM_PAGE];
+
+  if (!Native_onReadData(ROM_PAGE + 0x0123) || !Native_onReadData(HP85A_16K_RAM_module_base_addr + 0x0123))
+  {
+    Test_Change_Missed++;
+  }
+  if (((page->flags & PAGE_FLAG_DRAM_SHADOW) && !page->write_ptr) || !(Page_Table[IO_ADDR >> 8].flags & PAGE_FLAG_IO))
+  {
+    Test_Change_Bad_Pages++;
+  }
+  if ((Native_IRQ_Count() & 3) == 0)
+  {
+    ioWriteRSELEC(TEST_ROM_ID);
+    buildRomPageTable();
+  }
+}
+
+void test_table_changes_under_the_isr(void)
+{
+  uint32_t    i = 0;
+
+  Test_Setup(true, TEST_ROM_ID);
+  Test_Change_Missed    = 0;
+  Test_Change_Bad_Pages = 0;
+  Native_IRQ_Start(&Test_Change_ISR, TEST_CHANGE_ISR_PERIOD_US);
+  while (Native_IRQ_Count() < TEST_CHANGE_ISR_RUNS)
+  {
+    DRAM_Shadow_Enable(i & 1);
+    if ((i++ & 3) == 0)
+    {
+      enHP85RamExp(true);
+    }
+  }
+  Native_IRQ_Stop();
+  DRAM_Shadow_Enable(false);
+
+  TEST_ASSERT_EQUAL_UINT32(0, Test_Change_Missed);
+  TEST_ASSERT_EQUAL_UINT32(0, Test_Change_Bad_Pages);
+  TEST_ASSERT_TRUE(Page_Table[TEST_CHANGE_DRAM_PAGE].write_ptr == NULL);
+  TEST_ASSERT_EQUAL_UINT32(0, Page_Table[TEST_CHANGE_DRAM_PAGE].flags);
+}
+
+//
+//  Time both decodes for each kind of bus cycle, 256 addresses of the kind, round and round
+//
+
+#define BENCH_ROUNDS                  (1U << 21)
+
+struct S_Bench_Case
+{
+  const char  *name;
+  bool        write;
+  uint8_t     rom_id;
+  uint16_t    base;
+  uint16_t    step;                                     //  0 for a single I/O register
+};
+
+static const struct S_Bench_Case Bench_Cases[] =
+{
+  {"ROM read",                false, TEST_ROM_ID,       060000,                                 1},
+  {"AUXROM window read",      false, AUXROM_PRIMARY_ID, 060000 + AUXROM_RAM_WINDOW_START,       1},
+  {"16K RAM read",            false, TEST_ROM_ID,       HP85A_16K_RAM_module_base_addr,         1},
+  {"I/O read",                false, TEST_ROM_ID,       0177400 + TEST_IO_READ_ADDR,            0},
+  {"Not ours read",           false, TEST_ROM_ID,       0100000,                                1},
+  {"AUXROM window write",     true,  AUXROM_PRIMARY_ID, 060000 + AUXROM_RAM_WINDOW_START,       1},
+  {"16K RAM write",           true,  TEST_ROM_ID,       HP85A_16K_RAM_module_base_addr,         1},
+  {"I/O write",               true,  TEST_ROM_ID,       0177400 + TEST_IO_READ_ADDR,            0},
+  {"Not ours write",          true,  TEST_ROM_ID,       0100000,                                1}
+};
+
+static double Bench_Run(const struct S_Bench_Case *c, bool ref)
+{
+  static uint8_t  ref_ram[EXP_RAM_SIZE], ref_window[sizeof(AUXROM_RAM_Window.as_bytes)];
+  volatile uint32_t   sink = 0;
+  uint32_t        round;
+  uint16_t        addr;
+
+  auto start = std::chrono::steady_clock::now();
+  for (round = 0 ; round < BENCH_ROUNDS ; round++)
+  {
+    addr = c->base + (round & 0xFF) * c->step;
+    if (c->write)
+    {
+      if (ref)
+      {
+        Ref_onWriteData(addr, round, ref_ram, ref_window);
+      }
+      else
+      {
+        Native_onWriteData(addr, round);
+      }
+    }
+    else
+    {
+      sink += ref ? Ref_onReadData(addr) : Native_onReadData(addr);
+    }
+    if ((round & 0xFFFF) == 0)
+    {
+      IO_Writes.clear();
+      Ref_IO_Writes.clear();
+    }
+  }
+  auto stop = std::chrono::steady_clock::now();
+  (void)sink;
+  return std::chrono::duration<double, std::nano>(stop - start).count() / BENCH_ROUNDS;
+}
+
+void test_decode_bench(void)
+{
+  uint32_t    i;
+  double      before, after;
+
+  printf("\nAddress decode, host ns per bus cycle\n");
+  printf("Cycle                    If-chain  Page table\n");
+  for (i = 0 ; i < sizeof(Bench_Cases) / sizeof(Bench_Cases[0]) ; i++)
+  {
+    Test_Setup(true, Bench_Cases[i].rom_id);
+    before = Bench_Run(&Bench_Cases[i], true);
+    after  = Bench_Run(&Bench_Cases[i], false);
+    printf("%-22s  %8.2f  %8.2f\n", Bench_Cases[i].name, before, after);
+  }
+  printf("\n");
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_reads_match_if_chain);
+  RUN_TEST(test_writes_match_if_chain);
+  RUN_TEST(test_rselec_changes_rebuild_rom_pages);
+  RUN_TEST(test_table_changes_under_the_isr);
+  RUN_TEST(test_decode_bench);
+  return UNITY_END();
+}
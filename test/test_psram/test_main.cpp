@@ -0,0 +1,158 @@
+//
+//      11/26/2020      EXTMEM buffers against the PSRAM that is fitted
+//
+//  The linker places every EXTMEM variable from the start of the PSRAM, in whatever order it likes, so a buffer
+//  fits only if its end is within external_psram_size MB of that start. Here external_psram_size is changed around
+//  the end of the Logic Analyzer buffers, wherever they landed, and deep capture must be allowed exactly when both
+//  fit. The flight recorder's "fr start" and the event trace's "trace on" must refuse to start when their ring
+//  doesn't fit.
+//
+//  The PSRAM budget in EBTKS_Config.h is checked against what the linker actually placed: all the EXTMEM built
+//  here, plus the AUXROM SD services, must fit in PSRAM_BUDGET_KB (the directory listing buffers are built on the
+//  host, so they are counted twice). With a standard 8 MB chip every user must pass its own run time check.
+//
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "Inc_Common_Headers.h"
+
+extern "C" uint8_t external_psram_size;
+extern "C" char __stop_extmem[];                                  //  From the linker, see Arduino.h
+
+#define TEST_MB                       (1024 * 1024)
+
+//
+//  The end of the LA PSRAM buffers, as an offset from the start of the PSRAM. Found through the pointers that
+//  Logic_Analyzer_Select_Buffer() sets up for a deep capture
+//
+
+static uintptr_t LA_PSRAM_End(void)
+{
+  uintptr_t   end_1, end_2;
+
+  external_psram_size = 16;                                       //  Everything fits
+  Logic_Analyzer_Current_Buffer_Length = LOGIC_ANALYZER_PSRAM_SAMPLES;
+  Logic_Analyzer_Current_Index_Mask    = LOGIC_ANALYZER_PSRAM_SAMPLES - 1;
+  Logic_Analyzer_Select_Buffer();
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_PSRAM_SAMPLES, Logic_Analyzer_Current_Buffer_Length);
+  end_1 = (uintptr_t)&Logic_Analyzer_Data_1[LOGIC_ANALYZER_PSRAM_SAMPLES] - PSRAM_START_ADDRESS;
+  end_2 = (uintptr_t)&Logic_Analyzer_Data_2[LOGIC_ANALYZER_PSRAM_SAMPLES] - PSRAM_START_ADDRESS;
+  return (end_1 > end_2) ? end_1 : end_2;
+}
+
+void test_la_deep_capture_needs_both_buffers_in_psram(void)
+{
+  uintptr_t   end = LA_PSRAM_End();
+  uint32_t    mb_needed = (end + TEST_MB - 1) / TEST_MB;
+  char        msg[80];
+
+  snprintf(msg, sizeof(msg), "LA PSRAM buffers end %lu KB into the PSRAM", (unsigned long)(end / 1024));
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(16, mb_needed);
+
+  external_psram_size = mb_needed;
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_PSRAM_SAMPLES, Logic_Analyzer_Max_Buffer_Length());
+  external_psram_size = mb_needed - 1;
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_BUFFER_SIZE, Logic_Analyzer_Max_Buffer_Length());
+  external_psram_size = 0;                                        //  No PSRAM chip
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_BUFFER_SIZE, Logic_Analyzer_Max_Buffer_Length());
+}
+
+//
+//  "la setup" asked for a deep capture, but the PSRAM can't hold it. The internal buffers are used instead
+//
+
+void test_select_buffer_falls_back_to_internal(void)
+{
+  external_psram_size = 0;
+  Logic_Analyzer_Current_Buffer_Length = LOGIC_ANALYZER_PSRAM_SAMPLES;
+  Logic_Analyzer_Current_Index_Mask    = LOGIC_ANALYZER_PSRAM_SAMPLES - 1;
+  Logic_Analyzer_Select_Buffer();
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_BUFFER_SIZE, Logic_Analyzer_Current_Buffer_Length);
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_BUFFER_SIZE - 1, Logic_Analyzer_Current_Index_Mask);
+  TEST_ASSERT_FALSE(PSRAM_HOLDS(&Logic_Analyzer_Data_1[1]));
+}
+
+//
+//  "fr start" prompts for the file size once the ring is known to fit. Counting the prompts tells us if it did.
+//  Returning false is a Ctrl-C, so nothing is started
+//
+
+static uint32_t   Prompts;
+
+bool wait_for_serial_string(void)
+{
+  Prompts++;
+  return false;
+}
+
+void test_flight_recorder_needs_its_ring_in_psram(void)
+{
+  external_psram_size = 16;
+  Flight_Recorder_Start_Command();
+  TEST_ASSERT_EQUAL_UINT32(1, Prompts);
+  external_psram_size = 0;
+  Flight_Recorder_Start_Command();
+  TEST_ASSERT_EQUAL_UINT32(1, Prompts);                           //  Refused before the prompt
+}
+
+void test_event_trace_needs_its_ring_in_psram(void)
+{
+  Native_Serial_Quiet = true;
+  external_psram_size = 0;
+  Event_Trace_On_Command();
+  TEST_ASSERT_FALSE(Event_Trace_Active);
+  external_psram_size = 16;
+  Event_Trace_On_Command();
+  TEST_ASSERT_TRUE(Event_Trace_Active);
+  Event_Trace_Off_Command();
+  Native_Serial_Quiet = false;
+}
+
+void test_default_extmem_fits_the_budget(void)
+{
+  uintptr_t   extmem_bytes = (uintptr_t)__stop_extmem - PSRAM_START_ADDRESS;
+  char        msg[100];
+
+  snprintf(msg, sizeof(msg), "EXTMEM on the host: %lu KB, plus %d KB for the SD services, budget %d KB",
+           (unsigned long)(extmem_bytes / 1024), PSRAM_SD_SERVICES_KB, PSRAM_BUDGET_KB);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(PSRAM_BUDGET_KB, PSRAM_SD_SERVICES_KB + PSRAM_LA_KB + PSRAM_FLIGHT_RECORDER_KB +
+                                   PSRAM_EVENT_TRACE_KB);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32((PSRAM_BUDGET_KB - PSRAM_SD_SERVICES_KB) * 1024, extmem_bytes);
+
+  external_psram_size = PSRAM_BUDGET_KB / 1024;
+  TEST_ASSERT_EQUAL_UINT32(LOGIC_ANALYZER_PSRAM_SAMPLES, Logic_Analyzer_Max_Buffer_Length());
+  Flight_Recorder_Start_Command();
+  TEST_ASSERT_EQUAL_UINT32(1, Prompts);
+  Native_Serial_Quiet = true;
+  Event_Trace_On_Command();
+  TEST_ASSERT_TRUE(Event_Trace_Active);
+  Event_Trace_Off_Command();
+  Native_Serial_Quiet = false;
+}
+
+void setUp(void)
+{
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  Prompts = 0;
+}
+
+void tearDown(void)
+{
+  external_psram_size = 8;
+}
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_la_deep_capture_needs_both_buffers_in_psram);
+  RUN_TEST(test_select_buffer_falls_back_to_internal);
+  RUN_TEST(test_flight_recorder_needs_its_ring_in_psram);
+  RUN_TEST(test_event_trace_needs_its_ring_in_psram);
+  RUN_TEST(test_default_extmem_fits_the_budget);
+  return UNITY_END();
+}
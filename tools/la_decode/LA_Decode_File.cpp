@@ -0,0 +1,188 @@
+//
+//      11/26/2020      Host side Capricorn trace decoder
+//
+//  Decodes a capture on the PC with the decoder the firmware uses for "la decode", EBTKS_LA_Decode.cpp, built
+//  unchanged against the Teensy stand-in in test/native/EBTKS_Native. The sample layout is the one
+//  onPhi_1_Rise() builds (EBTKS_Bus_Interface_ISR.cpp), with the bit masks from EBTKS.h and the DMA tags and
+//  IFETCH bit from EBTKS_Logic_Analyzer.h, so the decoder and the capture can't disagree.
+//
+//  Two kinds of file are read:
+//
+//      A "la dump" stream, as captured from USB Serial. Anything before the first sync (the command echo, say) is
+//      skipped, and frames with a bad checksum are counted and skipped. See EBTKS_LA_Export.cpp for the format.
+//      Sample numbers are relative to the trigger, if there was one.
+//      A flight recorder file, /FLIGHT.BIN, see EBTKS_Flight_Recorder.cpp. Samples are numbered from the start
+//      of the recording, counting dropped cycles. Format 1 files have no IFETCH, so no instructions are found
+//
+//  The whole file is in memory, and the decoder writes through a large stdio buffer, so a 4 MB capture takes a
+//  small fraction of a second (test/test_la_decode times it).
+//
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#include "Inc_Common_Headers.h"
+#include "LA_Decode_File.h"
+
+#define LA_DUMP_SYNC_1                (0xA5)              //  As in EBTKS_LA_Export.cpp
+#define LA_DUMP_SYNC_2                (0x5A)
+#define LA_DUMP_SAMPLE_BYTES          (5)
+#define LA_DUMP_FLAG_TRIGGERED        (0x01)
+
+#define FR_HEADER_BYTES               (512)               //  As in EBTKS_Flight_Recorder.cpp
+#define FR_HEADER_TEXT                "EBTKS flight recorder"
+#define FR_RSELEC_MARKER              (0x80000000U)
+#define FR_DROP_MARKER                (0x40000000U)
+
+FILE    *LA_Decode_Out = NULL;
+
+//
+//  The firmware's version writes to the SD Card, see EBTKS_LA_Export.cpp
+//
+
+void Logic_Analyzer_Text_Printf(const char *format, ...)
+{
+  va_list     args;
+
+  if (LA_Decode_Out)
+  {
+    va_start(args, format);
+    vfprintf(LA_Decode_Out, format, args);
+    va_end(args);
+  }
+}
+
+static uint32_t LA_Get_LE32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//
+//  Find the next frame at or after *pos with a good checksum. Returns its type, or 0 at the end of the data
+//
+
+static uint8_t LA_Dump_Next_Frame(const uint8_t *data, size_t length, size_t *pos, const uint8_t **payload, uint32_t *payload_len,
+                                  struct S_LA_Decode_Result *result)
+{
+  size_t      p = *pos;
+  uint32_t    len, i;
+  uint8_t     sum;
+
+  while (p + 6 <= length)
+  {
+    if ((data[p] != LA_DUMP_SYNC_1) || (data[p + 1] != LA_DUMP_SYNC_2))
+    {
+      p++;
+      continue;
+    }
+    len = data[p + 3] | (data[p + 4] << 8);
+    if (p + 5 + len + 1 > length)
+    {
+      result->bad_frames++;                               //  Cut off
+      break;
+    }
+    sum = 0;
+    for (i = 0 ; i < len + 4 ; i++)                       //  Type, length, payload, checksum
+    {
+      sum += data[p + 2 + i];
+    }
+    if (sum != 0)
+    {
+      result->bad_frames++;
+      p++;
+      continue;
+    }
+    *payload     = &data[p + 5];
+    *payload_len = len;
+    *pos         = p + 5 + len + 1;
+    return data[p + 2];
+  }
+  *pos = length;
+  return 0;
+}
+
+static void LA_Decode_Dump(const uint8_t *data, size_t length, struct S_LA_Decode_Result *result)
+{
+  size_t          pos = 0;
+  const uint8_t   *payload;
+  uint32_t        payload_len, i;
+  int32_t         relative;
+  uint8_t         type;
+
+  //
+  //  The end frame says if there was a trigger, and that has to be known for the first sample
+  //
+  while ((type = LA_Dump_Next_Frame(data, length, &pos, &payload, &payload_len, result)) != 0)
+  {
+    if ((type == 'E') && (payload_len >= 5))
+    {
+      result->ended     = true;
+      result->triggered = (payload[4] & LA_DUMP_FLAG_TRIGGERED) != 0;
+    }
+  }
+  result->bad_frames = 0;                                 //  Counted again below
+  Logic_Analyzer_Index_of_Trigger = result->triggered ? 0 : -1;
+
+  Capricorn_Trace_Begin();
+  pos = 0;
+  while ((type = LA_Dump_Next_Frame(data, length, &pos, &payload, &payload_len, result)) != 0)
+  {
+    if ((type != 'S') || (payload_len < 4) || ((payload_len - 4) % LA_DUMP_SAMPLE_BYTES))
+    {
+      continue;
+    }
+    relative = (int32_t)LA_Get_LE32(payload);
+    for (i = 4 ; i < payload_len ; i += LA_DUMP_SAMPLE_BYTES)
+    {
+      Capricorn_Trace_Sample(LA_Get_LE32(&payload[i]), payload[i + 4], relative++);
+      result->samples++;
+    }
+  }
+  Capricorn_Trace_Finish();
+}
+
+static void LA_Decode_Flight_Recorder(const uint8_t *data, size_t length, struct S_LA_Decode_Result *result)
+{
+  size_t      pos;
+  uint32_t    word, rselec = 0;
+  int32_t     sample_number = 0;
+
+  Logic_Analyzer_Index_of_Trigger = -1;
+  Capricorn_Trace_Begin();
+  for (pos = FR_HEADER_BYTES ; pos + 4 <= length ; pos += 4)
+  {
+    word = LA_Get_LE32(&data[pos]);
+    if (word & FR_RSELEC_MARKER)
+    {
+      rselec = word & 0xFFU;
+    }
+    else if (word & FR_DROP_MARKER)
+    {
+      result->dropped += word & 0x3FFFFFFFU;
+      sample_number   += word & 0x3FFFFFFFU;
+    }
+    else
+    {
+      Capricorn_Trace_Sample(word, rselec, sample_number++);
+      result->samples++;
+    }
+  }
+  Capricorn_Trace_Finish();
+}
+
+//
+//  Decode a whole file, already read into memory. Returns false if it is neither kind of capture
+//
+
+bool LA_Decode_Buffer(const uint8_t *data, size_t length, struct S_LA_Decode_Result *result)
+{
+  memset(result, 0, sizeof(struct S_LA_Decode_Result));
+  if ((length >= FR_HEADER_BYTES) && (memcmp(data, FR_HEADER_TEXT, strlen(FR_HEADER_TEXT)) == 0))
+  {
+    result->flight_recorder = true;
+    LA_Decode_Flight_Recorder(data, length, result);
+    return true;
+  }
+  LA_Decode_Dump(data, length, result);
+  return result->samples != 0;
+}
@@ -0,0 +1,25 @@
+//
+//      11/26/2020      Host side Capricorn trace decoder, see LA_Decode_File.cpp
+//
+
+#ifndef LA_DECODE_FILE_H
+#define LA_DECODE_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct S_LA_Decode_Result
+{
+  bool        flight_recorder;                            //  Else a "la dump" stream
+  uint32_t    samples;                                    //  Bus cycles given to the decoder
+  uint32_t    dropped;                                    //  Flight recorder drop markers, added up
+  uint32_t    bad_frames;                                 //  "la dump" frames with a bad checksum or length
+  bool        triggered;
+  bool        ended;                                      //  "la dump": the end frame was seen
+};
+
+extern FILE   *LA_Decode_Out;                             //  Where Logic_Analyzer_Text_Printf() writes. NULL to discard
+
+bool LA_Decode_Buffer(const uint8_t *data, size_t length, struct S_LA_Decode_Result *result);
+
+#endif
@@ -0,0 +1,90 @@
+//
+//      11/26/2020      la_decode, the Capricorn trace decoder for the PC
+//
+//  Build and run with PlatformIO:
+//
+//      pio run -e la_decode
+//      .pio/build/la_decode/program  capture.bin  [decoded.txt]
+//
+//  capture.bin is a "la dump" stream captured from USB Serial, or a flight recorder /FLIGHT.BIN . The decoded
+//  instructions and the cycles per instruction table go to decoded.txt (default stdout), and the totals and the
+//  most frequent opcodes to stdout. See LA_Decode_File.cpp
+//
+
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+
+#include "Inc_Common_Headers.h"
+#include "LA_Decode_File.h"
+
+#define LA_DECODE_OUT_BUFFER          (1024 * 1024)
+
+int main(int argc, char **argv)
+{
+  FILE                        *in;
+  std::vector<uint8_t>        data;
+  long                        length;
+  struct S_LA_Decode_Result   result;
+  double                      seconds;
+
+  if ((argc < 2) || (argc > 3))
+  {
+    fprintf(stderr, "Usage: %s capture.bin [decoded.txt]\n", argv[0]);
+    return 2;
+  }
+  if (!(in = fopen(argv[1], "rb")))
+  {
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(in, 0, SEEK_END);
+  length = ftell(in);
+  fseek(in, 0, SEEK_SET);
+  data.resize(length > 0 ? length : 1);
+  if ((length <= 0) || (fread(data.data(), 1, length, in) != (size_t)length))
+  {
+    fprintf(stderr, "%s: can't read it\n", argv[1]);
+    fclose(in);
+    return 1;
+  }
+  fclose(in);
+
+  LA_Decode_Out = stdout;
+  if ((argc == 3) && !(LA_Decode_Out = fopen(argv[2], "w")))
+  {
+    perror(argv[2]);
+    return 1;
+  }
+  setvbuf(LA_Decode_Out, NULL, _IOFBF, LA_DECODE_OUT_BUFFER);
+
+  auto start = std::chrono::steady_clock::now();
+  if (!LA_Decode_Buffer(data.data(), length, &result))
+  {
+    fprintf(stderr, "%s: no samples found. Expected a \"la dump\" stream or a flight recorder file\n", argv[1]);
+    return 1;
+  }
+  fflush(LA_Decode_Out);
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (LA_Decode_Out != stdout)
+  {
+    fclose(LA_Decode_Out);
+    Capricorn_Trace_Summary();
+  }
+
+  fprintf(stderr, "%s: %s, %u samples", argv[1], result.flight_recorder ? "flight recorder" : "la dump", result.samples);
+  if (result.dropped)
+  {
+    fprintf(stderr, ", %u dropped", result.dropped);
+  }
+  if (result.bad_frames)
+  {
+    fprintf(stderr, ", %u bad frames", result.bad_frames);
+  }
+  if (!result.flight_recorder && !result.ended)
+  {
+    fprintf(stderr, ", no end frame (cut short?)");
+  }
+  fprintf(stderr, ". Decoded in %.3f s\n", seconds);
+  return 0;
+}